@@ -29,7 +29,7 @@ SwarmID::SwarmID(std::string hexstr)
     int val,len=hexstr.length()/2;
 
     empty_ = false;
-    if (len == Sha1Hash::SIZE) { // Assumption: pubkey always bigger
+    if (len == Sha1Hash::SIZE || len == HASHSZ_MAX) { // Assumption: pubkey always bigger
         ttype_ = FILE_TRANSFER;
         roothash_ = Sha1Hash(true,hexstr.c_str());
         if (roothash_ == Sha1Hash::ZERO)
@@ -50,6 +50,10 @@ SwarmID::SwarmID(uint8_t *data,uint16_t datalength)
     if (datalength == Sha1Hash::SIZE) { // Assumption: pubkey always bigger
         ttype_ = FILE_TRANSFER;
         roothash_ = Sha1Hash(false,(const char*)data);
+    } else if (datalength == HASHSZ_MAX) {
+        // SHA-256 or SHA-512/256 root, POPT_MERKLE_HASH_FUNC tells which
+        ttype_ = FILE_TRANSFER;
+        roothash_ = Sha1Hash(POPT_MERKLE_HASH_FUNC_SHA256,data);
     } else {
         ttype_ = LIVE_TRANSFER;
         spubkey_ = SwarmPubKey(data,datalength);
@@ -162,7 +166,8 @@ void swift::Shutdown()
 
 
 int swift::Open(std::string filename, SwarmID& swarmid, std::string trackerurl, bool force_check_diskvshash,
-                popt_cont_int_prot_t cipm, bool zerostate, bool activate, uint32_t chunk_size, std::string metadir)
+                popt_cont_int_prot_t cipm, bool zerostate, bool activate, uint32_t chunk_size, std::string metadir,
+                popt_merkle_func_t merkle_func)
 {
     if (api_debug)
         fprintf(stderr,"swift::Open %s id %s track %s cdisk %d cipm %" PRIu32 " zs %d act %d cs %" PRIu32 "\n",
@@ -171,9 +176,16 @@ int swift::Open(std::string filename, SwarmID& swarmid, std::string trackerurl,
 
     if (swarmid.ttype() != FILE_TRANSFER)
         return -1;
+    if (chunk_size == 0 || chunk_size > SWIFT_MAX_CHUNK_SIZE)
+        return -1;
+    // A 32-byte root hash is not SHA-1, default to SHA-256 for it
+    if (merkle_func == POPT_MERKLE_HASH_FUNC_SHA1 && swarmid.roothash().size() != Sha1Hash::SIZE)
+        merkle_func = swarmid.roothash().func();
+    if (swarmid.roothash() != Sha1Hash::ZERO && swarmid.roothash().size() != Sha1Hash::Size(merkle_func))
+        return -1;
 
     SwarmData* swarm = SwarmManager::GetManager().AddSwarm(filename, swarmid.roothash(), trackerurl, force_check_diskvshash,
-                       cipm, zerostate, activate, chunk_size, metadir);
+                       cipm, zerostate, activate, chunk_size, metadir, merkle_func);
     if (swarm == NULL)
         return -1;
     else
@@ -276,6 +288,18 @@ ssize_t swift::Read(int td, void *buf, size_t nbyte, int64_t offset)
         return ct->GetStorage()->Read(buf, nbyte, offset);
 }
 
+ssize_t swift::Read(int td, struct evbuffer *evb, size_t nbyte, int64_t offset, bool filerefok)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::Read td %d evb %p n " PRISIZET " o %" PRIi64 "\n", td, evb, nbyte, offset);
+
+    ContentTransfer *ct = FindActivateTransferByTD(td);
+    if (ct == NULL)
+        return -1;
+    else
+        return ct->GetStorage()->Read(evb, nbyte, offset, filerefok);
+}
+
 ssize_t swift::Write(int td, const void *buf, size_t nbyte, int64_t offset)
 {
     if (api_debug)
@@ -597,6 +621,10 @@ int swift::Checkpoint(int td)
         return -1;
     }
 
+    // WRITEBUF: the checkpoint claims the chunks are on disk
+    if (ft->GetStorage()->Flush() < 0)
+        return -1;
+
     std::string binmap_filename = ft->GetStorage()->GetOSPathName();
     binmap_filename.append(".mbinmap");
     //fprintf(stderr,"swift: HACK checkpointing %s at %" PRIi64 "\n", binmap_filename.c_str(), Complete(td));
@@ -626,9 +654,9 @@ int swift::Seek(int td, int64_t offset, int whence)
         return -1; // also for LIVE
 
     // Quick fail in order not to activate a swarm only to fail after activation
-    if (whence != SEEK_SET)  // TODO other
+    if (whence != SEEK_SET && whence != SEEK_CUR)  // TODO other
         return -1;
-    if (offset >= swift::Size(td))
+    if (offset < 0 || offset >= swift::Size(td))
         return -1;
 
     if (!swarm->Touch()) {
@@ -640,7 +668,11 @@ int swift::Seek(int td, int64_t offset, int whence)
     }
     FileTransfer *ft = swarm->GetTransfer();
 
-    // whence == SEEK_SET && offset < swift::Size(td)  - validated by quick fail above
+    // SEEK_CUR is not relative, it also gives the absolute offset: how far a
+    // streaming reader got. So both are in bounds if in the content, check
+    // again as activation may have changed what is known about its size.
+    if (offset >= (int64_t)ft->hashtree()->size())
+        return -1;
 
     // Which bin to seek to?
     int64_t coff = offset - (offset % ft->hashtree()->chunk_size()); // ceil to chunk
@@ -652,6 +684,47 @@ int swift::Seek(int td, int64_t offset, int whence)
 }
 
 
+// DEADLINE
+void swift::SetBitrate(int td, double bytespersec)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::SetBitrate td %d r %lf\n", td, bytespersec);
+
+    SwarmData* swarm = SwarmManager::GetManager().FindSwarm(td);
+    if (swarm == NULL || !swarm->Touch())
+        return; // also for LIVE
+    FileTransfer *ft = swarm->GetTransfer();
+    if (ft->picker() != NULL)
+        ft->picker()->SetBitrate(bytespersec);
+}
+
+
+// PREFETCH
+void swift::SetPrefetch(int td, std::vector<std::pair<uint64_t,uint64_t> > &ranges)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::SetPrefetch td %d n %d\n", td, (int)ranges.size());
+
+    SwarmData* swarm = SwarmManager::GetManager().FindSwarm(td);
+    if (swarm == NULL || !swarm->Touch())
+        return; // also for LIVE
+    FileTransfer *ft = swarm->GetTransfer();
+    if (ft->picker() == NULL)
+        return;
+
+    // Convert to chunk ranges and those to bins
+    uint32_t chunk_size = ft->hashtree()->chunk_size();
+    binvector bv;
+    std::vector<std::pair<uint64_t,uint64_t> >::iterator iter;
+    for (iter=ranges.begin(); iter!=ranges.end(); iter++) {
+        if (iter->first > iter->second)
+            continue;
+        chunk32_to_bin32(iter->first/chunk_size,iter->second/chunk_size,&bv);
+    }
+    ft->picker()->SetPrefetch(bv);
+}
+
+
 
 void swift::AddPeer(Address& addr, SwarmID& swarmid)
 {
@@ -787,6 +860,9 @@ LiveTransfer *swift::LiveCreate(std::string filename, KeyPair &keypair, std::str
         fprintf(stderr,"swift::LiveCreate %s keypair checkp %s cipm %" PRIu32 " ldw %" PRIu64 " nsign %" PRIu32 " cs %" PRIu32
                 "\n", filename.c_str(), checkpoint_filename.c_str(), cipm, disc_wnd, nchunks_per_sign, chunk_size);
 
+    if (chunk_size == 0 || chunk_size > SWIFT_MAX_CHUNK_SIZE)
+        return NULL;
+
     // Arno: LIVE streams are not managed by SwarmManager
     LiveTransfer *lt = new LiveTransfer(filename,keypair,checkpoint_filename,cipm,disc_wnd,nchunks_per_sign,chunk_size);
     fprintf(stderr,"swift::LiveCreate: swarmid: %s\n",lt->swarm_id().hex().c_str());
@@ -820,6 +896,9 @@ int swift::LiveOpen(std::string filename, SwarmID &swarmid, std::string trackeru
         fprintf(stderr,"swift::LiveOpen %s hash %s track %s src %s cipm %" PRIu32 " ldw %" PRIu64 " cs %" PRIu32 "\n",
                 filename.c_str(), swarmid.hex().c_str(), trackerurl.c_str(), srcaddr.str().c_str(), cipm, disc_wnd, chunk_size);
 
+    if (chunk_size == 0 || chunk_size > SWIFT_MAX_CHUNK_SIZE)
+        return -1;
+
     // Help user
     if (cipm == POPT_CONT_INT_PROT_MERKLE)
         cipm = POPT_CONT_INT_PROT_UNIFIED_MERKLE;
@@ -848,6 +927,28 @@ uint64_t swift::GetHookinOffset(int td)
 }
 
 
+void swift::SetLivePushChildren(int td, uint32_t nchildren)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::SetLivePushChildren td %d n %" PRIu32 "\n", td, nchildren);
+
+    LiveTransfer *lt = LiveTransfer::FindByTD(td);
+    if (lt != NULL)
+        lt->SetPushChildren(nchildren);
+}
+
+
+void swift::SetLiveFECRatio(int td, double ratio)
+{
+    if (api_debug)
+        fprintf(stderr,"swift::SetLiveFECRatio td %d ratio %lf\n", td, ratio);
+
+    LiveTransfer *lt = LiveTransfer::FindByTD(td);
+    if (lt != NULL)
+        lt->SetFECRatio(ratio);
+}
+
+
 // Called from sendrecv.cpp
 void swift::Touch(int td)
 {
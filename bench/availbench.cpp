@@ -0,0 +1,103 @@
+/*
+ *  availbench.cpp
+ *
+ *  Micro-benchmarks for Availability updates, i.e. the rarity bookkeeping
+ *  done on every HAVE/ACK received when rarest-first picking is used.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <cstdlib>
+#include <benchmark/benchmark.h>
+
+
+using namespace swift;
+
+
+#define BENCH_AVAIL_CONNECTIONS     20
+
+
+/** Each of npeers announces nchunks single-chunk HAVEs in random order */
+static void BM_AvailabilitySet(benchmark::State &state)
+{
+    int npeers = state.range(0);
+    uint64_t nchunks = state.range(1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Availability *avail = new Availability(BENCH_AVAIL_CONNECTIONS);
+        std::vector<binmap_t *> peers;
+        for (int p=0; p<npeers; p++)
+            peers.push_back(new binmap_t());
+        srand(npeers);
+        state.ResumeTiming();
+
+        for (uint64_t i=0; i<nchunks; i++) {
+            for (int p=0; p<npeers; p++) {
+                bin_t b(0,rand()%nchunks);
+                if (peers[p]->is_filled(b))
+                    continue;
+                avail->set(p,*peers[p],b);
+                peers[p]->set(b);
+            }
+        }
+
+        state.PauseTiming();
+        for (int p=0; p<npeers; p++)
+            delete peers[p];
+        delete avail;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations()*npeers*nchunks);
+}
+
+
+/** Peers with fragmented binmaps leave the swarm one by one */
+static void BM_AvailabilityRemoveBinmap(benchmark::State &state)
+{
+    int npeers = state.range(0);
+    uint64_t nchunks = state.range(1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Availability *avail = new Availability(BENCH_AVAIL_CONNECTIONS);
+        std::vector<binmap_t *> peers;
+        srand(npeers);
+        for (int p=0; p<npeers; p++) {
+            binmap_t *bm = new binmap_t();
+            for (uint64_t i=0; i<nchunks/2; i++) {
+                bin_t b(0,rand()%nchunks);
+                if (bm->is_filled(b))
+                    continue;
+                avail->set(p,*bm,b);
+                bm->set(b);
+            }
+            peers.push_back(bm);
+        }
+        state.ResumeTiming();
+
+        for (int p=0; p<npeers; p++)
+            avail->removeBinmap(p,*peers[p]);
+
+        state.PauseTiming();
+        for (int p=0; p<npeers; p++)
+            delete peers[p];
+        delete avail;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations()*npeers);
+}
+
+
+static void AvailArgs(benchmark::internal::Benchmark *b)
+{
+    for (int npeers=2; npeers<=BENCH_AVAIL_CONNECTIONS-2; npeers*=3)
+        for (int64_t n=1<<8; n<=1<<12; n<<=2)
+            b->Args({npeers,n});
+    b->ArgNames({"npeers","nchunks"});
+}
+
+BENCHMARK(BM_AvailabilitySet)->Apply(AvailArgs);
+BENCHMARK(BM_AvailabilityRemoveBinmap)->Apply(AvailArgs);
+
+BENCHMARK_MAIN();
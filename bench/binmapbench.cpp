@@ -0,0 +1,111 @@
+/*
+ *  binmapbench.cpp
+ *
+ *  Micro-benchmarks for binmap_t set/reset/find_complement under several
+ *  fragmentation patterns.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "binmap.h"
+
+#include <cstdlib>
+#include <benchmark/benchmark.h>
+
+
+using namespace swift;
+
+
+/** Fragmentation patterns used to fill a binmap before measuring */
+typedef enum {
+    FRAG_SEQUENTIAL,  // one contiguous run, as after an in-order download
+    FRAG_STRIDED,     // every other chunk, worst case for the cell tree
+    FRAG_RANDOM,      // half the chunks in random order, as with rarest-first
+} frag_pattern_t;
+
+
+static void fill_binmap(binmap_t &bm, uint64_t nchunks, frag_pattern_t pattern)
+{
+    switch (pattern) {
+    case FRAG_SEQUENTIAL:
+        for (uint64_t i=0; i<nchunks/2; i++)
+            bm.set(bin_t(0,i));
+        break;
+    case FRAG_STRIDED:
+        for (uint64_t i=0; i<nchunks; i+=2)
+            bm.set(bin_t(0,i));
+        break;
+    case FRAG_RANDOM:
+        srand(nchunks);
+        for (uint64_t i=0; i<nchunks/2; i++)
+            bm.set(bin_t(0,rand()%nchunks));
+        break;
+    }
+}
+
+
+static void BM_BinmapSet(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    frag_pattern_t pattern = (frag_pattern_t)state.range(1);
+    for (auto _ : state) {
+        binmap_t bm;
+        fill_binmap(bm,nchunks,pattern);
+        benchmark::DoNotOptimize(bm.cells_number());
+    }
+    state.SetItemsProcessed(state.iterations()*(nchunks/2));
+}
+
+
+static void BM_BinmapReset(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    frag_pattern_t pattern = (frag_pattern_t)state.range(1);
+    for (auto _ : state) {
+        state.PauseTiming();
+        binmap_t bm;
+        bm.set(bin_t(0,0)); // make sure the root exists
+        fill_binmap(bm,nchunks,pattern);
+        state.ResumeTiming();
+        for (uint64_t i=0; i<nchunks; i++)
+            bm.reset(bin_t(0,i));
+        benchmark::DoNotOptimize(bm.is_empty());
+    }
+    state.SetItemsProcessed(state.iterations()*nchunks);
+}
+
+
+static void BM_BinmapFindComplement(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    frag_pattern_t pattern = (frag_pattern_t)state.range(1);
+
+    // Peer offers everything, we have a fragmented subset: the piece
+    // picker's typical query.
+    binmap_t offer, have;
+    for (uint64_t i=0; i<nchunks; i++)
+        offer.set(bin_t(0,i));
+    fill_binmap(have,nchunks,pattern);
+
+    uint64_t twist = 0;
+    for (auto _ : state) {
+        bin_t b = binmap_t::find_complement(have, offer, twist++ & 63);
+        benchmark::DoNotOptimize(b);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+static void FragArgs(benchmark::internal::Benchmark *b)
+{
+    for (int64_t n=1<<10; n<=1<<18; n<<=4)
+        for (int p=FRAG_SEQUENTIAL; p<=FRAG_RANDOM; p++)
+            b->Args({n,p});
+    b->ArgNames({"nchunks","frag"});
+}
+
+BENCHMARK(BM_BinmapSet)->Apply(FragArgs);
+BENCHMARK(BM_BinmapReset)->Apply(FragArgs);
+BENCHMARK(BM_BinmapFindComplement)->Apply(FragArgs);
+
+BENCHMARK_MAIN();
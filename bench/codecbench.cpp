@@ -0,0 +1,87 @@
+/*
+ *  codecbench.cpp
+ *
+ *  Micro-benchmarks for the chunk address codec used by every ACK, HAVE,
+ *  REQUEST, CANCEL and INTEGRITY message.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <benchmark/benchmark.h>
+
+
+using namespace swift;
+
+
+/** Mix of bins as seen on the wire: single chunks, small and large ranges */
+static binvector bench_bins(int count)
+{
+    binvector bv;
+    for (int i=0; i<count; i++) {
+        int layer = i % 8;
+        bv.push_back(bin_t(layer,(uint64_t)i*7+3));
+    }
+    return bv;
+}
+
+
+static void BM_AddChunkAddr(benchmark::State &state)
+{
+    popt_chunk_addr_t ca = (popt_chunk_addr_t)state.range(0);
+    binvector bv = bench_bins(256);
+    struct evbuffer *evb = evbuffer_new();
+    for (auto _ : state) {
+        binvector::iterator iter;
+        for (iter=bv.begin(); iter!=bv.end(); iter++)
+            evbuffer_add_chunkaddr(evb,*iter,ca,SWIFT_DEFAULT_CHUNK_SIZE);
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+    }
+    evbuffer_free(evb);
+    state.SetItemsProcessed(state.iterations()*bv.size());
+}
+
+
+static void BM_RemoveChunkAddr(benchmark::State &state)
+{
+    popt_chunk_addr_t ca = (popt_chunk_addr_t)state.range(0);
+    binvector bv = bench_bins(256);
+
+    // Pre-encode once, then decode from a copy each iteration
+    struct evbuffer *evb = evbuffer_new();
+    binvector::iterator iter;
+    for (iter=bv.begin(); iter!=bv.end(); iter++)
+        evbuffer_add_chunkaddr(evb,*iter,ca,SWIFT_DEFAULT_CHUNK_SIZE);
+    size_t wirelen = evbuffer_get_length(evb);
+    std::string wire((char *)evbuffer_pullup(evb,wirelen),wirelen);
+    evbuffer_drain(evb,wirelen);
+
+    uint64_t nbins = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        evbuffer_add(evb,wire.data(),wire.size());
+        state.ResumeTiming();
+        for (int i=0; i<bv.size(); i++) {
+            binvector out = evbuffer_remove_chunkaddr(evb,ca,SWIFT_DEFAULT_CHUNK_SIZE);
+            nbins += out.size();
+        }
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+    }
+    benchmark::DoNotOptimize(nbins);
+    evbuffer_free(evb);
+    state.SetItemsProcessed(state.iterations()*bv.size());
+}
+
+
+static void ChunkAddrArgs(benchmark::internal::Benchmark *b)
+{
+    for (int ca=POPT_CHUNK_ADDR_BIN32; ca<=POPT_CHUNK_ADDR_CHUNK64; ca++)
+        b->Arg(ca);
+    b->ArgName("chunk_addr");
+}
+
+BENCHMARK(BM_AddChunkAddr)->Apply(ChunkAddrArgs);
+BENCHMARK(BM_RemoveChunkAddr)->Apply(ChunkAddrArgs);
+
+BENCHMARK_MAIN();
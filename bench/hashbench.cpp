@@ -0,0 +1,164 @@
+/*
+ *  hashbench.cpp
+ *
+ *  Micro-benchmarks for the Merkle hash tree: Submit (hashing content on
+ *  disk), OfferHash (uncle verification) and OfferData (chunk verification
+ *  and storage), per Merkle hash function. MerkleHash times the raw hash
+ *  over an inner node (two child hashes) and over a chunk.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "bin_utils.h"
+#include "sha2.h"
+
+#include <benchmark/benchmark.h>
+
+
+using namespace swift;
+
+
+#define BENCH_SEED_FILENAME     "hashbench.dat"
+#define BENCH_LEECH_FILENAME    "hashbench-leech.dat"
+
+
+static void create_content(std::string filename, uint64_t nchunks, uint32_t chunk_size)
+{
+    FILE *fp = fopen(filename.c_str(),"wb");
+    char *chunk = new char[chunk_size];
+    for (uint64_t i=0; i<nchunks; i++) {
+        memset(chunk,(int)(i%251),chunk_size);
+        memcpy(chunk,&i,sizeof(i));
+        fwrite(chunk,1,chunk_size,fp);
+    }
+    delete[] chunk;
+    fclose(fp);
+}
+
+
+static void remove_state(std::string filename)
+{
+    unlink(filename.c_str());
+    unlink((filename+".mhash").c_str());
+    unlink((filename+".mbinmap").c_str());
+}
+
+
+/** Collect the uncle hashes a seeder would send for pos, top-down */
+static void collect_uncles(MmapHashTree &seeder, bin_t pos, std::vector<std::pair<bin_t,Sha1Hash> > &uncles)
+{
+    bin_t peak = seeder.peak_for(pos);
+    uncles.clear();
+    while (pos != peak) {
+        bin_t uncle = pos.sibling();
+        uncles.push_back(std::make_pair(uncle,seeder.hash(uncle)));
+        pos = pos.parent();
+    }
+    std::reverse(uncles.begin(),uncles.end());
+}
+
+
+static void BM_MerkleHash(benchmark::State &state)
+{
+    popt_merkle_func_t func = (popt_merkle_func_t)state.range(0);
+    size_t length = state.range(1);
+    char *data = new char[length];
+    memset(data,0x5a,length);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Sha1Hash(func,data,length));
+    delete[] data;
+    state.SetBytesProcessed(state.iterations()*length);
+    if (func == POPT_MERKLE_HASH_FUNC_SHA256)
+        state.SetLabel(sha256_hw_accelerated() ? "shani" : "portable");
+}
+
+
+static void BM_HashTreeSubmit(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    popt_merkle_func_t func = (popt_merkle_func_t)state.range(1);
+    create_content(BENCH_SEED_FILENAME,nchunks,SWIFT_DEFAULT_CHUNK_SIZE);
+    for (auto _ : state) {
+        state.PauseTiming();
+        unlink(BENCH_SEED_FILENAME ".mhash");
+        state.ResumeTiming();
+
+        Storage storage(BENCH_SEED_FILENAME,".",-1,0);
+        MmapHashTree tree(&storage,Sha1Hash::ZERO,SWIFT_DEFAULT_CHUNK_SIZE,BENCH_SEED_FILENAME ".mhash",true,"",func);
+        benchmark::DoNotOptimize(tree.root_hash());
+    }
+    remove_state(BENCH_SEED_FILENAME);
+    state.SetBytesProcessed(state.iterations()*nchunks*SWIFT_DEFAULT_CHUNK_SIZE);
+}
+
+
+/** Leecher receives every chunk in order with its uncles, as from a seeder
+ * via INTEGRITY+DATA. When offerdata is false only the hashes are offered. */
+static void run_offer(benchmark::State &state, bool offerdata)
+{
+    uint64_t nchunks = state.range(0);
+    popt_merkle_func_t func = (popt_merkle_func_t)state.range(1);
+    uint32_t cs = SWIFT_DEFAULT_CHUNK_SIZE;
+    create_content(BENCH_SEED_FILENAME,nchunks,cs);
+
+    Storage seedstorage(BENCH_SEED_FILENAME,".",-1,0);
+    MmapHashTree seeder(&seedstorage,Sha1Hash::ZERO,cs,BENCH_SEED_FILENAME ".mhash",true,"",func);
+
+    char *chunk = new char[cs];
+    std::vector<std::pair<bin_t,Sha1Hash> > uncles;
+    for (auto _ : state) {
+        state.PauseTiming();
+        remove_state(BENCH_LEECH_FILENAME);
+        Storage *storage = new Storage(BENCH_LEECH_FILENAME,".",-1,0);
+        MmapHashTree *leecher = new MmapHashTree(storage,seeder.root_hash(),cs,BENCH_LEECH_FILENAME ".mhash",false,"",func);
+        for (int p=0; p<seeder.peak_count(); p++)
+            leecher->OfferHash(seeder.peak(p),seeder.peak_hash(p));
+        state.ResumeTiming();
+
+        for (uint64_t i=0; i<nchunks; i++) {
+            bin_t pos(0,i);
+            collect_uncles(seeder,pos,uncles);
+            for (int u=0; u<uncles.size(); u++)
+                leecher->OfferHash(uncles[u].first,uncles[u].second);
+            if (offerdata) {
+                state.PauseTiming();
+                seedstorage.Read(chunk,cs,i*cs);
+                state.ResumeTiming();
+                benchmark::DoNotOptimize(leecher->OfferData(pos,chunk,cs));
+            } else
+                benchmark::DoNotOptimize(leecher->OfferHash(pos,seeder.hash(pos)));
+        }
+
+        state.PauseTiming();
+        delete leecher;
+        delete storage;
+        state.ResumeTiming();
+    }
+    delete[] chunk;
+    remove_state(BENCH_LEECH_FILENAME);
+    remove_state(BENCH_SEED_FILENAME);
+    state.SetItemsProcessed(state.iterations()*nchunks);
+}
+
+
+static void BM_HashTreeOfferHash(benchmark::State &state)
+{
+    run_offer(state,false);
+}
+
+
+static void BM_HashTreeOfferData(benchmark::State &state)
+{
+    run_offer(state,true);
+}
+
+
+#define BENCH_FUNCS { POPT_MERKLE_HASH_FUNC_SHA1, POPT_MERKLE_HASH_FUNC_SHA256, POPT_MERKLE_HASH_FUNC_SHA512_256 }
+
+BENCHMARK(BM_MerkleHash)->ArgsProduct({BENCH_FUNCS, {2*HASHSZ_MAX, SWIFT_DEFAULT_CHUNK_SIZE, 8192}})->ArgNames({"func","bytes"});
+BENCHMARK(BM_HashTreeSubmit)->ArgsProduct({benchmark::CreateRange(1<<8,1<<16,16), BENCH_FUNCS})->ArgNames({"nchunks","func"});
+BENCHMARK(BM_HashTreeOfferHash)->ArgsProduct({benchmark::CreateRange(1<<8,1<<14,16), BENCH_FUNCS})->ArgNames({"nchunks","func"});
+BENCHMARK(BM_HashTreeOfferData)->ArgsProduct({benchmark::CreateRange(1<<8,1<<14,16), BENCH_FUNCS})->ArgNames({"nchunks","func"});
+
+BENCHMARK_MAIN();
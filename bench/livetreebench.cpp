@@ -0,0 +1,103 @@
+/*
+ *  livetreebench.cpp
+ *
+ *  Micro-benchmarks for the Unified Merkle Tree used in live streaming:
+ *  appending chunks at the source (including signing a munro every
+ *  NCHUNKS_PER_SIG chunks) and pruning the tree behind the live discard
+ *  window.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <benchmark/benchmark.h>
+
+
+using namespace swift;
+
+
+static KeyPair *bench_keypair()
+{
+    static KeyPair *kp = NULL;
+    if (kp == NULL)
+        kp = KeyPair::Generate(POPT_LIVE_SIG_ALG_ECDSAP256SHA256);
+    return kp;
+}
+
+
+/** Append nchunks to a fresh source tree, signing every nchunks_per_sign */
+static void BM_LiveTreeAppend(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    uint32_t nchunks_per_sign = state.range(1);
+    char data[SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(data,'L',SWIFT_DEFAULT_CHUNK_SIZE);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        LiveHashTree *umt = new LiveHashTree(NULL,*bench_keypair(),SWIFT_DEFAULT_CHUNK_SIZE,nchunks_per_sign);
+        state.ResumeTiming();
+
+        for (uint64_t i=0; i<nchunks; i++) {
+            umt->AddData(data,SWIFT_DEFAULT_CHUNK_SIZE);
+            if ((i+1) % nchunks_per_sign == 0)
+                umt->AddSignedMunro();
+        }
+
+        state.PauseTiming();
+        delete umt;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations()*nchunks);
+}
+
+
+/** Append and prune as a source with a live discard window does, see
+ * LiveTransfer::OnDataPruneTree() */
+static void BM_LiveTreeAppendPrune(benchmark::State &state)
+{
+    uint64_t nchunks = state.range(0);
+    uint64_t disc_wnd = state.range(1);
+    uint32_t nchunks_per_sign = SWIFT_DEFAULT_LIVE_NCHUNKS_PER_SIGN;
+    char data[SWIFT_DEFAULT_CHUNK_SIZE];
+    memset(data,'P',SWIFT_DEFAULT_CHUNK_SIZE);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        LiveHashTree *umt = new LiveHashTree(NULL,*bench_keypair(),SWIFT_DEFAULT_CHUNK_SIZE,nchunks_per_sign);
+        state.ResumeTiming();
+
+        for (uint64_t i=0; i<nchunks; i++) {
+            umt->AddData(data,SWIFT_DEFAULT_CHUNK_SIZE);
+            if ((i+1) % nchunks_per_sign != 0)
+                continue;
+            umt->AddSignedMunro();
+
+            // Prune the nchunks_per_sign subtree that just left the window
+            int64_t leftcid = (int64_t)(i+1) - (int64_t)disc_wnd - nchunks_per_sign;
+            if (leftcid < 0)
+                continue;
+            leftcid -= leftcid % nchunks_per_sign;
+            bin_t leftpos(0,leftcid);
+            while (leftpos.base_length() < nchunks_per_sign)
+                leftpos = leftpos.parent();
+            if (leftpos.is_right()) {
+                while (leftpos.parent().is_right())
+                    leftpos = leftpos.parent();
+            }
+            umt->PruneTree(leftpos);
+        }
+
+        state.PauseTiming();
+        delete umt;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations()*nchunks);
+}
+
+
+BENCHMARK(BM_LiveTreeAppend)->ArgsProduct({{1<<10,1<<14},{1,32}})->ArgNames({"nchunks","nchunks_per_sign"});
+BENCHMARK(BM_LiveTreeAppendPrune)->ArgsProduct({{1<<12,1<<15},{1<<8,1<<11}})->ArgNames({"nchunks","disc_wnd"});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,411 @@
+/*
+ *  loopbackbench.cpp
+ *
+ *  End-to-end throughput benchmark: one seeder and K leechers on 127.0.0.1,
+ *  each a separate process using the real swift::Listen/Open API. A
+ *  generated file of configurable size and chunk size is transferred and
+ *  the following is reported as JSON on stdout:
+ *
+ *  - goodput per leecher and aggregate
+ *  - CPU seconds per GB of content delivered
+ *  - datagrams received per chunk
+ *  - INTEGRITY hash bytes received per chunk
+ *  - time-to-first-byte, i.e. until the first verified chunk
+ *
+ *  Usage: loopbackbench [-n leechers] [-s size] [-c chunksize] [-p baseport]
+ *                       [-t timeout-in-s] [-m pmtu] [-i] [-k]
+ *  -i disables content integrity protection (POPT_CONT_INT_PROT_NONE),
+ *  -m sets the largest UDP payload the channels probe for (Channel::MAX_PMTU),
+ *  -k keeps the files afterwards.
+ *
+ *  POSIX only (uses fork).
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sstream>
+
+
+using namespace swift;
+
+
+#define LOOPBACK_SEED_FILENAME      "loopback-seed.dat"
+#define LOOPBACK_LEECH_FILENAME     "loopback-leech"
+#define LOOPBACK_POLL_INTERVAL      (10*TINT_MSEC)
+
+
+/** What a peer process reports back to the parent */
+struct peer_result_t {
+    bool     complete;
+    tint     ttfb;       // usec from Open till first verified chunk
+    tint     elapsed;    // usec from Open till complete
+    uint64_t dgrams_up, dgrams_down;
+    uint64_t raw_bytes_up, raw_bytes_down;
+    uint64_t hash_bytes_up, hash_bytes_down;
+    tint     cpu;        // usec user+sys
+};
+
+
+/*
+ * Peer process state
+ */
+static int peer_td = -1;
+static tint peer_start = 0;
+static tint peer_deadline = TINT_NEVER;
+static peer_result_t peer_result;
+static struct event evpoll;
+
+
+static tint cpu_time()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    return (tint)ru.ru_utime.tv_sec*TINT_SEC + ru.ru_utime.tv_usec
+           + (tint)ru.ru_stime.tv_sec*TINT_SEC + ru.ru_stime.tv_usec;
+}
+
+
+static void fill_result()
+{
+    peer_result.dgrams_up = Channel::global_dgrams_up;
+    peer_result.dgrams_down = Channel::global_dgrams_down;
+    peer_result.raw_bytes_up = Channel::global_raw_bytes_up;
+    peer_result.raw_bytes_down = Channel::global_raw_bytes_down;
+    peer_result.hash_bytes_up = Channel::global_hash_bytes_up;
+    peer_result.hash_bytes_down = Channel::global_hash_bytes_down;
+    peer_result.cpu = cpu_time();
+}
+
+
+static void FirstByteCallback(int td, bin_t bin)
+{
+    if (peer_result.ttfb == 0)
+        peer_result.ttfb = usec_time() - peer_start;
+}
+
+
+static void LeechPollCallback(int fd, short event, void *arg)
+{
+    if (swift::IsComplete(peer_td)) {
+        peer_result.complete = true;
+        peer_result.elapsed = usec_time() - peer_start;
+        event_base_loopexit(Channel::evbase, NULL);
+        return;
+    }
+    if (usec_time() > peer_deadline) {
+        event_base_loopexit(Channel::evbase, NULL);
+        return;
+    }
+    evtimer_add(&evpoll, tint2tv(LOOPBACK_POLL_INTERVAL));
+}
+
+
+static void SeedStopCallback(int fd, short event, void *arg)
+{
+    event_base_loopexit(Channel::evbase, NULL);
+}
+
+
+static void peer_init(uint16_t port)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+    memset(&peer_result,0,sizeof(peer_result));
+    Address bindaddr("127.0.0.1",port);
+    if (swift::Listen(bindaddr) <= 0) {
+        eprintf("loopbackbench: cannot listen on %s\n", bindaddr.str().c_str());
+        exit(1);
+    }
+}
+
+
+/** Seeder process: hashes the content, sends the root hash to the parent,
+ * then seeds until SIGTERM and reports its counters. */
+static void run_seeder(int fd, uint16_t port, uint32_t chunk_size, popt_cont_int_prot_t cipm)
+{
+    peer_init(port);
+
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    peer_td = swift::Open(LOOPBACK_SEED_FILENAME,noswarmid,"",false,cipm,false,true,chunk_size);
+    if (peer_td < 0)
+        exit(1);
+    std::string hex = swift::GetSwarmID(peer_td).hex();
+    if (write(fd,hex.c_str(),hex.length()) != hex.length())
+        exit(1);
+
+    struct event *evstop = evsignal_new(Channel::evbase,SIGTERM,SeedStopCallback,NULL);
+    evsignal_add(evstop,NULL);
+    event_base_dispatch(Channel::evbase);
+
+    fill_result();
+    peer_result.complete = true;
+    if (write(fd,&peer_result,sizeof(peer_result)) != sizeof(peer_result))
+        exit(1);
+    exit(0);
+}
+
+
+/** Leecher process: downloads from the seeder (which acts as tracker, so
+ * leechers learn about each other via PEX) and reports its counters. */
+static void run_leecher(int fd, int idx, uint16_t port, uint16_t seedport, std::string swarmidhex,
+                        uint32_t chunk_size, popt_cont_int_prot_t cipm, tint timeout)
+{
+    peer_init(port);
+
+    std::ostringstream fn;
+    fn << LOOPBACK_LEECH_FILENAME << idx << ".dat";
+    std::ostringstream tracker;
+    tracker << SWIFT_URI_SCHEME << "://127.0.0.1:" << seedport;
+
+    SwarmID swarmid(swarmidhex);
+    peer_start = usec_time();
+    peer_deadline = peer_start + timeout;
+    peer_td = swift::Open(fn.str(),swarmid,tracker.str(),false,cipm,false,true,chunk_size);
+    if (peer_td < 0)
+        exit(1);
+    swift::AddProgressCallback(peer_td,&FirstByteCallback,0);
+
+    evtimer_assign(&evpoll, Channel::evbase, LeechPollCallback, NULL);
+    evtimer_add(&evpoll, tint2tv(LOOPBACK_POLL_INTERVAL));
+    event_base_dispatch(Channel::evbase);
+
+    fill_result();
+    if (write(fd,&peer_result,sizeof(peer_result)) != sizeof(peer_result))
+        exit(1);
+    exit(0);
+}
+
+
+static pid_t spawn(int *readfdptr)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        print_error("loopbackbench: pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        print_error("loopbackbench: fork");
+        exit(1);
+    } else if (pid == 0) {
+        close(fds[0]);
+        *readfdptr = fds[1]; // child writes
+    } else {
+        close(fds[1]);
+        *readfdptr = fds[0];
+    }
+    return pid;
+}
+
+
+static bool read_result(int fd, peer_result_t *resptr)
+{
+    char *p = (char *)resptr;
+    size_t got = 0;
+    while (got < sizeof(peer_result_t)) {
+        ssize_t ret = read(fd,p+got,sizeof(peer_result_t)-got);
+        if (ret <= 0)
+            return false;
+        got += ret;
+    }
+    return true;
+}
+
+
+static int create_content(uint64_t size)
+{
+    FILE *fp = fopen(LOOPBACK_SEED_FILENAME,"wb");
+    if (fp == NULL)
+        return -1;
+    srand(size);
+    char buf[4096];
+    uint64_t left = size;
+    while (left > 0) {
+        size_t n = std::min(left,(uint64_t)sizeof(buf));
+        for (size_t i=0; i<n; i++)
+            buf[i] = (char)rand();
+        fwrite(buf,1,n,fp);
+        left -= n;
+    }
+    fclose(fp);
+    return 0;
+}
+
+
+static void remove_files(int nleechers)
+{
+    for (int i=-1; i<nleechers; i++) {
+        std::ostringstream fn;
+        if (i < 0)
+            fn << LOOPBACK_SEED_FILENAME;
+        else
+            fn << LOOPBACK_LEECH_FILENAME << i << ".dat";
+        unlink(fn.str().c_str());
+        unlink((fn.str()+".mhash").c_str());
+        unlink((fn.str()+".mbinmap").c_str());
+    }
+}
+
+
+static void usage()
+{
+    fprintf(stderr,"Usage: loopbackbench [-n leechers] [-s size] [-c chunksize] [-p baseport] [-t timeout-in-s] [-m pmtu] [-i] [-k]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    int nleechers = 1;
+    uint64_t size = 64*1024*1024;
+    uint32_t chunk_size = SWIFT_DEFAULT_CHUNK_SIZE;
+    uint16_t baseport = 21000;
+    tint timeout = 300*TINT_SEC;
+    popt_cont_int_prot_t cipm = POPT_CONT_INT_PROT_MERKLE;
+    bool keep = false;
+
+    int c;
+    while ((c = getopt(argc,argv,"n:s:c:p:t:m:ik")) != -1) {
+        switch (c) {
+        case 'n':
+            nleechers = atoi(optarg);
+            break;
+        case 's':
+            size = strtoull(optarg,NULL,10);
+            break;
+        case 'c':
+            chunk_size = atoi(optarg);
+            break;
+        case 'p':
+            baseport = atoi(optarg);
+            break;
+        case 't':
+            timeout = atoi(optarg)*TINT_SEC;
+            break;
+        case 'm':
+            Channel::MAX_PMTU = atoi(optarg);
+            break;
+        case 'i':
+            cipm = POPT_CONT_INT_PROT_NONE;
+            break;
+        case 'k':
+            keep = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (nleechers < 1 || size == 0 || chunk_size == 0 || Channel::MAX_PMTU < SWIFT_MAX_UDP_OVER_ETH_PAYLOAD
+            || Channel::MAX_PMTU > SWIFT_MAX_RECV_DGRAM_SIZE) {
+        usage();
+        return 1;
+    }
+
+    remove_files(nleechers);
+    if (create_content(size) < 0) {
+        print_error("loopbackbench: cannot create content");
+        return 1;
+    }
+
+    // Seeder
+    int seedfd;
+    pid_t seedpid = spawn(&seedfd);
+    if (seedpid == 0)
+        run_seeder(seedfd,baseport,chunk_size,cipm);
+
+    char hex[Sha1Hash::SIZE*2+1];
+    int got = 0;
+    while (got < Sha1Hash::SIZE*2) {
+        ssize_t ret = read(seedfd,hex+got,Sha1Hash::SIZE*2-got);
+        if (ret <= 0) {
+            eprintf("loopbackbench: seeder failed\n");
+            return 1;
+        }
+        got += ret;
+    }
+    hex[Sha1Hash::SIZE*2] = '\0';
+
+    // Leechers
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    for (int i=0; i<nleechers; i++) {
+        int fd;
+        pid_t pid = spawn(&fd);
+        if (pid == 0)
+            run_leecher(fd,i,baseport+1+i,baseport,hex,chunk_size,cipm,timeout);
+        pids.push_back(pid);
+        fds.push_back(fd);
+    }
+
+    std::vector<peer_result_t> results(nleechers);
+    int ncomplete = 0;
+    for (int i=0; i<nleechers; i++) {
+        if (!read_result(fds[i],&results[i]))
+            memset(&results[i],0,sizeof(peer_result_t));
+        if (results[i].complete)
+            ncomplete++;
+        close(fds[i]);
+        waitpid(pids[i],NULL,0);
+    }
+
+    peer_result_t seedres;
+    kill(seedpid,SIGTERM);
+    if (!read_result(seedfd,&seedres))
+        memset(&seedres,0,sizeof(seedres));
+    close(seedfd);
+    waitpid(seedpid,NULL,0);
+
+    // Aggregate
+    uint64_t nchunks = (size+chunk_size-1)/chunk_size;
+    double sum_goodput=0.0, min_goodput=-1.0, sum_ttfb=0.0, max_ttfb=0.0;
+    double sum_dgrams_per_chunk=0.0, sum_hash_bytes_per_chunk=0.0;
+    tint max_elapsed=0, cpu=seedres.cpu;
+    for (int i=0; i<nleechers; i++) {
+        peer_result_t &r = results[i];
+        cpu += r.cpu;
+        if (!r.complete)
+            continue;
+        double goodput = (double)size/((double)r.elapsed/TINT_SEC);
+        sum_goodput += goodput;
+        if (min_goodput < 0.0 || goodput < min_goodput)
+            min_goodput = goodput;
+        sum_ttfb += (double)r.ttfb/TINT_MSEC;
+        max_ttfb = std::max(max_ttfb,(double)r.ttfb/TINT_MSEC);
+        max_elapsed = std::max(max_elapsed,r.elapsed);
+        sum_dgrams_per_chunk += (double)r.dgrams_down/nchunks;
+        sum_hash_bytes_per_chunk += (double)r.hash_bytes_down/nchunks;
+    }
+    double n = ncomplete ? ncomplete : 1;
+    double gbdelivered = (double)size*ncomplete/(1024.0*1024.0*1024.0);
+
+    printf("{\n");
+    printf("  \"leechers\": %d,\n", nleechers);
+    printf("  \"complete\": %d,\n", ncomplete);
+    printf("  \"size\": %" PRIu64 ",\n", size);
+    printf("  \"chunk_size\": %" PRIu32 ",\n", chunk_size);
+    printf("  \"cont_int_prot\": %d,\n", (int)cipm);
+    printf("  \"max_pmtu\": %d,\n", Channel::MAX_PMTU);
+    printf("  \"goodput_avg_bps\": %.0f,\n", sum_goodput/n);
+    printf("  \"goodput_min_bps\": %.0f,\n", min_goodput < 0.0 ? 0.0 : min_goodput);
+    printf("  \"goodput_aggregate_bps\": %.0f,\n",
+           max_elapsed ? (double)size*ncomplete/((double)max_elapsed/TINT_SEC) : 0.0);
+    printf("  \"cpu_s_per_gb\": %.3f,\n", gbdelivered > 0.0 ? ((double)cpu/TINT_SEC)/gbdelivered : 0.0);
+    printf("  \"seeder_cpu_s\": %.3f,\n", (double)seedres.cpu/TINT_SEC);
+    printf("  \"dgrams_per_chunk\": %.3f,\n", sum_dgrams_per_chunk/n);
+    printf("  \"hash_bytes_per_chunk\": %.3f,\n", sum_hash_bytes_per_chunk/n);
+    printf("  \"ttfb_avg_ms\": %.3f,\n", sum_ttfb/n);
+    printf("  \"ttfb_max_ms\": %.3f,\n", max_ttfb);
+    printf("  \"seeder_dgrams_up\": %" PRIu64 ",\n", seedres.dgrams_up);
+    printf("  \"seeder_raw_bytes_up\": %" PRIu64 "\n", seedres.raw_bytes_up);
+    printf("}\n");
+
+    if (!keep)
+        remove_files(nleechers);
+
+    return ncomplete == nleechers ? 0 : 2;
+}
@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# Runs all micro-benchmarks and writes one JSON result file per benchmark
+# into the given directory (default: bench/results), for tracking over time.
+# Extra arguments are passed to each benchmark, e.g. --benchmark_filter=Binmap
+#
+
+BENCHDIR=`cd \`dirname $0\` && pwd`
+OUTDIR=${1:-$BENCHDIR/results}
+shift
+
+mkdir -p $OUTDIR
+for bench in $BENCHDIR/*bench; do
+    name=`basename $bench`
+    if [ -x $bench -a $name != loopbackbench ]; then
+        echo $name
+        (cd $OUTDIR && $bench --benchmark_out=$name.json --benchmark_out_format=json "$@")
+    fi
+done
+
+# End-to-end loopback transfer, prints JSON itself. Set LOOPBACK_ARGS to
+# change the defaults, e.g. LOOPBACK_ARGS="-n 4 -s 268435456"
+if [ -x $BENCHDIR/loopbackbench ]; then
+    echo loopbackbench
+    (cd $OUTDIR && $BENCHDIR/loopbackbench $LOOPBACK_ARGS > loopbackbench.json)
+fi
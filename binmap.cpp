@@ -1684,7 +1684,7 @@ bin_t binmap_t::_find_complement(const bin_t& bin, const bitmap_t dbitmap, const
         }
 
         // Ric,  2013-09-09: Solved
-        uint32_t offset = bin.base_left().twisted(twist & ~0x0f).toUInt() & ~31;
+        bin_t::uint_t offset = bin.base_left().twisted(twist & ~0x0f).toUInt() & ~31;
         return bin_t(offset + bitmap_to_bin(bitmap)).to_twisted(twist & 0x0f);
 
     } else {
@@ -1705,7 +1705,7 @@ bin_t binmap_t::_find_complement(const bin_t& bin, const bitmap_t dbitmap, const
         }
 
         // Ric: 2013-09 bug fix
-        uint32_t offset = bin.base_left().twisted(twist & ~0x1f).toUInt() & ~63;
+        bin_t::uint_t offset = bin.base_left().twisted(twist & ~0x1f).toUInt() & ~63;
         return bin_t(offset + bitmap_to_bin(bitmap)).to_twisted(twist & 0x1f);
 
     }
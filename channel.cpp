@@ -26,7 +26,11 @@ tint Channel::start = now_t::now;
 tint Channel::epoch = now_t::now/360000000LL*360000000LL; // make logs mergeable
 uint64_t Channel::global_dgrams_up=0, Channel::global_dgrams_down=0,
                   Channel::global_raw_bytes_up=0, Channel::global_raw_bytes_down=0,
-                           Channel::global_bytes_up=0, Channel::global_bytes_down=0;
+                           Channel::global_bytes_up=0, Channel::global_bytes_down=0,
+                                    Channel::global_hash_bytes_up=0, Channel::global_hash_bytes_down=0,
+                                    Channel::global_hashes_deduped=0,
+                                             Channel::global_retransmits=0, Channel::global_hash_check_fails=0;
+LatencyHistogram Channel::global_rtt_hist, Channel::global_send_lag_hist;
 sckrwecb_t Channel::sock_open[] = {};
 int Channel::sock_count = 0;
 swift::tint Channel::last_tick = 0;
@@ -39,6 +43,7 @@ FILE* Channel::debug_file = NULL;
 // Only in dev: ledbat log file
 FILE* Channel::debug_ledbat = NULL;
 tint Channel::MIN_PEX_REQUEST_INTERVAL = TINT_SEC;
+int Channel::MAX_PMTU = SWIFT_PMTU_JUMBO;
 
 /*
  * Instance methods
@@ -49,8 +54,11 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     peer_(peer_addr), socket_(socket==INVALID_SOCKET?default_socket():socket), // FIXME
     transfer_(transfer), own_id_mentioned_(false),
     ack_in_right_basebin_(bin_t::NONE),
-    data_in_(TINT_NEVER,bin_t::NONE), data_in_dbl_(bin_t::NONE), data_out_size_(0),
-    data_out_cap_(bin_t::ALL),hint_in_size_(0), hint_out_size_(0), hint_queue_out_size_(0),
+    data_in_(TINT_NEVER,bin_t::NONE), data_in_dbl_(bin_t::NONE), ack_pending_time_(TINT_NEVER),
+    ack_pending_owd_(TINT_NEVER), have_cursor_(0), pmtu_(SWIFT_MAX_UDP_OVER_ETH_PAYLOAD), pmtu_max_(MAX_PMTU),
+    pmtu_probe_size_(0), pmtu_probe_nchunks_(0), pmtu_probe_bin_(bin_t::NONE), pmtu_probe_sending_(false),
+    pmtu_probe_time_(0), data_out_size_(0),
+    data_out_cap_(bin_t::ALL),hashes_out_count_(0),hint_in_size_(0), hint_out_size_(0), hint_queue_out_size_(0),
     // Gertjan fix 996e21e8abfc7d88db3f3f8158f2a2c4fc8a8d3f
     // "Changed PEX rate limiting to per channel limiting"
     pex_requested_(false),  // Ric: init var that wasn't initialiazed
@@ -64,6 +72,8 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     send_control_(PING_PONG_CONTROL), sent_since_recv_(0),
     lastrecvwaskeepalive_(false), lastsendwaskeepalive_(false), keepalivereason_(NONE),
     live_have_no_hint_(false), // Arno: live speed opt
+    live_have_due_(false),
+    push_in_count_(0), push_in_time_(0), relay_pex_time_(0),
     ack_rcvd_recent_(0), ack_not_rcvd_recent_(0), owd_min_bin_(0), owd_min_bin_start_(NOW-LEDBAT_ROLLOVER),
     owd_cur_(TINT_NEVER), owd_min_(TINT_NEVER),
     dgrams_sent_(0), dgrams_rcvd_(0),
@@ -73,7 +83,9 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     hs_out_(NULL), hs_in_(NULL),
     last_sent_munro_(bin_t::NONE),
     munro_ack_rcvd_(false),
-    rtt_hint_tintbin_()
+    push_munro_out_(bin_t::NONE),
+    rtt_hint_tintbin_(),
+    trace_(NULL)
 {
     // ARNOTODO: avoid infinitely growing vector
     this->id_ = channels.size();
@@ -87,12 +99,13 @@ Channel::Channel(ContentTransfer* transfer, int socket, Address peer_addr) :
     evtimer_assign(evsend_ptr_,evbase,&Channel::LibeventSendCallback,this);
     evtimer_add(evsend_ptr_,tint2tv(next_send_time_));
 
-    //LIVE
-    evsendlive_ptr_ = NULL;
-
     // RATELIMIT
     transfer_->GetChannels()->push_back(this);
 
+    // TELEMETRY
+    if (transfer_->IsTracing())
+        SetTracing(true);
+
     hs_out_ = new Handshake(transfer->GetDefaultHandshake());
 
     dprintf("%s #%" PRIu32 " init channel %s transfer %d\n",tintstr(),id_,peer_.str().c_str(), transfer_->td());
@@ -117,6 +130,11 @@ Channel::~Channel()
         channels->erase(iter);
     }
 
+    while (!repair_out_.empty()) {
+        evbuffer_free(repair_out_.front());
+        repair_out_.pop_front();
+    }
+
     if (hs_in_ != NULL) {
         delete hs_in_;
         hs_in_ = NULL;
@@ -125,6 +143,18 @@ Channel::~Channel()
         delete hs_out_;
         hs_out_ = NULL;
     }
+    SetTracing(false);
+}
+
+
+void Channel::SetTracing(bool enable)
+{
+    if (enable && trace_ == NULL)
+        trace_ = new TraceRing();
+    else if (!enable && trace_ != NULL) {
+        delete trace_;
+        trace_ = NULL;
+    }
 }
 
 
@@ -136,11 +166,6 @@ void Channel::ClearEvents()
         delete evsend_ptr_;
         evsend_ptr_ = NULL;
     }
-    if (evsendlive_ptr_ != NULL) {
-        evtimer_del(evsendlive_ptr_);
-        delete evsendlive_ptr_;
-        evsendlive_ptr_ = NULL;
-    }
 }
 
 HashTree * Channel::hashtree()
@@ -298,14 +323,60 @@ Address swift::BoundAddress(evutil_socket_t sock)
 }
 
 
-int Channel::SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb)
+#ifdef IP_MTU_DISCOVER
+/** MULTIDATA: Set DF on the datagrams sent on sock, saving the previous
+ * setting in saved[0] (IPv4) and saved[1] (IPv6), -1 if not set */
+static void set_dontfrag(evutil_socket_t sock, int *saved)
+{
+    socklen_t optlen = sizeof(int);
+    int pmtudisc = IP_PMTUDISC_DO;
+    saved[0] = saved[1] = -1;
+    if (getsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, (setsockoptptr_t)&saved[0], &optlen) != 0
+            || setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, (setsockoptptr_t)&pmtudisc, sizeof(int)) != 0)
+        saved[0] = -1;
+#ifdef IPV6_MTU_DISCOVER
+    optlen = sizeof(int);
+    int pmtudisc6 = IPV6_PMTUDISC_DO;
+    if (getsockopt(sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (setsockoptptr_t)&saved[1], &optlen) != 0
+            || setsockopt(sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (setsockoptptr_t)&pmtudisc6, sizeof(int)) != 0)
+        saved[1] = -1;
+#endif
+}
+
+static void restore_dontfrag(evutil_socket_t sock, const int *saved)
+{
+    if (saved[0] != -1)
+        setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, (setsockoptptr_t)&saved[0], sizeof(int));
+#ifdef IPV6_MTU_DISCOVER
+    if (saved[1] != -1)
+        setsockopt(sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (setsockoptptr_t)&saved[1], sizeof(int));
+#endif
+}
+#endif
+
+int Channel::SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb, bool dontfrag)
 {
     int length = evbuffer_get_length(evb);
+    // MULTIDATA: Path MTU probes must not be fragmented, so they fail
+    // instead. Sending one larger than the path allows gives EMSGSIZE.
+    // The socket is shared by all channels, so DF is on for this datagram
+    // only.
+#ifdef IP_MTU_DISCOVER
+    int pmtudisc[2];
+    if (dontfrag)
+        set_dontfrag(sock,pmtudisc);
+#endif
     int r = sendto(sock,(const char *)evbuffer_pullup(evb, length),length,0,
                    (struct sockaddr*)&(addr.addr),addr.get_family_sockaddr_length());
     // SCHAAP: 2012-06-16 - How about EAGAIN and EWOULDBLOCK? Do we just drop the packet then as well?
+    int saverrno = errno;
+#ifdef IP_MTU_DISCOVER
+    if (dontfrag)
+        restore_dontfrag(sock,pmtudisc);
+#endif
     if (r<0) {
-        print_error("can't send");
+        if (!dontfrag || saverrno != EMSGSIZE) // MULTIDATA: failed probe is reported by caller
+            print_error("can't send");
         evbuffer_drain(evb, length); // Arno: behaviour is to pretend the packet got lost
     } else {
         evbuffer_drain(evb,r);
@@ -313,6 +384,7 @@ int Channel::SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *
         global_raw_bytes_up+=length;
     }
     Time();
+    errno = saverrno;
     return r;
 }
 
@@ -497,11 +569,11 @@ int swift::evbuffer_add_64be(struct evbuffer *evb, uint64_t l)
 
 int swift::evbuffer_add_hash(struct evbuffer *evb, const Sha1Hash& hash)
 {
-    return evbuffer_add(evb, hash.bits, Sha1Hash::SIZE);
+    return evbuffer_add(evb, hash.bits, hash.size());
 }
 
 // PPSP
-int swift::evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr)
+int swift::evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr, uint32_t chunk_size)
 {
     int ret = -1;
     if (chunk_addr == POPT_CHUNK_ADDR_BIN32)
@@ -509,6 +581,34 @@ int swift::evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_add
     else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
         ret = evbuffer_add_32be(evb, (uint32_t)b.base_offset());
         ret = evbuffer_add_32be(evb, (uint32_t)(b.base_offset()+b.base_length()-1));  // end is inclusive
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64)
+        ret = evbuffer_add_64be(evb, bin_toUInt64(b));
+    else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        ret = evbuffer_add_64be(evb, b.base_offset());
+        ret = evbuffer_add_64be(evb, b.base_offset()+b.base_length()-1);  // end is inclusive
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BYTE64) {
+        ret = evbuffer_add_64be(evb, b.base_offset()*chunk_size);
+        ret = evbuffer_add_64be(evb, (b.base_offset()+b.base_length())*chunk_size-1);  // end is inclusive
+    }
+    return ret;
+}
+
+/** ACKAGG: Encode the chunk range schunk to echunk (inclusive) as one chunk
+ * spec. Only possible with the range addressing methods, returns -1 for
+ * the bin methods. */
+int swift::evbuffer_add_chunkrange(struct evbuffer *evb, uint64_t schunk, uint64_t echunk, popt_chunk_addr_t chunk_addr,
+                                   uint32_t chunk_size)
+{
+    int ret = -1;
+    if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
+        ret = evbuffer_add_32be(evb, (uint32_t)schunk);
+        ret = evbuffer_add_32be(evb, (uint32_t)echunk);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        ret = evbuffer_add_64be(evb, schunk);
+        ret = evbuffer_add_64be(evb, echunk);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BYTE64) {
+        ret = evbuffer_add_64be(evb, schunk*chunk_size);
+        ret = evbuffer_add_64be(evb, (echunk+1)*chunk_size-1);  // end is inclusive
     }
     return ret;
 }
@@ -567,16 +667,25 @@ uint64_t swift::evbuffer_remove_64be(struct evbuffer *evb)
     return l;
 }
 
-Sha1Hash swift::evbuffer_remove_hash(struct evbuffer* evb)
+Sha1Hash swift::evbuffer_remove_hash(struct evbuffer* evb, popt_merkle_func_t func)
 {
-    char bits[Sha1Hash::SIZE];
-    if (evbuffer_remove(evb, bits, Sha1Hash::SIZE) < Sha1Hash::SIZE)
+    uint8_t bits[HASHSZ_MAX];
+    size_t size = Sha1Hash::Size(func);
+    if (evbuffer_remove(evb, bits, size) < (int)size)
         return Sha1Hash::ZERO;
-    return Sha1Hash(false, bits);
+    return Sha1Hash(func, bits);
+}
+
+/** CHUNK64: Whether a decoded 64-bit bin lies within the bin tree, i.e.
+ * ends at or before SWIFT_CHUNK64_MAX_CHUNK, or is ALL or NONE as the
+ * 32-bit encoding allows. */
+static bool bin64_valid(bin_t pos)
+{
+    return pos.is_none() || pos.toUInt() <= bin_t::ALL.toUInt();
 }
 
 // PPSP
-binvector swift::evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr_t chunk_addr)
+binvector swift::evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr_t chunk_addr, uint32_t chunk_size)
 {
     binvector bv;
     if (chunk_addr == POPT_CHUNK_ADDR_BIN32) {
@@ -587,10 +696,69 @@ binvector swift::evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr
         uint32_t echunk = evbuffer_remove_32be(evb);
         if (schunk <= echunk) // Bad input protection
             swift::chunk32_to_bin32(schunk,echunk,&bv);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64) {
+        bin_t pos = bin_fromUInt64(evbuffer_remove_64be(evb));
+        if (bin64_valid(pos)) // Bad input protection
+            bv.push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        uint64_t schunk = evbuffer_remove_64be(evb);
+        uint64_t echunk = evbuffer_remove_64be(evb);
+        if (schunk <= echunk && echunk <= SWIFT_CHUNK64_MAX_CHUNK) // Bad input protection
+            swift::chunk64_to_bin64(schunk,echunk,&bv);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BYTE64) {
+        uint64_t sbyte = evbuffer_remove_64be(evb);
+        uint64_t ebyte = evbuffer_remove_64be(evb);
+        // Ranges must start at a chunk, the last chunk may be short
+        if (chunk_size > 0 && sbyte <= ebyte && sbyte % chunk_size == 0 && ebyte/chunk_size <= SWIFT_CHUNK64_MAX_CHUNK)
+            swift::chunk64_to_bin64(sbyte/chunk_size,ebyte/chunk_size,&bv);
     }
     return bv;
 }
 
+// DECODE
+Sha1Hash DgramCursor::gethash(popt_merkle_func_t func)
+{
+    size_t size = Sha1Hash::Size(func);
+    if (!Need(size))
+        return Sha1Hash::ZERO;
+    Sha1Hash hash(func,ptr_);
+    ptr_ += size;
+    return hash;
+}
+
+// DECODE: Same checks as evbuffer_remove_chunkaddr()
+int DgramCursor::getchunkaddr(popt_chunk_addr_t chunk_addr, uint32_t chunk_size, binarray_t *ba)
+{
+    ba->size = 0;
+    if (chunk_addr == POPT_CHUNK_ADDR_BIN32) {
+        bin_t pos = bin_fromUInt32(get32be());
+        ba->push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK32) {
+        uint32_t schunk = get32be();
+        uint32_t echunk = get32be();
+        if (schunk <= echunk) // Bad input protection
+            swift::chunk64_to_binarray(schunk,echunk,ba);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BIN64) {
+        bin_t pos = bin_fromUInt64(get64be());
+        if (bin64_valid(pos)) // Bad input protection
+            ba->push_back(pos);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_CHUNK64) {
+        uint64_t schunk = get64be();
+        uint64_t echunk = get64be();
+        if (schunk <= echunk && echunk <= SWIFT_CHUNK64_MAX_CHUNK) // Bad input protection
+            swift::chunk64_to_binarray(schunk,echunk,ba);
+    } else if (chunk_addr == POPT_CHUNK_ADDR_BYTE64) {
+        uint64_t sbyte = get64be();
+        uint64_t ebyte = get64be();
+        // Ranges must start at a chunk, the last chunk may be short
+        if (chunk_size > 0 && sbyte <= ebyte && sbyte % chunk_size == 0 && ebyte/chunk_size <= SWIFT_CHUNK64_MAX_CHUNK)
+            swift::chunk64_to_binarray(sbyte/chunk_size,ebyte/chunk_size,ba);
+    }
+    if (!ok_)
+        ba->size = 0;
+    return ba->size;
+}
+
 Address swift::evbuffer_remove_pexaddr(struct evbuffer *evb, int family)
 {
     int ret = -1;
@@ -617,6 +785,24 @@ Address swift::evbuffer_remove_pexaddr(struct evbuffer *evb, int family)
  * method finds which bins describe this range.
  */
 void swift::chunk32_to_bin32(uint32_t schunk, uint32_t echunk, binvector *bvptr)
+{
+    swift::chunk64_to_bin64(schunk,echunk,bvptr);
+}
+
+
+/** CHUNK64: As chunk32_to_bin32() for 64-bit chunk IDs up to
+ * SWIFT_CHUNK64_MAX_CHUNK */
+void swift::chunk64_to_bin64(uint64_t schunk, uint64_t echunk, binvector *bvptr)
+{
+    binarray_t ba;
+    swift::chunk64_to_binarray(schunk,echunk,&ba);
+    bvptr->insert(bvptr->end(),ba.bins,ba.bins+ba.size);
+}
+
+
+/** DECODE: As chunk64_to_bin64() into a fixed-size array. Returns the
+ * number of bins. */
+int swift::chunk64_to_binarray(uint64_t schunk, uint64_t echunk, binarray_t *ba)
 {
     bin_t s(0,schunk);
     bin_t e(0,echunk);
@@ -627,32 +813,23 @@ void swift::chunk32_to_bin32(uint32_t schunk, uint32_t echunk, binvector *bvptr)
         // previous node belongs to the range description. Next, we start at
         // the left most chunk in the subtree next to the previous node, and see
         // how far up we can go there.
-        //fprintf(stderr,"\ncur %s par left %s par right %s\n", cur.str().c_str(), cur.parent().base_left().str().c_str(), cur.parent().base_right().str().c_str());
         if (cur.parent().base_left() < s || cur.parent().base_right() > e) {
-            /*if (cur.parent().base_left() < s)
-            fprintf(stderr,"parent %s left %s before s, add %s\n", cur.parent().str().c_str(), cur.parent().base_left().str().c_str(), cur.str().c_str() );
-            if (cur.parent().base_right() > e)
-            fprintf(stderr,"parent %s right %s exceeds e, add %s\n", cur.parent().str().c_str(), cur.parent().base_right().str().c_str(), cur.str().c_str() );
-             */
-            bvptr->push_back(cur);
+            ba->push_back(cur);
 
             if (cur.parent().base_left() < s)
                 cur = bin_t(0,cur.parent().base_right().layer_offset()+1);
             else
                 cur = bin_t(0,cur.base_right().layer_offset()+1);
 
-            //fprintf(stderr,"newcur %s\n", cur.str().c_str() );
-
             if (cur >= e) {
-                if (cur == e) {
-                    // fprintf(stderr,"adding e %s\n", cur.str().c_str() );
-                    bvptr->push_back(e);
-                }
+                if (cur == e)
+                    ba->push_back(e);
                 break;
             }
         } else
             cur = cur.parent();
     }
+    return ba->size;
 }
 
 
@@ -0,0 +1,324 @@
+/*
+ *  chunkindex.cpp
+ *  DEDUP: per-process index from Merkle leaf hash to a local copy of the
+ *  chunk, so that swarms sharing content (re-encodes with identical
+ *  segments, multi-file swarms sharing files) download it once.
+ *
+ *  The on-disk store is a text file with a line per swarm:
+ *
+ *  roothash-in-hex hashfunc chunksize<TAB>file<TAB>destdir<TAB>mhash<TAB>mbinmap<TAB>mfspec
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "compat.h"
+
+using namespace swift;
+
+
+ChunkIndex * ChunkIndex::__singleton = NULL;
+
+#define CHUNKINDEX_STORE_FIELDS     6
+
+
+static uint64_t LeafKey(const Sha1Hash &leafhash)
+{
+    uint64_t key;
+    memcpy(&key,leafhash.bits,sizeof(key));
+    return key;
+}
+
+
+/** Stored swarms are opened from whatever the working directory is then */
+static std::string AbsolutePath(std::string path)
+{
+    if (path == "" || path.substr(0,1) == FILE_SEP || path.substr(0,1) == "/"
+            || (path.length() > 1 && path[1] == ':'))
+        return path;
+    return getcwd_utf8()+FILE_SEP+path;
+}
+
+
+ChunkIndex::ChunkIndex() : enabled_(false), hits_(0)
+{
+    if (__singleton == NULL) {
+        __singleton = this;
+    }
+}
+
+
+ChunkIndex::~ChunkIndex()
+{
+    chunk_sources_t::iterator iter;
+    for (iter=sources_.begin(); iter!=sources_.end(); iter++) {
+        if (*iter != NULL)
+            delete (*iter)->storage;
+        delete *iter;
+    }
+    if (__singleton == this)
+        __singleton = NULL;
+}
+
+
+ChunkIndex * ChunkIndex::GetInstance()
+{
+    if (__singleton == NULL) {
+        new ChunkIndex();
+    }
+    return __singleton;
+}
+
+
+int ChunkIndex::SetStore(std::string filename)
+{
+    enabled_ = true;
+    store_filename_ = filename;
+
+    FILE *fp = fopen_utf8(filename.c_str(),"a+");
+    if (fp == NULL) {
+        print_error("chunkindex: cannot open store");
+        store_filename_ = "";
+        return -1;
+    }
+    rewind(fp);
+
+    char line[Storage::MULTIFILE_MAX_LINE*CHUNKINDEX_STORE_FIELDS];
+    int nloaded=0;
+    while (fgets(line,sizeof(line),fp) != NULL) {
+        std::vector<std::string> fields;
+        char *start = line;
+        char *tab;
+        while ((tab = strchr(start,'\t')) != NULL) {
+            fields.push_back(std::string(start,tab-start));
+            start = tab+1;
+        }
+        fields.push_back(std::string(start,strcspn(start,"\r\n")));
+        if (fields.size() != CHUNKINDEX_STORE_FIELDS)
+            continue;
+
+        char hashhex[2*HASHSZ_MAX+1];
+        int func=0;
+        uint32_t chunk_size=0;
+        if (sscanf(fields[0].c_str(),"%64s %d %" SCNu32,hashhex,&func,&chunk_size) != 3 || chunk_size == 0)
+            continue;
+        if (FindSource(fields[3]) >= 0)
+            continue;
+
+        chunk_source_t *cs = new chunk_source_t();
+        cs->ft = NULL;
+        cs->storage = NULL;
+        cs->root_hash = Sha1Hash(true,hashhex);
+        cs->func = (popt_merkle_func_t)func;
+        cs->root_hash.func_ = cs->func;
+        cs->chunk_size = chunk_size;
+        cs->filename = fields[1];
+        cs->destdir = fields[2];
+        cs->hash_filename = fields[3];
+        cs->binmap_filename = fields[4];
+        cs->mfspec_filename = fields[5];
+        cs->stored = true;
+        sources_.push_back(cs);
+        if (LoadStoredSource(sources_.size()-1) == 0)
+            nloaded++;
+    }
+    fclose(fp);
+
+    dprintf("%s chunkindex: store %s has %d swarms %" PRIu64 " chunks\n",tintstr(),filename.c_str(),nloaded,
+            (uint64_t)index_.size());
+    return 0;
+}
+
+
+bool ChunkIndex::HasContent(chunk_source_t *cs)
+{
+    // Storage creates what is missing, as for a download
+    if (file_exists_utf8(cs->filename) == 1)
+        return true;
+    return cs->mfspec_filename != "" && file_exists_utf8(cs->mfspec_filename) == 1;
+}
+
+
+int ChunkIndex::LoadStoredSource(uint32_t src)
+{
+    chunk_source_t *cs = sources_[src];
+    // Without a checkpoint the tree would have to be built from the content
+    if (file_exists_utf8(cs->hash_filename) != 1 || file_exists_utf8(cs->binmap_filename) != 1)
+        return -1;
+    if (!HasContent(cs))
+        return -1;
+
+    Storage storage(cs->filename,cs->destdir,-1,0,cs->mfspec_filename);
+    if (!storage.IsOperational())
+        return -1;
+    MmapHashTree ht(&storage,cs->root_hash,cs->chunk_size,cs->hash_filename,false,cs->binmap_filename,cs->func);
+    if (!ht.IsOperational())
+        return -1;
+    AddSourceChunks(src,&ht);
+    return 0;
+}
+
+
+int ChunkIndex::WriteStoredSource(chunk_source_t *cs)
+{
+    FILE *fp = fopen_utf8(store_filename_.c_str(),"a");
+    if (fp == NULL) {
+        print_error("chunkindex: cannot append to store");
+        return -1;
+    }
+    int ret = fprintf(fp,"%s %d %" PRIu32 "\t%s\t%s\t%s\t%s\t%s\n",cs->root_hash.hex().c_str(),(int)cs->func,
+                      cs->chunk_size,cs->filename.c_str(),cs->destdir.c_str(),cs->hash_filename.c_str(),
+                      cs->binmap_filename.c_str(),cs->mfspec_filename.c_str());
+    fclose(fp);
+    return ret < 0 ? -1 : 0;
+}
+
+
+int ChunkIndex::FindSource(std::string hash_filename)
+{
+    for (int i=0; i<sources_.size(); i++)
+        if (sources_[i] != NULL && sources_[i]->hash_filename == hash_filename)
+            return i;
+    return -1;
+}
+
+
+int ChunkIndex::FindSource(FileTransfer *ft)
+{
+    for (int i=0; i<sources_.size(); i++)
+        if (sources_[i] != NULL && sources_[i]->ft == ft)
+            return i;
+    return -1;
+}
+
+
+void ChunkIndex::AddTransfer(FileTransfer *ft, std::string filename, std::string destdir,
+                             std::string hash_filename, std::string binmap_filename, std::string mfspec_filename)
+{
+    HashTree *ht = ft->hashtree();
+    if (!enabled_ || ht == NULL || ht->root_hash() == Sha1Hash::ZERO)
+        return;
+
+    int src = FindSource(AbsolutePath(hash_filename));
+    if (src < 0) {
+        chunk_source_t *cs = new chunk_source_t();
+        cs->filename = AbsolutePath(filename);
+        cs->destdir = AbsolutePath(destdir);
+        cs->hash_filename = AbsolutePath(hash_filename);
+        cs->binmap_filename = AbsolutePath(binmap_filename);
+        cs->mfspec_filename = AbsolutePath(mfspec_filename);
+        cs->storage = NULL;
+        cs->stored = false;
+        sources_.push_back(cs);
+        src = sources_.size()-1;
+    }
+    chunk_source_t *cs = sources_[src];
+    cs->ft = ft;
+    // Read via ft while it is open, it may be writing the same files
+    delete cs->storage;
+    cs->storage = NULL;
+    cs->root_hash = ht->root_hash();
+    cs->chunk_size = ft->chunk_size();
+    cs->func = ht->hash_func();
+    if (!cs->stored && store_filename_ != "")
+        cs->stored = (WriteStoredSource(cs) == 0);
+
+    AddSourceChunks(src,ht);
+}
+
+
+void ChunkIndex::RemoveTransfer(FileTransfer *ft)
+{
+    int src = FindSource(ft);
+    if (src < 0)
+        return;
+    if (sources_[src]->stored) {
+        // Read from disk from now on
+        sources_[src]->ft = NULL;
+        return;
+    }
+
+    chunk_index_t::iterator iter = index_.begin();
+    while (iter != index_.end()) {
+        if (iter->second.first == src)
+            index_.erase(iter++);
+        else
+            iter++;
+    }
+    delete sources_[src]->storage;
+    delete sources_[src];
+    sources_[src] = NULL;
+}
+
+
+void ChunkIndex::AddChunk(FileTransfer *ft, bin_t pos)
+{
+    int src = FindSource(ft);
+    if (src < 0)
+        return;
+    AddSourceChunk(src,pos.base_offset(),ft->hashtree()->hash(pos));
+}
+
+
+void ChunkIndex::AddSourceChunks(uint32_t src, HashTree *ht)
+{
+    binmap_t *ack_out = ht->ack_out();
+    for (uint64_t c=0; c<ht->size_in_chunks(); c++) {
+        bin_t pos(0,c);
+        if (ack_out->is_filled(pos))
+            AddSourceChunk(src,c,ht->hash(pos));
+    }
+}
+
+
+void ChunkIndex::AddSourceChunk(uint32_t src, uint64_t chunk, const Sha1Hash &leafhash)
+{
+    if (leafhash == Sha1Hash::ZERO)
+        return;
+    uint64_t key = LeafKey(leafhash);
+    std::pair<chunk_index_t::iterator,chunk_index_t::iterator> range = index_.equal_range(key);
+    chunk_index_t::iterator iter;
+    for (iter=range.first; iter!=range.second; iter++)
+        if (iter->second.first == src && iter->second.second == chunk)
+            return;
+    index_.insert(std::make_pair(key,std::make_pair(src,chunk)));
+}
+
+
+ssize_t ChunkIndex::Read(const Sha1Hash &leafhash, uint32_t chunk_size, char *buf, FileTransfer *notft)
+{
+    std::pair<chunk_index_t::iterator,chunk_index_t::iterator> range = index_.equal_range(LeafKey(leafhash));
+    chunk_index_t::iterator iter;
+    for (iter=range.first; iter!=range.second; iter++) {
+        chunk_source_t *cs = sources_[iter->second.first];
+        if (cs == NULL || (cs->ft != NULL && cs->ft == notft) || cs->chunk_size != chunk_size
+                || cs->func != leafhash.func())
+            continue;
+
+        int64_t offset = iter->second.second*chunk_size;
+        ssize_t r = -1;
+        if (cs->ft != NULL)
+            r = cs->ft->GetStorage()->Read(buf,chunk_size,offset);
+        else {
+            // Opened once, not for every chunk a swarm takes from it
+            if (cs->storage == NULL) {
+                if (!HasContent(cs))
+                    continue;
+                cs->storage = new Storage(cs->filename,cs->destdir,-1,0,cs->mfspec_filename);
+            }
+            if (cs->storage->IsOperational())
+                r = cs->storage->Read(buf,chunk_size,offset);
+            else {
+                delete cs->storage;
+                cs->storage = NULL;
+            }
+        }
+        // The content may have changed since it was indexed
+        if (r <= 0 || Sha1Hash(leafhash.func(),buf,r) != leafhash)
+            continue;
+
+        hits_++;
+        return r;
+    }
+    return -1;
+}
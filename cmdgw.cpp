@@ -246,6 +246,50 @@ void CmdGwGotSETMOREINFO(SwarmID &swarmid, bool enable)
     req->moreinfo = enable;
 }
 
+void CmdGwGotSETTRACE(SwarmID &swarmid, bool enable)
+{
+    cmd_gw_t* req = CmdGwFindRequestBySwarmID(swarmid);
+    if (req == NULL)
+        return;
+    ContentTransfer *ct = swift::GetActivatedTransfer(req->td);
+    if (ct == NULL)
+        return;
+    ct->SetTracing(enable);
+}
+
+void CmdGwGotDUMPTRACE(evutil_socket_t cmdsock, SwarmID &swarmid)
+{
+    cmd_gw_t* req = CmdGwFindRequestBySwarmID(swarmid);
+    if (req == NULL)
+        return;
+    ContentTransfer *ct = swift::GetActivatedTransfer(req->td);
+    if (ct == NULL)
+        return;
+
+    /*
+     *  Format:
+     *  TRACE roothash nbytes\r\n
+     *  <bytes>, see telemetry.h, decode with tracedecode
+     */
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add(evb,TRACE_DUMP_MAGIC,strlen(TRACE_DUMP_MAGIC));
+    evbuffer_add_8(evb,TRACE_DUMP_VERSION);
+    channels_t *peerchans = ct->GetChannels();
+    channels_t::iterator iter;
+    for (iter=peerchans->begin(); iter!=peerchans->end(); iter++) {
+        Channel *c = *iter;
+        if (c != NULL && c->GetTraceRing() != NULL)
+            c->GetTraceRing()->Dump(evb,c->id());
+    }
+
+    size_t evb_len = evbuffer_get_length(evb);
+    char cmd[MAX_CMD_MESSAGE];
+    sprintf(cmd,"TRACE %s " PRISIZET "\r\n",swarmid.hex().c_str(),evb_len);
+    send(cmdsock,cmd,strlen(cmd),0);
+    send(cmdsock,(const char *)evbuffer_pullup(evb,evb_len),evb_len,0);
+    evbuffer_free(evb);
+}
+
 void CmdGwGotPEERADDR(SwarmID &swarmid, Address &peer)
 {
     cmd_gw_t* req = CmdGwFindRequestBySwarmID(swarmid);
@@ -342,10 +386,30 @@ void CmdGwSendINFO(cmd_gw_t* req, int dlstatus)
             }
         }
         oss << "], ";
+        // HOOKIN: startup delay vs. stalls of live clients
+        if (ct != NULL && ct->ttype() == LIVE_TRANSFER && ct->picker() != NULL) {
+            livepp_stats_t ls;
+            ((LivePiecePicker *)ct->picker())->GetStats(ls);
+            double playsecs = ls.play_time ? (double)(Channel::Time()-ls.play_time)/1000000.0L : 0.0;
+            oss << "\"live\": {";
+            oss << "\"hookin_chunk\": " << (ls.hookin_bin == bin_t::NONE ? -1 : (int64_t)ls.hookin_bin.layer_offset()) << ", ";
+            oss << "\"hookin_delay\": " << (ls.hookin_time ? (double)(ls.hookin_time-ls.open_time)/1000000.0L : -1.0) << ", ";
+            oss << "\"startup_delay\": " << (ls.play_time ? (double)(ls.play_time-ls.open_time)/1000000.0L : -1.0) << ", ";
+            oss << "\"prebuffer_chunks\": " << ls.prebuf_chunks << ", ";
+            oss << "\"rate\": " << ls.rate << ", ";
+            oss << "\"hookin_peers\": " << ls.npeers << ", ";
+            oss << "\"hookins\": " << ls.nhookins << ", ";
+            oss << "\"stalls\": " << ls.nstalls << ", ";
+            oss << "\"stall_time\": " << (double)ls.stall_time/1000000.0L << ", ";
+            oss << "\"stalls_per_min\": " << (playsecs > 0.0 ? ls.nstalls*60.0/playsecs : 0.0) << " ";
+            oss << "}, ";
+        }
         oss << "\"raw_bytes_up\": " << Channel::global_raw_bytes_up << ", ";
         oss << "\"raw_bytes_down\": " << Channel::global_raw_bytes_down << ", ";
         oss << "\"bytes_up\": " << Channel::global_bytes_up << ", ";
-        oss << "\"bytes_down\": " << Channel::global_bytes_down << " ";
+        oss << "\"bytes_down\": " << Channel::global_bytes_down << ", ";
+        oss << "\"hash_bytes_up\": " << Channel::global_hash_bytes_up << ", ";
+        oss << "\"hash_bytes_down\": " << Channel::global_hash_bytes_down << " ";
         oss << "}";
 
         oss << "\r\n";
@@ -828,7 +892,8 @@ int CmdGwHandleCommand(evutil_socket_t cmdsock, char *copyline)
                 filename = swarmidhexstr;
 
             if (durstr != "-1")
-                td = swift::Open(filename,swarmid,trackerurl,false,sm.cont_int_prot_,false,activate,sm.chunk_size_,metadir);
+                td = swift::Open(filename,swarmid,trackerurl,false,sm.cont_int_prot_,false,activate,sm.chunk_size_,metadir,
+                                 sm.merkle_func_);
             else
                 td = swift::LiveOpen(filename,swarmid,trackerurl,sm.injector_addr_,sm.cont_int_prot_,sm.live_disc_wnd_,sm.chunk_size_);
             if (td == -1) {
@@ -956,6 +1021,26 @@ int CmdGwHandleCommand(evutil_socket_t cmdsock, char *copyline)
         std::string swarmidhexstr(swarmidhexcstr);
         SwarmID swarmid(swarmidhexstr);
         CmdGwGotSETMOREINFO(swarmid,enable);
+    } else if (!strcmp(method,"SETTRACE")) {
+        // SETTRACE roothash toggle\r\n
+        token = strtok_r(paramstr," ",&savetok); // hash
+        if (token == NULL)
+            return ERROR_MISS_ARG;
+        char *swarmidhexcstr = token;
+        token = strtok_r(NULL," ",&savetok);      // bool
+        if (token == NULL)
+            return ERROR_MISS_ARG;
+        bool enable = (bool)!strcmp(token,"1");
+
+        std::string swarmidhexstr(swarmidhexcstr);
+        SwarmID swarmid(swarmidhexstr);
+        CmdGwGotSETTRACE(swarmid,enable);
+    } else if (!strcmp(method,"DUMPTRACE")) {
+        // DUMPTRACE roothash\r\n
+        char *swarmidhexcstr = paramstr;
+        std::string swarmidhexstr(swarmidhexcstr);
+        SwarmID swarmid(swarmidhexstr);
+        CmdGwGotDUMPTRACE(cmdsock,swarmid);
     } else if (!strcmp(method,"SHUTDOWN")) {
         CmdGwCloseConnection(cmdsock);
         // Tell libevent to stop processing events
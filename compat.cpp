@@ -111,6 +111,26 @@ namespace swift
     }
 
 
+    int     file_preallocate(int fd, int64_t new_size)
+    {
+        int64_t cur_size = file_size(fd);
+        if (cur_size < 0 || new_size <= cur_size)
+            return file_resize(fd,new_size);
+#if defined(__linux__)
+        if (fallocate(fd,0,cur_size,new_size-cur_size) == 0)
+            return 0;
+        // e.g. EOPNOTSUPP on filesystems without extents
+#elif defined(__APPLE__)
+        fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, new_size-cur_size, 0 };
+        if (fcntl(fd,F_PREALLOCATE,&store) < 0) {
+            store.fst_flags = F_ALLOCATEALL;
+            (void)fcntl(fd,F_PREALLOCATE,&store);
+        }
+#endif
+        return file_resize(fd,new_size);
+    }
+
+
     void print_error(const char* msg)
     {
         perror(msg);
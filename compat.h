@@ -263,6 +263,11 @@ namespace swift
 
     int file_resize(int fd, int64_t new_size);
 
+    /** Like file_resize, but when growing let the filesystem allocate the
+     * new blocks up front (contiguous if it can) instead of leaving a hole
+     * that random writes fill piecemeal. */
+    int file_preallocate(int fd, int64_t new_size);
+
     void* memory_map(int fd, size_t size=0);
     void memory_unmap(int fd, void*, size_t size);
 
@@ -33,7 +33,7 @@ uint64_t ContentTransfer::cleancounter = 0;
 
 ContentTransfer::ContentTransfer(transfer_t ttype) :  ttype_(ttype),
     swarm_id_(), mychannels_(), callbacks_(), picker_(NULL), hashtree_(NULL),
-    speedupcount_(0), speeddwcount_(0), trackerurl_(),
+    speedupcount_(0), speeddwcount_(0), retransmits_(0), hash_check_fails_(0), tracing_(false), trackerurl_(),
     tracker_retry_interval_(TRACKER_RETRY_INTERVAL_START),
     tracker_retry_time_(NOW),
     ext_tracker_client_(NULL),
@@ -43,6 +43,8 @@ ContentTransfer::ContentTransfer(transfer_t ttype) :  ttype_(ttype),
     cur_speed_[DDIR_DOWNLOAD] = MovingAverageSpeed();
     max_speed_[DDIR_UPLOAD] = DBL_MAX;
     max_speed_[DDIR_DOWNLOAD] = DBL_MAX;
+    dgrams_[DDIR_UPLOAD] = dgrams_[DDIR_DOWNLOAD] = 0;
+    raw_bytes_[DDIR_UPLOAD] = raw_bytes_[DDIR_DOWNLOAD] = 0;
 }
 
 
@@ -118,6 +120,22 @@ void ContentTransfer::GarbageCollectChannels()
 }
 
 
+void ContentTransfer::ReopenChannel(evutil_socket_t sock, const Address &addr)
+{
+    reopen_.push_back(std::make_pair(sock,addr));
+}
+
+
+void ContentTransfer::ReopenChannels()
+{
+    for (int i=0; i<reopen_.size(); i++) {
+        dprintf("%s F%d content reopen chan %s\n",tintstr(),td_,reopen_[i].second.str().c_str());
+        new Channel(this,reopen_[i].first,reopen_[i].second);
+    }
+    reopen_.clear();
+}
+
+
 
 
 
@@ -148,10 +166,16 @@ void ContentTransfer::LibeventGlobalCleanCallback(int fd, short event, void *arg
         ct->OnRecvNoData();
         ct->OnSendNoData();
 
+        // WRITEBUF
+        if (ct->GetStorage() != NULL)
+            (void)ct->GetStorage()->FlushIfDue();
+
 
         // Arno: Call garage collect only once every CHANNEL_GARBAGECOLLECT_INTERVAL
         if ((ContentTransfer::cleancounter % CHANNEL_GARBAGECOLLECT_INTERVAL) == 0)
             ct->GarbageCollectChannels();
+        // CHUNK64
+        ct->ReopenChannels();
 
         // Some external trackers need periodic reports
         if (ct->ext_tracker_client_ != NULL) {
@@ -424,6 +448,17 @@ uint32_t ContentTransfer::GetNumSeeders()
     return count;
 }
 
+void ContentTransfer::SetTracing(bool enable)
+{
+    tracing_ = enable;
+    channels_t::iterator iter;
+    for (iter=mychannels_.begin(); iter!=mychannels_.end(); iter++) {
+        Channel *c = *iter;
+        if (c != NULL)
+            c->SetTracing(enable);
+    }
+}
+
 void ContentTransfer::AddPeer(Address &peer)
 {
     Channel *c = new Channel(this,INVALID_SOCKET,peer);
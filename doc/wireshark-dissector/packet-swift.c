@@ -29,15 +29,60 @@
 #endif
 
 #include <epan/packet.h>
+#include <epan/conversation.h>
+#include <epan/prefs.h>
+#include <epan/emem.h>
 
 static int proto_swift = -1;
 
+/* PPSPP handshake protocol options */
+#define POPT_VERSION            0
+#define POPT_MIN_VERSION        1
+#define POPT_SWARMID            2
+#define POPT_CONT_INT_PROT      3
+#define POPT_MERKLE_HASH_FUNC   4
+#define POPT_LIVE_SIG_ALG       5
+#define POPT_CHUNK_ADDR         6
+#define POPT_LIVE_DISC_WND      7
+#define POPT_SUPP_MSGS          8
+#define POPT_END                255
+
+/* Chunk addressing methods (POPT_CHUNK_ADDR) */
+#define CHUNK_ADDR_BIN32        0
+#define CHUNK_ADDR_BYTE64       1
+#define CHUNK_ADDR_CHUNK32      2
+#define CHUNK_ADDR_BIN64        3
+#define CHUNK_ADDR_CHUNK64      4
+
+/* Chunk addressing assumed until a PPSPP handshake says otherwise */
+static gint swift_default_chunk_addr = CHUNK_ADDR_BIN32;
+
+/* Chunk addressing announced by each side of a conversation */
+typedef struct _swift_conv_t {
+    address     addr1;
+    guint32     port1;
+    gint        chunk_addr1;    /* used by addr1:port1 */
+    gint        chunk_addr2;    /* used by the other side */
+} swift_conv_t;
+
 /* Global fields */
 static int hf_swift_receiving_channel = -1;
 static int hf_swift_message_type = -1;
 
 /* 00 Handshake fields */
 static int hf_swift_handshake_channel = -1;
+static int hf_swift_handshake_option = -1;
+static int hf_swift_handshake_option_value = -1;
+static int hf_swift_handshake_chunk_addr = -1;
+
+/* Chunk address fields for other than 32-bit bins */
+static int hf_swift_bin64 = -1;
+static int hf_swift_chunk32_start = -1;
+static int hf_swift_chunk32_end = -1;
+static int hf_swift_chunk64_start = -1;
+static int hf_swift_chunk64_end = -1;
+static int hf_swift_byte64_start = -1;
+static int hf_swift_byte64_end = -1;
 
 /* 01 Data fields */
 static int hf_swift_data_bin_id = -1;
@@ -90,6 +135,38 @@ static const value_string message_type_names[] = {
     { 0, NULL}
 };
 
+static const value_string handshake_option_names[] = {
+    { POPT_VERSION, "Version" },
+    { POPT_MIN_VERSION, "Minimum Version" },
+    { POPT_SWARMID, "Swarm ID" },
+    { POPT_CONT_INT_PROT, "Content Integrity Protection Method" },
+    { POPT_MERKLE_HASH_FUNC, "Merkle Hash Function" },
+    { POPT_LIVE_SIG_ALG, "Live Signature Algorithm" },
+    { POPT_CHUNK_ADDR, "Chunk Addressing Method" },
+    { POPT_LIVE_DISC_WND, "Live Discard Window" },
+    { POPT_SUPP_MSGS, "Supported Messages" },
+    { POPT_END, "End" },
+    { 0, NULL}
+};
+
+static const value_string chunk_addr_names[] = {
+    { CHUNK_ADDR_BIN32, "32-bit bins" },
+    { CHUNK_ADDR_BYTE64, "64-bit byte ranges" },
+    { CHUNK_ADDR_CHUNK32, "32-bit chunk ranges" },
+    { CHUNK_ADDR_BIN64, "64-bit bins" },
+    { CHUNK_ADDR_CHUNK64, "64-bit chunk ranges" },
+    { 0, NULL}
+};
+
+static const enum_val_t chunk_addr_prefs[] = {
+    { "bin32", "32-bit bins", CHUNK_ADDR_BIN32 },
+    { "byte64", "64-bit byte ranges", CHUNK_ADDR_BYTE64 },
+    { "chunk32", "32-bit chunk ranges", CHUNK_ADDR_CHUNK32 },
+    { "bin64", "64-bit bins", CHUNK_ADDR_BIN64 },
+    { "chunk64", "64-bit chunk ranges", CHUNK_ADDR_CHUNK64 },
+    { NULL, NULL, 0 }
+};
+
 
 void
 proto_register_swift(void)
@@ -126,6 +203,99 @@ proto_register_swift(void)
             }
         },
 
+        {
+            &hf_swift_handshake_option,
+            {
+                "Handshake Option", "swift.handshake.option",
+                FT_UINT8, BASE_DEC,
+                VALS(handshake_option_names), 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_handshake_option_value,
+            {
+                "Option Value", "swift.handshake.option_value",
+                FT_BYTES, BASE_NONE,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_handshake_chunk_addr,
+            {
+                "Chunk Addressing Method", "swift.handshake.chunk_addr",
+                FT_UINT8, BASE_DEC,
+                VALS(chunk_addr_names), 0x0,
+                NULL, HFILL
+            }
+        },
+
+        /* Chunk addresses */
+        {
+            &hf_swift_bin64,
+            {
+                "Bin ID", "swift.bin64",
+                FT_UINT64, BASE_HEX,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_chunk32_start,
+            {
+                "Start Chunk", "swift.chunk32.start",
+                FT_UINT32, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_chunk32_end,
+            {
+                "End Chunk", "swift.chunk32.end",
+                FT_UINT32, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_chunk64_start,
+            {
+                "Start Chunk", "swift.chunk64.start",
+                FT_UINT64, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_chunk64_end,
+            {
+                "End Chunk", "swift.chunk64.end",
+                FT_UINT64, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_byte64_start,
+            {
+                "Start Byte", "swift.byte64.start",
+                FT_UINT64, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+        {
+            &hf_swift_byte64_end,
+            {
+                "End Byte", "swift.byte64.end",
+                FT_UINT64, BASE_DEC,
+                NULL, 0x0,
+                NULL, HFILL
+            }
+        },
+
         /* 01 Data */
         {
             &hf_swift_data_bin_id,
@@ -282,6 +452,7 @@ proto_register_swift(void)
     static gint *ett[] = {
         &ett_swift
     };
+    module_t *swift_module;
 
     proto_swift = proto_register_protocol(
                       "swift: the multiparty transport protocol", /* name       */
@@ -292,6 +463,12 @@ proto_register_swift(void)
     proto_register_field_array(proto_swift, hf, array_length(hf));
     proto_register_subtree_array(ett, array_length(ett));
     register_dissector("swift", dissect_swift, proto_swift);
+
+    swift_module = prefs_register_protocol(proto_swift, NULL);
+    prefs_register_enum_preference(swift_module, "chunk_addr",
+                                   "Default chunk addressing method",
+                                   "Chunk addressing assumed when no PPSPP handshake was seen",
+                                   &swift_default_chunk_addr, chunk_addr_prefs, FALSE);
 }
 
 void
@@ -326,15 +503,127 @@ dissect_swift_heur(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
     return TRUE;
 }
 
+/* Returns the per conversation state, creating it if needed */
+static swift_conv_t *
+get_swift_conv(packet_info *pinfo)
+{
+    conversation_t *conversation;
+    swift_conv_t *conv;
+
+    conversation = find_conversation(pinfo->fd->num, &pinfo->src, &pinfo->dst,
+                                     pinfo->ptype, pinfo->srcport, pinfo->destport, 0);
+    if (conversation == NULL)
+        conversation = conversation_new(pinfo->fd->num, &pinfo->src, &pinfo->dst,
+                                        pinfo->ptype, pinfo->srcport, pinfo->destport, 0);
+
+    conv = (swift_conv_t *)conversation_get_proto_data(conversation, proto_swift);
+    if (conv == NULL) {
+        conv = se_alloc(sizeof(swift_conv_t));
+        SE_COPY_ADDRESS(&conv->addr1, &pinfo->src);
+        conv->port1 = pinfo->srcport;
+        conv->chunk_addr1 = swift_default_chunk_addr;
+        conv->chunk_addr2 = swift_default_chunk_addr;
+        conversation_add_proto_data(conversation, proto_swift, conv);
+    }
+    return conv;
+}
+
+/* Chunk addressing used by the sender of this packet */
+static gint *
+get_sender_chunk_addr(swift_conv_t *conv, packet_info *pinfo)
+{
+    if (ADDRESSES_EQUAL(&conv->addr1, &pinfo->src) && conv->port1 == pinfo->srcport)
+        return &conv->chunk_addr1;
+    return &conv->chunk_addr2;
+}
+
+/* Adds a chunk address in the given method, returns the new offset */
+static gint
+dissect_swift_chunk_addr(tvbuff_t *tvb, proto_tree *tree, gint offset, int hf_bin32, gint chunk_addr)
+{
+    switch (chunk_addr) {
+    case CHUNK_ADDR_BYTE64:
+        proto_tree_add_item(tree, hf_swift_byte64_start, tvb, offset, 8, FALSE);
+        proto_tree_add_item(tree, hf_swift_byte64_end, tvb, offset+8, 8, FALSE);
+        return offset + 16;
+    case CHUNK_ADDR_CHUNK32:
+        proto_tree_add_item(tree, hf_swift_chunk32_start, tvb, offset, 4, FALSE);
+        proto_tree_add_item(tree, hf_swift_chunk32_end, tvb, offset+4, 4, FALSE);
+        return offset + 8;
+    case CHUNK_ADDR_BIN64:
+        proto_tree_add_item(tree, hf_swift_bin64, tvb, offset, 8, FALSE);
+        return offset + 8;
+    case CHUNK_ADDR_CHUNK64:
+        proto_tree_add_item(tree, hf_swift_chunk64_start, tvb, offset, 8, FALSE);
+        proto_tree_add_item(tree, hf_swift_chunk64_end, tvb, offset+8, 8, FALSE);
+        return offset + 16;
+    default:
+        proto_tree_add_item(tree, hf_bin32, tvb, offset, 4, FALSE);
+        return offset + 4;
+    }
+}
+
+/* Adds the PPSPP handshake options, if any, and learns the sender's chunk
+ * addressing method from them. Returns the new offset. */
+static gint
+dissect_swift_handshake_options(tvbuff_t *tvb, proto_tree *tree, gint offset, gint *chunk_addr)
+{
+    /* Legacy swift handshakes have no options */
+    if (!tvb_bytes_exist(tvb, offset, 2) || tvb_get_guint8(tvb, offset) != POPT_VERSION
+            || tvb_get_guint8(tvb, offset+1) != 1)
+        return offset;
+
+    while (tvb_bytes_exist(tvb, offset, 1)) {
+        guint8 option;
+        guint len;
+        option = tvb_get_guint8(tvb, offset);
+        proto_tree_add_item(tree, hf_swift_handshake_option, tvb, offset, 1, FALSE);
+        offset += 1;
+
+        switch (option) {
+        case POPT_END:
+            return offset;
+        case POPT_SWARMID:
+            len = 2 + tvb_get_ntohs(tvb, offset);
+            break;
+        case POPT_CHUNK_ADDR:
+            proto_tree_add_item(tree, hf_swift_handshake_chunk_addr, tvb, offset, 1, FALSE);
+            *chunk_addr = tvb_get_guint8(tvb, offset);
+            offset += 1;
+            continue;
+        case POPT_LIVE_DISC_WND:
+            if (*chunk_addr == CHUNK_ADDR_BIN32 || *chunk_addr == CHUNK_ADDR_CHUNK32)
+                len = 4;
+            else
+                len = 8;
+            break;
+        case POPT_SUPP_MSGS:
+            len = 1 + tvb_get_guint8(tvb, offset);
+            break;
+        default:
+            len = 1;
+            break;
+        }
+        proto_tree_add_item(tree, hf_swift_handshake_option_value, tvb, offset, len, FALSE);
+        offset += len;
+    }
+    return offset;
+}
+
 static void
 dissect_swift(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
 {
     gint offset = 0;
+    gint *chunk_addr;
     col_set_str(pinfo->cinfo, COL_PROTOCOL, "swift");
     /* Clear out stuff in the info column */
     col_clear(pinfo->cinfo,COL_INFO);
 
-    if (tree) { /* we are being asked for details */
+    chunk_addr = get_sender_chunk_addr(get_swift_conv(pinfo), pinfo);
+
+    /* Not only when asked for details, as handshakes tell how to parse
+       later packets */
+    {
         proto_item *ti;
         ti = proto_tree_add_item(tree, proto_swift, tvb, 0, -1, FALSE);
 
@@ -368,28 +657,25 @@ dissect_swift(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
             case 0: /* Handshake */
                 proto_tree_add_item(swift_tree, hf_swift_handshake_channel, tvb, offset, 4, FALSE);
                 offset += 4;
+                offset = dissect_swift_handshake_options(tvb, swift_tree, offset, chunk_addr);
                 break;
             case 1: /* Data */
-                proto_tree_add_item(swift_tree, hf_swift_data_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_data_bin_id, *chunk_addr);
                 /* We assume that the data field comprises the rest of this packet */
                 dat_len = tvb_length(tvb) - offset;
                 proto_tree_add_item(swift_tree, hf_swift_data_payload, tvb, offset, dat_len, FALSE);
                 offset += dat_len;
                 break;
             case 2: /* Ack */
-                proto_tree_add_item(swift_tree, hf_swift_ack_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_ack_bin_id, *chunk_addr);
                 proto_tree_add_item(swift_tree, hf_swift_ack_timestamp, tvb, offset, 8, FALSE);
                 offset += 8;
                 break;
             case 3: /* Have */
-                proto_tree_add_item(swift_tree, hf_swift_have_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_have_bin_id, *chunk_addr);
                 break;
             case 4: /* Hash */
-                proto_tree_add_item(swift_tree, hf_swift_hash_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_hash_bin_id, *chunk_addr);
                 proto_tree_add_item(swift_tree, hf_swift_hash_value, tvb, offset, 20, FALSE);
                 offset += 20;
                 break;
@@ -406,8 +692,7 @@ dissect_swift(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
                 offset += 2;
                 break;
             case 7: /* Signed Hash */
-                proto_tree_add_item(swift_tree, hf_swift_signed_hash_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_signed_hash_bin_id, *chunk_addr);
                 proto_tree_add_item(swift_tree, hf_swift_signed_hash_value, tvb, offset, 20, FALSE);
                 offset += 20;
                 /* It is not entirely clear what size the public key will be, so we allow any size
@@ -417,8 +702,7 @@ dissect_swift(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
                 offset += dat_len;
                 break;
             case 8: /* Hint */
-                proto_tree_add_item(swift_tree, hf_swift_hint_bin_id, tvb, offset, 4, FALSE);
-                offset += 4;
+                offset = dissect_swift_chunk_addr(tvb, swift_tree, offset, hf_swift_hint_bin_id, *chunk_addr);
                 break;
             case 9: /* SWIFT_MSGTYPE_RCVD */
                 break;
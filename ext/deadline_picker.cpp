@@ -0,0 +1,312 @@
+/*
+ *  deadline_picker.cpp
+ *  swift
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+
+#include "swift.h"
+#include <cassert>
+
+using namespace swift;
+
+/**
+ * Picks pieces in VoD fashion by playback deadline. Every chunk ahead of
+ * the playback position is due when the player will reach it at the
+ * content bitrate. Chunks due within SWIFT_VOD_DEADLINE_WINDOW_TIME are
+ * requested in order from the peers that can deliver them in time, the
+ * rest rarest first. Chunks about to miss their deadline are requested a
+ * second time from another peer (endgame).
+ *
+ * The playback position and bitrate are fed by the HTTP gateway via
+ * Seek() and SetBitrate(). Until a position is known this is a plain
+ * rarest-first picker.
+ *
+ * PREFETCH: The HTTP gateway may also set ranges it expects to be
+ * requested next. These are picked in order after the deadline window.
+ * */
+class DeadlinePiecePicker : public RFPiecePicker
+{
+    struct deadline_hint_t {
+        bin_t       bin;
+        uint32_t    channelid;
+        tint        time;
+        tint        arrival;    // estimated arrival when requested
+        bool        dup;        // requested a second time
+    };
+    typedef std::map<bin_t::uint_t,deadline_hint_t> DeadlineHintMapType;
+
+    struct peer_rate_t {
+        uint64_t    bytes_down0;
+        tint        since;
+        double      rate;       // bytes/s, -1 = not measured yet
+    };
+    typedef std::map<uint32_t,peer_rate_t> PeerRateMapType;
+
+    bool            playing_;           // playback position known
+    bin_t::uint_t   playback_chunk_;    // next chunk the player needs
+    double          bitrate_;           // set by SetBitrate(), 0 = unknown
+    double          measured_rate_;     // consumption rate from Seek()
+    bin_t::uint_t   rate_chunk0_;
+    tint            rate_time0_;
+    DeadlineHintMapType deadline_hints_;
+    PeerRateMapType peer_rates_;
+    binvector       prefetch_;
+
+public:
+
+    DeadlinePiecePicker(FileTransfer* file_to_pick_from) : RFPiecePicker(file_to_pick_from),
+        playing_(false), playback_chunk_(0), bitrate_(0.0), measured_rate_(0.0), rate_chunk0_(0),
+        rate_time0_(0) {
+    }
+
+    virtual ~DeadlinePiecePicker() {}
+
+    virtual bin_t Pick(binmap_t& offer, uint64_t max_width, tint expires, uint32_t channelid) {
+        if ((!playing_ && prefetch_.size() == 0) || !hashtree()->size())
+            return RFPiecePicker::Pick(offer,max_width,expires,channelid);
+
+        // delete outdated hints
+        while (hint_out_.size() && hint_out_.front().time<NOW-TINT_SEC*PICKER_TIMEOUT) { // FIXME sec
+            binmap_t::copy(ack_hint_out_, *(hashtree()->ack_out()), hint_out_.front().bin);
+            hint_out_.pop_front();
+        }
+        PruneDeadlineHints();
+
+        bin_t hint = bin_t::NONE;
+        tint arrival = EstimateArrival(channelid);
+        if (playing_ && arrival != TINT_NEVER) {
+            hint = PickEndgame(offer,max_width,channelid,arrival);
+            if (hint != bin_t::NONE) {
+                deadline_hints_[hint.base_offset()].dup = true;
+            } else {
+                hint = PickByDeadline(offer,max_width,channelid,arrival);
+                if (hint != bin_t::NONE) {
+                    deadline_hint_t &dh = deadline_hints_[hint.base_offset()];
+                    dh.bin = hint;
+                    dh.channelid = channelid;
+                    dh.time = NOW;
+                    dh.arrival = arrival;
+                    dh.dup = false;
+                }
+            }
+        }
+        if (hint == bin_t::NONE)
+            hint = PickPrefetch(offer,max_width);
+        if (hint == bin_t::NONE)
+            return RFPiecePicker::Pick(offer,max_width,expires,channelid);
+
+        ack_hint_out_.set(hint);
+        hint_out_.push_back(tintbin(NOW,hint));
+        return hint;
+    }
+
+    virtual int Seek(bin_t offbin, int whence) {
+        if (whence != SEEK_SET && whence != SEEK_CUR)
+            return -1;
+
+        bin_t::uint_t chunk = offbin.base_offset();
+        if (whence == SEEK_CUR && playing_ && chunk >= rate_chunk0_ && chunk > 0 &&
+                hashtree()->ack_out()->is_filled(bin_t(0,chunk-1))) {
+            // Player consumed up to here, update the consumption rate
+            if (NOW-rate_time0_ >= TINT_SEC) {
+                double sample = (double)((chunk-rate_chunk0_)*hashtree()->chunk_size()) *TINT_SEC / (NOW-rate_time0_);
+                if (measured_rate_ == 0.0)
+                    measured_rate_ = sample;
+                else
+                    measured_rate_ = 0.75*measured_rate_ + 0.25*sample;
+                rate_chunk0_ = chunk;
+                rate_time0_ = NOW;
+            }
+        } else {
+            // Jump, restart rate measurement from here
+            rate_chunk0_ = chunk;
+            rate_time0_ = NOW;
+        }
+        playback_chunk_ = chunk;
+        playing_ = true;
+        return 0;
+    }
+
+    virtual void SetBitrate(double bytespersec) {
+        bitrate_ = bytespersec;
+    }
+
+    virtual void SetPrefetch(binvector &ranges) {
+        prefetch_ = ranges;
+    }
+
+protected:
+
+    /** Playback rate in bytes/s used to compute deadlines */
+    double PlaybackRate() {
+        if (bitrate_ > 0.0)
+            return bitrate_;
+        if (measured_rate_ > 0.0)
+            return measured_rate_;
+        return SWIFT_VOD_DEFAULT_BITRATE;
+    }
+
+    /** Time at which the player will need chunk */
+    tint DueTime(bin_t::uint_t chunk) {
+        if (chunk <= playback_chunk_)
+            return NOW;
+        double secs = (double)((chunk-playback_chunk_)*hashtree()->chunk_size()) / PlaybackRate();
+        return NOW + (tint)(secs*TINT_SEC);
+    }
+
+    /** Inverse of DueTime: first chunk the player will need at t or later */
+    bin_t::uint_t ChunkDueAt(tint t) {
+        if (t <= NOW)
+            return playback_chunk_;
+        double secs = (double)(t-NOW)/TINT_SEC;
+        return playback_chunk_ + (bin_t::uint_t)(secs*PlaybackRate()/hashtree()->chunk_size());
+    }
+
+    /** Estimated time at which a chunk requested from the peer on channelid
+     * now would arrive: one round trip plus draining the requests already
+     * outstanding at the peer's measured download rate. */
+    tint EstimateArrival(uint32_t channelid) {
+        Channel *c = Channel::channel(channelid);
+        if (c == NULL)
+            return TINT_NEVER;
+
+        PeerRateMapType::iterator iter = peer_rates_.find(channelid);
+        if (iter == peer_rates_.end()) {
+            peer_rate_t pr;
+            pr.bytes_down0 = c->bytes_down();
+            pr.since = NOW;
+            pr.rate = -1.0;
+            iter = peer_rates_.insert(std::make_pair(channelid,pr)).first;
+        }
+        peer_rate_t &pr = iter->second;
+        if (NOW-pr.since >= TINT_SEC) {
+            double sample = (double)(c->bytes_down()-pr.bytes_down0)*TINT_SEC / (NOW-pr.since);
+            if (pr.rate < 0.0)
+                pr.rate = sample;
+            else
+                pr.rate = 0.75*pr.rate + 0.25*sample;
+            pr.bytes_down0 = c->bytes_down();
+            pr.since = NOW;
+        }
+
+        tint arrival = NOW + c->rtt_avg();
+        if (pr.rate > 0.0) {
+            double queued = (double)((c->GetHintSize(DDIR_DOWNLOAD)+1)*hashtree()->chunk_size());
+            arrival += (tint)(queued/pr.rate*TINT_SEC);
+        } else if (pr.rate == 0.0 && c->GetHintSize(DDIR_DOWNLOAD) > 0) {
+            // Asked but delivered nothing, assume it won't before the picker timeout
+            arrival += TINT_SEC*PICKER_TIMEOUT;
+        }
+        return arrival;
+    }
+
+    /** Earliest estimated arrival over the other channels of this transfer */
+    tint BestOtherArrival(uint32_t channelid) {
+        tint best = TINT_NEVER;
+        channels_t *channels = transfer_->GetChannels();
+        channels_t::iterator iter;
+        for (iter=channels->begin(); iter!=channels->end(); iter++) {
+            Channel *c = *iter;
+            if (c == NULL || c->id() == channelid || !c->is_established())
+                continue;
+            tint arrival = EstimateArrival(c->id());
+            if (arrival < best)
+                best = arrival;
+        }
+        return best;
+    }
+
+    /** Returns the first chunks in the deadline window this peer offers and
+     * nobody was asked for. Chunks due before this peer could deliver them
+     * are left to faster peers. */
+    bin_t PickByDeadline(binmap_t& offer, uint64_t max_width, uint32_t channelid, tint arrival) {
+        bin_t::uint_t start = playback_chunk_;
+        bin_t::uint_t end = ChunkDueAt(NOW+SWIFT_VOD_DEADLINE_WINDOW_TIME*TINT_SEC);
+        if (end >= hashtree()->size_in_chunks())
+            end = hashtree()->size_in_chunks()-1;
+
+        if (arrival > NOW && arrival >= BestOtherArrival(channelid))
+            start = std::max(start,ChunkDueAt(arrival));
+
+        bin_t::uint_t cur = start;
+        while (cur <= end) {
+            // Largest aligned bin starting at cur that fits in the window
+            bin_t range(0,cur);
+            while (range.parent().base_offset() == cur && range.parent().base_offset()+range.parent().base_length()-1 <= end)
+                range.to_parent();
+
+            bin_t hint = binmap_t::find_complement(ack_hint_out_, offer, range, 0);
+            if (!hint.is_none()) {
+                while (hint.base_length()>max_width && !hint.is_base())
+                    hint.to_left();
+                return hint;
+            }
+            cur = range.base_offset()+range.base_length();
+        }
+        return bin_t::NONE;
+    }
+
+    /** Returns the first chunks of the prefetch ranges this peer offers and
+     * nobody was asked for. Ranges are tried in the order given. */
+    bin_t PickPrefetch(binmap_t& offer, uint64_t max_width) {
+        binvector::iterator iter;
+        for (iter=prefetch_.begin(); iter!=prefetch_.end(); iter++) {
+            bin_t hint = binmap_t::find_complement(ack_hint_out_, offer, *iter, 0);
+            if (!hint.is_none()) {
+                while (hint.base_length()>max_width && !hint.is_base())
+                    hint.to_left();
+                return hint;
+            }
+        }
+        return bin_t::NONE;
+    }
+
+    /** Returns a chunk due within SWIFT_VOD_DEADLINE_ENDGAME_TIME that was
+     * requested from another peer and will likely be late, if this peer
+     * can deliver it in time. */
+    bin_t PickEndgame(binmap_t& offer, uint64_t max_width, uint32_t channelid, tint arrival) {
+        tint endgame = NOW + SWIFT_VOD_DEADLINE_ENDGAME_TIME*TINT_SEC;
+
+        DeadlineHintMapType::iterator iter;
+        for (iter=deadline_hints_.begin(); iter!=deadline_hints_.end(); iter++) {
+            deadline_hint_t &dh = iter->second;
+            tint due = DueTime(dh.bin.base_offset());
+            if (due > endgame)
+                break;
+            if (dh.dup || dh.channelid == channelid || arrival > due)
+                continue;
+            // At risk: overdue, or not expected in time when requested
+            if (dh.arrival > NOW && dh.arrival <= due)
+                continue;
+            if (!offer.is_filled(dh.bin) || !hashtree()->ack_out()->is_empty(dh.bin))
+                continue;
+            if (dh.bin.base_length() > max_width)
+                continue;
+            return dh.bin;
+        }
+        return bin_t::NONE;
+    }
+
+    /** Forgets deadline hints that were received, timed out or played */
+    void PruneDeadlineHints() {
+        DeadlineHintMapType::iterator iter = deadline_hints_.begin();
+        while (iter != deadline_hints_.end()) {
+            deadline_hint_t &dh = iter->second;
+            if (dh.time < NOW-TINT_SEC*PICKER_TIMEOUT || hashtree()->ack_out()->is_filled(dh.bin) ||
+                    dh.bin.base_offset()+dh.bin.base_length() <= playback_chunk_)
+                deadline_hints_.erase(iter++);
+            else
+                iter++;
+        }
+
+        PeerRateMapType::iterator piter = peer_rates_.begin();
+        while (piter != peer_rates_.end()) {
+            if (Channel::channel(piter->first) == NULL)
+                peer_rates_.erase(piter++);
+            else
+                piter++;
+        }
+    }
+};
@@ -14,14 +14,30 @@
 #include "swift.h"
 #include <cassert>
 #include <map>
+#include <algorithm>
 
 using namespace swift;
 
 #define LIVE_PP_MIN_BITRATE_MEASUREMENT_INTERVAL    10 // seconds
 
+// Minimal source time between munros to estimate the stream rate for hook-in
+#define LIVE_PP_MIN_RATE_MEASUREMENT_INTERVAL       (TINT_SEC/4)
+// Minimal time a peer must have been sending to us to use its measured throughput
+#define LIVE_PP_MIN_THROUGHPUT_MEASUREMENT_INTERVAL TINT_SEC
+// Cap on the RTTs of slow start assumed for a peer without measured throughput
+#define LIVE_PP_MAX_SLOWSTART_ROUNDS                16
+
+
+/** Last munro of a peer, and its download counter when first seen */
+struct peer_munro_t {
+    bin_t       munro;
+    tint        sourcet;
+    tint        since;          // local time of first munro from peer
+    uint64_t    bytes_down0;    // Channel::bytes_down() at since
+};
 
 // Map to store the highest chunk each peer has, used for hooking in.
-typedef std::map<uint32_t, bin_t> PeerPosMapType;
+typedef std::map<uint32_t, peer_munro_t> PeerPosMapType;
 
 
 /** Picks pieces nearly sequentially after hook-in point */
@@ -42,6 +58,16 @@ protected:
     tint        hookin_tint_;   // Timestamp of *munro* off which hook-in was calculated
     bin_t           current_bin_;   // Current pos, not yet received
 
+    // HOOKIN
+    PeerPosMapType  peer_munros_;       // Last munro per channel
+    bin_t           oldest_munro_bin_;  // Munro with lowest source timestamp seen
+    tint            oldest_munro_tint_;
+    tint            first_munro_time_;  // Local time of first munro
+    livepp_stats_t  stats_;
+    tint            stall_start_;       // Start of current stall, 0 = playing
+    uint64_t        stall_chunk_;       // Chunk the player is waiting for
+    tint            play_stall_time_;   // Time stalled since playout started
+
 public:
 
     SimpleLivePiecePicker(LiveTransfer* trans_to_pick_from) :
@@ -49,8 +75,12 @@ public:
         twist_(0), search4hookin_(true),
         last_munro_bin_(bin_t::NONE), last_munro_tint_(0),
         hookin_bin_(bin_t::NONE), hookin_tint_(0),
-        current_bin_(bin_t::NONE) {
+        current_bin_(bin_t::NONE),
+        oldest_munro_bin_(bin_t::NONE), oldest_munro_tint_(0), first_munro_time_(0),
+        stats_(), stall_start_(0), stall_chunk_(0), play_stall_time_(0) {
         binmap_t::copy(ack_hint_out_, *(transfer_->ack_out()));
+        stats_.open_time = NOW;
+        stats_.hookin_bin = bin_t::NONE;
     }
     virtual ~SimpleLivePiecePicker() {}
 
@@ -66,8 +96,14 @@ public:
     }
 
     virtual bin_t Pick(binmap_t& offer, uint64_t max_width, tint expires, uint32_t channelid) {
-        if (search4hookin_)
-            return bin_t::NONE;
+        if (search4hookin_) {
+            // Waiting for more munros, see if we waited long enough
+            if (first_munro_time_ == 0)
+                return bin_t::NONE;
+            Hookin();
+            if (search4hookin_)
+                return bin_t::NONE;
+        }
 
         while (hint_out_.size() && hint_out_.front().time<NOW-TINT_SEC*PICKER_TIMEOUT) { // FIXME sec
             binmap_t::copy(ack_hint_out_, *(transfer_->ack_out()), hint_out_.front().bin);
@@ -81,6 +117,7 @@ public:
             //fprintf(stderr,"live: pp: new cur is %s\n", current_bin_.str().c_str() );
         }
         //dprintf("live: pp: new cur end\n" );
+        UpdatePlayout();
 
         // Request next from this peer, if not already requested
         bin_t hint = PickLargestBin(offer,current_bin_);
@@ -129,7 +166,7 @@ public:
     }
 
 
-    void AddPeerMunro(bin_t munro, tint sourcet) {
+    void AddPeerMunro(bin_t munro, tint sourcet, uint32_t channelid) {
         //fprintf(stderr,"live: pp: AddPeerMunro: munro %s\n", munro.str().c_str());
 
         // Source has advanced
@@ -137,6 +174,28 @@ public:
             last_munro_bin_ = munro;
             last_munro_tint_ = sourcet;
         }
+        // HOOKIN: keep the oldest munro to estimate the stream rate from
+        if (oldest_munro_bin_ == bin_t::NONE || sourcet < oldest_munro_tint_) {
+            oldest_munro_bin_ = munro;
+            oldest_munro_tint_ = sourcet;
+        }
+        if (first_munro_time_ == 0)
+            first_munro_time_ = NOW;
+
+        PeerPosMapType::iterator iter = peer_munros_.find(channelid);
+        if (iter == peer_munros_.end()) {
+            peer_munro_t pm;
+            Channel *c = Channel::channel(channelid);
+            pm.munro = bin_t::NONE;
+            pm.sourcet = 0;
+            pm.since = NOW;
+            pm.bytes_down0 = (c != NULL) ? c->bytes_down() : 0;
+            iter = peer_munros_.insert(std::make_pair(channelid,pm)).first;
+        }
+        if (iter->second.munro == bin_t::NONE || sourcet >= iter->second.sourcet) {
+            iter->second.munro = munro;
+            iter->second.sourcet = sourcet;
+        }
 
         if (!search4hookin_) {
             // Already hooked in, check for too much divergence from source
@@ -146,6 +205,13 @@ public:
         }
 
         // First time hook-in, or diverging
+        Hookin();
+    }
+
+
+    /** Executes the first hook-in, or a re-hook-in when lagging, if a
+     * position can be chosen yet. */
+    void Hookin() {
         bin_t candbin = CalculateHookinPos();
         if (candbin != bin_t::NONE) {
             hookin_bin_ = candbin;
@@ -153,6 +219,14 @@ public:
             hookin_tint_ = last_munro_tint_;
             search4hookin_ = false;
             fprintf(stderr,"live: pp: Execute hook-in on %s\n", hookin_bin_.str().c_str());
+
+            // Restart the virtual player
+            EndStall();
+            stats_.hookin_time = NOW;
+            stats_.hookin_bin = hookin_bin_;
+            stats_.play_time = 0;
+            stats_.nhookins++;
+            play_stall_time_ = 0;
         }
     }
 
@@ -200,16 +274,171 @@ public:
 
 
     bin_t CalculateHookinPos() {
-        /* If you want more prebuffering, you should substract a few seconds worth
-         * of chunks from last_munro_bin_. Be sure to check if they are
-         * actually available from peers (e.g. case where source just started)
-         */
+        bin_t candbin = CalculateAdaptiveHookinPos();
+        if (candbin != bin_t::NONE)
+            return candbin;
+
+        // No stream rate known yet. Wait a bit for munros from more peers or
+        // the next epoch, unless there are no peers to download from anyway.
+        if (first_munro_time_+SWIFT_LIVE_HOOKIN_MAX_WAIT > NOW && HavePeerThroughput())
+            return bin_t::NONE;
 
         // Return base start of munro subtree, this means prebuffering of
         // nchunks_per_sign
         //
+        stats_.prebuf_chunks = last_munro_bin_.base_length();
+        stats_.rate = 0.0;
+        stats_.npeers = peer_munros_.size();
         return last_munro_bin_.base_left();
-        //return bin_t(0,1077);
+    }
+
+
+    /** Chooses the hook-in pos from the distribution of peer munros. The
+     * live edge is the highest munro that peers able to keep up with the
+     * stream have. The prebuffer behind it is SWIFT_LIVE_HOOKIN_PREBUFFER_TIME
+     * worth of chunks, or less if those peers cannot deliver that many within
+     * SWIFT_LIVE_HOOKIN_FILL_TIME. Returns bin_t::NONE if the stream rate or
+     * peer throughput is unknown. */
+    bin_t CalculateAdaptiveHookinPos() {
+        double rate = CalculateChunkRate();
+        if (rate == 0.0)
+            return bin_t::NONE;
+
+        // Edges of peers in sync with the source and how many chunks each
+        // can deliver during the fill, highest edge first.
+        std::vector<std::pair<bin_t::uint_t,double> > edges;
+        PeerPosMapType::iterator iter;
+        for (iter=peer_munros_.begin(); iter!=peer_munros_.end(); iter++) {
+            peer_munro_t &pm = iter->second;
+            if (pm.sourcet+(SWIFT_LIVE_MAX_SOURCE_DIVERGENCE_TIME*TINT_SEC) < last_munro_tint_)
+                continue;
+            double nchunks = EstimatePeerChunks(iter->first,pm,SWIFT_LIVE_HOOKIN_FILL_TIME);
+            if (nchunks > 0.0)
+                edges.push_back(std::make_pair(pm.munro.base_right().layer_offset(),nchunks));
+        }
+        if (edges.size() == 0)
+            return bin_t::NONE;
+        std::sort(edges.rbegin(),edges.rend());
+
+        double keepup = rate*SWIFT_LIVE_HOOKIN_FILL_TIME/TINT_SEC;
+        double deliverable = 0.0;
+        size_t i=0;
+        for (i=0; i<edges.size(); i++) {
+            deliverable += edges[i].second;
+            if (deliverable >= keepup)
+                break;
+        }
+        if (i == edges.size())
+            i = edges.size()-1; // nobody keeps up, take the edge all have
+        bin_t::uint_t edge = edges[i].first;
+
+        uint64_t nchunks = (uint64_t)std::min(rate*SWIFT_LIVE_HOOKIN_PREBUFFER_TIME/TINT_SEC,deliverable);
+        nchunks = std::max(nchunks,(uint64_t)1);
+        uint64_t wnd = transfer_->GetDefaultHandshake().live_disc_wnd_;
+        if (wnd != POPT_LIVE_DISC_WND_ALL)
+            nchunks = std::min(nchunks,std::max(wnd/2,(uint64_t)1)); // peers discard the oldest
+        nchunks = std::min(nchunks,(uint64_t)edge+1);
+
+        stats_.prebuf_chunks = nchunks;
+        stats_.rate = rate;
+        stats_.npeers = i+1;
+        dprintf("%s live: pp: hook-in edge %" PRIu64 " prebuf %" PRIu64 " rate %.1lf peers %" PRIu32 "\n",
+                tintstr(),(uint64_t)edge,nchunks,rate,stats_.npeers);
+        return bin_t(0,edge-nchunks+1);
+    }
+
+
+    /** Returns the stream rate in chunks/s estimated from the munros with
+     * the lowest and highest source timestamp, or 0.0 if unknown. */
+    double CalculateChunkRate() {
+        if (oldest_munro_bin_ == bin_t::NONE
+                || last_munro_tint_ < oldest_munro_tint_+LIVE_PP_MIN_RATE_MEASUREMENT_INTERVAL)
+            return 0.0;
+        bin_t::uint_t lastc = last_munro_bin_.base_right().layer_offset();
+        bin_t::uint_t oldc = oldest_munro_bin_.base_right().layer_offset();
+        if (lastc <= oldc)
+            return 0.0;
+        return (double)(lastc-oldc)*TINT_SEC/(double)(last_munro_tint_-oldest_munro_tint_);
+    }
+
+
+    /** Returns how many chunks the peer on channelid can deliver in interval.
+     * Measured if it has been sending to us long enough, otherwise what slow
+     * start from a window of 1 achieves at the peer's RTT. */
+    virtual double EstimatePeerChunks(uint32_t channelid, peer_munro_t &pm, tint interval) {
+        Channel *c = Channel::channel(channelid);
+        if (c == NULL || c->transfer() != transfer_ || !c->is_established())
+            return 0.0;
+
+        uint64_t bytes = c->bytes_down() - pm.bytes_down0;
+        tint took = NOW - pm.since;
+        if (bytes > 0 && took >= LIVE_PP_MIN_THROUGHPUT_MEASUREMENT_INTERVAL)
+            return (double)bytes/transfer_->chunk_size() * (double)interval/(double)took;
+
+        tint rtt = std::max(c->rtt_avg(),(tint)TINT_MSEC);
+        int rounds = std::min(interval/rtt,(tint)LIVE_PP_MAX_SLOWSTART_ROUNDS);
+        return (double)((1ULL << rounds)-1);
+    }
+
+
+    bool HavePeerThroughput() {
+        PeerPosMapType::iterator iter;
+        for (iter=peer_munros_.begin(); iter!=peer_munros_.end(); iter++) {
+            if (EstimatePeerChunks(iter->first,iter->second,SWIFT_LIVE_HOOKIN_FILL_TIME) > 0.0)
+                return true;
+        }
+        return false;
+    }
+
+
+    /** Advances a virtual player that starts when the prebuffer is filled
+     * and plays at the stream rate. A stall is counted whenever its playhead
+     * reaches current_bin_, i.e., the next chunk was not downloaded in time. */
+    void UpdatePlayout() {
+        if (search4hookin_ || current_bin_ == bin_t::NONE)
+            return;
+
+        uint64_t curc = current_bin_.layer_offset();
+        if (stats_.play_time == 0) {
+            if (curc - hookin_bin_.layer_offset() >= std::max(stats_.prebuf_chunks,(uint64_t)1))
+                stats_.play_time = NOW;
+            return;
+        }
+        if (stall_start_ != 0) {
+            if (curc > stall_chunk_)
+                EndStall();
+            return;
+        }
+
+        if (stats_.rate == 0.0)
+            stats_.rate = CalculateChunkRate();
+        if (stats_.rate == 0.0)
+            return;
+        tint played = NOW - stats_.play_time - play_stall_time_;
+        uint64_t playhead = hookin_bin_.layer_offset() + (uint64_t)(stats_.rate*played/TINT_SEC);
+        if (playhead >= curc) {
+            stall_start_ = NOW;
+            stall_chunk_ = curc;
+            stats_.nstalls++;
+            dprintf("%s live: pp: stall on %s\n", tintstr(), current_bin_.str().c_str());
+        }
+    }
+
+
+    void EndStall() {
+        if (stall_start_ == 0)
+            return;
+        stats_.stall_time += NOW - stall_start_;
+        play_stall_time_ += NOW - stall_start_;
+        stall_start_ = 0;
+    }
+
+
+    void GetStats(livepp_stats_t &stats) {
+        UpdatePlayout();
+        stats = stats_;
+        if (stall_start_ != 0)
+            stats.stall_time += NOW - stall_start_;
     }
 
 
@@ -343,8 +572,13 @@ public:
 
 
     virtual bin_t Pick(binmap_t& offer, uint64_t max_width, tint expires, uint32_t channelid) {
-        if (search4hookin_)
-            return bin_t::NONE;
+        if (search4hookin_) {
+            if (first_munro_time_ == 0)
+                return bin_t::NONE;
+            Hookin();
+            if (search4hookin_)
+                return bin_t::NONE;
+        }
 
         while (hint_out_.size() && hint_out_.front().time<NOW-TINT_SEC*3/2) { // FIXME sec
             binmap_t::copy(ack_hint_out_, *(transfer_->ack_out()), hint_out_.front().bin);
@@ -360,6 +594,7 @@ public:
         }
         same_curbin_count_++;
         //dprintf("live: pp: new cur end\n" );
+        UpdatePlayout();
 
         char priority='H';
         // Request next from this peer, if not already requested
@@ -20,6 +20,7 @@ using namespace swift;
 class RFPiecePicker : public PiecePicker
 {
 
+protected:
     binmap_t        ack_hint_out_;
     tbqueue         hint_out_;
     FileTransfer*   transfer_;
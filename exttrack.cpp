@@ -133,6 +133,7 @@ std::string ExternalTrackerClient::CreateQuery(ContentTransfer *transfer, Addres
     std::ostringstream oss;
 
     oss << "info_hash=";
+    // info_hash is 20 bytes, use a prefix of SHA-256 root hashes
     esc = evhttp_uriencode((const char *)infohash.bytes(),Sha1Hash::SIZE,false);
     if (esc == NULL)
         return "";
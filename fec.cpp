@@ -0,0 +1,157 @@
+/*
+ *  fec.cpp
+ *
+ *  Reed-Solomon erasure code over GF(2^8) with a Cauchy generator matrix.
+ *  Data chunk i has field element i, repair chunk j has field element k+j,
+ *  and the coefficient of data chunk i in repair chunk j is 1/((k+j) ^ i).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ */
+#include "fec.h"
+
+#include <string.h>
+#include <algorithm>
+
+using namespace swift;
+
+// Primitive polynomial x^8+x^4+x^3+x^2+1
+#define FEC_GF_POLY     0x11d
+
+static uint8_t gf_exp[2*256];
+static uint8_t gf_log[256];
+static bool gf_init = false;
+
+
+void FECCodec::InitTables()
+{
+    if (gf_init)
+        return;
+    uint32_t x = 1;
+    for (int i=0; i<255; i++) {
+        gf_exp[i] = (uint8_t)x;
+        gf_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= FEC_GF_POLY;
+    }
+    for (int i=255; i<2*256; i++)
+        gf_exp[i] = gf_exp[i-255];
+    gf_init = true;
+}
+
+
+uint8_t FECCodec::Mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a]+gf_log[b]];
+}
+
+
+uint8_t FECCodec::Inv(uint8_t a)
+{
+    return gf_exp[255-gf_log[a]];
+}
+
+
+uint8_t FECCodec::Coef(uint32_t k, uint32_t j, uint32_t i)
+{
+    return Inv((uint8_t)((k+j) ^ i));
+}
+
+
+void FECCodec::MulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c == 0)
+        return;
+    // One table per call, cheaper than two lookups per byte for chunk sizes
+    uint8_t table[256];
+    for (int v=0; v<256; v++)
+        table[v] = Mul(c,(uint8_t)v);
+    for (size_t b=0; b<len; b++)
+        dst[b] ^= table[src[b]];
+}
+
+
+void FECCodec::Encode(uint32_t k, uint32_t repairidx, const std::vector<const uint8_t *> &data,
+                      uint8_t *repair, size_t len)
+{
+    InitTables();
+    memset(repair,0,len);
+    for (uint32_t i=0; i<k; i++)
+        MulAdd(repair,data[i],Coef(k,repairidx,i),len);
+}
+
+
+bool FECCodec::Decode(uint32_t k, const std::vector<uint8_t *> &data, const std::vector<bool> &present,
+                      const std::vector<uint32_t> &repairidx, const std::vector<const uint8_t *> &repairs,
+                      size_t len)
+{
+    InitTables();
+
+    std::vector<uint32_t> missing;
+    for (uint32_t i=0; i<k; i++) {
+        if (!present[i])
+            missing.push_back(i);
+    }
+    uint32_t e = missing.size();
+    if (e == 0)
+        return true;
+    if (repairs.size() < e)
+        return false;
+
+    // Subtract the present chunks from the first e repairs, leaving a
+    // combination of the missing ones only.
+    std::vector<uint8_t> syndromes(e*len);
+    for (uint32_t r=0; r<e; r++) {
+        uint8_t *s = &syndromes[r*len];
+        memcpy(s,repairs[r],len);
+        for (uint32_t i=0; i<k; i++) {
+            if (present[i])
+                MulAdd(s,data[i],Coef(k,repairidx[r],i),len);
+        }
+    }
+
+    // Invert the e x e Cauchy submatrix by Gauss-Jordan elimination
+    std::vector<uint8_t> a(e*e), inv(e*e,0);
+    for (uint32_t r=0; r<e; r++) {
+        for (uint32_t c=0; c<e; c++)
+            a[r*e+c] = Coef(k,repairidx[r],missing[c]);
+        inv[r*e+r] = 1;
+    }
+    for (uint32_t c=0; c<e; c++) {
+        uint32_t p = c;
+        while (p < e && a[p*e+c] == 0)
+            p++;
+        if (p == e)
+            return false; // duplicate repair chunks
+        if (p != c) {
+            for (uint32_t x=0; x<e; x++) {
+                std::swap(a[p*e+x],a[c*e+x]);
+                std::swap(inv[p*e+x],inv[c*e+x]);
+            }
+        }
+        uint8_t f = Inv(a[c*e+c]);
+        for (uint32_t x=0; x<e; x++) {
+            a[c*e+x] = Mul(a[c*e+x],f);
+            inv[c*e+x] = Mul(inv[c*e+x],f);
+        }
+        for (uint32_t r=0; r<e; r++) {
+            uint8_t g = a[r*e+c];
+            if (r == c || g == 0)
+                continue;
+            for (uint32_t x=0; x<e; x++) {
+                a[r*e+x] ^= Mul(g,a[c*e+x]);
+                inv[r*e+x] ^= Mul(g,inv[c*e+x]);
+            }
+        }
+    }
+
+    for (uint32_t c=0; c<e; c++) {
+        uint8_t *d = data[missing[c]];
+        memset(d,0,len);
+        for (uint32_t r=0; r<e; r++)
+            MulAdd(d,&syndromes[r*len],inv[c*e+r],len);
+    }
+    return true;
+}
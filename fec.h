@@ -0,0 +1,54 @@
+/*
+ *  fec.h
+ *
+ *  Systematic Reed-Solomon erasure code over GF(2^8) for live forward error
+ *  correction. A block of k data chunks is extended with repair chunks, each
+ *  a linear combination of the data chunks with coefficients from a Cauchy
+ *  matrix. Any k of the k data and m repair chunks reconstruct the block,
+ *  since every square submatrix of a Cauchy matrix is invertible.
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ */
+#ifndef SWIFT_FEC_H_
+#define SWIFT_FEC_H_
+
+#include "compat.h"
+#include <vector>
+
+// Maximum number of data plus repair chunks in a block
+#define SWIFT_FEC_MAX_SYMBOLS   255
+
+namespace swift
+{
+
+    class FECCodec
+    {
+    public:
+        /** Computes repair chunk repairidx (0-based) of a block of k data
+         * chunks of len bytes each into repair. Requires
+         * k+repairidx < SWIFT_FEC_MAX_SYMBOLS. */
+        static void Encode(uint32_t k, uint32_t repairidx, const std::vector<const uint8_t *> &data,
+                           uint8_t *repair, size_t len);
+
+        /** Reconstructs the missing data chunks of a block of k chunks.
+         * data[i] points to a buffer of len bytes, holding chunk i if
+         * present[i], and receiving it otherwise. repairidx and repairs are
+         * the received repair chunks. Returns false if too few chunks were
+         * received. */
+        static bool Decode(uint32_t k, const std::vector<uint8_t *> &data, const std::vector<bool> &present,
+                           const std::vector<uint32_t> &repairidx, const std::vector<const uint8_t *> &repairs,
+                           size_t len);
+
+    protected:
+        static uint8_t Mul(uint8_t a, uint8_t b);
+        static uint8_t Inv(uint8_t a);
+        /** Cauchy matrix element for repair chunk j and data chunk i */
+        static uint8_t Coef(uint32_t k, uint32_t j, uint32_t i);
+        /** dst ^= c * src, byte-wise in GF(2^8) */
+        static void MulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+        static void InitTables();
+    };
+
+}
+
+#endif /* SWIFT_FEC_H_ */
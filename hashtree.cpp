@@ -11,6 +11,7 @@
 #include "bin_utils.h"
 //#include <openssl/sha.h>
 #include "sha1.h"
+#include "sha2.h"
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
@@ -31,34 +32,73 @@ void SHA1(const void *data, size_t length, unsigned char *hash)
     blk_SHA1_Final(hash, &ctx);
 }
 
-Sha1Hash::Sha1Hash(const Sha1Hash& left, const Sha1Hash& right)
+/** Hash data into bits with the given Merkle hash function. Leaves the
+    bytes past Sha1Hash::Size(func) alone. */
+static void MerkleHash(popt_merkle_func_t func, const void *data1, size_t length1,
+                       const void *data2, size_t length2, uint8_t *hash)
 {
-    blk_SHA_CTX ctx;
-    blk_SHA1_Init(&ctx);
-    blk_SHA1_Update(&ctx, left.bits,SIZE);
-    blk_SHA1_Update(&ctx, right.bits,SIZE);
-    blk_SHA1_Final(bits, &ctx);
+    if (func == POPT_MERKLE_HASH_FUNC_SHA256) {
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, data1, length1);
+        if (length2)
+            sha256_update(&ctx, data2, length2);
+        sha256_final(hash, &ctx);
+    } else if (func == POPT_MERKLE_HASH_FUNC_SHA512_256) {
+        sha512_ctx ctx;
+        sha512_256_init(&ctx);
+        sha512_update(&ctx, data1, length1);
+        if (length2)
+            sha512_update(&ctx, data2, length2);
+        sha512_256_final(hash, &ctx);
+    } else {
+        blk_SHA_CTX ctx;
+        blk_SHA1_Init(&ctx);
+        blk_SHA1_Update(&ctx, data1, length1);
+        if (length2)
+            blk_SHA1_Update(&ctx, data2, length2);
+        blk_SHA1_Final(hash, &ctx);
+    }
+}
+
+Sha1Hash::Sha1Hash(const Sha1Hash& left, const Sha1Hash& right) : func_(left.func_)
+{
+    size_t size = left.size();
+    memset(bits+size,0,HASHSZ_MAX-size);
+    MerkleHash(func(), left.bits, size, right.bits, size, bits);
 }
 
-Sha1Hash::Sha1Hash(const char* data, size_t length)
+Sha1Hash::Sha1Hash(const char* data, size_t length) : func_(POPT_MERKLE_HASH_FUNC_SHA1)
 {
     if (length==-1)
         length = strlen(data);
+    memset(bits+HASHSZ,0,HASHSZ_MAX-HASHSZ);
     SHA1((unsigned char*)data,length,bits);
 }
 
-Sha1Hash::Sha1Hash(const uint8_t* data, size_t length)
+Sha1Hash::Sha1Hash(const uint8_t* data, size_t length) : func_(POPT_MERKLE_HASH_FUNC_SHA1)
 {
+    memset(bits+HASHSZ,0,HASHSZ_MAX-HASHSZ);
     SHA1(data,length,bits);
 }
 
-Sha1Hash::Sha1Hash(bool hex, const char* hash)
+Sha1Hash::Sha1Hash(popt_merkle_func_t func, const char* data, size_t length) : func_(func)
 {
+    size_t size = Size(func);
+    memset(bits+size,0,HASHSZ_MAX-size);
+    MerkleHash(func, data, length, NULL, 0, bits);
+}
+
+Sha1Hash::Sha1Hash(bool hex, const char* hash) : func_(POPT_MERKLE_HASH_FUNC_SHA1)
+{
+    memset(bits,0,HASHSZ_MAX);
     if (hex) {
         int val;
-        for (int i=0; i<SIZE; i++) {
+        if (strlen(hash) == HASHSZ_MAX*2)
+            func_ = POPT_MERKLE_HASH_FUNC_SHA256;
+        for (int i=0; i<size(); i++) {
             if (sscanf(hash+i*2, "%2x", &val)!=1) {
-                memset(bits,0,20);
+                memset(bits,0,HASHSZ_MAX);
                 return;
             }
             bits[i] = val;
@@ -68,19 +108,27 @@ Sha1Hash::Sha1Hash(bool hex, const char* hash)
         memcpy(bits,hash,SIZE);
 }
 
+Sha1Hash::Sha1Hash(popt_merkle_func_t func, const uint8_t* raw) : func_(func)
+{
+    size_t size = Size(func);
+    memcpy(bits,raw,size);
+    memset(bits+size,0,HASHSZ_MAX-size);
+}
+
 std::string Sha1Hash::hex() const
 {
-    char hex[HASHSZ*2+1];
-    for (int i=0; i<HASHSZ; i++)
+    char hex[HASHSZ_MAX*2+1];
+    for (int i=0; i<size(); i++)
         sprintf(hex+i*2, "%02x", (int)(unsigned char)bits[i]);
-    return std::string(hex,HASHSZ*2);
+    return std::string(hex,size()*2);
 }
 
 
 Sha1Hash & Sha1Hash::operator= (const Sha1Hash & source)
 {
     if (this != &source) {
-        memcpy(bits,source.bits,SIZE);
+        memcpy(bits,source.bits,HASHSZ_MAX);
+        func_ = source.func_;
     }
     return *this;
 }
@@ -91,11 +139,14 @@ Sha1Hash & Sha1Hash::operator= (const Sha1Hash & source)
 
 
 MmapHashTree::MmapHashTree(Storage *storage, const Sha1Hash& root_hash, uint32_t chunk_size, std::string hash_filename,
-                           bool force_check_diskvshash,std::string binmap_filename) :
-    HashTree(), root_hash_(root_hash), hashes_(NULL),
+                           bool force_check_diskvshash,std::string binmap_filename, popt_merkle_func_t hash_func) :
+    HashTree(), root_hash_(root_hash), hashes_(NULL), hash_func_(hash_func), hash_size_(Sha1Hash::Size(hash_func)),
     peak_count_(0), hash_fd_(-1), hash_filename_(hash_filename), size_(0), sizec_(0), complete_(0), completec_(0),
     chunk_size_(chunk_size), storage_(storage)
 {
+    // A 32-byte root parsed from hex may be either SHA-2 variant
+    root_hash_.func_ = hash_func_;
+
     // MULTIFILE
     storage_->SetHashTree(this);
     // If multi-file spec we know the exact size even before getting peaks+last chunk
@@ -176,7 +227,8 @@ MmapHashTree::MmapHashTree(Storage *storage, const Sha1Hash& root_hash, uint32_t
 
 
 MmapHashTree::MmapHashTree(bool dummy, std::string binmap_filename) :
-    HashTree(), root_hash_(Sha1Hash::ZERO), hashes_(NULL), peak_count_(0), hash_fd_(0),
+    HashTree(), root_hash_(Sha1Hash::ZERO), hashes_(NULL), hash_func_(POPT_MERKLE_HASH_FUNC_SHA1),
+    hash_size_(HASHSZ), peak_count_(0), hash_fd_(0),
     hash_filename_(""), filename_(""), size_(0), sizec_(0), complete_(0), completec_(0),
     chunk_size_(0)
 {
@@ -211,7 +263,7 @@ void MmapHashTree::Submit()
     //fprintf(stderr,"hashtree: submit: cs %i\n", chunk_size_);
 
     peak_count_ = gen_peaks(sizec_,peaks_);
-    int hashes_size = Sha1Hash::SIZE*sizec_*2;
+    int hashes_size = hash_size_*sizec_*2;
     dprintf("%s hashtree submit resizing hash file to %d\n",tintstr(), hashes_size);
     if (hashes_size == 0) {
         SetBroken();
@@ -226,7 +278,7 @@ void MmapHashTree::Submit()
     }
 
     file_resize(hash_fd_,hashes_size);
-    hashes_ = (Sha1Hash*) memory_map(hash_fd_,hashes_size);
+    hashes_ = (uint8_t*) memory_map(hash_fd_,hashes_size);
     if (!hashes_) {
         size_ = sizec_ = complete_ = completec_ = 0;
         print_error("mmap failed");
@@ -245,18 +297,18 @@ void MmapHashTree::Submit()
             return;
         }
         bin_t pos(0,i);
-        hashes_[pos.toUInt()] = Sha1Hash(chunk,rd);
+        set_hash(pos,Sha1Hash(hash_func_,chunk,rd));
         ack_out_.set(pos);
         while (pos.is_right()) {
             pos = pos.parent();
-            hashes_[pos.toUInt()] = Sha1Hash(hashes_[pos.left().toUInt()],hashes_[pos.right().toUInt()]);
+            set_hash(pos,Sha1Hash(hash(pos.left()),hash(pos.right())));
         }
         complete_+=rd;
         completec_++;
     }
     delete chunk;
     for (int p=0; p<peak_count_; p++) {
-        peak_hashes_[p] = hashes_[peaks_[p].toUInt()];
+        peak_hashes_[p] = hash(peaks_[p]);
     }
 
     Sha1Hash calcroothash = DeriveRoot();
@@ -284,7 +336,7 @@ void MmapHashTree::RecoverProgress()
     // so, lets verify hashes and the data we've got
     char *zero_chunk = new char[chunk_size_];
     memset(zero_chunk, 0, chunk_size_);
-    Sha1Hash zero_hash(zero_chunk,chunk_size_);
+    Sha1Hash zero_hash(hash_func_,zero_chunk,chunk_size_);
 
     // Arno: loop over all pieces, read each from file
     // Note that we may have the complete hashtree, but not have all pieces.
@@ -294,15 +346,15 @@ void MmapHashTree::RecoverProgress()
     char *buf = new char[chunk_size_];
     for (int p=0; p<size_in_chunks(); p++) {
         bin_t pos(0,p);
-        if (hashes_[pos.toUInt()]==Sha1Hash::ZERO)
+        if (hash(pos)==Sha1Hash::ZERO)
             continue;
         ssize_t rd = storage_->Read(buf,chunk_size_,p*chunk_size_);
         if (rd!=(chunk_size_) && p!=size_in_chunks()-1)
             break;
         if (rd==(chunk_size_) && !memcmp(buf, zero_chunk, rd) &&
-                hashes_[pos.toUInt()]!=zero_hash) // FIXME // Arno == don't have piece yet?
+                hash(pos)!=zero_hash) // FIXME // Arno == don't have piece yet?
             continue;
-        if (!OfferHash(pos, Sha1Hash(buf,rd)))
+        if (!OfferHash(pos, Sha1Hash(hash_func_,buf,rd)))
             continue;
         ack_out_.set(pos);
         completec_++;
@@ -329,11 +381,11 @@ bool MmapHashTree::RecoverPeakHashes()
     bin_t peaks[64];
     int peak_count = gen_peaks(sizek,peaks);
     for (int i=0; i<peak_count; i++) {
-        Sha1Hash peak_hash;
-        file_seek(hash_fd_,peaks[i].toUInt()*sizeof(Sha1Hash));
-        if (read(hash_fd_,&peak_hash,sizeof(Sha1Hash))!=sizeof(Sha1Hash))
+        uint8_t raw[HASHSZ_MAX];
+        file_seek(hash_fd_,peaks[i].toUInt()*hash_size_);
+        if (read(hash_fd_,raw,hash_size_)!=hash_size_)
             return false;
-        OfferPeakHash(peaks[i], peak_hash);
+        OfferPeakHash(peaks[i], Sha1Hash(hash_func_,raw));
     }
     if (!this->size())
         return false; // if no valid peak hashes found
@@ -343,8 +395,12 @@ bool MmapHashTree::RecoverPeakHashes()
 
 int MmapHashTree::serialize(FILE *fp)
 {
-    fprintf_retiffail(fp,"version %i\n", 1);
+    // Version 2 adds the Merkle hash function, only written when not SHA-1
+    // so SHA-1 checkpoints stay readable by older versions.
+    fprintf_retiffail(fp,"version %i\n", hash_func_ == POPT_MERKLE_HASH_FUNC_SHA1 ? 1 : 2);
     fprintf_retiffail(fp,"root hash %s\n", root_hash_.hex().c_str());
+    if (hash_func_ != POPT_MERKLE_HASH_FUNC_SHA1)
+        fprintf_retiffail(fp,"merkle hash func %d\n", (int)hash_func_);
     fprintf_retiffail(fp,"chunk size %" PRIu32 "\n", chunk_size_);
     fprintf_retiffail(fp,"complete %" PRIu64 "\n", complete_);
     fprintf_retiffail(fp,"completec %" PRIu64 "\n", completec_);
@@ -372,17 +428,22 @@ int MmapHashTree::internal_deserialize(FILE *fp,bool contentavail)
     char hexhashstr[256];
     uint64_t c,cc;
     uint32_t cs;
-    int version;
+    int version,func=POPT_MERKLE_HASH_FUNC_SHA1;
 
     fscanf_retiffail(fp,"version %i\n", &version);
     fscanf_retiffail(fp,"root hash %s\n", hexhashstr);
+    if (version >= 2)
+        fscanf_retiffail(fp,"merkle hash func %d\n", &func);
     fscanf_retiffail(fp,"chunk size %" PRIu32 "\n", &cs);
     fscanf_retiffail(fp,"complete %" PRIu64 "\n", &c);
     fscanf_retiffail(fp,"completec %" PRIu64 "\n", &cc);
 
     if (ack_out_.deserialize(fp) < 0)
         return -1;
+    hash_func_ = (popt_merkle_func_t)func;
+    hash_size_ = Sha1Hash::Size(hash_func_);
     root_hash_ = Sha1Hash(true, hexhashstr);
+    root_hash_.func_ = hash_func_;
     chunk_size_ = cs;
     complete_ = c;
     completec_ = cc;
@@ -457,7 +518,7 @@ bool MmapHashTree::OfferPeakHash(bin_t pos, const Sha1Hash& hash)
     }
 
     // mmap the hash file into memory
-    uint64_t expected_size = sizeof(Sha1Hash)*sizec_*2;
+    uint64_t expected_size = hash_size_*sizec_*2;
     // Arno, 2011-10-18: on Windows we could optimize this away,
     //CreateFileMapping, see compat.cpp will resize the file for us with
     // the right params.
@@ -467,7 +528,7 @@ bool MmapHashTree::OfferPeakHash(bin_t pos, const Sha1Hash& hash)
         file_resize(hash_fd_, expected_size);
     }
 
-    hashes_ = (Sha1Hash*) memory_map(hash_fd_,expected_size);
+    hashes_ = (uint8_t*) memory_map(hash_fd_,expected_size);
     if (!hashes_) {
         size_ = sizec_ = complete_ = completec_ = 0;
         print_error("mmap failed");
@@ -475,7 +536,7 @@ bool MmapHashTree::OfferPeakHash(bin_t pos, const Sha1Hash& hash)
     }
 
     for (int i=0; i<peak_count_; i++)
-        hashes_[peaks_[i].toUInt()] = peak_hashes_[i];
+        set_hash(peaks_[i],peak_hashes_[i]);
 
     dprintf("%s hashtree memory mapped\n",tintstr());
 
@@ -543,22 +604,22 @@ bool MmapHashTree::OfferHash(bin_t pos, const Sha1Hash& hash)
     if (peak.is_none())
         return false;
     if (peak==pos)
-        return hash == hashes_[pos.toUInt()];
+        return hash == this->hash(pos);
     if (!ack_out_.is_empty(pos.parent()))
-        return hash==hashes_[pos.toUInt()]; // have this hash already, even accptd data
+        return hash==this->hash(pos); // have this hash already, even accptd data
     // LESSHASH
     // Arno: if we already verified this hash against the root, don't replace
     if (!is_hash_verified_.is_empty(bin_t(0,pos.toUInt())))
-        return hash == hashes_[pos.toUInt()];
+        return hash == this->hash(pos);
 
-    hashes_[pos.toUInt()] = hash;
+    set_hash(pos,hash);
     if (!pos.is_base())
         return false; // who cares?
     bin_t p = pos;
     Sha1Hash uphash = hash;
     // Arno: Note well: bin_t(0,p.toUInt()) is to abuse binmap as bitmap.
     while (p!=peak && ack_out_.is_empty(p) && is_hash_verified_.is_empty(bin_t(0,p.toUInt()))) {
-        hashes_[p.toUInt()] = uphash;
+        set_hash(p,uphash);
         p = p.parent();
         // Arno: Prevent poisoning the tree with bad values:
         // Left hand hashes should never be zero, and right
@@ -566,12 +627,13 @@ bool MmapHashTree::OfferHash(bin_t pos, const Sha1Hash& hash)
         // layer 0. Higher layers will never have 0 hashes
         // as SHA1(zero+zero) != zero (but b80de5...)
         //
-        if (hashes_[p.left().toUInt()] == Sha1Hash::ZERO || hashes_[p.right().toUInt()] == Sha1Hash::ZERO)
+        Sha1Hash left = this->hash(p.left()), right = this->hash(p.right());
+        if (left == Sha1Hash::ZERO || right == Sha1Hash::ZERO)
             break;
-        uphash = Sha1Hash(hashes_[p.left().toUInt()],hashes_[p.right().toUInt()]);
+        uphash = Sha1Hash(left,right);
     }// walk to the nearest proven hash
 
-    bool success = (uphash==hashes_[p.toUInt()]);
+    bool success = (uphash==this->hash(p));
     // LESSHASH
     if (success) {
         // Arno: The hash checks out. Mark all hashes on the uncle path as
@@ -611,7 +673,7 @@ bool MmapHashTree::OfferData(bin_t pos, const char* data, size_t length)
     if (peak.is_none())
         return false;
 
-    Sha1Hash data_hash(data,length);
+    Sha1Hash data_hash(hash_func_,data,length);
     if (!OfferHash(pos, data_hash)) {
         //printf("invalid hash for %s: %s\n",pos.str(bin_name_buf),data_hash.hex().c_str()); // paranoid
         //fprintf(stderr,"INVALID HASH FOR %" PRIi64 " layer %d\n", pos.toUInt(), pos.layer() );
@@ -632,6 +694,9 @@ bool MmapHashTree::OfferData(bin_t pos, const char* data, size_t length)
         if (storage_->GetReservedSize()!=size_)
             storage_->ResizeReserved(size_);
     }
+    // WRITEBUF: complete content should be on disk for whoever opens it next
+    if (completec_ == sizec_)
+        (void)storage_->Flush();
     return true;
 }
 
@@ -666,7 +731,7 @@ uint64_t MmapHashTree::seq_complete(int64_t offset)
 MmapHashTree::~MmapHashTree()
 {
     if (hashes_)
-        memory_unmap(hash_fd_, hashes_, sizec_*2*sizeof(Sha1Hash));
+        memory_unmap(hash_fd_, hashes_, sizec_*2*hash_size_);
     if (hash_fd_ >= 0) {
         close(hash_fd_);
     }
@@ -18,28 +18,50 @@ namespace swift
 {
 
 #define HASHSZ 20
-
-    /** SHA-1 hash, 20 bytes of data */
+// Largest Merkle hash supported, SHA-256 and SHA-512/256
+#define HASHSZ_MAX 32
+
+    // Merkle hash function, PPSPP protocol option
+    typedef enum {
+        POPT_MERKLE_HASH_FUNC_SHA1 = 0,
+        POPT_MERKLE_HASH_FUNC_SHA224 = 1,
+        POPT_MERKLE_HASH_FUNC_SHA256 = 2,
+        POPT_MERKLE_HASH_FUNC_SHA384 = 3,
+        POPT_MERKLE_HASH_FUNC_SHA512 = 4,
+        // Not in RFC 7574, private to this implementation
+        POPT_MERKLE_HASH_FUNC_SHA512_256 = 5
+    } popt_merkle_func_t;
+
+    /** Merkle tree hash. SHA-1 (20 bytes) unless constructed with another
+        popt_merkle_func_t; bytes past size() are always zero. */
     struct Sha1Hash {
-        uint8_t    bits[HASHSZ];
+        uint8_t    bits[HASHSZ_MAX];
+        uint8_t    func_;
 
-        Sha1Hash() {
-            memset(bits,0,HASHSZ);
+        Sha1Hash() : func_(POPT_MERKLE_HASH_FUNC_SHA1) {
+            memset(bits,0,HASHSZ_MAX);
         }
-        /** Make a hash of two hashes (for building Merkle hash trees). */
+        /** Make a hash of two hashes (for building Merkle hash trees),
+            using the hash function of the left one. */
         Sha1Hash(const Sha1Hash& left, const Sha1Hash& right);
         /** Hash an old plain string. */
         Sha1Hash(const char* str, size_t length=-1);
         Sha1Hash(const uint8_t* data, size_t length);
-        /** Either parse hash from hex representation of read in raw format. */
+        /** Hash data with the given hash function. */
+        Sha1Hash(popt_merkle_func_t func, const char* data, size_t length);
+        /** Either parse hash from hex representation of read in raw format.
+            A 64 digit hex string is taken to be a SHA-256 hash. */
         Sha1Hash(bool hex, const char* hash);
+        /** Raw hash of Size(func) bytes */
+        Sha1Hash(popt_merkle_func_t func, const uint8_t* raw);
         Sha1Hash(const Sha1Hash& h) {
-            memcpy(bits,h.bits,SIZE);
+            memcpy(bits,h.bits,HASHSZ_MAX);
+            func_ = h.func_;
         }
 
         std::string    hex() const;
         bool    operator == (const Sha1Hash& b) const {
-            return 0==memcmp(bits,b.bits,SIZE);
+            return 0==memcmp(bits,b.bits,HASHSZ_MAX);
         }
         bool    operator != (const Sha1Hash& b) const {
             return !(*this==b);
@@ -52,15 +74,28 @@ namespace swift
         }
         Sha1Hash & operator = (const Sha1Hash &source);
 
+        popt_merkle_func_t func() const {
+            return (popt_merkle_func_t)func_;
+        }
+        size_t  size() const {
+            return Size(func());
+        }
+        /** Number of bytes in a hash made with func */
+        static size_t Size(popt_merkle_func_t func) {
+            return (func == POPT_MERKLE_HASH_FUNC_SHA256 || func == POPT_MERKLE_HASH_FUNC_SHA512_256) ? HASHSZ_MAX : HASHSZ;
+        }
+
         const static Sha1Hash ZERO;
         const static size_t SIZE = HASHSZ;
     };
 
 // Arno: The chunk size parameter can now be configured via the constructor,
-// for values up to 8192. Above that you'll have to edit the
-// SWIFT_MAX_SEND_DGRAM_SIZE in swift.h
+// for values up to SWIFT_MAX_CHUNK_SIZE. A DATA message is a single UDP
+// datagram, so chunks larger than the path MTU rely on IP fragmentation.
 //
 #define SWIFT_DEFAULT_CHUNK_SIZE 1024
+// Largest chunk that fits in a UDP datagram with its hashes (max 64 KB)
+#define SWIFT_MAX_CHUNK_SIZE     32768
 
 
     class Storage;
@@ -92,13 +127,17 @@ namespace swift
         /** Returns the i-th peak's bin number. */
         virtual bin_t           peak(int i) const = 0;
         /** Returns peak hash #i. */
-        virtual const Sha1Hash& peak_hash(int i) const = 0;
+        virtual Sha1Hash        peak_hash(int i) const = 0;
         /** Return the peak bin the given bin belongs to. */
         virtual bin_t           peak_for(bin_t pos) const  = 0;;
         /** Return a (Merkle) hash for the given bin. */
-        virtual const Sha1Hash& hash(bin_t pos) const  = 0;
+        virtual Sha1Hash        hash(bin_t pos) const  = 0;
         /** Give the root hash, which is effectively an identifier of this file. */
         virtual const Sha1Hash& root_hash() const  = 0;
+        /** Hash function the tree is built with. */
+        virtual popt_merkle_func_t hash_func() const {
+            return root_hash().func();
+        }
         /** Get file size, in bytes. */
         virtual uint64_t        size() const  = 0;
         /** Get file size in chunks (in kilobytes, rounded up). */
@@ -129,7 +168,10 @@ namespace swift
     {
         /** Merkle hash tree: root */
         Sha1Hash        root_hash_;
-        Sha1Hash        *hashes_;
+        /** Hashes of all bins, hash_size_ bytes each, mmap'd from the .mhash file */
+        uint8_t         *hashes_;
+        popt_merkle_func_t hash_func_;
+        size_t          hash_size_;
         /** Merkle hash tree: peak hashes */
         Sha1Hash        peak_hashes_[64];
         bin_t           peaks_[64];
@@ -168,12 +210,16 @@ namespace swift
         bool            RecoverPeakHashes();
         Sha1Hash        DeriveRoot();
         bool            OfferPeakHash(bin_t pos, const Sha1Hash& hash);
+        void            set_hash(bin_t pos, const Sha1Hash& hash) {
+            memcpy(hashes_+pos.toUInt()*hash_size_,hash.bits,hash_size_);
+        }
 
 
     public:
 
         MmapHashTree(Storage *storage, const Sha1Hash& root=Sha1Hash::ZERO, uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE,
-                     std::string hash_filename="", bool force_check_diskvshash=true, std::string binmap_filename="");
+                     std::string hash_filename="", bool force_check_diskvshash=true, std::string binmap_filename="",
+                     popt_merkle_func_t hash_func=POPT_MERKLE_HASH_FUNC_SHA1);
 
         // Arno, 2012-01-03: Hack to quickly learn root hash from a checkpoint
         MmapHashTree(bool dummy, std::string binmap_filename);
@@ -189,16 +235,19 @@ namespace swift
         bin_t           peak(int i) const {
             return peaks_[i];
         }
-        const Sha1Hash& peak_hash(int i) const {
+        Sha1Hash        peak_hash(int i) const {
             return peak_hashes_[i];
         }
         bin_t           peak_for(bin_t pos) const;
-        const Sha1Hash& hash(bin_t pos) const {
-            return hashes_[pos.toUInt()];
+        Sha1Hash        hash(bin_t pos) const {
+            return Sha1Hash(hash_func_,hashes_+pos.toUInt()*hash_size_);
         }
         const Sha1Hash& root_hash() const {
             return root_hash_;
         }
+        popt_merkle_func_t hash_func() const {
+            return hash_func_;
+        }
         uint64_t        size() const {
             return size_;
         }
@@ -251,6 +300,7 @@ namespace swift
         int             peak_count_;
         /** File descriptor to put hashes to */
         int             hash_fd_;
+        popt_merkle_func_t hash_func_;
         /** Base size, as derived from the hashes. */
         uint64_t        size_;
         uint64_t        sizec_;
@@ -274,7 +324,8 @@ namespace swift
     public:
 
         ZeroHashTree(Storage *storage, const Sha1Hash& root=Sha1Hash::ZERO, uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE,
-                     std::string hash_filename=NULL, std::string binmap_filename=NULL);
+                     std::string hash_filename=NULL, std::string binmap_filename=NULL,
+                     popt_merkle_func_t hash_func=POPT_MERKLE_HASH_FUNC_SHA1);
 
         // Arno, 2012-01-03: Hack to quickly learn root hash from a checkpoint
         ZeroHashTree(bool dummy, std::string binmap_filename);
@@ -290,12 +341,15 @@ namespace swift
         bin_t           peak(int i) const {
             return peaks_[i];
         }
-        const Sha1Hash& peak_hash(int i) const;
+        Sha1Hash        peak_hash(int i) const;
         bin_t           peak_for(bin_t pos) const;
-        const Sha1Hash& hash(bin_t pos) const;
+        Sha1Hash        hash(bin_t pos) const;
         const Sha1Hash& root_hash() const {
             return root_hash_;
         }
+        popt_merkle_func_t hash_func() const {
+            return hash_func_;
+        }
         uint64_t        size() const {
             return size_;
         }
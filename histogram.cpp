@@ -0,0 +1,54 @@
+/*
+ *  histogram.cpp
+ *  Class to keep a fixed-bucket histogram of time intervals
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "histogram.h"
+#include <string.h>
+
+using namespace swift;
+
+// Bucket bounds in usec, 100us .. 10s in 1-2.5-5 steps, last one is +Inf
+static const tint histogram_bounds[HISTOGRAM_NBUCKETS] = {
+    100, 250, 500,
+    TINT_MSEC, 5*TINT_MSEC/2, 5*TINT_MSEC,
+    10*TINT_MSEC, 25*TINT_MSEC, 50*TINT_MSEC,
+    100*TINT_MSEC, 250*TINT_MSEC, 500*TINT_MSEC,
+    TINT_SEC, 5*TINT_SEC/2, 5*TINT_SEC, 10*TINT_SEC,
+    TINT_NEVER
+};
+
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+
+void LatencyHistogram::AddSample(tint t)
+{
+    if (t < 0)
+        t = 0;
+    int i=0;
+    while (t > histogram_bounds[i])
+        i++;
+    counts_[i]++;
+    count_++;
+    sum_ += t;
+}
+
+
+tint LatencyHistogram::GetBucketBound(int i)
+{
+    return histogram_bounds[i];
+}
+
+
+void LatencyHistogram::Reset()
+{
+    memset(counts_,0,sizeof(counts_));
+    count_ = 0;
+    sum_ = 0;
+}
@@ -0,0 +1,47 @@
+/*
+ *  histogram.h
+ *  Class to keep a fixed-bucket histogram of time intervals, e.g. RTTs,
+ *  for export via the statsgw /metrics page.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "compat.h"
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+namespace swift
+{
+
+#define HISTOGRAM_NBUCKETS  17
+
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram();
+        /** Record an interval in usec. Negative values count as 0. */
+        void AddSample(tint t);
+        /** Upper bound of bucket i in usec, TINT_NEVER for the last (+Inf) bucket */
+        static tint GetBucketBound(int i);
+        /** Number of samples in bucket i, i.e. samples <= bound i and > bound i-1 */
+        uint64_t GetBucketCount(int i) const {
+            return counts_[i];
+        }
+        uint64_t GetCount() const {
+            return count_;
+        }
+        /** Sum of all samples in usec */
+        uint64_t GetSum() const {
+            return sum_;
+        }
+        void Reset();
+    protected:
+        uint64_t counts_[HISTOGRAM_NBUCKETS];
+        uint64_t count_;
+        uint64_t sum_;
+    };
+
+}
+
+#endif
@@ -48,7 +48,9 @@ const char *url_query_keys[] = { "v", "cp", "hf", "ca", "ld", "ia", "cs", "cl",
 
 
 
-#define HTTPGW_MAX_REQUEST 128
+// Request state is allocated in blocks of this many requests that are
+// kept and reused, so there is no limit on the number of open requests.
+#define HTTPGW_REQUEST_POOL_BLOCK   64
 
 struct http_gw_t {
     int      id;     // request id
@@ -76,8 +78,19 @@ struct http_gw_t {
     bool     live;   // Whether the request is for a live swarm
     bool     dash;   // Whether the request is a DASH request
     std::string dashrangestr; // DASH range requested, format x-y
-} http_requests[HTTPGW_MAX_REQUEST];
+    // bookkeeping
+    uint64_t membytes;   // memory accounted to this request, see HttpGwAccountMemory()
+    http_gw_t *nextfree; // pool free list
+};
 
+typedef std::map<struct evhttp_request *,http_gw_t *> httpgw_evreqmap_t;
+typedef std::map<int,http_gw_t *> httpgw_tdmap_t;
+
+std::vector<http_gw_t *> httpgw_pool_blocks;    // allocated blocks
+http_gw_t *httpgw_pool_free = NULL;             // unused requests
+httpgw_evreqmap_t httpgw_reqs_by_ev;            // open requests by libevent request
+httpgw_tdmap_t httpgw_reqs_by_td;               // open requests by transfer, one per transfer
+uint64_t httpgw_reqs_membytes = 0;              // sum of membytes of open requests
 
 int http_gw_reqs_open = 0;
 int http_gw_reqs_count = 0;
@@ -94,10 +107,35 @@ Address httpgw_bindaddr;                // Address of HTTP server
 // Arno, 2010-11-30: for SwarmPlayer 3000 backend autoquit when no HTTP req is received
 bool sawhttpconn = false;
 
-typedef std::pair<int,struct evhttp_request *> tdevreqpair;
-typedef std::vector<tdevreqpair>  tdevreqvector; // not a lot of reqs, so keep simple
+// PREFETCH: Number of past requests per transfer to look for a pattern in,
+// number of segments to prefetch when one is found, and time after which
+// the history of a transfer without requests is forgotten.
+#define HTTPGW_PREFETCH_HISTORY     4
+#define HTTPGW_PREFETCH_SEGMENTS    3
+#define HTTPGW_PREFETCH_IDLE_TIME   (60*TINT_SEC)
+
+struct httpgw_range_t {
+    uint64_t first;
+    uint64_t last;   // inclusive
+};
+
+struct httpgw_prefetch_t {
+    std::deque<httpgw_range_t>  history;    // recent requests, oldest first
+    std::vector<httpgw_range_t> predicted;  // windows being prefetched
+    tint                        last_time;
+};
+typedef std::map<int,httpgw_prefetch_t> httpgw_prefetch_map_t;
 
-tdevreqvector   httpgw_tdevreqvec;
+httpgw_prefetch_map_t httpgw_prefetch_map;
+uint64_t httpgw_prefetch_requests = 0;  // VOD requests seen
+uint64_t httpgw_prefetch_predicted = 0; // ... that started in a predicted window
+uint64_t httpgw_prefetch_hits = 0;      // ... whose data was all there already
+
+// Requests waiting for the request for the same transfer to finish
+typedef std::deque<struct evhttp_request *> evreqqueue_t;
+typedef std::map<int,evreqqueue_t> tdevreqqueuemap_t;
+
+tdevreqqueuemap_t httpgw_tdevreqqueues;
 
 /*
  * Local prototypes
@@ -105,25 +143,73 @@ tdevreqvector   httpgw_tdevreqvec;
 
 void HttpGwSubscribeToWrite(http_gw_t *req);
 void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg);
+void HttpGwPrefetchRecord(int td, uint64_t first, uint64_t last);
+void HttpGwGetPrefetchStats(uint64_t *requests, uint64_t *predicted, uint64_t *hits);
+void HttpGwGetRequestStats(int *open, uint64_t *membytes, uint64_t *poolbytes);
 
 
-http_gw_t *HttpGwFindRequestByEV(struct evhttp_request *evreq)
+http_gw_t *HttpGwAllocRequest()
 {
-    for (int httpc=0; httpc<http_gw_reqs_open; httpc++) {
-        if (http_requests[httpc].sinkevreq==evreq)
-            return &http_requests[httpc];
+    if (httpgw_pool_free == NULL) {
+        http_gw_t *block = new http_gw_t[HTTPGW_REQUEST_POOL_BLOCK];
+        httpgw_pool_blocks.push_back(block);
+        for (int i=HTTPGW_REQUEST_POOL_BLOCK-1; i>=0; i--) {
+            block[i].nextfree = httpgw_pool_free;
+            httpgw_pool_free = &block[i];
+        }
     }
-    return NULL;
+    http_gw_t *req = httpgw_pool_free;
+    httpgw_pool_free = req->nextfree;
+    // Nothing of the request that used it before
+    *req = http_gw_t();
+    return req;
 }
 
-http_gw_t *HttpGwFindRequestByTD(int td)
+
+void HttpGwFreeRequest(http_gw_t *req)
 {
-    for (int httpc=0; httpc<http_gw_reqs_open; httpc++) {
-        if (http_requests[httpc].td==td) {
-            return &http_requests[httpc];
-        }
+    // Release string memory, the struct itself is reused
+    std::string().swap(req->mfspecname);
+    std::string().swap(req->xcontentdur);
+    std::string().swap(req->mimetype);
+    std::string().swap(req->dashrangestr);
+    req->sinkevreq = NULL;
+    req->nextfree = httpgw_pool_free;
+    httpgw_pool_free = req;
+}
+
+
+/** Accounts the memory held on behalf of req: its state and the reply
+ * data queued in libevent but not yet sent. */
+void HttpGwAccountMemory(http_gw_t *req)
+{
+    uint64_t membytes = sizeof(http_gw_t) + req->mfspecname.capacity() + req->xcontentdur.capacity() +
+                        req->mimetype.capacity() + req->dashrangestr.capacity();
+    if (req->sinkevreq != NULL) {
+        struct evhttp_connection *evconn = evhttp_request_get_connection(req->sinkevreq);
+        if (evconn != NULL)
+            membytes += evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(evconn)));
     }
-    return NULL;
+    httpgw_reqs_membytes += membytes;
+    httpgw_reqs_membytes -= req->membytes;
+    req->membytes = membytes;
+}
+
+
+http_gw_t *HttpGwFindRequestByEV(struct evhttp_request *evreq)
+{
+    httpgw_evreqmap_t::iterator iter = httpgw_reqs_by_ev.find(evreq);
+    if (iter == httpgw_reqs_by_ev.end())
+        return NULL;
+    return iter->second;
+}
+
+http_gw_t *HttpGwFindRequestByTD(int td)
+{
+    httpgw_tdmap_t::iterator iter = httpgw_reqs_by_td.find(td);
+    if (iter == httpgw_reqs_by_td.end())
+        return NULL;
+    return iter->second;
 }
 
 http_gw_t *HttpGwFindRequestBySwarmID(SwarmID &swarmid)
@@ -135,10 +221,20 @@ http_gw_t *HttpGwFindRequestBySwarmID(SwarmID &swarmid)
 }
 
 
+/** Memory statistics for the stats gateway */
+void HttpGwGetRequestStats(int *open, uint64_t *membytes, uint64_t *poolbytes)
+{
+    *open = http_gw_reqs_open;
+    *membytes = httpgw_reqs_membytes;
+    *poolbytes = httpgw_pool_blocks.size()*HTTPGW_REQUEST_POOL_BLOCK*sizeof(http_gw_t);
+}
+
+
 void HttpGwCloseConnection(http_gw_t* req)
 {
     dprintf("%s @%i http get: cleanup evreq %p\n",tintstr(),req->id, req->sinkevreq);
 
+    struct evhttp_request *evreq = req->sinkevreq;
     struct evhttp_connection *evconn = evhttp_request_get_connection(req->sinkevreq);
 
     req->closing = true;
@@ -181,22 +277,23 @@ void HttpGwCloseConnection(http_gw_t* req)
 
     int oldtd = req->td;
 
-    *req = http_requests[--http_gw_reqs_open];
+    httpgw_reqs_by_ev.erase(evreq);
+    httpgw_reqs_by_td.erase(oldtd);
+    http_gw_reqs_open--;
+    httpgw_reqs_membytes -= req->membytes;
+    HttpGwFreeRequest(req);
 
     // Arno, 2013-06-26: See if there were concurrent requests for same swarm,
     // we serve them sequentially.
     //
-    tdevreqvector::iterator iter;
-    for (iter=httpgw_tdevreqvec.begin(); iter != httpgw_tdevreqvec.end(); iter++) {
-        tdevreqpair pair = *iter;
-        int gottd = pair.first;
-        struct evhttp_request *evreq = pair.second;
-        if (gottd == oldtd) {
-            httpgw_tdevreqvec.erase(iter);
-            dprintf("%s T%i http get: Dequeuing request\n",tintstr(), gottd);
-            HttpGwNewRequestCallback(evreq,evreq); // note: second evreq significant!
-            break;
-        }
+    tdevreqqueuemap_t::iterator iter = httpgw_tdevreqqueues.find(oldtd);
+    if (iter != httpgw_tdevreqqueues.end()) {
+        struct evhttp_request *queuedevreq = iter->second.front();
+        iter->second.pop_front();
+        if (iter->second.size() == 0)
+            httpgw_tdevreqqueues.erase(iter);
+        dprintf("%s T%i http get: Dequeuing request\n",tintstr(), oldtd);
+        HttpGwNewRequestCallback(queuedevreq,queuedevreq); // note: second evreq significant!
     }
 }
 
@@ -281,58 +378,31 @@ void HttpGwWrite(struct evhttp_request *evreq)
         else
             max_write_bytes = HTTPGW_LIVE_MAX_WRITE_BYTES;
 
-        // Allocate buffer to read into. TODO: let swift::Read accept evb
-        char *buf = (char *)malloc(max_write_bytes);
+        // Read straight into the evbuffer that is handed to libevent. For
+        // a single file without the raw H.264 processing, libevent may even
+        // send directly from the file.
+        bool h264 = (req->mimetype == "video/h264");
+        if (!h264)
+            req->foundH264NALU = true; // Other MIME type
 
         uint64_t tosend = std::min(max_write_bytes,want);
-        size_t rd = swift::Read(req->td,buf,tosend,req->offset);
+        struct evbuffer *evb = evbuffer_new();
+        ssize_t rd = swift::Read(req->td,evb,tosend,req->offset,!h264);
         if (rd<0) {
             print_error("httpgw: MayWrite: error pread");
+            evbuffer_free(evb);
             HttpGwCloseConnection(req);
-            free(buf);
             return;
         }
 
-        // Construct evbuffer and send incrementally
-        struct evbuffer *evb = evbuffer_new();
-        int ret = 0;
-
-        // ARNO LIVE raw H264 hack
-        if (req->mimetype == "video/h264") {
-            if (req->offset == req->startoff) {
-                // Arno, 2012-10-24: When tuning into a live stream of raw H.264
-                // you must
-                // 1. Replay Sequence Picture Set (SPS) and Picture Parameter Set (PPS)
-                // 2. Find first NALU in video stream (starts with 00 00 00 01 and next bit is 0
-                // 3. Write that first NALU
-                //
-                // PROBLEM is that SPS and PPS contain info on video size, frame rate,
-                // and stuff, so is stream specific. The hardcoded values here are
-                // for H.264 640x480 15 fps 500000 bits/s obtained via Spydroid.
-                //
-
-                const unsigned char h264sps[] = { 0x00, 0x00, 0x00, 0x01, 0x27, 0x42, 0x80, 0x29, 0x8D, 0x95, 0x01, 0x40, 0x7B, 0x20 };
-                const unsigned char h264pps[] = { 0x00, 0x00, 0x00, 0x01, 0x28, 0xDE, 0x09, 0x88 };
-
-                dprintf("%s @%i http write: adding H.264 SPS and PPS\n",tintstr(),req->id);
-
-                ret = evbuffer_add(evb,h264sps,sizeof(h264sps));
-                if (ret < 0)
-                    print_error("httpgw: MayWrite: error evbuffer_add H.264 SPS");
-                ret = evbuffer_add(evb,h264pps,sizeof(h264pps));
-                if (ret < 0)
-                    print_error("httpgw: MayWrite: error evbuffer_add H.264 PPS");
-            }
-        } else
-            req->foundH264NALU = true; // Other MIME type
-
         // Find first H.264 NALU
-        size_t naluoffset = 0;
-        if (!req->foundH264NALU && rd >= 5) {
-            for (int i=0; i<rd-5; i++) {
+        if (!req->foundH264NALU) {
+            size_t naluoffset = rd;
+            const unsigned char *buf = evbuffer_pullup(evb,rd);
+            for (ssize_t i=0; buf != NULL && i<rd-5; i++) {
                 // Find startcode before NALU
-                if (buf[i] == '\x00' && buf[i+1] == '\x00' && buf[i+2] == '\x00' && buf[i+3] == '\x01') {
-                    char naluhead = buf[i+4];
+                if (buf[i] == 0x00 && buf[i+1] == 0x00 && buf[i+2] == 0x00 && buf[i+3] == 0x01) {
+                    unsigned char naluhead = buf[i+4];
                     if ((naluhead & 0x80) == 0) {
                         // Found NALU
                         // http://mailman.videolan.org/pipermail/x264-devel/2007-February/002681.html
@@ -343,26 +413,40 @@ void HttpGwWrite(struct evhttp_request *evreq)
                     }
                 }
             }
+            // Arno, 2012-10-24: LIVE Don't change rd here, as that should be a multiple of chunks
+            evbuffer_drain(evb,naluoffset);
         }
 
-        // Live tuned-in or VOD:
-        if (req->foundH264NALU) {
-            // Arno, 2012-10-24: LIVE Don't change rd here, as that should be a multiple of chunks
-            ret = evbuffer_add(evb,buf+naluoffset,rd-naluoffset);
-            if (ret < 0) {
-                print_error("httpgw: MayWrite: error evbuffer_add");
-                evbuffer_free(evb);
-                HttpGwCloseConnection(req);
-                free(buf);
-                return;
-            }
+        // ARNO LIVE raw H264 hack
+        if (h264 && req->offset == req->startoff) {
+            // Arno, 2012-10-24: When tuning into a live stream of raw H.264
+            // you must
+            // 1. Replay Sequence Picture Set (SPS) and Picture Parameter Set (PPS)
+            // 2. Find first NALU in video stream (starts with 00 00 00 01 and next bit is 0
+            // 3. Write that first NALU
+            //
+            // PROBLEM is that SPS and PPS contain info on video size, frame rate,
+            // and stuff, so is stream specific. The hardcoded values here are
+            // for H.264 640x480 15 fps 500000 bits/s obtained via Spydroid.
+            //
+
+            const unsigned char h264sps[] = { 0x00, 0x00, 0x00, 0x01, 0x27, 0x42, 0x80, 0x29, 0x8D, 0x95, 0x01, 0x40, 0x7B, 0x20 };
+            const unsigned char h264pps[] = { 0x00, 0x00, 0x00, 0x01, 0x28, 0xDE, 0x09, 0x88 };
+
+            dprintf("%s @%i http write: adding H.264 SPS and PPS\n",tintstr(),req->id);
+
+            int ret = evbuffer_prepend(evb,h264pps,sizeof(h264pps));
+            if (ret < 0)
+                print_error("httpgw: MayWrite: error evbuffer_prepend H.264 PPS");
+            ret = evbuffer_prepend(evb,h264sps,sizeof(h264sps));
+            if (ret < 0)
+                print_error("httpgw: MayWrite: error evbuffer_prepend H.264 SPS");
         }
 
         if (evbuffer_get_length(evb) > 0)
             evhttp_send_reply_chunk(req->sinkevreq, evb);
 
         evbuffer_free(evb);
-        free(buf);
 
         int wn = rd;
         dprintf("%s @%i http write: sent %db\n",tintstr(),req->id,wn);
@@ -375,6 +459,7 @@ void HttpGwWrite(struct evhttp_request *evreq)
         // PPPLUG
         swift::Seek(req->td,req->offset,SEEK_CUR);
     }
+    HttpGwAccountMemory(req);
 
     // Arno, 2010-11-30: tosend is set to fuzzy len, so need extra/other test.
     if (req->tosend==0 || req->offset == req->endoff+1) {
@@ -402,6 +487,11 @@ void HttpGwLibeventMayWriteCallback(evutil_socket_t fd, short events, void *evre
 
     HttpGwWrite(req->sinkevreq);
 
+    // Writing may have finished and closed the request
+    req = HttpGwFindRequestByEV((struct evhttp_request *)evreqvoid);
+    if (req == NULL)
+        return;
+
     if (swift::ttype(req->td) == FILE_TRANSFER) {
 
         if (swift::Complete(req->td)+HTTPGW_VOD_MAX_WRITE_BYTES >= swift::Size(req->td)) {
@@ -649,6 +739,90 @@ bool HttpGwParseContentRangeHeader(http_gw_t *req,uint64_t filesize)
 }
 
 
+/*
+ * PREFETCH: Players read a VOD swarm as a series of HTTP requests: Range
+ * requests that continue where the previous one ended, or DASH segments
+ * (multi-file or byte ranges) at a fixed stride. Remember the last few
+ * requests per transfer and, when the last two show such a pattern, have
+ * the picker fetch the next HTTPGW_PREFETCH_SEGMENTS segments after the
+ * one being served.
+ */
+void HttpGwPrefetchRecord(int td, uint64_t first, uint64_t last)
+{
+    // Forget transfers nobody asked for in a while
+    httpgw_prefetch_map_t::iterator iter = httpgw_prefetch_map.begin();
+    while (iter != httpgw_prefetch_map.end()) {
+        if (iter->first != td && iter->second.last_time < NOW-HTTPGW_PREFETCH_IDLE_TIME)
+            httpgw_prefetch_map.erase(iter++);
+        else
+            iter++;
+    }
+
+    httpgw_prefetch_t &pf = httpgw_prefetch_map[td];
+    pf.last_time = NOW;
+
+    // Score the previous prediction
+    httpgw_prefetch_requests++;
+    std::vector<httpgw_range_t>::iterator piter;
+    for (piter=pf.predicted.begin(); piter!=pf.predicted.end(); piter++) {
+        if (first >= piter->first && first <= piter->last) {
+            httpgw_prefetch_predicted++;
+            if (swift::SeqComplete(td,first) >= last+1-first)
+                httpgw_prefetch_hits++;
+            break;
+        }
+    }
+
+    httpgw_range_t r;
+    r.first = first;
+    r.last = last;
+    pf.history.push_back(r);
+    if (pf.history.size() > HTTPGW_PREFETCH_HISTORY)
+        pf.history.pop_front();
+
+    // Predict: same length, same stride as the last two requests. For
+    // sequential reads the stride is the length.
+    pf.predicted.clear();
+    if (pf.history.size() >= 2) {
+        httpgw_range_t &a = pf.history[pf.history.size()-2];
+        httpgw_range_t &b = pf.history[pf.history.size()-1];
+        uint64_t alen = a.last+1-a.first;
+        uint64_t blen = b.last+1-b.first;
+        // Segments may differ a bit in size, allow 50%
+        if (b.first > a.first && alen < 2*blen && blen < 2*alen) {
+            uint64_t stride = b.first - a.first;
+            uint64_t size = swift::Size(td);
+            for (int k=1; k<=HTTPGW_PREFETCH_SEGMENTS; k++) {
+                httpgw_range_t p;
+                p.first = b.first + stride*k;
+                if (size > 0 && p.first >= size)
+                    break;
+                p.last = p.first + std::max(alen,blen)-1;
+                if (size > 0 && p.last >= size)
+                    p.last = size-1;
+                pf.predicted.push_back(p);
+            }
+        }
+    }
+
+    std::vector<std::pair<uint64_t,uint64_t> > ranges;
+    for (piter=pf.predicted.begin(); piter!=pf.predicted.end(); piter++)
+        ranges.push_back(std::make_pair(piter->first,piter->last));
+    swift::SetPrefetch(td,ranges);
+
+    dprintf("%s T%i http prefetch: %" PRIu64 "-%" PRIu64 " predicts %d windows\n",tintstr(),td,first,last,(int)pf.predicted.size());
+}
+
+
+/** PREFETCH: Statistics for the stats gateway */
+void HttpGwGetPrefetchStats(uint64_t *requests, uint64_t *predicted, uint64_t *hits)
+{
+    *requests = httpgw_prefetch_requests;
+    *predicted = httpgw_prefetch_predicted;
+    *hits = httpgw_prefetch_hits;
+}
+
+
 void HttpGwFirstProgressCallback(int td, bin_t bin)
 {
     //
@@ -739,6 +913,13 @@ void HttpGwFirstProgressCallback(int td, bin_t bin)
         //
         if (!HttpGwParseContentRangeHeader(req,filesize))
             return;
+
+        // DEADLINE: content duration gives the playback rate
+        if (req->xcontentdur.length() > 0) {
+            double dur = atof(req->xcontentdur.c_str());
+            if (dur > 0.0)
+                swift::SetBitrate(td,(double)filesize/dur);
+        }
     } else { //LIVE
         uint64_t hookinoff = swift::GetHookinOffset(td);
         req->startoff = hookinoff;
@@ -809,11 +990,12 @@ void HttpGwFirstProgressCallback(int td, bin_t bin)
 
     fprintf(stderr,"HTTP offset %" PRIi64 " tosend %" PRIi64 "\n", req->offset, req->tosend);
 
-    // Seek to wanted position in stream
-    if (!req->live && req->startoff != 0) {
+    // Seek to wanted position in stream. DEADLINE: also at 0, so the
+    // picker knows playback is about to start.
+    if (!req->live) {
         // Seek to multifile/range start
         int ret = swift::Seek(req->td,req->startoff,SEEK_SET);
-        if (ret < 0) {
+        if (ret < 0 && req->startoff != 0) {
             evhttp_send_error(req->sinkevreq,500,
                               "Internal error: Cannot seek to file start in range request or multi-file content.");
             req->replied = true;
@@ -822,6 +1004,10 @@ void HttpGwFirstProgressCallback(int td, bin_t bin)
         }
     }
 
+    // PREFETCH: learn from this request what will be asked next
+    if (!req->live && req->tosend > 0)
+        HttpGwPrefetchRecord(td,req->startoff,req->startoff+req->tosend-1);
+
     // Prepare rest of headers. Not actually sent till HttpGwWrite
     // calls evhttp_send_reply_start()
     //
@@ -1135,7 +1321,7 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
 
     // Handle LIVE
     bool live=false;
-    if (swarmidhexstr.length() > Sha1Hash::SIZE*2)
+    if (swarmidhexstr.length() != Sha1Hash::SIZE*2 && swarmidhexstr.length() != HASHSZ_MAX*2)
         live = true;
 
     bool dashrestart=false;
@@ -1157,7 +1343,7 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
             return;
         }
 
-        httpgw_tdevreqvec.push_back(tdevreqpair(existreq->td,evreq));
+        httpgw_tdevreqqueues[existreq->td].push_back(evreq);
 
         // We need delayed replying, so take ownership.
         // See http://code.google.com/p/libevent-longpolling/source/browse/trunk/main.c
@@ -1203,7 +1389,8 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
     if (td == -1) {
         // LIVE
         if (!live) {
-            td = swift::Open(filename,swarm_id,trackerurl,false,sm.cont_int_prot_,false,activate,sm.chunk_size_);
+            td = swift::Open(filename,swarm_id,trackerurl,false,sm.cont_int_prot_,false,activate,sm.chunk_size_,"",
+                             sm.merkle_func_);
         } else {
             td = swift::LiveOpen(filename,swarm_id,trackerurl,sm.injector_addr_,sm.cont_int_prot_,sm.live_disc_wnd_,sm.chunk_size_);
         }
@@ -1215,7 +1402,8 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
     }
 
     // 5. Record request
-    http_gw_t* req = http_requests + http_gw_reqs_open++;
+    http_gw_t* req = HttpGwAllocRequest();
+    http_gw_reqs_open++;
     req->id = ++http_gw_reqs_count;
     req->sinkevreq = evreq;
 
@@ -1238,6 +1426,9 @@ void HttpGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
     req->live = live;
     req->dash = false; // to be determined later
     req->dashrangestr = dashrangestr;
+    httpgw_reqs_by_ev[evreq] = req;
+    httpgw_reqs_by_td[td] = req;
+    HttpGwAccountMemory(req);
 
     fprintf(stderr,"httpgw: Opened %s dur %s\n",swarmidhexstr.c_str(), durstr.c_str());
 
@@ -1387,7 +1578,7 @@ std::string HttpGwStatsGetSpeedCallback(SwarmID &swarmid)
 bool HTTPIsSending()
 {
     if (http_gw_reqs_open > 0) {
-        int td = http_requests[http_gw_reqs_open-1].td;
+        int td = httpgw_reqs_by_td.rbegin()->first;
         fprintf(stderr,"httpgw: upload %lf\n",swift::GetCurrentSpeed(td,DDIR_UPLOAD)/1024.0);
         fprintf(stderr,"httpgw: dwload %lf\n",swift::GetCurrentSpeed(td,DDIR_DOWNLOAD)/1024.0);
     }
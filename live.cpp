@@ -52,6 +52,8 @@
 //LIVE
 #include "swift.h"
 #include <cfloat>
+#include <algorithm>
+#include "fec.h"
 
 #include "ext/live_picker.cpp" // FIXME FIXME FIXME FIXME
 
@@ -70,6 +72,21 @@ std::vector<LiveTransfer*> LiveTransfer::liveswarms;
 // live transfers get a transfer description (TD) above this offset
 #define TRANSFER_DESCR_LIVE_OFFSET  4000000
 
+
+/** Returns the aligned bins exactly covering chunks [from,to), left to right. */
+static binvector range2bins(uint64_t from, uint64_t to)
+{
+    binvector bv;
+    while (from < to) {
+        int layer = 0;
+        while (layer < 63 && !(from & (1ULL<<layer)) && from+(2ULL<<layer) <= to)
+            layer++;
+        bv.push_back(bin_t(layer,from>>layer));
+        from += 1ULL<<layer;
+    }
+    return bv;
+}
+
 /** A constructor for a live source. */
 LiveTransfer::LiveTransfer(std::string filename, KeyPair &keypair, std::string checkpoint_filename,
                            popt_cont_int_prot_t cipm, uint64_t disc_wnd, uint32_t nchunks_per_sign, uint32_t chunk_size) :
@@ -77,7 +94,13 @@ LiveTransfer::LiveTransfer(std::string filename, KeyPair &keypair, std::string c
     chunk_size_(chunk_size), am_source_(true),
     filename_(filename), last_chunkid_(0), offset_(0),
     chunks_since_sign_(0),
-    checkpoint_filename_(checkpoint_filename), checkpoint_bin_(bin_t::NONE)
+    checkpoint_filename_(checkpoint_filename), checkpoint_bin_(bin_t::NONE),
+    evfanout_ptr_(NULL), fanout_have_evb_(NULL), fanout_chunk_addr_(POPT_CHUNK_ADDR_CHUNK32), fanout_epoch_start_(0),
+    fanout_next_(0), fanout_left_(0), fanout_batch_(0), fanout_tick_(0),
+    last_epoch_time_(0), epoch_interval_(0), push_children_(SWIFT_LIVE_DEFAULT_PUSH_CHILDREN),
+    tier1_relays_(SWIFT_LIVE_DEFAULT_TIER1_RELAYS), evrebalance_ptr_(NULL),
+    fec_ratio_(SWIFT_LIVE_DEFAULT_FEC_RATIO), fec_loss_(0.0), fec_retransmits0_(0), fec_raw_up0_(0), fec_chunk_addr_(POPT_CHUNK_ADDR_CHUNK32),
+    fec_repairs_sent_(0), fec_recovered_(0)
 {
     Initialize(keypair,cipm,disc_wnd,nchunks_per_sign);
 
@@ -128,6 +151,7 @@ LiveTransfer::LiveTransfer(std::string filename, KeyPair &keypair, std::string c
     } else { // SIGNALL
         // Start generating chunks from rootbin.base_right()+1
     }
+    fanout_epoch_start_ = last_chunkid_;
 }
 
 
@@ -138,7 +162,13 @@ LiveTransfer::LiveTransfer(std::string filename, SwarmID &swarmid, Address &srca
     filename_(filename), last_chunkid_(0), offset_(0),
     chunks_since_sign_(0),
     checkpoint_filename_(""), checkpoint_bin_(bin_t::NONE),
-    srcaddr_(srcaddr)
+    srcaddr_(srcaddr),
+    evfanout_ptr_(NULL), fanout_have_evb_(NULL), fanout_chunk_addr_(POPT_CHUNK_ADDR_CHUNK32), fanout_epoch_start_(0),
+    fanout_next_(0), fanout_left_(0), fanout_batch_(0), fanout_tick_(0),
+    last_epoch_time_(0), epoch_interval_(0), push_children_(SWIFT_LIVE_DEFAULT_PUSH_CHILDREN),
+    tier1_relays_(SWIFT_LIVE_DEFAULT_TIER1_RELAYS), evrebalance_ptr_(NULL),
+    fec_ratio_(SWIFT_LIVE_DEFAULT_FEC_RATIO), fec_loss_(0.0), fec_retransmits0_(0), fec_raw_up0_(0), fec_chunk_addr_(POPT_CHUNK_ADDR_CHUNK32),
+    fec_repairs_sent_(0), fec_recovered_(0)
 {
     swarm_id_ = swarmid;
     SwarmPubKey spubkey = swarm_id_.spubkey();
@@ -216,6 +246,21 @@ LiveTransfer::~LiveTransfer()
         delete picker_;
         picker_ = NULL;
     }
+    if (evfanout_ptr_ != NULL) {
+        event_free(evfanout_ptr_);
+        evfanout_ptr_ = NULL;
+    }
+    if (fanout_have_evb_ != NULL) {
+        evbuffer_free(fanout_have_evb_);
+        fanout_have_evb_ = NULL;
+    }
+    if (evrebalance_ptr_ != NULL) {
+        event_free(evrebalance_ptr_);
+        evrebalance_ptr_ = NULL;
+    }
+    for (int i=0; i<fec_repair_evbs_.size(); i++)
+        evbuffer_free(fec_repair_evbs_[i]);
+    fec_repair_evbs_.clear();
 
     GlobalDel();
 }
@@ -311,6 +356,7 @@ int LiveTransfer::AddData(const void *buf, uint32_t nbyte)
     //    fprintf(stderr,"%s live: AddData: stored %d bytes\n", tintstr(), ret );
 
     uint64_t till = std::max((uint32_t)1,nbyte/chunk_size_);
+    uint64_t firstchunkid = last_chunkid_;
     bool newepoch=false;
     for (uint64_t c=0; c<till; c++) {
         // New chunk is here
@@ -356,60 +402,699 @@ int LiveTransfer::AddData(const void *buf, uint32_t nbyte)
             newepoch = true;
     }
 
-    fprintf(stderr,"live: AddData: added till chunkid %" PRIi64 "\n", last_chunkid_);
     dprintf("%s %%0 live: AddData: added till chunkid %" PRIi64 "\n", tintstr(), last_chunkid_);
 
+    // LIVEPUSH: Send to children straight away, children keep chunks of an
+    // epoch that is not signed yet until its munro arrives.
+    if (push_children_ > 0) {
+        binvector bv = range2bins(firstchunkid,last_chunkid_);
+        PushChunks(bv,NULL);
+    }
+
     // Arno, 2013-02-26: When UNIFIED_MERKLE chunks are published in batches
     // of nchunks_per_sign_
     if (!newepoch)
         return 0;
 
+    // LIVEFEC
+    if (FECEnabled())
+        EncodeRepairs(fanout_epoch_start_,last_chunkid_);
+
     // Announce chunks to peers via HAVEs
-    fprintf(stderr,"live: AddData: announcing to " PRISIZET " channels\n", mychannels_.size());
+    ScheduleFanout();
+
+    return 0;
+}
+
+
+/*
+ * FANOUT: Announcing a new epoch to all channels at once means a burst of
+ * sends and identical HAVE encodes for every peer. Instead, encode the HAVEs
+ * once and send to the channels in batches spread over part of the interval
+ * till the next epoch.
+ */
+void LiveTransfer::ScheduleFanout()
+{
+    binmap_t *ackptr = ack_out();
+    if (def_hs_out_.cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE)
+        ackptr = ack_out_signed();
+
+    // Split the new chunks into aligned bins
+    fanout_bins_ = range2bins(fanout_epoch_start_,last_chunkid_);
+    binvector::iterator iter;
+    for (iter=fanout_bins_.begin(); iter!=fanout_bins_.end(); iter++) {
+        if (!ackptr->is_filled(*iter)) {
+            // Not announceable, e.g. after checkpoint. Let channels find out.
+            fanout_bins_.clear();
+            break;
+        }
+    }
+    fanout_epoch_start_ = last_chunkid_;
+
+    if (fanout_have_evb_ == NULL)
+        fanout_have_evb_ = evbuffer_new();
+    evbuffer_drain(fanout_have_evb_,evbuffer_get_length(fanout_have_evb_));
+    fanout_chunk_addr_ = def_hs_out_.chunk_addr_;
+    for (iter=fanout_bins_.begin(); iter!=fanout_bins_.end(); iter++) {
+        evbuffer_add_8(fanout_have_evb_, SWIFT_HAVE);
+        evbuffer_add_chunkaddr(fanout_have_evb_,*iter,def_hs_out_.chunk_addr_,chunk_size_);
+    }
+    (void)evbuffer_pullup(fanout_have_evb_,-1);
+
+    // Spread over part of the (smoothed) epoch interval
+    if (last_epoch_time_ > 0) {
+        tint interval = NOW - last_epoch_time_;
+        if (epoch_interval_ == 0)
+            epoch_interval_ = interval;
+        else
+            epoch_interval_ = (epoch_interval_*3 + interval) / 4;
+    }
+    last_epoch_time_ = NOW;
+
+    uint32_t nchannels = mychannels_.size();
+    tint spread = epoch_interval_ * SWIFT_LIVE_FANOUT_SPREAD_PERCENT / 100;
+    tint nticks = spread / SWIFT_LIVE_FANOUT_MIN_TICK;
+    if (nticks > nchannels)
+        nticks = nchannels;
+    if (nticks < 1)
+        nticks = 1;
+    fanout_batch_ = (nchannels + nticks - 1) / nticks;
+    fanout_tick_ = spread / nticks;
+
+    // Continue at the cursor, so channels not reached last epoch go first
+    fanout_left_ = nchannels;
+
+    dprintf("%s %%0 live: fanout: %" PRIu32 " channels, %" PRIu32 " per %" PRIi64 " us\n", tintstr(),
+            nchannels, fanout_batch_, fanout_tick_);
+
+    if (evfanout_ptr_ == NULL)
+        evfanout_ptr_ = evtimer_new(Channel::evbase,&LiveTransfer::LibeventFanoutCallback,this);
+    else
+        evtimer_del(evfanout_ptr_);
+    FanoutSend();
+}
+
+
+void LiveTransfer::FanoutSend()
+{
+    uint32_t sent = 0;
+    while (fanout_left_ > 0 && sent < fanout_batch_ && mychannels_.size() > 0) {
+        if (fanout_next_ >= mychannels_.size())
+            fanout_next_ = 0;
+        Channel *c = mychannels_[fanout_next_++];
+        fanout_left_--;
+        //DDOS
+        if (c->is_established() && IsServed(c)) {
+            dprintf("%s %%0 live: fanout: send on channel %d\n", tintstr(), c->id());
+            c->LiveSend();
+            SendRepairs(c);
+            sent++;
+        }
+    }
+    if (fanout_left_ > 0 && mychannels_.size() > 0)
+        evtimer_add(evfanout_ptr_,tint2tv(fanout_tick_));
+}
+
+
+void LiveTransfer::LibeventFanoutCallback(int fd, short event, void *arg)
+{
+    Channel::Time();
+    LiveTransfer *lt = (LiveTransfer *)arg;
+    lt->FanoutSend();
+}
+
+
+/*
+ * LIVEPUSH: With REQUEST-driven download each hop costs an extra RTT: the
+ * HAVE must arrive before the chunk is requested. In push mode the source
+ * and relays send new chunks to a fixed set of children (the first
+ * push_children_ established channels, skipping peers that push to us) as
+ * soon as they can be announced. Children still pull whatever is lost or
+ * not pushed. In a mesh, enable it on relays only if the overlay is tree
+ * shaped, or peers get chunks from several parents.
+ */
+void LiveTransfer::PushChunks(binvector &bins, Channel *from)
+{
+    uint32_t nchildren = 0;
+    channels_t::iterator iter;
+    for (iter=mychannels_.begin(); iter!=mychannels_.end() && nchildren < push_children_; iter++) {
+        Channel *c = *iter;
+        if (c == from || !c->is_established() || c->PeerIsSource() || c->PeerPushes() || !IsServed(c))
+            continue;
+        c->LivePush(bins);
+        nchildren++;
+    }
+}
+
+
+bool LiveTransfer::AddFanoutHave(struct evbuffer *evb, binmap_t &have_out, binmap_t &ack,
+                                 popt_chunk_addr_t chunk_addr)
+{
+    if (fanout_bins_.size() == 0 || chunk_addr != fanout_chunk_addr_)
+        return false;
+
+    // Peer must know everything before the epoch and nothing of it
+    bin_t first = fanout_bins_.front();
+    bin_t missing = binmap_t::find_complement(have_out, ack, 0);
+    if (missing.is_none() || missing.base_offset() < first.base_offset())
+        return false;
+    binvector::iterator iter;
+    for (iter=fanout_bins_.begin(); iter!=fanout_bins_.end(); iter++) {
+        if (!have_out.is_empty(*iter))
+            return false;
+    }
+
+    evbuffer_add(evb,evbuffer_pullup(fanout_have_evb_,-1),evbuffer_get_length(fanout_have_evb_));
+    for (iter=fanout_bins_.begin(); iter!=fanout_bins_.end(); iter++)
+        have_out.set(*iter);
+    return true;
+}
+
+
+/*
+ * RELAYTREE: By default the source serves every peer that connects, so its
+ * upload grows with the audience. In relay overlay mode it only announces
+ * and serves chunks to tier1_relays_ first-tier relays. All other peers get
+ * the relays' addresses via PEX and download from them, or from peers
+ * further down. Free slots are filled as peers connect and relays leave,
+ * and every SWIFT_LIVE_RELAY_REBALANCE_INTERVAL the weakest relay is
+ * replaced by a peer with SWIFT_LIVE_RELAY_SWAP_FACTOR times its capacity.
+ *
+ * The source cannot observe what a peer uploads to others, so capacity is
+ * estimated from the path to the peer (window over RTT). Relays have grown
+ * their window by being served, which keeps the first tier stable.
+ */
+void LiveTransfer::SetTier1Relays(uint32_t nrelays)
+{
+    tier1_relays_ = nrelays;
+    if (!am_source_ || tier1_relays_ == 0)
+        return;
+    if (evrebalance_ptr_ == NULL) {
+        evrebalance_ptr_ = evtimer_new(Channel::evbase,&LiveTransfer::LibeventRebalanceCallback,this);
+        evtimer_add(evrebalance_ptr_,tint2tv(SWIFT_LIVE_RELAY_REBALANCE_INTERVAL));
+    }
+}
+
+
+bool LiveTransfer::IsRelay(Channel *c)
+{
+    return std::find(relays_.begin(),relays_.end(),c->id()) != relays_.end();
+}
+
+
+bool LiveTransfer::IsServed(Channel *c)
+{
+    return !am_source_ || tier1_relays_ == 0 || IsRelay(c);
+}
+
+
+void LiveTransfer::UpdateRelay(Channel *c)
+{
+    if (IsServed(c))
+        return;
+
+    if (relays_.size() >= tier1_relays_)
+        PruneRelays();
+    if (relays_.size() < tier1_relays_ && !c->IsScheduled4Delete()) {
+        relays_.push_back(c->id());
+        dprintf("%s #%" PRIu32 " live: relay: promoted, %d of %" PRIu32 "\n", tintstr(), c->id(),
+                (int)relays_.size(), tier1_relays_);
+        return;
+    }
+
+    // Steer to relays
+    if (c->is_established() && (c->GetRelayPexTime() == 0
+                                || c->GetRelayPexTime()+SWIFT_LIVE_RELAY_STEER_INTERVAL < NOW))
+        c->AddRelayPex(relays_);
+}
+
+
+Channel *LiveTransfer::RandomRelay(Channel *c)
+{
+    PruneRelays();
+    std::vector<uint32_t> others;
+    for (int i=0; i<relays_.size(); i++) {
+        if (relays_[i] != c->id())
+            others.push_back(relays_[i]);
+    }
+    if (others.size() == 0)
+        return NULL;
+    return Channel::channel(others[rand() % others.size()]);
+}
+
+
+void LiveTransfer::PruneRelays()
+{
+    std::vector<uint32_t>::iterator iter = relays_.begin();
+    while (iter != relays_.end()) {
+        Channel *c = Channel::channel(*iter);
+        if (c == NULL || c->transfer() != this || c->IsScheduled4Delete()) {
+            dprintf("%s #%" PRIu32 " live: relay: gone\n", tintstr(), *iter);
+            iter = relays_.erase(iter);
+        } else
+            iter++;
+    }
+}
+
+
+double LiveTransfer::RelayCapacity(Channel *c)
+{
+    tint rtt = std::max(c->rtt_avg(),(tint)TINT_MSEC);
+    double cap = (double)c->GetCwnd()*chunk_size_*TINT_SEC/(double)rtt;
+    // Peers behind NATs accept fewer incoming connections
+    if (c->peer().is_private())
+        cap /= 2.0;
+    return cap;
+}
+
+
+void LiveTransfer::Rebalance()
+{
+    PruneRelays();
+
+    // Best candidates first
+    std::vector<std::pair<double,uint32_t> > cands;
     channels_t::iterator iter;
     for (iter=mychannels_.begin(); iter!=mychannels_.end(); iter++) {
         Channel *c = *iter;
-        //DDOS
-        if (c->is_established()) {
-            dprintf("%s %%0 live: AddData: send on channel %d\n", tintstr(), c->id());
-            c->LiveSend();
+        if (c->is_established() && !c->IsScheduled4Delete() && !IsRelay(c))
+            cands.push_back(std::make_pair(RelayCapacity(c),c->id()));
+    }
+    std::sort(cands.rbegin(),cands.rend());
+
+    size_t next = 0;
+    while (relays_.size() < tier1_relays_ && next < cands.size()) {
+        relays_.push_back(cands[next++].second);
+        dprintf("%s #%" PRIu32 " live: relay: promoted on rebalance\n", tintstr(), relays_.back());
+    }
+    if (next >= cands.size() || relays_.size() == 0)
+        return;
+
+    // Replace weakest relay if much better candidate
+    int weakest = 0;
+    double weakestcap = DBL_MAX;
+    for (int i=0; i<relays_.size(); i++) {
+        Channel *c = Channel::channel(relays_[i]);
+        if (c == NULL)
+            continue;
+        double cap = RelayCapacity(c);
+        if (cap < weakestcap) {
+            weakest = i;
+            weakestcap = cap;
         }
     }
+    if (cands[next].first > weakestcap*SWIFT_LIVE_RELAY_SWAP_FACTOR) {
+        dprintf("%s #%" PRIu32 " live: relay: replaced by #%" PRIu32 " %.0lf > %.0lf\n", tintstr(), relays_[weakest],
+                cands[next].second, cands[next].first, weakestcap);
+        Channel *demoted = Channel::channel(relays_[weakest]);
+        relays_[weakest] = cands[next].second;
+        if (demoted != NULL)
+            demoted->AddRelayPex(relays_);
+    }
+}
 
-    return 0;
+
+void LiveTransfer::LibeventRebalanceCallback(int fd, short event, void *arg)
+{
+    Channel::Time();
+    LiveTransfer *lt = (LiveTransfer *)arg;
+    lt->Rebalance();
+    evtimer_add(lt->evrebalance_ptr_,tint2tv(SWIFT_LIVE_RELAY_REBALANCE_INTERVAL));
+}
+
+
+
+/*
+ * LIVEFEC: Over lossy links each lost chunk costs at least an RTT of
+ * REQUEST timeout and retransmission, which stalls playout near the live
+ * edge. With FEC the source sends repair chunks per epoch along with the
+ * fanout HAVEs. These are Reed-Solomon combinations of the chunks of the
+ * epoch (see fec.h), so a client that misses e chunks of a block and got e
+ * repairs reconstructs them as soon as the rest of the block is in, instead
+ * of waiting for the timeout. Repairs go only to peers that list
+ * SWIFT_LIVE_REPAIR in their POPT_SUPP_MSGS, i.e., that enabled FEC.
+ * They are queued on the channel and take the send slots that requested
+ * chunks leave free, so they count against the congestion window.
+ *
+ * In adaptive mode the ratio follows the share of upload that was
+ * retransmitted. As repairs reduce retransmissions, the estimate rises
+ * quickly but decays slowly.
+ */
+double LiveTransfer::CurrentFECRatio()
+{
+    if (fec_ratio_ != SWIFT_LIVE_FEC_ADAPTIVE)
+        return fec_ratio_;
+
+    uint64_t rtx = GetRetransmits() - fec_retransmits0_;
+    uint64_t up = GetRawBytes(DDIR_UPLOAD) - fec_raw_up0_;
+    fec_retransmits0_ = GetRetransmits();
+    fec_raw_up0_ = GetRawBytes(DDIR_UPLOAD);
+    if (up > 0) {
+        double loss = std::min(1.0,(double)rtx*chunk_size_/(double)up);
+        if (loss > fec_loss_)
+            fec_loss_ = loss;
+        else
+            fec_loss_ = (fec_loss_*7.0 + loss) / 8.0;
+    }
+    return std::min(fec_loss_*SWIFT_LIVE_FEC_LOSS_FACTOR,SWIFT_LIVE_FEC_MAX_RATIO);
+}
+
+
+void LiveTransfer::EncodeRepairs(uint64_t start, uint64_t end)
+{
+    for (int i=0; i<fec_repair_evbs_.size(); i++)
+        evbuffer_free(fec_repair_evbs_[i]);
+    fec_repair_evbs_.clear();
+    fec_chunk_addr_ = def_hs_out_.chunk_addr_;
+
+    double ratio = CurrentFECRatio();
+    if (ratio <= 0.0)
+        return;
+
+    std::vector<uint8_t> buf;
+    std::vector<const uint8_t *> data;
+    for (uint64_t first=start; first<end; first+=SWIFT_LIVE_FEC_MAX_BLOCK) {
+        uint32_t k = std::min(end-first,(uint64_t)SWIFT_LIVE_FEC_MAX_BLOCK);
+        uint32_t m = (uint32_t)ceil(ratio*k);
+        m = std::min(m,(uint32_t)SWIFT_FEC_MAX_SYMBOLS-k);
+
+        // Short reads, e.g. last chunk of a file, are zero padded
+        buf.assign((size_t)k*chunk_size_,0);
+        data.clear();
+        for (uint32_t i=0; i<k; i++) {
+            uint8_t *ptr = &buf[(size_t)i*chunk_size_];
+            if (storage_->Read((char *)ptr,chunk_size_,(first+i)*chunk_size_) < 0) {
+                print_error("live: fec: error reading chunk");
+                return;
+            }
+            data.push_back(ptr);
+        }
+
+        bin_t firstbin(0,first);
+        for (uint32_t j=0; j<m; j++) {
+            struct evbuffer *evb = evbuffer_new();
+            evbuffer_add_8(evb, SWIFT_LIVE_REPAIR);
+            evbuffer_add_chunkaddr(evb,firstbin,def_hs_out_.chunk_addr_,chunk_size_);
+            evbuffer_add_8(evb, k);
+            evbuffer_add_8(evb, j);
+
+            struct evbuffer_iovec vec;
+            if (evbuffer_reserve_space(evb, chunk_size_, &vec, 1) < 0) {
+                print_error("live: fec: error on evbuffer_reserve_space");
+                evbuffer_free(evb);
+                return;
+            }
+            FECCodec::Encode(k,j,data,(uint8_t *)vec.iov_base,chunk_size_);
+            vec.iov_len = chunk_size_;
+            evbuffer_commit_space(evb, &vec, 1);
+            fec_repair_evbs_.push_back(evb);
+        }
+        dprintf("%s %%0 live: fec: block %" PRIu64 " k %" PRIu32 " m %" PRIu32 " ratio %.2lf\n", tintstr(),
+                first, k, m, ratio);
+    }
+}
+
+
+void LiveTransfer::SendRepairs(Channel *c)
+{
+    if (fec_repair_evbs_.size() == 0 || !c->PeerSupportsRepair())
+        return;
+    for (int i=0; i<fec_repair_evbs_.size(); i++) {
+        if (!c->LiveQueueRepair(fec_repair_evbs_[i],fec_chunk_addr_))
+            return;
+    }
+}
+
+
+void LiveTransfer::OnRepair(bin_t first, uint32_t k, uint32_t repairidx, const uint8_t *data, uint32_t length)
+{
+    if (am_source_ || !FECEnabled())
+        return;
+
+    uint64_t firstc = first.layer_offset();
+    if (ack_out()->is_filled(bin_t(0,firstc)) && ack_out()->is_filled(bin_t(0,firstc+k-1))
+            && ack_out()->find_empty(bin_t(0,firstc)).base_offset() >= firstc+k)
+        return; // got all
+
+    fec_block_t &block = fec_blocks_[firstc];
+    if (block.k != k) {
+        block.k = k;
+        block.repairidx.clear();
+        block.repairs.clear();
+    }
+    if (std::find(block.repairidx.begin(),block.repairidx.end(),repairidx) != block.repairidx.end())
+        return;
+    block.repairidx.push_back(repairidx);
+    size_t off = block.repairs.size();
+    block.repairs.resize(off+chunk_size_,0);
+    memcpy(&block.repairs[off],data,std::min(length,chunk_size_));
+
+    // Forget the oldest blocks
+    while (fec_blocks_.size() > SWIFT_LIVE_FEC_MAX_PENDING_BLOCKS)
+        fec_blocks_.erase(fec_blocks_.begin());
+
+    TryRepair(firstc);
+}
+
+
+void LiveTransfer::OnRepairData(bin_t pos)
+{
+    if (fec_blocks_.size() == 0)
+        return;
+    uint64_t c = pos.layer_offset();
+    std::map<uint64_t,fec_block_t>::iterator iter = fec_blocks_.upper_bound(c);
+    if (iter == fec_blocks_.begin())
+        return;
+    iter--;
+    if (c < iter->first + iter->second.k)
+        TryRepair(iter->first);
+}
+
+
+void LiveTransfer::TryRepair(uint64_t first)
+{
+    std::map<uint64_t,fec_block_t>::iterator iter = fec_blocks_.find(first);
+    if (iter == fec_blocks_.end())
+        return;
+    fec_block_t &block = iter->second;
+
+    std::vector<bool> present(block.k,false);
+    uint32_t npresent = 0;
+    for (uint32_t i=0; i<block.k; i++) {
+        present[i] = ack_out()->is_filled(bin_t(0,first+i));
+        if (present[i])
+            npresent++;
+    }
+    if (npresent == block.k) {
+        fec_blocks_.erase(iter);
+        return;
+    }
+    if (npresent+block.repairidx.size() < block.k)
+        return;
+
+    std::vector<uint8_t> buf((size_t)block.k*chunk_size_,0);
+    std::vector<uint8_t *> data;
+    for (uint32_t i=0; i<block.k; i++) {
+        uint8_t *ptr = &buf[(size_t)i*chunk_size_];
+        if (present[i] && storage_->Read((char *)ptr,chunk_size_,(first+i)*chunk_size_) < 0) {
+            print_error("live: fec: error reading chunk");
+            return;
+        }
+        data.push_back(ptr);
+    }
+    std::vector<const uint8_t *> repairs;
+    for (uint32_t j=0; j<block.repairidx.size(); j++)
+        repairs.push_back(&block.repairs[(size_t)j*chunk_size_]);
+
+    uint32_t nrecovered = 0;
+    if (FECCodec::Decode(block.k,data,present,block.repairidx,repairs,chunk_size_)) {
+        for (uint32_t i=0; i<block.k; i++) {
+            if (!present[i] && OfferChunk(bin_t(0,first+i),data[i],chunk_size_))
+                nrecovered++;
+        }
+    }
+    dprintf("%s %%0 live: fec: block %" PRIu64 " recovered %" PRIu32 " of %" PRIu32 "\n", tintstr(), first,
+            nrecovered, block.k-npresent);
+    fec_recovered_ += nrecovered;
+    fec_blocks_.erase(iter);
+}
+
+
+bool LiveTransfer::OfferChunk(bin_t pos, const uint8_t *data, uint32_t length)
+{
+    if (!ack_out()->is_empty(pos))
+        return false;
+
+    if (def_hs_out_.cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE) {
+        // Check integrity, also writes to storage
+        if (!hashtree()->OfferData(pos, (char *)data, length)) {
+            dprintf("%s %%0 live: offer: !data %s\n", tintstr(), pos.str().c_str());
+            return false;
+        }
+    } else {
+        if (storage_->Write(data,length,pos.base_offset()*chunk_size_) < 0) {
+            print_error("live: offer: storage Write failed");
+            return false;
+        }
+        ack_out()->set(pos);
+    }
+    dprintf("%s %%0 live: offer: -data %s\n", tintstr(), pos.str().c_str());
+
+    bin_t cover = ack_out()->cover(pos);
+    Progress(cover);
+
+    if (def_hs_out_.live_disc_wnd_ != POPT_LIVE_DISC_WND_ALL && hashtree() != NULL)
+        OnDataPruneTree(def_hs_out_,pos,((LiveHashTree *)hashtree())->GetNChunksPerSig());
+
+    // LIVEPUSH: Relay to our children
+    if (push_children_ > 0) {
+        binvector bv;
+        bv.push_back(pos);
+        PushChunks(bv,NULL);
+    }
+    return true;
 }
 
 
+/*
+ * LIVEPUSH: The source pushes chunks as soon as they are added, before the
+ * epoch they belong to is signed. A child can't check them yet, so it keeps
+ * them till the signed munro arrives and checks them against it. The uncle
+ * hashes are not sent, they follow from the other chunks of the epoch.
+ */
+bool LiveTransfer::OnPushedData(bin_t pos, const uint8_t *data, uint32_t length)
+{
+    if (def_hs_out_.cont_int_prot_ != POPT_CONT_INT_PROT_UNIFIED_MERKLE || !pos.is_base())
+        return false;
+    LiveHashTree *umt = (LiveHashTree *)hashtree();
+    bin_t munro = umt->GetMunro(pos);
+    if (munro.is_none())
+        return false;
+
+    push_pending_[pos.layer_offset()] = std::string((const char *)data,length);
+    while (push_pending_.size() > SWIFT_LIVE_PUSH_MAX_PENDING)
+        push_pending_.erase(push_pending_.begin());
+    dprintf("%s %%0 live: push: keep %s till munro %s\n", tintstr(), pos.str().c_str(), munro.str().c_str());
+
+    VerifyPushed(munro);
+    return true;
+}
+
+
+void LiveTransfer::VerifyPushed(bin_t munro)
+{
+    if (push_pending_.empty() || munro.is_none())
+        return;
+    LiveHashTree *umt = (LiveHashTree *)hashtree();
+    Node *n = umt->FindNode(munro);
+    if (n == NULL || !n->GetVerified())
+        return;
+
+    std::map<bin_t,Sha1Hash> hashes;
+    std::map<uint64_t,std::string>::iterator iter = push_pending_.lower_bound(munro.base_offset());
+    while (iter != push_pending_.end() && iter->first <= munro.base_right().layer_offset()) {
+        bin_t pos(0,iter->first);
+        if (!ack_out()->is_empty(pos)) {
+            push_pending_.erase(iter++);
+            continue;
+        }
+
+        // Uncles from the tree or the other chunks kept. Remember its own
+        // hash, it is gone from push_pending_ when its siblings need it.
+        PushedHash(pos,hashes);
+        binvector uncles;
+        std::vector<Sha1Hash> unclehashes;
+        bin_t p = pos;
+        for (; p!=munro; p=p.parent()) {
+            Sha1Hash h = PushedHash(p.sibling(),hashes);
+            if (h == Sha1Hash::ZERO)
+                break;
+            uncles.push_back(p.sibling());
+            unclehashes.push_back(h);
+        }
+        if (p != munro) {
+            iter++;
+            continue;
+        }
+
+        // Like a DATA message: uncles in descending layer order, then chunk
+        for (int i=uncles.size()-1; i>=0; i--)
+            umt->OfferHash(uncles[i],unclehashes[i]);
+        std::string data = iter->second;
+        push_pending_.erase(iter++);
+        if (OfferChunk(pos,(const uint8_t *)data.data(),data.length()))
+            OnRepairData(pos);
+        else {
+            // Counted like a chunk failing in Channel::OnData()
+            Channel::global_hash_check_fails++;
+            OnHashCheckFail();
+            dprintf("%s %%0 live: push: !data %s munro %s\n", tintstr(), pos.str().c_str(), munro.str().c_str());
+        }
+    }
+}
+
+
+Sha1Hash LiveTransfer::PushedHash(bin_t pos, std::map<bin_t,Sha1Hash> &hashes)
+{
+    std::map<bin_t,Sha1Hash>::iterator iter = hashes.find(pos);
+    if (iter != hashes.end())
+        return iter->second;
+
+    Sha1Hash h = Sha1Hash::ZERO;
+    Node *n = ((LiveHashTree *)hashtree())->FindNode(pos);
+    if (n != NULL && n->GetVerified() && n->GetHash() != Sha1Hash::ZERO)
+        h = n->GetHash();
+    else if (pos.is_base()) {
+        std::map<uint64_t,std::string>::iterator piter = push_pending_.find(pos.layer_offset());
+        if (piter != push_pending_.end())
+            h = Sha1Hash(piter->second.data(),piter->second.length());
+    } else {
+        Sha1Hash left = PushedHash(pos.left(),hashes);
+        Sha1Hash right = PushedHash(pos.right(),hashes);
+        if (left != Sha1Hash::ZERO && right != Sha1Hash::ZERO)
+            h = Sha1Hash(left,right);
+    }
+    hashes[pos] = h;
+    return h;
+}
+
 void LiveTransfer::UpdateSignedAckOut()
 {
     // Arno, 2013-02-26: Can only send HAVEs covered by signed peaks
     // At this point in time, peaks == signed peaks
     LiveHashTree *umt = (LiveHashTree *)hashtree();
 
-    signed_ack_out_.clear();
-    for (int i=0; i<umt->peak_count(); i++) {
+    // Peaks only grow: a new munro becomes a peak or merges with older peaks
+    // into a bigger one. So just add the peaks that changed since last epoch,
+    // the bins they replace are covered by them.
+    bool newroot = false;
+    int i=0;
+    for (; i<umt->peak_count(); i++) {
         bin_t sigpeak = umt->peak(i);
+        if (i < signed_peaks_.size() && signed_peaks_[i] == sigpeak)
+            continue;
         signed_ack_out_.set(sigpeak);
+        if (checkpoint_bin_ != bin_t::NONE && sigpeak.base_offset() <= checkpoint_bin_.base_right().base_offset())
+            newroot = true;
 
         //fprintf(stderr,"live: AddData: UMT: DOHAVE %s %s %s\n", sigpeak.str().c_str(), sigpeak.base_left().str().c_str(), sigpeak.base_right().str().c_str() );
     }
+    signed_peaks_.resize(umt->peak_count());
+    for (i=0; i<umt->peak_count(); i++)
+        signed_peaks_[i] = umt->peak(i);
+
     // LIVECHECKPOINT, see constructor
     // SIGNMUNRO
-    if (checkpoint_bin_ != bin_t::NONE) {
-        for (int i=0; i<=checkpoint_bin_.layer_offset(); i++) {
-            bin_t clearbin(checkpoint_bin_.layer(),i);
-            signed_ack_out_.reset(clearbin);
-
-            //fprintf(stderr,"live: AddData: UMT: UNHAVE %s %s %s\n", clearbin.str().c_str(), clearbin.base_left().str().c_str(), clearbin.base_right().str().c_str() );
+    // Chunks left of and including the checkpoint are never announced. Only
+    // a new peak over them (first epoch, tree grew a layer) sets them again.
+    if (newroot) {
+        binvector bv = range2bins(0,checkpoint_bin_.base_right().base_offset()+1);
+        binvector::iterator iter;
+        for (iter=bv.begin(); iter!=bv.end(); iter++) {
+            signed_ack_out_.reset(*iter);
+
+            //fprintf(stderr,"live: AddData: UMT: UNHAVE %s\n", (*iter).str().c_str() );
         }
-        // TEST
-        /* fprintf(stderr,"live: AddData: UMT: checkp %s\n", checkpoint_bin_.str().c_str() );
-        bin_t bf = signed_ack_out_.find_filled();
-        bin_t be = signed_ack_out_.find_empty();
-        bin_t sbe = signed_ack_out_.find_empty(checkpoint_bin_);
-
-        fprintf(stderr,"live: AddData: UMT: bf %s be %s sbe %s\n", bf.str().c_str(), be.str().c_str(), sbe.str().c_str() );
-        */
     }
 }
 
@@ -438,7 +1123,7 @@ binmap_t *LiveTransfer::ack_out()
 }
 
 
-void LiveTransfer::OnVerifiedMunroHash(bin_t munro, tint sourcet)
+void LiveTransfer::OnVerifiedMunroHash(bin_t munro, tint sourcet, uint32_t channelid)
 {
     // Channel sendc received a correctly signed munro.
     LiveHashTree *umt = (LiveHashTree *)hashtree();
@@ -447,7 +1132,7 @@ void LiveTransfer::OnVerifiedMunroHash(bin_t munro, tint sourcet)
 
     // Arno, 2013-05-22: Hook-in using signed peaks in UMT.
     LivePiecePicker *lpp = (LivePiecePicker *)picker_;
-    lpp->AddPeerMunro(munro, sourcet);
+    lpp->AddPeerMunro(munro, sourcet, channelid);
 }
 
 
@@ -620,20 +1305,98 @@ bin_t LiveTransfer::GetSourceCurrentPos()
 }
 
 
+uint64_t LiveTransfer::GetLastChunkID()
+{
+    if (am_source_)
+        return last_chunkid_;
+    if (picker() == NULL)
+        return 0;
+    bin_t cpos = ((LivePiecePicker *)picker())->GetCurrentPos();
+    if (cpos.is_none() || cpos.is_all())
+        return 0;
+    return cpos.base_offset();
+}
+
+
 /*
  * Channel extensions for live
  */
 
+void Channel::LivePush(binvector &bins)
+{
+    binvector::iterator iter;
+    for (iter=bins.begin(); iter!=bins.end(); iter++) {
+        if (ack_in_.is_filled(*iter))
+            continue;
+        push_in_.push_back(tintbin(NOW,*iter));
+        hint_in_size_ += (*iter).base_length();
+        dprintf("%s #%" PRIu32 " +push %s\n",tintstr(),id_,(*iter).str().c_str());
+    }
+    Reschedule();
+}
+
+
+void Channel::OnUnrequestedData()
+{
+    // A single one may be the late answer to a REQUEST we already gave up
+    // on, so only a run of them shows the peer pushes to us.
+    if (push_in_time_ < NOW-SWIFT_LIVE_PUSH_EVIDENCE_TIME)
+        push_in_count_ = 0;
+    push_in_count_++;
+    push_in_time_ = NOW;
+}
+
+
+void Channel::AddRelayPex(std::vector<uint32_t> &relayids)
+{
+    for (int i=0; i<relayids.size(); i++) {
+        if (relayids[i] == id_)
+            continue;
+        bool queued = false;
+        tbqueue::iterator iter;
+        for (iter=reverse_pex_out_.begin(); iter!=reverse_pex_out_.end(); iter++) {
+            if ((*iter).bin.toUInt() == relayids[i]) {
+                queued = true;
+                break;
+            }
+        }
+        if (!queued)
+            reverse_pex_out_.push_back(tintbin(NOW,bin_t(relayids[i])));
+    }
+    relay_pex_time_ = NOW;
+    dprintf("%s #%" PRIu32 " live: relay: steer to %d relays\n",tintstr(),id_,(int)relayids.size());
+    if (send_control_ == KEEP_ALIVE_CONTROL && reverse_pex_out_.size() > 0)
+        Reschedule();
+}
+
+
 void Channel::LiveSend()
 {
-    //fprintf(stderr,"live: LiveSend: channel %d\n", id() );
+    // SAFECLOSE
+    if (evsend_ptr_ == NULL)
+        return;
+
+    // Bring the next send forward to when congestion control allows it,
+    // Reschedule() sends directly if that is now.
+    live_have_due_ = true;
+    Reschedule();
+}
+
+
+bool Channel::LiveQueueRepair(struct evbuffer *repair, popt_chunk_addr_t chunk_addr)
+{
+    if (hs_out_->chunk_addr_ != chunk_addr)
+        return false;
 
-    if (evsendlive_ptr_ == NULL) {
-        evsendlive_ptr_ = new struct event;
-        // Arno, 2013-02-01: Don't reassign, causes crashes.
-        evtimer_assign(evsendlive_ptr_,evbase,&Channel::LibeventSendCallback,this);
+    // Repairs of an old epoch are of least use, drop those first
+    if (repair_out_.size() >= SWIFT_LIVE_FEC_MAX_QUEUED) {
+        evbuffer_free(repair_out_.front());
+        repair_out_.pop_front();
     }
-    //fprintf(stderr,"live: LiveSend: next %" PRIi64 "\n", next_send_time_ );
-    evtimer_add(evsendlive_ptr_,tint2tv(next_send_time_));
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add(evb,evbuffer_pullup(repair,-1),evbuffer_get_length(repair));
+    repair_out_.push_back(evb);
+    Reschedule();
+    return true;
 }
 
@@ -399,7 +399,7 @@ Sha1Hash  LiveHashTree::DeriveRoot()
 }
 
 
-bool LiveHashTree::InitFromCheckpoint(BinHashSigTuple lastmunrotup)
+bool LiveHashTree::InitFromCheckpoint(BinHashSigTuple lastmunrotup, bool verified)
 {
     fprintf(stderr,"umt: InitFromCheckpoint: %s %s %" PRIi64 " %s\n", lastmunrotup.bin().str().c_str(),
             lastmunrotup.hash().hex().c_str(), lastmunrotup.sigtint().time(), lastmunrotup.sigtint().sig().hex().c_str());
@@ -417,7 +417,9 @@ bool LiveHashTree::InitFromCheckpoint(BinHashSigTuple lastmunrotup)
     OfferHash(lastmunrotup.bin(),lastmunrotup.hash());
 
     // Add lastmunrotup sig to tree
-    if (!OfferSignedMunroHash(lastmunrotup.bin(),lastmunrotup.sigtint())) {
+    bool added = verified ? AddVerifiedMunro(lastmunrotup.bin(),lastmunrotup.sigtint())
+                 : OfferSignedMunroHash(lastmunrotup.bin(),lastmunrotup.sigtint());
+    if (!added) {
         fprintf(stderr,"umt: InitFromCheckpoint: failed!\n");
         return false;
     }
@@ -502,7 +504,12 @@ bool LiveHashTree::OfferSignedMunroHash(bin_t pos, SigTintTuple &sigtint)
         fprintf(stderr,"umt: OfferSignedMunroHash: signature wrong! %s\n", pos.str().c_str());
         return false;
     }
+    return AddVerifiedMunro(pos,sigtint);
+}
+
 
+bool LiveHashTree::AddVerifiedMunro(bin_t pos, SigTintTuple &sigtint)
+{
     // Check if sane
     bin_t oldmunro = GetLastMunro();
     if (oldmunro != bin_t::NONE && oldmunro.layer_offset()+1 != pos.layer_offset()) {
@@ -519,8 +526,8 @@ bool LiveHashTree::OfferSignedMunroHash(bin_t pos, SigTintTuple &sigtint)
 
         // Grow tree such that munro fits in it, and other peers can send
         // other munros (e.g. older)
-        // NOTE: recursive call, InitFromCheckpoint calls OfferSignedMunroHash
-        InitFromCheckpoint(BinHashSigTuple(cand_munro_bin_,cand_munro_hash_,sigtint));
+        // NOTE: recursive call, InitFromCheckpoint calls AddVerifiedMunro
+        InitFromCheckpoint(BinHashSigTuple(cand_munro_bin_,cand_munro_hash_,sigtint),true);
         return true;
     }
 
@@ -932,7 +939,7 @@ bin_t LiveHashTree::peak(int i) const
     return peak_bins_[i]; // TODOinline
 }
 
-const Sha1Hash& LiveHashTree::peak_hash(int i) const
+Sha1Hash LiveHashTree::peak_hash(int i) const
 {
     return hash(peak(i)); // TODOinline
 }
@@ -946,7 +953,7 @@ bin_t LiveHashTree::peak_for(bin_t pos) const
     return bin_t::NONE;
 }
 
-const Sha1Hash& LiveHashTree::hash(bin_t pos) const
+Sha1Hash LiveHashTree::hash(bin_t pos) const
 {
     // This API may not be fastest with dynamic tree.
     Node *n = FindNode(pos);
@@ -174,6 +174,9 @@ namespace swift
         void        PruneTree(bin_t pos);
 
         bool        OfferSignedMunroHash(bin_t pos, SigTintTuple &sigtint);
+        /** Add munro offered via OfferHash whose signature checked out.
+         * Public for testing */
+        bool        AddVerifiedMunro(bin_t pos, SigTintTuple &sigtint);
 
         /** Add node to the hashtree */
         bool CreateAndVerifyNode(bin_t pos, const Sha1Hash &hash, bool verified);
@@ -181,7 +184,8 @@ namespace swift
         bool SetVerifiedIfNot0(Node *piter, bin_t p, int verclass);
 
         // LIVECHECKPOINT
-        bool InitFromCheckpoint(BinHashSigTuple lastmunrotup);
+        /** verified: signature of lastmunrotup already checked */
+        bool InitFromCheckpoint(BinHashSigTuple lastmunrotup, bool verified=false);
 
         /** Returns size of signature on the wire */
         uint16_t    GetSigSizeInBytes();
@@ -201,9 +205,9 @@ namespace swift
         bool            OfferData(bin_t bin, const char* data, size_t length);
         int             peak_count() const;
         bin_t           peak(int i) const;
-        const Sha1Hash& peak_hash(int i) const;
+        Sha1Hash        peak_hash(int i) const;
         bin_t           peak_for(bin_t pos) const;
-        const Sha1Hash& hash(bin_t pos) const;
+        Sha1Hash        hash(bin_t pos) const;
         const Sha1Hash& root_hash() const;
         uint64_t        size() const;
         uint64_t        size_in_chunks() const;
@@ -29,23 +29,33 @@ const char* Channel::SEND_CONTROL_MODES[] = {"keepalive", "pingpong",
 tint Channel::NextSendTime()
 {
     TimeoutDataOut(); // precaution to know free cwnd
+    tint next = TINT_NEVER;
     switch (send_control_) {
     case KEEP_ALIVE_CONTROL:
-        return KeepAliveNextSendTime();
+        next = KeepAliveNextSendTime();
+        break;
     case PING_PONG_CONTROL:
-        return PingPongNextSendTime();
+        next = PingPongNextSendTime();
+        break;
     case SLOW_START_CONTROL:
-        return SlowStartNextSendTime();
+        next = SlowStartNextSendTime();
+        break;
     case AIMD_CONTROL:
-        return AimdNextSendTime();
+        next = AimdNextSendTime();
+        break;
     case LEDBAT_CONTROL:
-        return LedbatNextSendTime();
+        next = LedbatNextSendTime();
+        break;
     case CLOSE_CONTROL:
         return TINT_NEVER;
     default:
         fprintf(stderr,"send_control.cpp: unknown control %d\n", send_control_);
         return TINT_NEVER;
     }
+    // ACKAGG: Delayed ACKs go out on their own if nothing else does
+    if (send_control_ != CLOSE_CONTROL)
+        next = std::min(next,AckDueTime());
+    return next;
 }
 
 tint Channel::SwitchSendControl(send_control_t control_mode)
@@ -81,6 +91,7 @@ tint Channel::SwitchSendControl(send_control_t control_mode)
         break;
     }
     send_control_ = control_mode;
+    tevent(TRACE_CWND,send_control_,(uint64_t)(cwnd_*1000));
     return NextSendTime();
 }
 
@@ -90,7 +101,11 @@ tint Channel::KeepAliveNextSendTime()
         lprintf("\t\t==== Switch to Close Control ==== \n");
         return SwitchSendControl(CLOSE_CONTROL);
     }
-    if (ack_rcvd_recent_ && hint_in_size_) {
+    // LIVEPUSH: pushed chunks need no prior ACK to get going, but not to
+    // a quiet peer as CwndRateNextSendTime() would switch right back.
+    // Likewise LIVEFEC repairs.
+    if ((ack_rcvd_recent_ && hint_in_size_) ||
+            ((!push_in_.empty() || !repair_out_.empty()) && last_recv_time_>=NOW-rtt_avg_*8)) {
         if (keepalivereason_==NOTHING_TO_SEND) {
             lprintf("\t\t==== Switch back to LEDBAT ==== \n");
             keepalivereason_ = NONE;
@@ -100,10 +115,10 @@ tint Channel::KeepAliveNextSendTime()
             return SwitchSendControl(SLOW_START_CONTROL);
         }
     }
-    if (data_in_.time!=TINT_NEVER)
+    if (AckDueTime()<=NOW)
         return NOW;
 
-    if (live_have_no_hint_) {
+    if (live_have_no_hint_ || live_have_due_) {
         live_have_no_hint_ = false;
         return NOW;
     }
@@ -115,8 +130,14 @@ tint Channel::KeepAliveNextSendTime()
     not what we want. The scheduled time for the next packet should be unchanged
     on reception."
     */
-    if (!reverse_pex_out_.empty())
-        return reverse_pex_out_.front().time;
+    // RELAYTREE: A reverse PEX due later must not postpone regular sends,
+    // peers steered to us wait for our HAVEs.
+    tint reverse_pex_time = TINT_NEVER;
+    if (!reverse_pex_out_.empty()) {
+        reverse_pex_time = reverse_pex_out_.front().time;
+        if (reverse_pex_time <= last_send_time_ + send_interval_)
+            return reverse_pex_time;
+    }
 
     // Arno: Fix that doesn't do exponential growth always, only after sends
     // without following recvs
@@ -139,7 +160,7 @@ tint Channel::KeepAliveNextSendTime()
     }
     if (send_interval_>MAX_SEND_INTERVAL)
         send_interval_ = MAX_SEND_INTERVAL;
-    return last_send_time_ + send_interval_;
+    return std::min(last_send_time_ + send_interval_,reverse_pex_time);
 }
 
 tint Channel::PingPongNextSendTime()    // FIXME INFINITE LOOP
@@ -153,7 +174,7 @@ tint Channel::PingPongNextSendTime()    // FIXME INFINITE LOOP
         lprintf("\t\t==== Switch to Slow Start Control ==== \n");
         return SwitchSendControl(SLOW_START_CONTROL);
     }
-    if (data_in_.time!=TINT_NEVER)
+    if (AckDueTime()<=NOW)
         return NOW;
     if (last_recv_time_>last_send_time_)
         return NOW;
@@ -164,8 +185,8 @@ tint Channel::PingPongNextSendTime()    // FIXME INFINITE LOOP
 
 tint Channel::CwndRateNextSendTime()
 {
-    if (data_in_.time!=TINT_NEVER)
-        return NOW; // TODO: delayed ACKs
+    if (AckDueTime()<=NOW)
+        return NOW;
     if (last_recv_time_<NOW-rtt_avg_*8) {
         lprintf("\t\t==== Switch to Keep Alive Control (last_recv_time_<NOW-rtt_avg_*8) ==== \n");
         return SwitchSendControl(KEEP_ALIVE_CONTROL);
@@ -195,6 +216,9 @@ tint Channel::CwndRateNextSendTime()
     } else {
         dprintf("%s #%" PRIu32 " sendctrl avoid sending (cwnd %.2f, data_out %" PRIu32 ")\n",
                 tintstr(),id_,cwnd_,data_out_size_);
+        // LIVEFEC: only repairs in the window
+        if (data_out_.empty() && !repair_sent_.empty())
+            return repair_sent_.front() + rtt_avg_;
         assert(data_out_.front().time!=TINT_NEVER);
         return data_out_.front().time + ack_timeout();
     }
@@ -10,6 +10,7 @@
 #include "compat.h"
 #include "bin_utils.h"
 #include "swift.h"
+#include "fec.h"
 #include <algorithm>  // kill it
 #include <cassert>
 #include <cfloat>
@@ -63,13 +64,18 @@ void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransm
 
         if (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE) {
             if (pos != bin_t::NONE)
-                AddFileUncleHashes(evb,pos);
+                AddFileUncleHashes(evb,pos,isretransmit);
         }
     } else {
         // LIVE
         if (PeerIsSource())
             return;
 
+        // RELAYTREE: Peers steered to relays hook in on the relays' munros
+        LiveTransfer *lt = (LiveTransfer *)transfer();
+        if (!lt->IsServed(this))
+            return;
+
         // See if there is a first, or new signed munro to send
         bin_t munro = bin_t::NONE;
         if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_NONE) {
@@ -78,20 +84,31 @@ void Channel::AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransm
             LivePiecePicker *lpp = (LivePiecePicker *)transfer()->picker();
             if (lpp == NULL) {
                 // I am source
-                LiveTransfer *lt = (LiveTransfer *)transfer();
                 munro = lt->GetSourceCurrentPos();
             } else
                 munro = lpp->GetCurrentPos();
         } else { //POPT_CONT_INT_PROT_UNIFIED_MERKLE
             LiveHashTree *umt = (LiveHashTree *)hashtree();
+            // LIVEPUSH: Chunks pushed before their epoch was signed went
+            // without hashes, send the munro as soon as it is signed.
+            bin_t last = umt->GetLastMunro();
+            if (!last.is_none() && last != push_munro_out_ && last != last_sent_munro_ && !push_out_.is_empty(last)
+                    && umt->GetSignedMunro(last).bin() != bin_t::NONE) {
+                AddLiveSignedMunroHash(evb,last);
+                push_munro_out_ = last;
+                last_sent_munro_ = last;
+            }
             if (pos == bin_t::NONE) {
                 // Initially send last signed munro
-                munro = umt->GetLastMunro();
+                munro = last;
             } else {
                 // After, send munro required for pos
                 munro = umt->GetMunro(pos);
                 if (munro == bin_t::NONE)
                     return;
+                // LIVEPUSH: Not signed yet, the peer checks it when it is
+                if (umt->GetSignedMunro(munro).bin() == bin_t::NONE)
+                    return;
             }
         }
 
@@ -131,8 +148,10 @@ void Channel::AddUnsignedPeakHashes(struct evbuffer *evb)
     for (int i=0; i<hashtree()->peak_count(); i++) {
         bin_t peak = hashtree()->peak(i);
         evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_);
-        evbuffer_add_hash(evb, hashtree()->peak_hash(i));
+        evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_,transfer()->chunk_size());
+        Sha1Hash h = hashtree()->peak_hash(i);
+        evbuffer_add_hash(evb, h);
+        global_hash_bytes_up += h.size();
         dprintf("%s #%" PRIu32 " +phash %s\n",tintstr(),id_,peak.str().c_str());
     }
 }
@@ -161,8 +180,9 @@ void Channel::AddLiveSignedMunroHash(struct evbuffer *evb, bin_t munro)
 
     if (hs_out_->cont_int_prot_ != POPT_CONT_INT_PROT_NONE) {
         evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_);
+        evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_,transfer()->chunk_size());
         evbuffer_add_hash(evb, bhst.hash());
+        global_hash_bytes_up += Sha1Hash::SIZE;
     }
 
     dprintf("%s #%" PRIu32 " +mhash %s\n",tintstr(),id_,bhst.bin().str().c_str());
@@ -170,7 +190,7 @@ void Channel::AddLiveSignedMunroHash(struct evbuffer *evb, bin_t munro)
     //fprintf(stderr,"AddLiveSignedMunroHash: speak %s %s\n", bhst.bin().str().c_str(), bhst.hash().hex().c_str() );
 
     evbuffer_add_8(evb, SWIFT_SIGNED_INTEGRITY);
-    evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_);
+    evbuffer_add_chunkaddr(evb,bhst.bin(),hs_out_->chunk_addr_,transfer()->chunk_size());
     evbuffer_add_64be(evb, bhst.sigtint().time());
     evbuffer_add(evb, bhst.sigtint().sig().bits(), bhst.sigtint().sig().length());
 
@@ -179,17 +199,25 @@ void Channel::AddLiveSignedMunroHash(struct evbuffer *evb, bin_t munro)
 
 
 
-void Channel::AddFileUncleHashes(struct evbuffer *evb, bin_t pos)
+void Channel::AddFileUncleHashes(struct evbuffer *evb, bin_t pos, bool isretransmit)
 {
     bin_t peak = hashtree()->peak_for(pos);
     binvector bv;
-    while (pos!=peak && ((NOW&3)==3 || !pos.parent().contains(data_out_cap_)) &&
-            ack_in_.is_empty(pos.parent())) {
-        // Ric: TODO optimise.. send based on pkt loss statistics
-        //      the above is correct but should not happen at the beginning!
-        //while (pos!=peak && ack_in_.is_empty(pos.parent()) ) {
-        bin_t uncle = pos.sibling();
-        bv.push_back(uncle);
+    // HASHDEDUP: A retransmit carries its full path, as the chunks it would
+    // depend on may have been lost too. So does an anchor, after which
+    // chunks depend only on the anchor and those sent after it.
+    bool fullpath = isretransmit || hashes_out_count_ >= SWIFT_HASH_ANCHOR_INTERVAL;
+    if (fullpath) {
+        hashes_out_.clear();
+        hashes_out_count_ = 0;
+    }
+    while (pos!=peak && ack_in_.is_empty(pos.parent())) {
+        // HASHDEDUP: Once a chunk under the parent went out with its uncles,
+        // the peer can derive this uncle and all above it.
+        if (!fullpath && !hashes_out_.is_empty(pos.parent()))
+            global_hashes_deduped++;
+        else
+            bv.push_back(pos.sibling());
         pos = pos.parent();
     }
 
@@ -198,8 +226,10 @@ void Channel::AddFileUncleHashes(struct evbuffer *evb, bin_t pos)
     for (iter=bv.rbegin(); iter != bv.rend(); iter++) {
         bin_t uncle = *iter;
         evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_);
-        evbuffer_add_hash(evb, hashtree()->hash(uncle));
+        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_,transfer()->chunk_size());
+        Sha1Hash h = hashtree()->hash(uncle);
+        evbuffer_add_hash(evb, h);
+        global_hash_bytes_up += h.size();
         dprintf("%s #%" PRIu32 " +hash %s\n",tintstr(),id_,uncle.str().c_str());
     }
 
@@ -234,7 +264,7 @@ void Channel::AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, b
     for (iter=bv.rbegin(); iter != bv.rend(); iter++) {
         bin_t uncle = *iter;
         evbuffer_add_8(evb, SWIFT_INTEGRITY);
-        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_);
+        evbuffer_add_chunkaddr(evb,uncle,hs_out_->chunk_addr_,transfer()->chunk_size());
         Sha1Hash h = hashtree()->hash(uncle);
         if (h == Sha1Hash::ZERO) {
             // TEMP SIGNPEAKTODO
@@ -242,6 +272,7 @@ void Channel::AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, b
             fflush(stderr);
         }
         evbuffer_add_hash(evb,h);
+        global_hash_bytes_up += Sha1Hash::SIZE;
         dprintf("%s #%" PRIu32 " +hash %s\n",tintstr(),id_,uncle.str().c_str());
         pos = pos.parent();
     }
@@ -273,6 +304,11 @@ bin_t Channel::DequeueHint(bool *retransmitptr)
     // Arno, 2012-01-23: Extra protection against channel loss, don't send DATA
     if (last_recv_time_ < NOW-(3*TINT_SEC)) {
         dprintf("%s #%" PRIu32 " dequeue hint aborted, long time no recv %s\n",tintstr(),id_, tintstr(last_recv_time_));
+        // LIVEPUSH: peer may be gone, don't keep waking up for pushes
+        while (!push_in_.empty()) {
+            hint_in_size_ -= push_in_.front().bin.base_length();
+            push_in_.pop_front();
+        }
         return bin_t::NONE;
     }
 
@@ -294,6 +330,28 @@ bin_t Channel::DequeueHint(bool *retransmitptr)
         }
     }
 
+    // LIVEPUSH: Fresh chunks pushed to us as child go before requests
+    while (!push_in_.empty() && send.is_none()) {
+        bin_t push = push_in_.front().bin;
+        tint time = push_in_.front().time;
+        hint_in_size_ -= push.base_length();
+        push_in_.pop_front();
+
+        if (time < NOW-TINT_SEC) {
+            dprintf("%s #%" PRIu32 " Don't push: %s is too old\n",tintstr(),id_, push.str().c_str());
+            continue;
+        }
+        while (!push.is_base()) {
+            push_in_.push_front(tintbin(time,push.right()));
+            hint_in_size_ += push_in_.front().bin.base_length();
+            push = push.left();
+        }
+        if (!ack_in_.is_filled(push)) {
+            send = push;
+            push_out_.set(push);
+        }
+    }
+
     if (ENABLE_SENDERSIZE_PUSH && send.is_none() && hint_in_.empty() && last_recv_time_>NOW-rtt_avg_-TINT_SEC) {
         bin_t my_pick = ImposeHint(); // FIXME move to the loop
         if (!my_pick.is_none()) {
@@ -324,10 +382,20 @@ bin_t Channel::DequeueHint(bool *retransmitptr)
             hint = hint.left();
         }
 
-        if (!ack_in_.is_filled(hint))
+        if (ack_in_.is_filled(hint) && push_out_.is_filled(hint)) {
+            // LIVEPUSH: Peer got the push, but could not check it. Send it
+            // again with all hashes.
+            dprintf("%s #%" PRIu32 " hint %s was pushed but not verified\n",tintstr(),id_,hint.str().c_str());
+            push_out_.reset(hint);
+            last_sent_munro_ = bin_t::NONE;
+            *retransmitptr = true;
             send = hint;
-        else
+        } else if (ack_in_.is_filled(hint))
             dprintf("%s #%" PRIu32 " hint %s has already been acknowledged\n",tintstr(),id_,hint.str().c_str());
+        else if (push_out_.is_filled(hint))
+            dprintf("%s #%" PRIu32 " hint %s has already been pushed\n",tintstr(),id_,hint.str().c_str()); // lost ones are retransmitted
+        else
+            send = hint;
     }
 
     dprintf("%s #%" PRIu32 " dequeued %s [%" PRIu64 "]\n",tintstr(),id_,send.str().c_str(),hint_in_size_);
@@ -335,6 +403,52 @@ bin_t Channel::DequeueHint(bool *retransmitptr)
 }
 
 
+/*
+ * CHUNK64: 32-bit chunk addresses are used until the transfer nears 2^32
+ * chunks (2^31 for bins), e.g. a live stream running for weeks. The method
+ * is fixed by the handshake that opens the channel: channels opened near
+ * the limit, or answering a peer that uses 64-bit addresses, use the 64-bit
+ * variant. An open channel that gets near the limit is closed and opened
+ * again, see Send().
+ */
+bool Channel::NearChunkAddrLimit()
+{
+    if (hs_out_->version_ == VER_SWIFT_LEGACY || !hs_out_->Is32BitChunkAddr())
+        return false;
+
+    uint64_t limit = (hs_out_->chunk_addr_ == POPT_CHUNK_ADDR_BIN32) ? 0x7fffffffULL : 0xffffffffULL;
+    limit -= SWIFT_CHUNKADDR_UPGRADE_MARGIN;
+
+    uint64_t lastchunkid = 0;
+    if (transfer()->ttype() == FILE_TRANSFER) {
+        if (hashtree() != NULL)
+            lastchunkid = hashtree()->size_in_chunks();
+    } else
+        lastchunkid = ((LiveTransfer *)transfer())->GetLastChunkID();
+
+    return (lastchunkid >= limit);
+}
+
+
+void Channel::ChooseChunkAddr()
+{
+    if (hs_out_->version_ == VER_SWIFT_LEGACY || !hs_out_->Is32BitChunkAddr())
+        return;
+
+    bool ours = NearChunkAddrLimit();
+    bool peers = (hs_in_ != NULL && hs_in_->version_ != VER_SWIFT_LEGACY && !hs_in_->Is32BitChunkAddr());
+    if (!ours && !peers)
+        return;
+
+    hs_out_->WidenChunkAddr();
+    // New channels start out wide
+    if (ours)
+        transfer()->GetDefaultHandshake().chunk_addr_ = hs_out_->chunk_addr_;
+
+    dprintf("%s #%" PRIu32 " chunk addr %d\n",tintstr(),id_,hs_out_->chunk_addr_);
+}
+
+
 void Channel::AddHandshake(struct evbuffer *evb)
 {
     // If peer not responding, try legacy swift protocol
@@ -384,7 +498,7 @@ void Channel::AddHandshake(struct evbuffer *evb)
             if (hs_in_ == NULL) { // initiating, send swarm ID
                 evbuffer_add_8(evb, POPT_SWARMID);
                 if (transfer()->ttype() == FILE_TRANSFER) {
-                    evbuffer_add_16be(evb, Sha1Hash::SIZE);
+                    evbuffer_add_16be(evb, transfer()->swarm_id().roothash().size());
                     evbuffer_add_hash(evb, transfer()->swarm_id().roothash());
                 } else {
                     SwarmPubKey spubkey = transfer()->swarm_id().spubkey();
@@ -396,7 +510,9 @@ void Channel::AddHandshake(struct evbuffer *evb)
             evbuffer_add_8(evb, POPT_CONT_INT_PROT);
             evbuffer_add_8(evb, hs_out_->cont_int_prot_);
             cross << "cipm " << hs_out_->cont_int_prot_ << " ";
-            if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE) {
+            if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE
+                    || (hs_in_ == NULL && transfer()->ttype() == FILE_TRANSFER
+                        && transfer()->swarm_id().roothash().size() != Sha1Hash::SIZE)) {
                 evbuffer_add_8(evb, POPT_MERKLE_HASH_FUNC);
                 evbuffer_add_8(evb, hs_out_->merkle_func_);
                 cross << "mhf " << hs_out_->merkle_func_ << " ";
@@ -406,6 +522,10 @@ void Channel::AddHandshake(struct evbuffer *evb)
                 evbuffer_add_8(evb, hs_out_->live_sig_alg_);
                 cross << "lsa " << hs_out_->live_sig_alg_ << " ";
             }
+            // CHUNK64: Only the first handshake may pick it, retransmits
+            // must announce the same
+            if (dgrams_sent_ == 0)
+                ChooseChunkAddr();
             evbuffer_add_8(evb, POPT_CHUNK_ADDR);
             evbuffer_add_8(evb, hs_out_->chunk_addr_);
             cross << "cam " << hs_out_->chunk_addr_ << " ";
@@ -419,6 +539,23 @@ void Channel::AddHandshake(struct evbuffer *evb)
                     evbuffer_add_64be(evb, hs_out_->live_disc_wnd_);
                 cross << "ldw " << std::hex << hs_out_->live_disc_wnd_ << std::dec << " ";
             }
+            // LIVEFEC: Only list supported messages when it matters, older
+            // peers cannot parse POPT_SUPP_MSGS.
+            if (transfer()->ttype() == LIVE_TRANSFER && ((LiveTransfer *)transfer())->FECEnabled()) {
+                uint64_t msgs = SupportedMessages();
+                uint8_t size8 = (SWIFT_MESSAGE_COUNT+7)/8;
+                evbuffer_add_8(evb, POPT_SUPP_MSGS);
+                evbuffer_add_8(evb, size8);
+                for (int i8=0; i8<size8; i8++) {
+                    uint8_t bits = 0;
+                    for (int b=0; b<8; b++) {
+                        if ((msgs >> (i8*8+b)) & 1)
+                            bits |= 0x80 >> b;
+                    }
+                    evbuffer_add_8(evb, bits);
+                }
+                cross << "msgs " << std::hex << msgs << std::dec << " ";
+            }
         }
         dprintf("%s #%" PRIu32 " +hs %x ppsp %s\n",tintstr(),id_,encoded, cross.str().c_str());
 
@@ -464,6 +601,17 @@ void Channel::Send()
             break;
         }
 
+    // CHUNK64: The peer decodes with the addressing it was told when the
+    // channel opened, so rather than switch, open a new channel.
+    if (send_control_ != CLOSE_CONTROL && is_established() && NearChunkAddrLimit()) {
+        dprintf("%s #%" PRIu32 " chunk addr limit near, reopen\n",tintstr(),id_);
+        hs_out_->WidenChunkAddr();
+        transfer()->GetDefaultHandshake().chunk_addr_ = hs_out_->chunk_addr_;
+        transfer()->ReopenChannel(socket_,peer_);
+        Close(CLOSE_SEND);
+        return;
+    }
+
     struct evbuffer *evb = evbuffer_new();
     uint32_t pcid = 0;
     if (hs_in_ != NULL)
@@ -476,6 +624,9 @@ void Channel::Send()
         AddHandshake(evb);
     else {
         if (is_established()) {
+            // RELAYTREE: Before anything is announced to the peer
+            if (transfer()->ttype() == LIVE_TRANSFER)
+                ((LiveTransfer *)transfer())->UpdateRelay(this);
             // FIXME: seeder check
             AddHave(evb);
             AddAck(evb);
@@ -509,19 +660,53 @@ void Channel::Send()
             tintstr(),id_,(int)evbuffer_get_length(evb),peer().str().c_str(),
             pcid);
     last_send_time_ = NOW;
-
-    int r = SendTo(socket_,peer(),evb);
-    if (r==-1)
+    live_have_due_ = false;
+
+    bool probe = pmtu_probe_sending_;
+    pmtu_probe_sending_ = false;
+    int r = SendTo(socket_,peer(),evb,probe);
+    if (r==-1 && probe && errno == EMSGSIZE)
+        OnPMTUProbeFailed(true);
+    else if (r==-1)
         print_error("swift can't send datagram");
     else {
         raw_bytes_up_ += r;
         sent_since_recv_++;
         dgrams_sent_++;
+        tevent(TRACE_SEND,r,data.toUInt());
+        if (!data.is_none() && !data.is_all())
+            tevent(TRACE_CWND,send_control_,(uint64_t)(cwnd_*1000));
+        if (transfer_ != NULL)
+            transfer_->OnDatagram(DDIR_UPLOAD,r);
     }
     evbuffer_free(evb);
     Reschedule();
 }
 
+uint64_t Channel::SupportedMessages()
+{
+    // CHOKE, UNCHOKE and PEX_REScert are parsed but ignored
+    uint64_t msgs = 0;
+    msgs |= (uint64_t)1 << SWIFT_HANDSHAKE;
+    msgs |= (uint64_t)1 << SWIFT_DATA;
+    msgs |= (uint64_t)1 << SWIFT_ACK;
+    msgs |= (uint64_t)1 << SWIFT_HAVE;
+    msgs |= (uint64_t)1 << SWIFT_INTEGRITY;
+    msgs |= (uint64_t)1 << SWIFT_PEX_RESv4;
+    msgs |= (uint64_t)1 << SWIFT_PEX_REQ;
+    msgs |= (uint64_t)1 << SWIFT_REQUEST;
+    msgs |= (uint64_t)1 << SWIFT_CANCEL;
+    msgs |= (uint64_t)1 << SWIFT_PEX_RESv6;
+    if (transfer()->ttype() == LIVE_TRANSFER) {
+        if (hs_out_->cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE)
+            msgs |= (uint64_t)1 << SWIFT_SIGNED_INTEGRITY;
+        if (((LiveTransfer *)transfer())->FECEnabled())
+            msgs |= (uint64_t)1 << SWIFT_LIVE_REPAIR;
+    }
+    return msgs;
+}
+
+
 void Channel::AddHint(struct evbuffer *evb)
 {
 
@@ -537,9 +722,7 @@ void Channel::AddHint(struct evbuffer *evb)
         return;
     }
 
-    FileTransfer * ft = (FileTransfer *)transfer();
-
-    if (ft->hashtree()->is_complete())
+    if (hashtree() != NULL && hashtree()->is_complete())
         return;
 
     // 1. Calc max of what we are allowed to request, uncongested bandwidth wise
@@ -670,7 +853,7 @@ void Channel::AddHint(struct evbuffer *evb)
                 fprintf(stderr,"hint c%d: ask %s\n", id(), hint.str().c_str());
             }
             evbuffer_add_8(evb, SWIFT_REQUEST);
-            evbuffer_add_chunkaddr(evb,hint,hs_out_->chunk_addr_);
+            evbuffer_add_chunkaddr(evb,hint,hs_out_->chunk_addr_,transfer()->chunk_size());
             dprintf("%s #%" PRIu32 " +hint %s [%" PRIi64 "]\n",tintstr(),id_,hint.str().c_str(),hint_out_size_);
             dprintf("%s #%" PRIu32 " +hint base %s width %d\n",tintstr(),id_,hint.base_left().str().c_str(),
                     (int)hint.base_length());
@@ -752,7 +935,7 @@ void Channel::AddCancel(struct evbuffer *evb)
         bin_t cancel = cancel_out_.front();
         cancel_out_.pop_front();
         evbuffer_add_8(evb, SWIFT_CANCEL);
-        evbuffer_add_chunkaddr(evb,cancel,hs_out_->chunk_addr_);
+        evbuffer_add_chunkaddr(evb,cancel,hs_out_->chunk_addr_,transfer()->chunk_size());
         dprintf("%s #%" PRIu32 " +cancel %s\n",
                 tintstr(),id_,cancel.str().c_str());
     }
@@ -774,11 +957,15 @@ bin_t Channel::AddData(struct evbuffer *evb)
 
     bin_t tosend = bin_t::NONE;
     bool isretransmit = false;
+    bool repair = false;
     tint luft = send_interval_>>4; // may wake up a bit earlier
 
     if ((data_out_size_<cwnd_ || cwnd_>0) && last_data_out_time_+send_interval_-reschedule_delay_<=NOW+luft) {
         tosend = DequeueHint(&isretransmit);
-        if (tosend.is_none()) {
+        // LIVEFEC: Requested chunks go first
+        if (tosend.is_none() && !repair_out_.empty())
+            repair = true;
+        else if (tosend.is_none()) {
             dprintf("%s #%" PRIu32 " sendctrl no idea what data to send\n",tintstr(),id_);
             if (send_control_!=KEEP_ALIVE_CONTROL && send_control_!=CLOSE_CONTROL) {
                 lprintf("\t\t==== Switch to Keep Alive Control (nothing to send) ==== \n");
@@ -794,6 +981,11 @@ bin_t Channel::AddData(struct evbuffer *evb)
     // Note this is called always, not just when there are requests pending.
     AddRequiredHashes(evb,tosend,isretransmit);
 
+    if (repair) {
+        SendIfTooBig(evb);
+        AddRepair(evb);
+        return bin_t::NONE;
+    }
     if (tosend.is_none()) {// && (last_data_out_time_>NOW-TINT_SEC || data_out_.empty()))
         transfer()->OnSendNoData();
         return bin_t::NONE; // once in a while, empty data is sent just to check rtt FIXED
@@ -805,9 +997,24 @@ bin_t Channel::AddData(struct evbuffer *evb)
     // Send hashes in separate datagram if first would get too big
     SendIfTooBig(evb);
 
+    ssize_t r = AddDataChunk(evb,tosend,isretransmit);
+    if (r <= 0)
+        return bin_t::NONE;
+
+    // MULTIDATA: A short chunk must be the last in the datagram, as the
+    // receiver takes the rest of it as the chunk's content.
+    if (r == transfer()->chunk_size())
+        AddMoreData(evb);
+
+    return tosend;
+}
+
+
+ssize_t Channel::AddDataChunk(struct evbuffer *evb, bin_t tosend, bool isretransmit)
+{
     // Add chunk
     evbuffer_add_8(evb, SWIFT_DATA);
-    evbuffer_add_chunkaddr(evb,tosend,hs_out_->chunk_addr_);
+    evbuffer_add_chunkaddr(evb,tosend,hs_out_->chunk_addr_,transfer()->chunk_size());
     // PPSPTODO LEDBAT current system time 64-bit
     if (hs_in_ != NULL && hs_in_->version_ == VER_PPSPP_v1) {
         // NOTE: Time updates NOW, so customary behavior where NOW is not
@@ -819,7 +1026,7 @@ bin_t Channel::AddData(struct evbuffer *evb)
     struct evbuffer_iovec vec;
     if (evbuffer_reserve_space(evb, transfer()->chunk_size(), &vec, 1) < 0) {
         print_error("error on evbuffer_reserve_space");
-        return bin_t::NONE;
+        return -1;
     }
 
     if (DEBUGTRAFFIC)
@@ -834,20 +1041,28 @@ bin_t Channel::AddData(struct evbuffer *evb)
         dprintf("%s #%" PRIu32 " !data %s\n",tintstr(),id_,tosend.str().c_str());
         vec.iov_len = 0;
         evbuffer_commit_space(evb, &vec, 1);
-        return bin_t::NONE;
+        return -1;
     }
     // assert(dgram.space()>=r+4+1);
     vec.iov_len = r;
     if (evbuffer_commit_space(evb, &vec, 1) < 0) {
         print_error("error on evbuffer_commit_space");
-        return bin_t::NONE;
+        return -1;
     }
 
     last_data_out_time_ = NOW;
     data_out_.push_back(tosend);
     data_out_size_++;
+    if (transfer()->ttype() == FILE_TRANSFER) {
+        hashes_out_.set(tosend);
+        hashes_out_count_++;
+    }
     bytes_up_ += r;
     global_bytes_up += r;
+    if (isretransmit) {
+        global_retransmits++;
+        transfer_->OnRetransmit();
+    }
 
     dprintf("%s #%" PRIu32 " +data %s\n",tintstr(),id_,tosend.str().c_str());
 
@@ -855,7 +1070,126 @@ bin_t Channel::AddData(struct evbuffer *evb)
     // ARNOSMPTODO: count overhead bytes too? Move to Send() then.
     transfer_->OnSendData(transfer()->chunk_size());
 
-    return tosend;
+    return r;
+}
+
+
+void Channel::AddRepair(struct evbuffer *evb)
+{
+    struct evbuffer *repair = repair_out_.front();
+    repair_out_.pop_front();
+    int r = evbuffer_get_length(repair);
+    evbuffer_add_buffer(evb,repair);
+    evbuffer_free(repair);
+
+    // Takes a send slot and a place in the window like a chunk
+    last_data_out_time_ = NOW;
+    repair_sent_.push_back(NOW);
+    data_out_size_++;
+    ((LiveTransfer *)transfer())->OnRepairSent();
+    dprintf("%s #%" PRIu32 " +repair %ib\n",tintstr(),id_,r);
+}
+
+
+void Channel::AddMoreData(struct evbuffer *evb)
+{
+    // MULTIDATA: Datagrams up to pmtu_ are known to get through. If the
+    // path may take more, this datagram probes for it, one probe at a time.
+    // The first datagrams to a cold peer carry the peak hashes, keep those
+    // to a single chunk.
+    if (ack_in_.is_empty())
+        return;
+
+    int maxsize = pmtu_;
+    if (pmtu_probe_bin_.is_none() && NOW >= pmtu_probe_time_) {
+        if (pmtu_max_ <= pmtu_)
+            pmtu_max_ = MAX_PMTU; // search converged a while ago, try again
+        maxsize = std::max(pmtu_,pmtu_max_);
+    }
+
+    int datasize = 1+ChunkAddrSize(hs_out_->chunk_addr_)+8+transfer()->chunk_size();
+    int nchunks = 1;
+    bin_t last = bin_t::NONE;
+    struct evbuffer *hevb = NULL;
+    // Each extra chunk takes the next send slot, so the rate is unchanged.
+    // The burst is bounded by the congestion window.
+    while (evbuffer_get_length(evb)+datasize <= maxsize && nchunks < cwnd_) {
+        if (transfer()->GetCurrentSpeed(DDIR_UPLOAD) > transfer()->GetMaxSpeed(DDIR_UPLOAD))
+            break;
+        bool isretransmit = false;
+        bin_t tosend = DequeueHint(&isretransmit);
+        if (tosend.is_none())
+            break;
+
+        // Hashes go before the chunk, see if both fit
+        if (hevb == NULL)
+            hevb = evbuffer_new();
+        bin_t munro = last_sent_munro_;
+        AddRequiredHashes(hevb,tosend,isretransmit);
+        if (evbuffer_get_length(evb)+evbuffer_get_length(hevb)+datasize > maxsize) {
+            evbuffer_drain(hevb,evbuffer_get_length(hevb));
+            last_sent_munro_ = munro;
+            RequeueHint(tosend,isretransmit);
+            break;
+        }
+        evbuffer_add_buffer(evb,hevb);
+
+        ssize_t r = AddDataChunk(evb,tosend,isretransmit);
+        if (r <= 0)
+            break;
+        nchunks++;
+        last = tosend;
+        if (r < transfer()->chunk_size())
+            break;
+    }
+    if (hevb != NULL)
+        evbuffer_free(hevb);
+    last_data_out_time_ = NOW + (nchunks-1)*send_interval_;
+
+    if (nchunks > 1 && evbuffer_get_length(evb) > pmtu_) {
+        pmtu_probe_size_ = evbuffer_get_length(evb);
+        pmtu_probe_nchunks_ = nchunks;
+        pmtu_probe_bin_ = last;
+        pmtu_probe_sending_ = true;
+        dprintf("%s #%" PRIu32 " pmtu probe %d chunks %d\n",tintstr(),id_,pmtu_probe_size_,nchunks);
+    }
+}
+
+
+void Channel::RequeueHint(bin_t pos, bool isretransmit)
+{
+    if (isretransmit)
+        data_out_tmo_.push_front(tintbin(NOW,pos));
+    else {
+        if (push_out_.is_filled(pos))
+            push_out_.reset(pos); // LIVEPUSH: serve it as request
+        hint_in_.push_front(tintbin(NOW,pos));
+        hint_in_size_ += pos.base_length();
+    }
+}
+
+
+void Channel::OnPMTUProbeFailed(bool sendfailed)
+{
+    dprintf("%s #%" PRIu32 " pmtu probe %d failed%s\n",tintstr(),id_,pmtu_probe_size_,sendfailed ? " to send" : "");
+
+    if (sendfailed) {
+        // Never left, so not lost: send the chunks again without backing off
+        hashes_out_.clear();
+        for (int i=0; i<pmtu_probe_nchunks_ && !data_out_.empty(); i++) {
+            data_out_tmo_.push_front(data_out_.back());
+            data_out_.pop_back();
+            data_out_size_--;
+        }
+    }
+    // Search between the known and the failed size, until it's less than
+    // a chunk
+    pmtu_max_ = (pmtu_+pmtu_probe_size_)/2;
+    if (pmtu_max_ < pmtu_+1+ChunkAddrSize(hs_out_->chunk_addr_)+8+transfer()->chunk_size()) {
+        pmtu_max_ = pmtu_;
+        pmtu_probe_time_ = NOW + SWIFT_PMTU_RAISE_TIME*TINT_SEC;
+    }
+    pmtu_probe_bin_ = bin_t::NONE;
 }
 
 
@@ -876,8 +1210,11 @@ void Channel::SendIfTooBig(struct evbuffer *evb)
                 tintstr(),id_,(int)evbuffer_get_length(evb),peer().str().c_str(),
                 hs_in_->peer_channel_id_);
         int ret = Channel::SendTo(socket_,peer(),evb); // kind of fragmentation
-        if (ret > 0)
+        if (ret > 0) {
             raw_bytes_up_ += ret;
+            if (transfer_ != NULL)
+                transfer_->OnDatagram(DDIR_UPLOAD,ret);
+        }
         evbuffer_add_32be(evb, hs_in_->peer_channel_id_);
     }
 }
@@ -885,53 +1222,125 @@ void Channel::SendIfTooBig(struct evbuffer *evb)
 
 void Channel::AddAck(struct evbuffer *evb)
 {
-    if (data_in_==tintbin())
-        //if (data_in_.bin==bin64_t::NONE)
-        return;
     // sometimes, we send a HAVE (e.g. in case the peer did repetitive send)
-    evbuffer_add_8(evb, data_in_.time==TINT_NEVER?SWIFT_HAVE:SWIFT_ACK);
-    evbuffer_add_chunkaddr(evb,data_in_.bin,hs_out_->chunk_addr_);
-    // PPSPTODO LEDBAT one-way delay
-    if (data_in_.time!=TINT_NEVER)
-        evbuffer_add_64be(evb, data_in_.time);
+    if (data_in_.time==TINT_NEVER && !data_in_.bin.is_none()) {
+        evbuffer_add_8(evb, SWIFT_HAVE);
+        evbuffer_add_chunkaddr(evb,data_in_.bin,hs_out_->chunk_addr_,transfer()->chunk_size());
+        have_out_.set(data_in_.bin);
+        dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,data_in_.bin.str().c_str());
+        if (data_in_.bin.layer()>2)
+            data_in_dbl_ = data_in_.bin;
+    }
+    data_in_ = tintbin();
+    if (ack_pending_.empty())
+        return;
 
-    if (DEBUGTRAFFIC)
-        fprintf(stderr,"send c%d: ACK %i\n", id(), bin_toUInt32(data_in_.bin));
+    // ACKAGG: Acknowledge everything received since the last ACK, adjacent
+    // chunks as one range. The one-way delay is that of the last chunk.
+    std::sort(ack_pending_.begin(),ack_pending_.end());
+    bin_t::uint_t schunk = ack_pending_[0].base_offset();
+    bin_t::uint_t echunk = schunk;
+    for (int i=1; i<=ack_pending_.size(); i++) {
+        if (i < ack_pending_.size()) {
+            bin_t::uint_t chunk = ack_pending_[i].base_offset();
+            if (chunk <= echunk+1) {
+                echunk = std::max(echunk,chunk);
+                continue;
+            }
+            AddChunkRange(evb,SWIFT_ACK,schunk,echunk,ack_pending_owd_);
+            schunk = echunk = chunk;
+        } else
+            AddChunkRange(evb,SWIFT_ACK,schunk,echunk,ack_pending_owd_);
+    }
 
-    have_out_.set(data_in_.bin);
-    dprintf("%s #%" PRIu32 " +ack %s %" PRIi64 "\n",
-            tintstr(),id_,data_in_.bin.str().c_str(),data_in_.time);
-    if (data_in_.bin.layer()>2)
-        data_in_dbl_ = data_in_.bin;
+    if (DEBUGTRAFFIC)
+        fprintf(stderr,"send c%d: ACK " PRISIZET " chunks\n", id(), ack_pending_.size());
 
 #if ENABLE_CANCEL == 1
-    // Ric: check that we are not sending a cancel msg for data_in_
-    std::deque<bin_t>::iterator it;
-    bin_t b = data_in_.bin;
-    for (it=cancel_out_.begin(); it!=cancel_out_.end(); it++) {
-        bin_t c = *it;
-        if (c == b) {
-            cancel_out_.erase(it);
-            break;
-        }
-        // b is always a single chunk :-)
-        else if (c.contains(b)) {
-            while (c.contains(b) && c!=b) {
-                if (c>b) {
-                    cancel_out_.insert(it+1,c.right());
-                    c.to_left();
-                } else {
-                    cancel_out_.insert(it+1,c.left());
-                    c.to_right();
+    // Ric: check that we are not sending a cancel msg for acked data
+    for (int i=0; i<ack_pending_.size(); i++) {
+        std::deque<bin_t>::iterator it;
+        bin_t b = ack_pending_[i];
+        for (it=cancel_out_.begin(); it!=cancel_out_.end(); it++) {
+            bin_t c = *it;
+            if (c == b) {
+                cancel_out_.erase(it);
+                break;
+            }
+            // b is always a single chunk :-)
+            else if (c.contains(b)) {
+                while (c.contains(b) && c!=b) {
+                    if (c>b) {
+                        cancel_out_.insert(it+1,c.right());
+                        c.to_left();
+                    } else {
+                        cancel_out_.insert(it+1,c.left());
+                        c.to_right();
+                    }
                 }
+                assert(c==b);
+                cancel_out_.erase(it);
+                break;
             }
-            assert(c==b);
-            cancel_out_.erase(it);
         }
     }
 #endif
-    data_in_ = tintbin();
-    //data_in_ = tintbin(NOW,bin64_t::NONE);
+    ack_pending_.clear();
+    ack_pending_time_ = TINT_NEVER;
+}
+
+
+void Channel::AddChunkRange(struct evbuffer *evb, uint8_t msgtype, bin_t::uint_t schunk, bin_t::uint_t echunk,
+                            tint owd)
+{
+    binarray_t ba;
+    swift::chunk64_to_binarray(schunk,echunk,&ba);
+    popt_chunk_addr_t chunk_addr = hs_out_->chunk_addr_;
+    if (chunk_addr == POPT_CHUNK_ADDR_BIN32 || chunk_addr == POPT_CHUNK_ADDR_BIN64) {
+        // One message per bin
+        for (int i=0; i<ba.size; i++) {
+            evbuffer_add_8(evb, msgtype);
+            evbuffer_add_chunkaddr(evb,ba.bins[i],chunk_addr,transfer()->chunk_size());
+            if (msgtype == SWIFT_ACK)
+                evbuffer_add_64be(evb, owd);
+        }
+    } else {
+        evbuffer_add_8(evb, msgtype);
+        evbuffer_add_chunkrange(evb,schunk,echunk,chunk_addr,transfer()->chunk_size());
+        if (msgtype == SWIFT_ACK)
+            evbuffer_add_64be(evb, owd);
+    }
+    for (int i=0; i<ba.size; i++)
+        have_out_.set(ba.bins[i]);
+
+    dprintf("%s #%" PRIu32 " +%s %" PRIu64 "-%" PRIu64 " %" PRIi64 "\n",tintstr(),id_,
+            msgtype == SWIFT_ACK ? "ack" : "have",(uint64_t)schunk,(uint64_t)echunk,owd);
+}
+
+
+tint Channel::AckDueTime()
+{
+    if (ack_pending_.empty())
+        return TINT_NEVER;
+    if (ack_pending_.size() >= SWIFT_DELAYED_ACK_CHUNKS)
+        return ack_pending_time_;
+    return ack_pending_time_ + std::min(SWIFT_DELAYED_ACK_TIME,rtt_avg_>>2);
+}
+
+
+bin_t Channel::FindHaveFrom(binmap_t &src, bin_t::uint_t chunk)
+{
+    if (chunk > SWIFT_CHUNK64_MAX_CHUNK)
+        return bin_t::NONE;
+    // Search the bins right of chunk left to right
+    binarray_t ba;
+    swift::chunk64_to_binarray(chunk,SWIFT_CHUNK64_MAX_CHUNK,&ba);
+    for (int i=0; i<ba.size; i++) {
+        bin_t b = binmap_t::find_complement(have_out_, src, ba.bins[i], 0);
+        if (!b.is_none())
+            return b;
+    }
+    return bin_t::NONE;
 }
 
 
@@ -939,7 +1348,7 @@ void Channel::AddHave(struct evbuffer *evb)
 {
     if (!data_in_dbl_.is_none()) { // TODO: do redundancy better
         evbuffer_add_8(evb, SWIFT_HAVE);
-        evbuffer_add_chunkaddr(evb,data_in_dbl_,hs_out_->chunk_addr_);
+        evbuffer_add_chunkaddr(evb,data_in_dbl_,hs_out_->chunk_addr_,transfer()->chunk_size());
         data_in_dbl_=bin_t::NONE;
     }
     if (DEBUGTRAFFIC)
@@ -954,7 +1363,7 @@ void Channel::AddHave(struct evbuffer *evb)
         for (int i=0; i<hashtree()->peak_count(); i++) {
             bin_t peak = hashtree()->peak(i);
             evbuffer_add_8(evb, SWIFT_HAVE);
-            evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_);
+            evbuffer_add_chunkaddr(evb,peak,hs_out_->chunk_addr_,transfer()->chunk_size());
             dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,peak.str().c_str());
         }
         return;
@@ -970,19 +1379,52 @@ void Channel::AddHave(struct evbuffer *evb)
         if (lt->am_source())
             transfer_ack_out_ptr = lt->ack_out_signed();
     }
+    // FANOUT
+    if (transfer()->ttype() == LIVE_TRANSFER && ((LiveTransfer *)transfer())->am_source()) {
+        LiveTransfer *lt = (LiveTransfer *)transfer();
+        // RELAYTREE: Only first-tier relays hear from the source
+        if (!lt->IsServed(this))
+            return;
+        if (lt->AddFanoutHave(evb,have_out_,*transfer_ack_out_ptr,hs_out_->chunk_addr_)) {
+            dprintf("%s #%" PRIu32 " +have epoch\n",tintstr(),id_);
+            if (DEBUGTRAFFIC)
+                fprintf(stderr,"epoch\n");
+            return;
+        }
+    }
+    // ACKAGG: Announce runs of adjacent chunks the peer hasn't heard of,
+    // continuing after the run announced last, wrapping around once. With
+    // bin addressing each run would take several messages, so announce
+    // single bins there.
+    bool ranges = (hs_out_->chunk_addr_ != POPT_CHUNK_ADDR_BIN32 && hs_out_->chunk_addr_ != POPT_CHUNK_ADDR_BIN64);
+    bool wrapped = (have_cursor_ == 0);
     for (int count=0; count<4; count++) {
-        bin_t ack = binmap_t::find_complement(have_out_, *(transfer_ack_out_ptr), 0); // FIXME: do rotating queue
+        bin_t ack = FindHaveFrom(*transfer_ack_out_ptr,have_cursor_);
+        if (ack.is_none() && !wrapped) {
+            wrapped = true;
+            have_cursor_ = 0;
+            ack = FindHaveFrom(*transfer_ack_out_ptr,have_cursor_);
+        }
         if (ack.is_none())
             break;
         ack = transfer_ack_out_ptr->cover(ack);
+        bin_t::uint_t schunk = ack.base_offset();
+        bin_t::uint_t echunk = schunk+ack.base_length()-1;
         have_out_.set(ack);
-        evbuffer_add_8(evb, SWIFT_HAVE);
-        evbuffer_add_chunkaddr(evb,ack,hs_out_->chunk_addr_);
+        while (ranges) {
+            bin_t next = FindHaveFrom(*transfer_ack_out_ptr,echunk+1);
+            if (next.is_none() || next.base_offset() != echunk+1)
+                break;
+            next = transfer_ack_out_ptr->cover(next);
+            schunk = std::min(schunk,next.base_offset());
+            echunk = next.base_offset()+next.base_length()-1;
+            have_out_.set(next);
+        }
+        AddChunkRange(evb,SWIFT_HAVE,schunk,echunk,TINT_NEVER);
+        have_cursor_ = echunk+1;
 
         if (DEBUGTRAFFIC)
-            fprintf(stderr," %i", bin_toUInt32(ack));
-
-        dprintf("%s #%" PRIu32 " +have %s\n",tintstr(),id_,ack.str().c_str());
+            fprintf(stderr," %" PRIu64 "-%" PRIu64, (uint64_t)schunk, (uint64_t)echunk);
     }
     if (DEBUGTRAFFIC)
         fprintf(stderr,"\n");
@@ -993,6 +1435,7 @@ void    Channel::Recv(struct evbuffer *evb)
 {
     dprintf("%s #%" PRIu32 " recvd %ib\n",tintstr(),id_,(int)evbuffer_get_length(evb)+4);
     dgrams_rcvd_++;
+    tevent(TRACE_RECV,evbuffer_get_length(evb)+4,0);
 
     if (!transfer()->IsOperational()) {
         dprintf("%s #%" PRIu32 " recvd on broken transfer %d \n",tintstr(),id_, transfer()->td());
@@ -1032,6 +1475,11 @@ void    Channel::Recv(struct evbuffer *evb)
     while (evbuffer_get_length(evb) && send_control_!=CLOSE_CONTROL) {
         uint8_t type = evbuffer_remove_8(evb);
 
+        // DECODE: The frequent messages are parsed in place from the
+        // (linearized) datagram, their bytes are drained after the switch.
+        size_t len = evbuffer_get_length(evb);
+        DgramCursor dc(len ? evbuffer_pullup(evb,len) : NULL,len);
+
         if (DEBUGTRAFFIC)
             fprintf(stderr,"GOT %d\n", type);
 
@@ -1046,31 +1494,34 @@ void    Channel::Recv(struct evbuffer *evb)
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
                 OnDataZeroState(evb);
             else
-                data=OnData(evb);
+                data=OnData(dc);
             break;
         case SWIFT_HAVE:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
                 OnHaveZeroState(evb);
             else
-                OnHave(evb);
+                OnHave(dc);
             break;
         case SWIFT_ACK:
-            OnAck(evb);
+            OnAck(dc);
             break;
         case SWIFT_INTEGRITY:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
                 OnHashZeroState(evb);
             else
-                OnHash(evb);
+                OnHash(dc);
             break;
         case SWIFT_SIGNED_INTEGRITY: // PPSP
             OnSignedHash(evb);
             break;
+        case SWIFT_LIVE_REPAIR: // LIVEFEC
+            OnRepair(evb);
+            break;
         case SWIFT_REQUEST:
-            OnHint(evb);
+            OnHint(dc);
             break;
         case SWIFT_CANCEL: // PPSP
-            OnCancel(evb);
+            OnCancel(dc);
             break;
         case SWIFT_PEX_RESv4:
             if (transfer()->ttype() == FILE_TRANSFER && ((FileTransfer *)transfer())->IsZeroState())
@@ -1106,6 +1557,7 @@ void    Channel::Recv(struct evbuffer *evb)
             dprintf("%s #%" PRIu32 " ?msg id unknown %i\n",tintstr(),id_,(int)type);
             return;
         }
+        evbuffer_drain(evb,dc.consumed());
     }
     if (DEBUGTRAFFIC) {
         fprintf(stderr,"\n");
@@ -1136,24 +1588,28 @@ void Channel::CloseOnError()
  * Arno: FAXME: HASH+DATA should be handled as a transaction: only when the
  * hashes check out should they be stored in the hashtree, otherwise revert.
  */
-void Channel::OnHash(struct evbuffer *evb)
+void Channel::OnHash(DgramCursor &dc)
 {
+    binarray_t ba;
     if (hs_in_->cont_int_prot_ != POPT_CONT_INT_PROT_MERKLE
             && hs_in_->cont_int_prot_ != POPT_CONT_INT_PROT_UNIFIED_MERKLE) {
         dprintf("%s #%" PRIu32 " ?hash but no integrity prot\n",tintstr(),id_);
+        // Skip it, so the rest of the datagram can still be parsed
+        dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba);
+        dc.skip(Sha1Hash::Size(hs_in_->merkle_func_));
         return;
     }
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0 || bv.size() > 1) {
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) != 1) {
         // chunk spec for hash must be power-of-2 range, so must fit in single bin
         dprintf("%s #%" PRIu32 " ?hash bad chunk spec\n",tintstr(),id_);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         Close(CLOSE_DO_NOT_SEND);
         return;
     }
-    bin_t pos = bv.front();
-    Sha1Hash hash = evbuffer_remove_hash(evb);
+    bin_t pos = ba.bins[0];
+    Sha1Hash hash = dc.gethash(hs_in_->merkle_func_);
+    global_hash_bytes_down += hash.size();
 
     dprintf("%s #%" PRIu32 " -hash %s\n",tintstr(),id_,pos.str().c_str());
     if (hashtree() != NULL && (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE
@@ -1171,13 +1627,13 @@ void Channel::OnHash(struct evbuffer *evb)
 }
 
 
-void Channel::CleanHintOut(bin_t pos)
+bool Channel::CleanHintOut(bin_t pos)
 {
     int hi = 0;
     while (hi<hint_out_.size() && !hint_out_[hi].bin.contains(pos))
         hi++;
     if (hi==hint_out_.size())
-        return; // something not hinted or hinted in far past
+        return false; // something not hinted or hinted in far past
 
     // Ric: TODO allow reordering of arriving pkts
     while (hi--) { // removing likely snubbed hints
@@ -1210,6 +1666,7 @@ void Channel::CleanHintOut(bin_t pos)
 #endif
     hint_out_size_ -= hint_out_.front().bin.base_length();
     hint_out_.pop_front();
+    return true;
 }
 
 bin_t Channel::DequeueHintOut(uint64_t size)
@@ -1273,36 +1730,31 @@ bin_t Channel::DequeueHintOut(uint64_t size)
 }
 
 
-bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted data
+bin_t Channel::OnData(DgramCursor &dc)     // TODO: HAVE NONE for corrupted data
 {
-
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0 || bv.size() > 1) {
+    binarray_t ba;
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) != 1) {
         // Chunk spec must denote single chunk
         dprintf("%s #%" PRIu32 " ?data bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         return bin_t::NONE;
     }
-    bin_t pos = bv.front();
+    bin_t pos = ba.bins[0];
     tint peer_time = TINT_NEVER;
     if (hs_out_->version_ == VER_PPSPP_v1)
-        peer_time = evbuffer_remove_64be(evb);
+        peer_time = dc.get64be();
 
-    // Arno: Assuming DATA last message in datagram
-    if (evbuffer_get_length(evb) > transfer()->chunk_size()) {
-        dprintf("%s #%" PRIu32 " !data chunk size mismatch %s: exp %" PRIu32 " got " PRISIZET "\n",tintstr(),id_,
-                pos.str().c_str(), transfer()->chunk_size(), evbuffer_get_length(evb));
-        fprintf(stderr,"WARNING: chunk size mismatch: exp %" PRIu32 " got " PRISIZET "\n",transfer()->chunk_size(),
-                evbuffer_get_length(evb));
-    }
+    // MULTIDATA: A DATA message is either the last in the datagram and
+    // takes the rest, or followed by more messages and a full chunk.
+    if (dc.remaining() > transfer()->chunk_size())
+        dprintf("%s #%" PRIu32 " -data %s not last in datagram\n",tintstr(),id_,pos.str().c_str());
 
-    int length = (evbuffer_get_length(evb) < transfer()->chunk_size()) ? evbuffer_get_length(
-                     evb) : transfer()->chunk_size();
+    int length = (dc.remaining() < transfer()->chunk_size()) ? dc.remaining() : transfer()->chunk_size();
     if (!transfer()->ack_out()->is_empty(pos)) {
         // Arno, 2012-01-24: print message for duplicate
         dprintf("%s #%" PRIu32 " Ddata %s\n",tintstr(),id_,pos.str().c_str());
-        evbuffer_drain(evb, length);
+        dc.skip(length);
         data_in_ = tintbin(TINT_NEVER,transfer()->ack_out()->cover(pos));
 
         // Arno, 2012-01-24: Make sure data interarrival periods don't get
@@ -1311,7 +1763,7 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
         return bin_t::NONE;
     }
 
-    uint8_t *data = evbuffer_pullup(evb, length);
+    const uint8_t *data = dc.data();
 
     //fprintf(stderr,"OnData: Got chunk %d / %" PRIi64 "\n", length, swift::SeqComplete(transfer()->fd()) );
 
@@ -1319,14 +1771,42 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
     if (hashtree() != NULL && (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE
                                || hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE)) {
         // Check integrity
-        if (!hashtree()->OfferData(pos, (char*)data, length)) {
-            evbuffer_drain(evb, length);
+        if (!hashtree()->OfferData(pos, (const char*)data, length)) {
+            // LIVEPUSH: Pushed before its epoch was signed, keep it till the
+            // munro arrives. Acknowledge it, so the parent doesn't push it
+            // again, it sends it again when we ask for it.
+            if (transfer()->ttype() == LIVE_TRANSFER && !CleanHintOut(pos)
+                    && ((LiveTransfer *)transfer())->OnPushedData(pos,data,length)) {
+                dc.skip(length);
+                dprintf("%s #%" PRIu32 " -data %s pushed ahead\n",tintstr(),id_,pos.str().c_str());
+                if (ack_pending_.empty())
+                    ack_pending_time_ = NOW;
+                ack_pending_.push_back(pos);
+                UpdateDIP(pos);
+                OnUnrequestedData();
+                bytes_down_ += length;
+                global_bytes_down += length;
+                return bin_t::NONE;
+            }
+            dc.skip(length);
+            global_hash_check_fails++;
+            transfer()->OnHashCheckFail();
             dprintf("%s #%" PRIu32 " !data %s\n",tintstr(),id_,pos.str().c_str());
             return bin_t::NONE;
         }
 
         // Arno: If we are getting content, keep activated
         swift::Touch(transfer()->td());
+
+        // DEDUP
+        if (transfer()->ttype() == FILE_TRANSFER)
+            ((FileTransfer *)transfer())->OnDataVerified(pos);
+        // LIVEPUSH: Its hashes may complete the uncles of chunks kept
+        else if (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_UNIFIED_MERKLE) {
+            LiveTransfer *lt = (LiveTransfer *)transfer();
+            if (lt->GetPushPending() > 0)
+                lt->VerifyPushed(((LiveHashTree *)hashtree())->GetMunro(pos));
+        }
     } else {
         // No content integrity checking, just write (TODO SIGN_ALL)
         int ret = transfer()->GetStorage()->Write(data,length,pos.base_offset()*transfer()->chunk_size());
@@ -1336,7 +1816,7 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
             transfer()->ack_out()->set(pos);
     }
 
-    evbuffer_drain(evb, length);
+    dc.skip(length);
     dprintf("%s #%" PRIu32 " -data %s\n",tintstr(),id_,pos.str().c_str());
 
     if (DEBUGTRAFFIC)
@@ -1355,20 +1835,38 @@ bin_t Channel::OnData(struct evbuffer *evb)     // TODO: HAVE NONE for corrupted
     if (peer_time!=TINT_NEVER)
         data_in_.time = NOW - peer_time;
 
+    // ACKAGG
+    if (ack_pending_.empty())
+        ack_pending_time_ = NOW;
+    ack_pending_.push_back(pos);
+    ack_pending_owd_ = data_in_.time;
+
     UpdateDIP(pos);
-    CleanHintOut(pos);
+    if (!CleanHintOut(pos) && transfer()->ttype() == LIVE_TRANSFER)
+        OnUnrequestedData(); // LIVEPUSH
     bytes_down_ += length;
     global_bytes_down += length;
 
     // SIGNPEAK
     // Purge hash tree, if desired
-    if (hs_out_->live_disc_wnd_ != POPT_LIVE_DISC_WND_ALL) {
+    if (hs_out_->live_disc_wnd_ != POPT_LIVE_DISC_WND_ALL && hashtree() != NULL) {
         // Discard parts of tree no longer in window
         LiveTransfer *lt = (LiveTransfer *)transfer();
         LiveHashTree *umt = (LiveHashTree *)hashtree();
         lt->OnDataPruneTree(*hs_out_,pos,umt->GetNChunksPerSig());
     }
 
+    // LIVEFEC: May complete a block we have repairs for
+    if (transfer()->ttype() == LIVE_TRANSFER)
+        ((LiveTransfer *)transfer())->OnRepairData(pos);
+
+    // LIVEPUSH: Relay to our children
+    if (transfer()->ttype() == LIVE_TRANSFER && ((LiveTransfer *)transfer())->GetPushChildren() > 0) {
+        binvector bv;
+        bv.push_back(pos);
+        ((LiveTransfer *)transfer())->PushChunks(bv,this);
+    }
+
     return pos;
 }
 
@@ -1379,6 +1877,7 @@ void Channel::UpdateRTT(tint owd)
     // one-way delay calculations
     std::pair <tint,tint> delay(owd, NOW);
     owd_current_.push_front(delay);
+    tevent(TRACE_OWD,0,owd);
 
     if (owd_min_bin_start_+ LEDBAT_ROLLOVER < NOW) {
         owd_min_bin_start_ = NOW;
@@ -1386,9 +1885,6 @@ void Channel::UpdateRTT(tint owd)
         owd_min_bins_[owd_min_bin_] = owd;
     } else if (owd_min_bins_[owd_min_bin_]>owd)
         owd_min_bins_[owd_min_bin_] = owd;
-
-    ack_rcvd_recent_++;
-
 }
 
 void Channel::UpdateDIP(bin_t pos)
@@ -1432,24 +1928,26 @@ void Channel::UpdateDIP(bin_t pos)
 }
 
 
-void Channel::OnAck(struct evbuffer *evb)
+void Channel::OnAck(DgramCursor &dc)
 {
-
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0) {
+    binarray_t ba;
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?ack bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         return;
     }
-    tint peer_owd = evbuffer_remove_64be(evb);
+    tint peer_owd = dc.get64be();
 
     munro_ack_rcvd_ = true;
 
-    binvector::iterator iter;
-    for (iter=bv.begin(); iter != bv.end(); iter++) {
-        bin_t ackd_pos = *iter;
+    // ACKAGG: An ACK may cover several chunks sent. Each counts for the
+    // congestion window, the delay and RTT are sampled once per ACK.
+    int nacked = 0;
+    tint firstsent = TINT_NEVER, lastsent = TINT_NEVER;
+    for (int i=0; i<ba.size; i++) {
+        bin_t ackd_pos = ba.bins[i];
 
         // FIXME FIXME: wrap around here
         if (ackd_pos.is_none()) // safety catch
@@ -1463,55 +1961,71 @@ void Channel::OnAck(struct evbuffer *evb)
 
         //fprintf(stderr,"OnAck: got bin %s is_complete %d\n", ackd_pos.str(), (int)ack_in_.is_complete_arno( transfer()->ack_out()->get_height() ));
 
-        int di = 0, ri = 0;
-        // find an entry for the send (data out) event
-        while (di<data_out_.size() && (data_out_[di]==tintbin() || !ackd_pos.contains(data_out_[di].bin)))
-            di++;
-        // FUTURE: delayed acks
-        // rule out retransmits
-        // Ric: by ruling out retransmits we screw up ledbat calculations
-        while (ri<data_out_tmo_.size() && !ackd_pos.contains(data_out_tmo_[ri].bin))
-            ri++;
-
-        dprintf("%s #%" PRIu32 " %cack %s owd:%" PRIi64 "\n",tintstr(),id_,
-                di==data_out_.size() ? (ri==data_out_tmo_.size() ? '?':'R') : '-',ackd_pos.str().c_str(),peer_owd);
-
-        if (di!=data_out_.size()) {
-            // Ric: FIXME assuming direct sending of acks
-            tint rtt = NOW-data_out_[di].time;
-
-            // Ric: quickly adapt to new network changes! (with large owd samples the previous rtt values influence
-            //if (owd > rtt_avg_)
-            //   rtt_avg_ = (rtt_avg_*3 + rtt) >> 2;
-            //else
-            rtt_avg_ = (rtt_avg_*7 + rtt) >> 3;
-            dev_avg_ = (dev_avg_*3 + tintabs(rtt-rtt_avg_)) >> 2;
+        int binacked = 0;
+        for (int di=0; di<data_out_.size(); di++) {
+            if (data_out_[di]==tintbin() || !ackd_pos.contains(data_out_[di].bin))
+                continue;
             assert(data_out_[di].time!=TINT_NEVER);
-            dprintf("%s #%" PRIu32 " rtt:%" PRIu64 ", rtt_avg:%" PRIu64 " dev:%" PRIu64 "\n", tintstr(), id_,rtt, rtt_avg_,
-                    dev_avg_);
-
-            UpdateRTT(peer_owd);
+            if (lastsent == TINT_NEVER || data_out_[di].time > lastsent)
+                lastsent = data_out_[di].time;
+            if (firstsent == TINT_NEVER || data_out_[di].time < firstsent)
+                firstsent = data_out_[di].time;
+            ack_rcvd_recent_++;
+            if (data_out_[di].bin == pmtu_probe_bin_) {
+                // MULTIDATA
+                dprintf("%s #%" PRIu32 " pmtu probe %d ok\n",tintstr(),id_,pmtu_probe_size_);
+                pmtu_ = std::max(pmtu_,pmtu_probe_size_);
+                pmtu_probe_bin_ = bin_t::NONE;
+            }
             dprintf("%s #%" PRIu32 " setting null %s\n",tintstr(),id_, data_out_[di].bin.str().c_str());
-            // early loss detection by packet reordering
-            /* TODO do we really need it?
-            for (int re=0; re<di-MAX_REORDERING; re++) {
-               if (data_out_[re]==tintbin())
-                   continue;
-               ack_not_rcvd_recent_++;
-               data_out_size_--;
-               data_out_tmo_.push_back(data_out_[re].bin);
-               dprintf("%s #%" PRIu32 " Rdata %s\n",tintstr(),id_,data_out_.front().bin.str().c_str());
-               data_out_cap_ = bin_t::ALL;
-               data_out_[re] = tintbin();
-            }*/
             data_out_size_--;
             data_out_[di]=tintbin();
-        } else if (ri!=data_out_tmo_.size()) {
-            // Ric: TODO test
-            //UpdateRTT(peer_owd);
-            data_out_tmo_[ri]=tintbin();
+            binacked++;
+        }
+        nacked += binacked;
+        // rule out retransmits
+        // Ric: by ruling out retransmits we screw up ledbat calculations
+        int nretrans = 0;
+        if (binacked == 0) {
+            for (int ri=0; ri<data_out_tmo_.size(); ri++) {
+                if (data_out_tmo_[ri]==tintbin() || !ackd_pos.contains(data_out_tmo_[ri].bin))
+                    continue;
+                // Ric: TODO test
+                //UpdateRTT(peer_owd);
+                data_out_tmo_[ri]=tintbin();
+                nretrans++;
+            }
+        }
+
+        dprintf("%s #%" PRIu32 " %cack %s owd:%" PRIi64 "\n",tintstr(),id_,
+                binacked ? '-' : (nretrans ? 'R':'?'),ackd_pos.str().c_str(),peer_owd);
+    }
+
+    if (nacked) {
+        UpdateRTT(peer_owd);
+
+        // Ric: FIXME assuming direct sending of acks
+        tint rtt = NOW-lastsent;
+        // ACKAGG: With fewer than SWIFT_DELAYED_ACK_CHUNKS the peer held
+        // the ACK until its timer ran out, which started when the first
+        // chunk arrived. Legacy peers ACK straight away. The ACK may also
+        // have gone out early with other messages, so take off at most half.
+        if (nacked < SWIFT_DELAYED_ACK_CHUNKS && hs_in_->version_ != VER_SWIFT_LEGACY) {
+            tint hold = std::min(SWIFT_DELAYED_ACK_TIME,rtt_avg_>>2) - (lastsent-firstsent);
+            if (hold > 0)
+                rtt -= std::min(hold,rtt>>1);
         }
 
+        // Ric: quickly adapt to new network changes! (with large owd samples the previous rtt values influence
+        //if (owd > rtt_avg_)
+        //   rtt_avg_ = (rtt_avg_*3 + rtt) >> 2;
+        //else
+        rtt_avg_ = (rtt_avg_*7 + rtt) >> 3;
+        global_rtt_hist.AddSample(rtt);
+        tevent(TRACE_ACK,rtt,ba.bins[ba.size-1].toUInt());
+        dev_avg_ = (dev_avg_*3 + tintabs(rtt-rtt_avg_)) >> 2;
+        dprintf("%s #%" PRIu32 " rtt:%" PRIu64 ", rtt_avg:%" PRIu64 " dev:%" PRIu64 "\n", tintstr(), id_,rtt, rtt_avg_,
+                dev_avg_);
     }
 
     // clear zeroed items
@@ -1541,14 +2055,25 @@ void Channel::TimeoutDataOut()
         if (data_out_.front()!=tintbin() && ack_in_.is_empty(data_out_.front().bin)) {
             ack_not_rcvd_recent_++;
             data_out_cap_ = bin_t::ALL;
+            // HASHDEDUP: Its uncles may have been lost with it, and chunks
+            // still in flight may depend on them. Rely on ACKs only.
+            hashes_out_.clear();
             // Ric: keep the original timing... otherwise calculations are wrong once
             //      we get the ack back
             data_out_tmo_.push_back(data_out_.front());
             data_out_size_--;
+            tevent(TRACE_LOSS,0,data_out_.front().bin.toUInt());
+            if (data_out_.front().bin == pmtu_probe_bin_)
+                OnPMTUProbeFailed(false);
             dprintf("%s #%" PRIu32 " Tdata %s\n",tintstr(),id_,data_out_.front().bin.str().c_str());
         }
         data_out_.pop_front();
     }
+    // LIVEFEC: repairs are not acked, an RTT is when a chunk would be
+    while (!repair_sent_.empty() && repair_sent_.front() < NOW-rtt_avg_) {
+        repair_sent_.pop_front();
+        data_out_size_--;
+    }
     // clear retransmit queue of older items
     while (!data_out_tmo_.empty() && (data_out_tmo_.front()==tintbin()
                                       || data_out_tmo_.front().time<NOW-MAX_POSSIBLE_RTT)) {
@@ -1563,26 +2088,24 @@ void Channel::TimeoutDataOut()
 }
 
 
-void Channel::OnHave(struct evbuffer *evb)
+void Channel::OnHave(DgramCursor &dc)
 {
-
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0) {
+    binarray_t ba;
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?have bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         return;
     }
-    binvector::iterator iter;
-    for (iter=bv.begin(); iter != bv.end(); iter++) {
-        bin_t ackd_pos = *iter;
+    for (int i=0; i<ba.size; i++) {
+        bin_t ackd_pos = ba.bins[i];
 
         if (ackd_pos.is_none()) // safety catch
             return; // wow, peer has hashes
 
         // PPPLUG
-        if (!hashtree()->is_complete() && transfer()->ttype() == FILE_TRANSFER) {
+        if (transfer()->ttype() == FILE_TRANSFER && !hashtree()->is_complete()) {
             FileTransfer *ft = (FileTransfer *)transfer();
 
             // Ric: update the availability if needed
@@ -1619,13 +2142,10 @@ void Channel::OnHaveLive(bin_t ackd_pos)
                     bin_t firstbasepos = bin_t(0,ack_in_right_basebin_.layer_offset() - hs_in_->live_disc_wnd_+1);
 
                     // 3. Empty all bins before start of window
-                    binvector cbv;
-                    swift::chunk32_to_bin32(0, firstbasepos.layer_offset(), &cbv); // firsbasepos exclusive
-                    binvector::iterator iter;
-                    for (iter=cbv.begin(); iter != cbv.end(); iter++) {
-                        bin_t cpos = *iter;
-                        ack_in_.reset(cpos);
-                    }
+                    binarray_t cba;
+                    swift::chunk64_to_binarray(0, firstbasepos.layer_offset(), &cba); // firsbasepos exclusive
+                    for (int i=0; i<cba.size; i++)
+                        ack_in_.reset(cba.bins[i]);
                     dprintf("%s #%" PRIu32 " have window %s %s\n",tintstr(),id_,firstbasepos.str().c_str(),
                             ack_in_right_basebin_.str().c_str());
                 }
@@ -1643,21 +2163,25 @@ void Channel::OnHaveLive(bin_t ackd_pos)
 }
 
 
-void Channel::OnHint(struct evbuffer *evb)
+void Channel::OnHint(DgramCursor &dc)
 {
-
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0) {
+    binarray_t ba;
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?hint bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         return;
     }
 
-    binvector::iterator iter;
-    for (iter=bv.begin(); iter != bv.end(); iter++) {
-        bin_t hint = *iter;
+    // RELAYTREE: Source ignores requests from peers it steered to relays
+    if (transfer()->ttype() == LIVE_TRANSFER && !((LiveTransfer *)transfer())->IsServed(this)) {
+        dprintf("%s #%" PRIu32 " ?hint not a relay\n",tintstr(),id_);
+        return;
+    }
+
+    for (int i=0; i<ba.size; i++) {
+        bin_t hint = ba.bins[i];
 
         // Ric: TODO test
         tbqueue::iterator it = hint_in_.begin();
@@ -1742,6 +2266,7 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
         uint8_t *swarmidbytes = NULL;
         uint8_t *msgbitmapbytes = NULL;
         SwarmID swarmid;
+        bool gotswarmid = false, gotmerklefunc = false;
         std::ostringstream cross;
         while (!end && evbuffer_get_length(evb) > 0) {
             popt_t poid = (popt_t)evbuffer_remove_8(evb);
@@ -1767,6 +2292,7 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
                 swarmid = SwarmID(swarmidbytes,size);
                 delete swarmidbytes;
                 hs->SetSwarmID(swarmid);
+                gotswarmid = true;
                 cross << "sid " << swarmid.hex() << " ";
                 break;
             case POPT_CONT_INT_PROT:
@@ -1775,6 +2301,7 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
                 break;
             case POPT_MERKLE_HASH_FUNC:
                 hs->merkle_func_ = (popt_merkle_func_t)evbuffer_remove_8(evb);
+                gotmerklefunc = true;
                 cross << "mhf " << hs->merkle_func_ << " ";
                 break;
             case POPT_LIVE_SIG_ALG:
@@ -1800,11 +2327,19 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
                     return NULL;
                 }
                 msgbitmapbytes = evbuffer_pullup(evb,size8);
-                evbuffer_drain(evb, size);
+                // Bit 0 of the first byte is the most significant one
+                hs->supp_msgs_ = 0;
+                for (i8=0; i8<size8; i8++) {
+                    for (int b=0; b<8; b++) {
+                        if (msgbitmapbytes[i8] & (0x80 >> b))
+                            hs->supp_msgs_ |= (uint64_t)1 << (i8*8+b);
+                    }
+                }
                 cross << "msgs " << std::hex;
                 for (i8=0; i8<size8; i8++)
                     cross << (int)msgbitmapbytes[i8];
-                cross << std::dec;
+                cross << std::dec << " ";
+                evbuffer_drain(evb, size8);
                 break;
             case POPT_END:
                 end = true;
@@ -1816,6 +2351,15 @@ Handshake *Channel::StaticOnHandshake(Address &addr, uint32_t cid, bool ver_know
                 return NULL;
             }
         }
+        // A root hash that is not SHA-1 sized doesn't say which function
+        // made it, so the peer must
+        if (gotswarmid && swarmid.ttype() == FILE_TRANSFER && swarmid.roothash().size() != Sha1Hash::SIZE
+                && (!gotmerklefunc || Sha1Hash::Size(hs->merkle_func_) != swarmid.roothash().size())) {
+            dprintf("%s #%" PRIu32 " ?hs %d-byte root hash without its merkle func\n",tintstr(),cid,
+                    (int)swarmid.roothash().size());
+            delete hs;
+            return NULL;
+        }
     }
 
     return hs;
@@ -1836,13 +2380,32 @@ void Channel::OnHandshake(Handshake *hishs)
         dprintf("%s #%" PRIu32 " -hs %x %s opened as channel %" PRIu32 "\n",tintstr(),id_,hishs->peer_channel_id_,
                 (hishs->version_ == VER_SWIFT_LEGACY) ? "swift" : "ppsp", id_);
 
+    // The options are fixed once the channel is established, the peer
+    // repeats its handshake until it knows we got it.
+    if (is_established()) {
+        dprintf("%s #%" PRIu32 " -hs ignored, established\n",tintstr(),id_);
+        delete hishs;
+        return;
+    }
+
     if (!hishs->IsSupported()) {
         dprintf("%s #%" PRIu32 " -hs unsupported\n",tintstr(),id_);
         Close(CLOSE_SEND);
         delete hishs;
         return;
     }
+    // Hashes are only checkable with the tree's own hash function
+    if (transfer()->ttype() == FILE_TRANSFER && hishs->cont_int_prot_ == POPT_CONT_INT_PROT_MERKLE
+            && hishs->merkle_func_ != hs_out_->merkle_func_) {
+        dprintf("%s #%" PRIu32 " -hs merkle func %d, want %d\n",tintstr(),id_,(int)hishs->merkle_func_,
+                (int)hs_out_->merkle_func_);
+        Close(CLOSE_SEND);
+        delete hishs;
+        return;
+    }
 
+    if (hs_in_ != NULL) // concurrent connection attempt
+        delete hs_in_;
     hs_in_ = hishs;
     hs_in_->ReleaseSwarmID(); // save mem per channel
 
@@ -1869,15 +2432,14 @@ void Channel::OnHandshake(Handshake *hishs)
 }
 
 
-void Channel::OnCancel(struct evbuffer *evb)
+void Channel::OnCancel(DgramCursor &dc)
 {
-
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
-    if (bv.size() == 0) {
+    binarray_t ba;
+    if (dc.getchunkaddr(hs_in_->chunk_addr_,transfer()->chunk_size(),&ba) == 0) {
         // Could not parse chunk spec
         dprintf("%s #%" PRIu32 " ?cancel bad chunk spec\n",tintstr(),id_);
         Close(CLOSE_DO_NOT_SEND);
-        evbuffer_drain(evb, evbuffer_get_length(evb));
+        dc.skip(dc.remaining());
         return;
     }
 
@@ -1892,9 +2454,8 @@ void Channel::OnCancel(struct evbuffer *evb)
     // If the hint is already in progress (i.e, already transmitted, not yet
     // acked), we let it be.
     //
-    binvector::iterator iter;
-    for (iter=bv.begin(); iter != bv.end(); iter++) {
-        bin_t cancelbin = *iter;
+    for (int i=0; i<ba.size; i++) {
+        bin_t cancelbin = ba.bins[i];
         dprintf("%s #%" PRIu32 " -cancel %s\n",tintstr(),id_,cancelbin.str().c_str());
 
         // 1. Remove hint from hint_in_ if contained in cancelbin. Use Riccardo's solution:
@@ -2000,7 +2561,7 @@ void Channel::OnSignedHash(struct evbuffer *evb)
         return;
     }
 
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_,transfer()->chunk_size());
     if (bv.size() == 0 || bv.size() > 1) {
         // chunk spec for hash must be power-of-2 range, so must fit in single bin
         dprintf("%s #%" PRIu32 " ?sigh bad chunk spec\n",tintstr(),id_);
@@ -2040,26 +2601,60 @@ void Channel::OnSignedHash(struct evbuffer *evb)
         if (!newverified)
             dprintf("%s #%" PRIu32 " !sigh %s\n",tintstr(),id_,pos.str().c_str());
         else {
+            // LIVEPUSH: Check the chunks pushed ahead of it
+            ((LiveTransfer *)transfer())->VerifyPushed(pos);
+
             if (source_tint+(SWIFT_LIVE_MAX_SOURCE_DIVERGENCE_TIME*TINT_SEC) < NOW)
                 dprintf("%s #%" PRIu32 " *sigh %s\n",tintstr(),id_,pos.str().c_str()); // outdated Sig
             else {
                 dprintf("%s #%" PRIu32 " -sigh %s\n",tintstr(),id_,pos.str().c_str());
 
                 LiveTransfer *lt = (LiveTransfer *)transfer();
-                lt->OnVerifiedMunroHash(pos,source_tint);
+                lt->OnVerifiedMunroHash(pos,source_tint,id_);
             }
         }
     } else if (hs_in_->cont_int_prot_ == POPT_CONT_INT_PROT_NONE) {
         dprintf("%s #%" PRIu32 " -sigh %s\n",tintstr(),id_,pos.str().c_str());
 
         LiveTransfer *lt = (LiveTransfer *)transfer();
-        lt->OnVerifiedMunroHash(pos,source_tint);
+        lt->OnVerifiedMunroHash(pos,source_tint,id_);
     } else {
         dprintf("%s #%" PRIu32 " ?sigh %s\n",tintstr(),id_,pos.str().c_str());
     }
 }
 
 
+void Channel::OnRepair(struct evbuffer *evb)
+{
+    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_,transfer()->chunk_size());
+    if (bv.size() != 1 || !bv.front().is_base() || evbuffer_get_length(evb) < 2) {
+        dprintf("%s #%" PRIu32 " ?repair bad chunk spec\n",tintstr(),id_);
+        Close(CLOSE_DO_NOT_SEND);
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+        return;
+    }
+    bin_t first = bv.front();
+    uint32_t k = evbuffer_remove_8(evb);
+    uint32_t repairidx = evbuffer_remove_8(evb);
+
+    // Like DATA, last message in datagram
+    uint32_t length = std::min((uint32_t)evbuffer_get_length(evb),transfer()->chunk_size());
+    if (transfer()->ttype() != LIVE_TRANSFER || k == 0 || k+repairidx >= SWIFT_FEC_MAX_SYMBOLS) {
+        dprintf("%s #%" PRIu32 " ?repair %s k %" PRIu32 " idx %" PRIu32 "\n",tintstr(),id_,first.str().c_str(),
+                k,repairidx);
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+        return;
+    }
+    dprintf("%s #%" PRIu32 " -repair %s k %" PRIu32 " idx %" PRIu32 "\n",tintstr(),id_,first.str().c_str(),
+            k,repairidx);
+
+    uint8_t *data = evbuffer_pullup(evb, length);
+    LiveTransfer *lt = (LiveTransfer *)transfer();
+    lt->OnRepair(first,k,repairidx,data,length);
+    evbuffer_drain(evb, evbuffer_get_length(evb));
+}
+
+
 /*
  * Sending messages
  */
@@ -2075,6 +2670,9 @@ void Channel::AddPex(struct evbuffer *evb)
             if (channels[(int) pex_peer.bin.toUInt()] == NULL)
                 continue;
             Address a = channels[(int) pex_peer.bin.toUInt()]->peer();
+            // Don't tell a peer about itself, we may have two channels to it
+            if (a == peer())
+                continue;
             // Arno, 2012-02-28: Don't send private addresses to non-private peers.
             if (!a.is_private() || (a.is_private() && peer().is_private())) {
                 evbuffer_add_pexaddr(evb, a);
@@ -2097,13 +2695,18 @@ void Channel::AddPex(struct evbuffer *evb)
     Address a;
     while (true) {
         // Arno, 2011-10-03: Choosing Gertjan's RandomChannel over RevealChannel here.
-        c = transfer()->RandomChannel(this);
+        // RELAYTREE: Source in relay overlay mode only reveals relays
+        if (transfer()->ttype() == LIVE_TRANSFER && ((LiveTransfer *)transfer())->am_source()
+                && ((LiveTransfer *)transfer())->GetTier1Relays() > 0)
+            c = ((LiveTransfer *)transfer())->RandomRelay(this);
+        else
+            c = transfer()->RandomChannel(this);
         if (c == NULL || tries > 5) {
             pex_requested_ = false;
             return;
         }
         a = c->peer();
-        if (!a.is_private() || (a.is_private() && peer().is_private()))
+        if (a != peer() && (!a.is_private() || (a.is_private() && peer().is_private())))
             break;
         tries++;
     }
@@ -2297,6 +2900,8 @@ void Channel::RecvDatagram(evutil_socket_t socket)
         channel->own_id_mentioned_ = true;
     }
     channel->raw_bytes_down_ += evboriglen;
+    if (channel->transfer() != NULL)
+        channel->transfer()->OnDatagram(DDIR_DOWNLOAD,evboriglen);
     //dprintf("recvd %i bytes for %i\n",data.size(),channel->id);
     bool wasestablished = channel->is_established();
 
@@ -2445,8 +3050,11 @@ void Channel::LibeventSendCallback(int fd, short event, void *arg)
     if (NOW<sender->next_send_time_-TINT_MSEC)
         dprintf("%s #%" PRIu32 " suspicious send %s<%s\n",tintstr(),
                 sender->id(),tintstr(NOW),tintstr(sender->next_send_time_));
-    if (sender->next_send_time_ != TINT_NEVER)
+    if (sender->next_send_time_ != TINT_NEVER) {
+        if (sender->next_send_time_ > 0) // first send is immediate, not scheduled
+            global_send_lag_hist.AddSample(NOW-sender->next_send_time_);
         sender->Send();
+    }
 }
 
 
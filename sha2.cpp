@@ -0,0 +1,347 @@
+/*
+ *  sha2.cpp
+ *  SHA-256 and SHA-512/256 (FIPS 180-4) for Merkle hash trees.
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "sha2.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA2_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t K512[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+
+#define ROR32(x,n)  (((x) >> (n)) | ((x) << (32-(n))))
+#define ROR64(x,n)  (((x) >> (n)) | ((x) << (64-(n))))
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p+4);
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+    put_be32(p,(uint32_t)(v >> 32));
+    put_be32(p+4,(uint32_t)v);
+}
+
+
+/*
+ * SHA-256
+ */
+
+static void sha256_blocks_c(uint32_t H[8], const uint8_t *data, size_t nblocks)
+{
+    uint32_t W[64];
+    while (nblocks--) {
+        int t;
+        for (t=0; t<16; t++)
+            W[t] = get_be32(data+t*4);
+        for (t=16; t<64; t++) {
+            uint32_t s0 = ROR32(W[t-15],7) ^ ROR32(W[t-15],18) ^ (W[t-15] >> 3);
+            uint32_t s1 = ROR32(W[t-2],17) ^ ROR32(W[t-2],19) ^ (W[t-2] >> 10);
+            W[t] = W[t-16] + s0 + W[t-7] + s1;
+        }
+        uint32_t a=H[0], b=H[1], c=H[2], d=H[3], e=H[4], f=H[5], g=H[6], h=H[7];
+        for (t=0; t<64; t++) {
+            uint32_t S1 = ROR32(e,6) ^ ROR32(e,11) ^ ROR32(e,25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t T1 = h + S1 + ch + K256[t] + W[t];
+            uint32_t S0 = ROR32(a,2) ^ ROR32(a,13) ^ ROR32(a,22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t T2 = S0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + T1;
+            d = c;
+            c = b;
+            b = a;
+            a = T1 + T2;
+        }
+        H[0] += a;
+        H[1] += b;
+        H[2] += c;
+        H[3] += d;
+        H[4] += e;
+        H[5] += f;
+        H[6] += g;
+        H[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef SHA2_SHANI
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t H[8], const uint8_t *data, size_t nblocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, MSG, TMP, ABEF_SAVE, CDGH_SAVE;
+    __m128i W[4];
+
+    // H is ABCD EFGH, the instructions want ABEF CDGH
+    TMP = _mm_loadu_si128((const __m128i *)&H[0]);
+    STATE1 = _mm_loadu_si128((const __m128i *)&H[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    while (nblocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+        for (int g=0; g<16; g++) {
+            __m128i Wg;
+            if (g < 4) {
+                Wg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+g*16)), MASK);
+                W[g] = Wg;
+            } else {
+                // W[t] = W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2]), 4 at a time
+                TMP = _mm_sha256msg1_epu32(W[g&3], W[(g-3)&3]);
+                TMP = _mm_add_epi32(TMP, _mm_alignr_epi8(W[(g-1)&3], W[(g-2)&3], 4));
+                Wg = _mm_sha256msg2_epu32(TMP, W[(g-1)&3]);
+                W[g&3] = Wg;
+            }
+            MSG = _mm_add_epi32(Wg, _mm_loadu_si128((const __m128i *)&K256[g*4]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            MSG = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        }
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += 64;
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+    _mm_storeu_si128((__m128i *)&H[0], STATE0);
+    _mm_storeu_si128((__m128i *)&H[4], STATE1);
+}
+
+static int detect_shani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+        return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ebx >> 29) & 1;
+}
+
+#endif
+
+typedef void (*sha256_blocks_t)(uint32_t H[8], const uint8_t *data, size_t nblocks);
+
+static sha256_blocks_t sha256_blocks_impl(void)
+{
+#ifdef SHA2_SHANI
+    static sha256_blocks_t impl = detect_shani() ? sha256_blocks_shani : sha256_blocks_c;
+    return impl;
+#else
+    return sha256_blocks_c;
+#endif
+}
+
+int sha256_hw_accelerated(void)
+{
+    return sha256_blocks_impl() != sha256_blocks_c;
+}
+
+void sha256_init(sha256_ctx *ctx)
+{
+    static const uint32_t IV[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    ctx->size = 0;
+    memcpy(ctx->H, IV, sizeof(IV));
+}
+
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    unsigned int fill = ctx->size & 63;
+    sha256_blocks_t blocks = sha256_blocks_impl();
+
+    ctx->size += len;
+    if (fill) {
+        unsigned int left = 64 - fill;
+        if (len < left) {
+            memcpy(ctx->W + fill, p, len);
+            return;
+        }
+        memcpy(ctx->W + fill, p, left);
+        blocks(ctx->H, ctx->W, 1);
+        p += left;
+        len -= left;
+    }
+    if (len >= 64) {
+        blocks(ctx->H, p, len/64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    if (len)
+        memcpy(ctx->W, p, len);
+}
+
+void sha256_final(unsigned char hashout[32], sha256_ctx *ctx)
+{
+    static const uint8_t pad[64] = { 0x80 };
+    uint8_t bits[8];
+    put_be64(bits, ctx->size << 3);
+    unsigned int fill = ctx->size & 63;
+    sha256_update(ctx, pad, 1 + (63 & (55 - fill)));
+    sha256_update(ctx, bits, 8);
+    for (int i=0; i<8; i++)
+        put_be32(hashout+i*4, ctx->H[i]);
+}
+
+
+/*
+ * SHA-512/256: SHA-512 with its own IV, truncated to 256 bits
+ */
+
+static void sha512_blocks(uint64_t H[8], const uint8_t *data, size_t nblocks)
+{
+    uint64_t W[80];
+    while (nblocks--) {
+        int t;
+        for (t=0; t<16; t++)
+            W[t] = get_be64(data+t*8);
+        for (t=16; t<80; t++) {
+            uint64_t s0 = ROR64(W[t-15],1) ^ ROR64(W[t-15],8) ^ (W[t-15] >> 7);
+            uint64_t s1 = ROR64(W[t-2],19) ^ ROR64(W[t-2],61) ^ (W[t-2] >> 6);
+            W[t] = W[t-16] + s0 + W[t-7] + s1;
+        }
+        uint64_t a=H[0], b=H[1], c=H[2], d=H[3], e=H[4], f=H[5], g=H[6], h=H[7];
+        for (t=0; t<80; t++) {
+            uint64_t S1 = ROR64(e,14) ^ ROR64(e,18) ^ ROR64(e,41);
+            uint64_t ch = (e & f) ^ (~e & g);
+            uint64_t T1 = h + S1 + ch + K512[t] + W[t];
+            uint64_t S0 = ROR64(a,28) ^ ROR64(a,34) ^ ROR64(a,39);
+            uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint64_t T2 = S0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + T1;
+            d = c;
+            c = b;
+            b = a;
+            a = T1 + T2;
+        }
+        H[0] += a;
+        H[1] += b;
+        H[2] += c;
+        H[3] += d;
+        H[4] += e;
+        H[5] += f;
+        H[6] += g;
+        H[7] += h;
+        data += 128;
+    }
+}
+
+void sha512_256_init(sha512_ctx *ctx)
+{
+    static const uint64_t IV[8] = {
+        0x22312194fc2bf72cULL, 0x9f555fa3c84c64c2ULL, 0x2393b86b6f53b151ULL, 0x963877195940eabdULL,
+        0x96283ee2a88effe3ULL, 0xbe5e1e2553863992ULL, 0x2b0199fc2c85b8aaULL, 0x0eb72ddc81c52ca2ULL
+    };
+    ctx->size = 0;
+    memcpy(ctx->H, IV, sizeof(IV));
+}
+
+void sha512_update(sha512_ctx *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    unsigned int fill = ctx->size & 127;
+
+    ctx->size += len;
+    if (fill) {
+        unsigned int left = 128 - fill;
+        if (len < left) {
+            memcpy(ctx->W + fill, p, len);
+            return;
+        }
+        memcpy(ctx->W + fill, p, left);
+        sha512_blocks(ctx->H, ctx->W, 1);
+        p += left;
+        len -= left;
+    }
+    if (len >= 128) {
+        sha512_blocks(ctx->H, p, len/128);
+        p += len & ~(size_t)127;
+        len &= 127;
+    }
+    if (len)
+        memcpy(ctx->W, p, len);
+}
+
+void sha512_256_final(unsigned char hashout[32], sha512_ctx *ctx)
+{
+    static const uint8_t pad[128] = { 0x80 };
+    // 128-bit length, messages stay below 2^61 bytes
+    uint8_t bits[16];
+    put_be64(bits, ctx->size >> 61);
+    put_be64(bits+8, ctx->size << 3);
+    unsigned int fill = ctx->size & 127;
+    sha512_update(ctx, pad, 1 + (127 & (111 - fill)));
+    sha512_update(ctx, bits, 16);
+    for (int i=0; i<4; i++)
+        put_be64(hashout+i*8, ctx->H[i]);
+}
@@ -0,0 +1,40 @@
+/*
+ *  sha2.h
+ *  SHA-256 and SHA-512/256 (FIPS 180-4) for Merkle hash trees.
+ *
+ *  SHA-256 uses the x86 SHA extensions when the CPU has them, SHA-512/256
+ *  is portable C. Same calling convention as sha1.h.
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#ifndef SWIFT_SHA2_H
+#define SWIFT_SHA2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t size;
+    uint32_t H[8];
+    uint8_t  W[64];
+} sha256_ctx;
+
+typedef struct {
+    uint64_t size;
+    uint64_t H[8];
+    uint8_t  W[128];
+} sha512_ctx;
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(unsigned char hashout[32], sha256_ctx *ctx);
+
+void sha512_256_init(sha512_ctx *ctx);
+void sha512_update(sha512_ctx *ctx, const void *data, size_t len);
+void sha512_256_final(unsigned char hashout[32], sha512_ctx *ctx);
+
+/** Whether SHA-256 runs on the CPU's SHA extensions */
+int sha256_hw_accelerated(void);
+
+#endif
@@ -9,6 +9,7 @@
  */
 
 #include "swift.h"
+#include "swarmmanager.h"
 #include <event2/http.h>
 
 using namespace swift;
@@ -74,6 +75,10 @@ const char *exit_page = "<!doctype html> \
 
 static void StatsGwNewRequestCallback(struct evhttp_request *evreq, void *arg);
 
+// In httpgw.cpp
+void HttpGwGetPrefetchStats(uint64_t *requests, uint64_t *predicted, uint64_t *hits);
+void HttpGwGetRequestStats(int *open, uint64_t *membytes, uint64_t *poolbytes);
+
 
 void StatsExitCallback(struct evhttp_request *evreq)
 {
@@ -120,9 +125,9 @@ void StatsOverviewCallback(struct evhttp_request *evreq)
     //statsgw_last_up = up;
 
 
-    char bodystr[102400];
-    strcpy(bodystr,"");
-    strcat(bodystr,top_page);
+    // Arno: Construct page in evbuffer, a fixed buffer overflows with many swarms
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add(evb,top_page,strlen(top_page));
 
     tdlist_t tds = swift::GetTransferDescriptors();
     tdlist_t::iterator iter;
@@ -130,34 +135,204 @@ void StatsOverviewCallback(struct evhttp_request *evreq)
         int td = *iter;
         uint64_t total = (int)swift::Size(td);
         uint64_t down  = (int)swift::Complete(td);
-        int perc = (int)((down * 100) / total);
-
-        char roothashhexstr[1024];
-        sprintf(roothashhexstr,"%s", GetSwarmID(td).hex().c_str());
+        int perc = total > 0 ? (int)((down * 100) / total) : 0;
 
-        char templ[2048];
-        sprintf(templ,swarm_page_templ,roothashhexstr, perc, '%', dspeed, uspeed);
-        strcat(bodystr,templ);
+        evbuffer_add_printf(evb,swarm_page_templ,GetSwarmID(td).hex().c_str(), perc, '%', dspeed, uspeed);
     }
 
-    strcat(bodystr,bottom_page);
+    int ret = evbuffer_add(evb,bottom_page,strlen(bottom_page));
+    if (ret < 0) {
+        print_error("statsgw: OverviewCallback: error evbuffer_add");
+        evbuffer_free(evb);
+        return;
+    }
 
     char contlenstr[1024];
-    sprintf(contlenstr,PRISIZET,strlen(bodystr));
+    sprintf(contlenstr,PRISIZET,evbuffer_get_length(evb));
     struct evkeyvalq *headers = evhttp_request_get_output_headers(evreq);
     evhttp_add_header(headers, "Connection", "close");
     evhttp_add_header(headers, "Content-Type", "text/html");
     evhttp_add_header(headers, "Content-Length", contlenstr);
     evhttp_add_header(headers, "Accept-Ranges", "none");
 
-    // Construct evbuffer and send via chunked encoding
+    evhttp_send_reply(evreq, 200, "OK", evb);
+    evbuffer_free(evb);
+}
+
+
+/*
+ * METRICS: OpenMetrics text format, see https://openmetrics.io
+ */
+
+static void StatsMetricsFamily(struct evbuffer *evb, const char *name, const char *type, const char *help)
+{
+    evbuffer_add_printf(evb,"# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+
+static void StatsMetricsHistogram(struct evbuffer *evb, const char *name, const char *help, LatencyHistogram &hist)
+{
+    StatsMetricsFamily(evb,name,"histogram",help);
+    uint64_t cum = 0;
+    for (int i=0; i<HISTOGRAM_NBUCKETS; i++) {
+        cum += hist.GetBucketCount(i);
+        tint bound = LatencyHistogram::GetBucketBound(i);
+        if (bound == TINT_NEVER)
+            evbuffer_add_printf(evb,"%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cum);
+        else
+            evbuffer_add_printf(evb,"%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, (double)bound/(double)TINT_SEC, cum);
+    }
+    evbuffer_add_printf(evb,"%s_count %" PRIu64 "\n", name, hist.GetCount());
+    evbuffer_add_printf(evb,"%s_sum %g\n", name, (double)hist.GetSum()/(double)TINT_SEC);
+}
+
+
+static void StatsMetricsUpDown(struct evbuffer *evb, const char *name, const char *labels, uint64_t up, uint64_t down)
+{
+    const char *sep = (labels[0] == '\0') ? "" : ",";
+    evbuffer_add_printf(evb,"%s_total{%s%sdirection=\"up\"} %" PRIu64 "\n", name, labels, sep, up);
+    evbuffer_add_printf(evb,"%s_total{%s%sdirection=\"down\"} %" PRIu64 "\n", name, labels, sep, down);
+}
+
+
+void StatsMetricsCallback(struct evhttp_request *evreq)
+{
     struct evbuffer *evb = evbuffer_new();
-    int ret = evbuffer_add(evb,bodystr,strlen(bodystr));
+
+    // Global counters
+    StatsMetricsFamily(evb,"swift_datagrams","counter","UDP datagrams sent and received.");
+    StatsMetricsUpDown(evb,"swift_datagrams","",Channel::global_dgrams_up,Channel::global_dgrams_down);
+    StatsMetricsFamily(evb,"swift_raw_bytes","counter","Bytes sent and received in UDP datagrams.");
+    StatsMetricsUpDown(evb,"swift_raw_bytes","",Channel::global_raw_bytes_up,Channel::global_raw_bytes_down);
+    StatsMetricsFamily(evb,"swift_content_bytes","counter","Bytes of content sent and received in DATA messages.");
+    StatsMetricsUpDown(evb,"swift_content_bytes","",Channel::global_bytes_up,Channel::global_bytes_down);
+    StatsMetricsFamily(evb,"swift_hash_bytes","counter","Bytes of hashes sent and received in INTEGRITY messages.");
+    StatsMetricsUpDown(evb,"swift_hash_bytes","",Channel::global_hash_bytes_up,Channel::global_hash_bytes_down);
+    StatsMetricsFamily(evb,"swift_hashes_deduped","counter","Uncle hashes not sent as the peer could already derive them.");
+    evbuffer_add_printf(evb,"swift_hashes_deduped_total %" PRIu64 "\n", Channel::global_hashes_deduped);
+    StatsMetricsFamily(evb,"swift_hash_bytes_per_content_byte","gauge","INTEGRITY overhead: hash bytes per content byte sent and received.");
+    evbuffer_add_printf(evb,"swift_hash_bytes_per_content_byte{direction=\"up\"} %g\n",
+                        Channel::global_bytes_up ? (double)Channel::global_hash_bytes_up/Channel::global_bytes_up : 0.0);
+    evbuffer_add_printf(evb,"swift_hash_bytes_per_content_byte{direction=\"down\"} %g\n",
+                        Channel::global_bytes_down ? (double)Channel::global_hash_bytes_down/Channel::global_bytes_down : 0.0);
+    StatsMetricsFamily(evb,"swift_retransmits","counter","Chunks sent again after they timed out.");
+    evbuffer_add_printf(evb,"swift_retransmits_total %" PRIu64 "\n", Channel::global_retransmits);
+    StatsMetricsFamily(evb,"swift_hash_check_failures","counter","Chunks received that failed the hash check.");
+    evbuffer_add_printf(evb,"swift_hash_check_failures_total %" PRIu64 "\n", Channel::global_hash_check_fails);
+
+    StatsMetricsFamily(evb,"swift_storage_disk_writes","counter","Write calls to disk for received content.");
+    evbuffer_add_printf(evb,"swift_storage_disk_writes_total %" PRIu64 "\n", Storage::global_disk_writes);
+    StatsMetricsFamily(evb,"swift_storage_disk_write_bytes","counter","Bytes of received content written to disk.");
+    evbuffer_add_printf(evb,"swift_storage_disk_write_bytes_total %" PRIu64 "\n", Storage::global_disk_write_bytes);
+    StatsMetricsFamily(evb,"swift_storage_buffered_bytes","gauge","Bytes of received content not yet written to disk.");
+    evbuffer_add_printf(evb,"swift_storage_buffered_bytes %" PRIu64 "\n", Storage::GetGlobalBufferedBytes());
+    StatsMetricsFamily(evb,"swift_storage_open_files","gauge","Files of multi-file swarms currently open.");
+    evbuffer_add_printf(evb,"swift_storage_open_files %" PRIu64 "\n", (uint64_t)StorageFile::GetOpenFiles());
+    StatsMetricsFamily(evb,"swift_storage_file_opens","counter","Times a file of a multi-file swarm was (re)opened.");
+    evbuffer_add_printf(evb,"swift_storage_file_opens_total %" PRIu64 "\n", StorageFile::global_file_opens);
+
+    ChunkIndex *ci = ChunkIndex::GetInstance();
+    StatsMetricsFamily(evb,"swift_dedup_chunks","counter","Chunks taken from another local swarm instead of the network.");
+    evbuffer_add_printf(evb,"swift_dedup_chunks_total %" PRIu64 "\n", ci->GetHitCount());
+    StatsMetricsFamily(evb,"swift_dedup_index_chunks","gauge","Chunks of local swarms in the dedup index.");
+    evbuffer_add_printf(evb,"swift_dedup_index_chunks %" PRIu64 "\n", ci->GetChunkCount());
+
+    SwarmManager &sm = SwarmManager::GetManager();
+    StatsMetricsFamily(evb,"swift_swarm_activations","counter","Swarms activated by the swarm manager.");
+    evbuffer_add_printf(evb,"swift_swarm_activations_total %" PRIu64 "\n", sm.GetActivationCount());
+    StatsMetricsFamily(evb,"swift_swarm_deactivations","counter","Swarms deactivated by the swarm manager.");
+    evbuffer_add_printf(evb,"swift_swarm_deactivations_total %" PRIu64 "\n", sm.GetDeactivationCount());
+    StatsMetricsFamily(evb,"swift_active_swarms","gauge","Swarms currently activated by the swarm manager.");
+    evbuffer_add_printf(evb,"swift_active_swarms %d\n", sm.GetActiveSwarmCount());
+
+    StatsMetricsHistogram(evb,"swift_rtt_seconds","Round-trip time samples from acknowledged DATA.",
+                          Channel::global_rtt_hist);
+    StatsMetricsHistogram(evb,"swift_send_lag_seconds","Time a channel's send event fired after NextSendTime().",
+                          Channel::global_send_lag_hist);
+
+    int httpopen=0;
+    uint64_t httpmembytes=0,httppoolbytes=0;
+    HttpGwGetRequestStats(&httpopen,&httpmembytes,&httppoolbytes);
+    StatsMetricsFamily(evb,"swift_httpgw_open_requests","gauge","Requests being served by the HTTP gateway.");
+    evbuffer_add_printf(evb,"swift_httpgw_open_requests %d\n", httpopen);
+    StatsMetricsFamily(evb,"swift_httpgw_request_memory_bytes","gauge","Memory held by open HTTP gateway requests, including unsent reply data.");
+    evbuffer_add_printf(evb,"swift_httpgw_request_memory_bytes %" PRIu64 "\n", httpmembytes);
+    StatsMetricsFamily(evb,"swift_httpgw_request_pool_bytes","gauge","Memory allocated for HTTP gateway request state.");
+    evbuffer_add_printf(evb,"swift_httpgw_request_pool_bytes %" PRIu64 "\n", httppoolbytes);
+
+    uint64_t pfrequests=0,pfpredicted=0,pfhits=0;
+    HttpGwGetPrefetchStats(&pfrequests,&pfpredicted,&pfhits);
+    StatsMetricsFamily(evb,"swift_httpgw_vod_requests","counter","VOD requests served by the HTTP gateway.");
+    evbuffer_add_printf(evb,"swift_httpgw_vod_requests_total %" PRIu64 "\n", pfrequests);
+    StatsMetricsFamily(evb,"swift_httpgw_prefetch_predicted","counter","HTTP gateway VOD requests that started in a prefetched range.");
+    evbuffer_add_printf(evb,"swift_httpgw_prefetch_predicted_total %" PRIu64 "\n", pfpredicted);
+    StatsMetricsFamily(evb,"swift_httpgw_prefetch_hits","counter","Predicted HTTP gateway VOD requests that were fully downloaded when served.");
+    evbuffer_add_printf(evb,"swift_httpgw_prefetch_hits_total %" PRIu64 "\n", pfhits);
+
+    // Per transfer counters, only for activated transfers
+    std::vector<ContentTransfer *> cts;
+    std::vector<std::string> swarmids;
+    tdlist_t tds = swift::GetTransferDescriptors();
+    tdlist_t::iterator iter;
+    for (iter = tds.begin(); iter != tds.end(); iter++) {
+        ContentTransfer *ct = swift::GetActivatedTransfer(*iter);
+        if (ct == NULL)
+            continue;
+        cts.push_back(ct);
+        swarmids.push_back("swarm=\""+ct->swarm_id().hex()+"\"");
+    }
+
+    int nmodes = Channel::CLOSE_CONTROL+1;
+    std::vector<int> globalmodes(nmodes,0);
+    StatsMetricsFamily(evb,"swift_transfer_channels","gauge","Channels of a transfer per send control mode.");
+    for (int i=0; i<cts.size(); i++) {
+        std::vector<int> modes(nmodes,0);
+        channels_t *chans = cts[i]->GetChannels();
+        channels_t::iterator citer;
+        for (citer=chans->begin(); citer!=chans->end(); citer++)
+            modes[(*citer)->GetSendControl()]++;
+        for (int m=0; m<nmodes; m++) {
+            evbuffer_add_printf(evb,"swift_transfer_channels{%s,mode=\"%s\"} %d\n",
+                                swarmids[i].c_str(), Channel::SEND_CONTROL_MODES[m], modes[m]);
+            globalmodes[m] += modes[m];
+        }
+    }
+    StatsMetricsFamily(evb,"swift_channels","gauge","Channels of all activated transfers per send control mode.");
+    for (int m=0; m<nmodes; m++)
+        evbuffer_add_printf(evb,"swift_channels{mode=\"%s\"} %d\n", Channel::SEND_CONTROL_MODES[m], globalmodes[m]);
+
+    StatsMetricsFamily(evb,"swift_transfer_datagrams","counter","UDP datagrams sent and received for a transfer.");
+    for (int i=0; i<cts.size(); i++)
+        StatsMetricsUpDown(evb,"swift_transfer_datagrams",swarmids[i].c_str(),
+                           cts[i]->GetDgrams(DDIR_UPLOAD),cts[i]->GetDgrams(DDIR_DOWNLOAD));
+    StatsMetricsFamily(evb,"swift_transfer_raw_bytes","counter","Bytes sent and received in UDP datagrams for a transfer.");
+    for (int i=0; i<cts.size(); i++)
+        StatsMetricsUpDown(evb,"swift_transfer_raw_bytes",swarmids[i].c_str(),
+                           cts[i]->GetRawBytes(DDIR_UPLOAD),cts[i]->GetRawBytes(DDIR_DOWNLOAD));
+    StatsMetricsFamily(evb,"swift_transfer_retransmits","counter","Chunks of a transfer sent again after they timed out.");
+    for (int i=0; i<cts.size(); i++)
+        evbuffer_add_printf(evb,"swift_transfer_retransmits_total{%s} %" PRIu64 "\n",
+                            swarmids[i].c_str(), cts[i]->GetRetransmits());
+    StatsMetricsFamily(evb,"swift_transfer_hash_check_failures","counter","Chunks of a transfer that failed the hash check.");
+    for (int i=0; i<cts.size(); i++)
+        evbuffer_add_printf(evb,"swift_transfer_hash_check_failures_total{%s} %" PRIu64 "\n",
+                            swarmids[i].c_str(), cts[i]->GetHashCheckFails());
+
+    int ret = evbuffer_add_printf(evb,"# EOF\n");
     if (ret < 0) {
-        print_error("statsgw: OverviewCallback: error evbuffer_add");
+        print_error("statsgw: MetricsCallback: error evbuffer_add");
+        evbuffer_free(evb);
         return;
     }
 
+    char contlenstr[1024];
+    sprintf(contlenstr,PRISIZET,evbuffer_get_length(evb));
+    struct evkeyvalq *headers = evhttp_request_get_output_headers(evreq);
+    evhttp_add_header(headers, "Connection", "close");
+    evhttp_add_header(headers, "Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+    evhttp_add_header(headers, "Content-Length", contlenstr);
+    evhttp_add_header(headers, "Accept-Ranges", "none");
+
     evhttp_send_reply(evreq, 200, "OK", evb);
     evbuffer_free(evb);
 }
@@ -250,6 +425,8 @@ void StatsGwNewRequestCallback(struct evhttp_request *evreq, void *arg)
         StatsExitCallback(evreq);
     } else if (!strncmp(uri,"/webUI",strlen("/webUI"))) {
         StatsOverviewCallback(evreq);
+    } else if (!strncmp(uri,"/metrics",strlen("/metrics"))) {
+        StatsMetricsCallback(evreq);
     }
 }
 
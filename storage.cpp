@@ -24,19 +24,41 @@ const std::string Storage::MULTIFILE_PATHNAME_FILE_SEP = "/";
 
 #define DEBUGSTORAGE     0
 
+bool Storage::direct_io_ = false;
+uint64_t Storage::global_buffered_bytes_ = 0;
+uint64_t Storage::global_disk_writes = 0;
+uint64_t Storage::global_disk_write_bytes = 0;
+
+StorageFile::open_files_t StorageFile::open_files_;
+size_t StorageFile::max_open_files_ = SWIFT_STORAGE_MAX_OPEN_FILES;
+uint64_t StorageFile::global_file_opens = 0;
+
 
 Storage::Storage(std::string ospathname, std::string destdir, int td, uint64_t live_disc_wnd_bytes,
                  std::string metamfspecospathname) :
     Operational(),
     state_(STOR_STATE_INIT),
     os_pathname_(ospathname), destdir_(destdir), ht_(NULL), spec_size_(0),
-    single_fd_(-1), reserved_size_(-1), total_size_from_spec_(-1), last_sf_(NULL),
-    td_(td), alloc_cb_(NULL), live_disc_wnd_bytes_(live_disc_wnd_bytes), meta_mfspec_os_pathname_(metamfspecospathname)
+    single_fd_(-1), reserved_size_(-1), total_size_from_spec_(-1), last_sfi_(-1),
+    td_(td), alloc_cb_(NULL), live_disc_wnd_bytes_(live_disc_wnd_bytes), live_ram_(NULL),
+    meta_mfspec_os_pathname_(metamfspecospathname), wbuf_bytes_(0), wbuf_time_(0), direct_fd_(-1),
+    direct_buf_(NULL)
 {
     // SIGNPEAK
     if (live_disc_wnd_bytes > 0 && live_disc_wnd_bytes != POPT_LIVE_DISC_WND_ALL) {
         state_ = STOR_STATE_SINGLE_LIVE_WRAP;
-        (void)OpenSingleFile();
+
+        // Small windows live in RAM, so serving live DATA needs no syscalls
+        if (live_disc_wnd_bytes <= SWIFT_LIVE_RAM_STORAGE_MAX_BYTES) {
+            live_ram_ = (char *)malloc(live_disc_wnd_bytes);
+            if (live_ram_ == NULL)
+                dprintf("%s %s storage: Cannot alloc RAM ring of %" PRIu64 ", using disk\n", tintstr(),
+                        roothashhex().c_str(), live_disc_wnd_bytes);
+            else
+                memset(live_ram_,0,live_disc_wnd_bytes);
+        }
+        if (live_ram_ == NULL || ENABLE_LIVE_RAM_WRITEBEHIND)
+            (void)OpenSingleFile();
         return;
     }
 
@@ -105,8 +127,15 @@ Storage::Storage(std::string ospathname, std::string destdir, int td, uint64_t l
 
 Storage::~Storage()
 {
+    (void)Flush();
+    if (direct_fd_ != -1)
+        close(direct_fd_);
+    if (direct_buf_ != NULL)
+        free(direct_buf_);
     if (single_fd_ != -1)
         close(single_fd_);
+    if (live_ram_ != NULL)
+        free(live_ram_);
 
     storage_files_t::iterator iter;
     for (iter = sfs_.begin(); iter < sfs_.end(); iter++) {
@@ -118,6 +147,16 @@ Storage::~Storage()
 
 
 ssize_t Storage::Write(const void *buf, size_t nbyte, int64_t offset)
+{
+    // WRITEBUF: Only buffer once the layout on disk is known
+    if (SWIFT_STORAGE_WRITE_BUFFER_MAX > 0 && ((state_ == STOR_STATE_SINGLE_FILE && single_fd_ != -1)
+            || state_ == STOR_STATE_MFSPEC_COMPLETE))
+        return WriteBuffered(buf,nbyte,offset);
+    return WriteNow(buf,nbyte,offset);
+}
+
+
+ssize_t Storage::WriteNow(const void *buf, size_t nbyte, int64_t offset)
 {
     if (DEBUGSTORAGE)
         dprintf("%s %s storage: Write: fd %d nbyte " PRISIZET " off %" PRIi64 " state %" PRIi32 "\n", tintstr(),
@@ -126,23 +165,7 @@ ssize_t Storage::Write(const void *buf, size_t nbyte, int64_t offset)
     if (state_ == STOR_STATE_SINGLE_FILE) {
         return pwrite(single_fd_, buf, nbyte, offset);
     } else if (state_ == STOR_STATE_SINGLE_LIVE_WRAP) { // SIGNPEAK
-        int64_t newoff = offset % live_disc_wnd_bytes_;
-
-        if (DEBUGSTORAGE)
-            dprintf("%s %d ?data writing disk %" PRIi64 " window %" PRIu64 "\n",tintstr(), 0, newoff, live_disc_wnd_bytes_);
-
-        if (newoff+nbyte > live_disc_wnd_bytes_) {
-            // Writing more than window
-            size_t firstbyte = live_disc_wnd_bytes_ - newoff;
-            if (DEBUGSTORAGE)
-                dprintf("%s %d ?data writing disk %" PRIi64 " firstbyte " PRISIZET "\n",tintstr(), 0, newoff, firstbyte);
-            int ret = pwrite(single_fd_, buf, firstbyte, newoff);
-            if (ret < 0)
-                return ret;
-            else
-                return Write(((char *)buf)+firstbyte,nbyte-firstbyte,offset+firstbyte);
-        } else
-            return pwrite(single_fd_, buf, nbyte, newoff);
+        return WriteLiveWrap(buf,nbyte,offset);
     }
 
     // MULTIFILE
@@ -197,41 +220,206 @@ ssize_t Storage::Write(const void *buf, size_t nbyte, int64_t offset)
         // state_ == STOR_STATE_MFSPEC_COMPLETE;
         //dprintf("%s %s storage: Write: complete\n", tintstr(), roothashhex().c_str());
 
-        StorageFile *sf = NULL;
-        if (last_sf_ != NULL && offset >= last_sf_->GetStart() && offset <= last_sf_->GetEnd())
-            sf = last_sf_;
-        else {
-            sf = FindStorageFile(offset);
-            if (sf == NULL) {
-                dprintf("%s %s storage: Write: File not found!\n", tintstr(), roothashhex().c_str());
+        if (MapFileIO(nbyte,offset) != nbyte) {
+            dprintf("%s %s storage: Write: File not found!\n", tintstr(), roothashhex().c_str());
+            errno = EINVAL;
+            return -1;
+        }
+
+        // FILEPOOL: one pwrite per file the data spans
+        const char *bufstr = (const char *)buf;
+        file_iolist_t::iterator iter;
+        for (iter=iol_.begin(); iter!=iol_.end(); iter++) {
+            if (iter->sf->Write(bufstr+iter->bufoff,iter->nbyte,iter->offset) < 0) {
                 errno = EINVAL;
                 return -1;
             }
-            last_sf_ = sf;
         }
+        return nbyte;
+    }
+}
 
-        std::pair<int64_t,int64_t> ht = WriteBuffer(sf,buf,nbyte,offset);
-        if (ht.first == -1) {
-            errno = EINVAL;
+
+ssize_t Storage::WriteBuffered(const void *buf, size_t nbyte, int64_t offset)
+{
+    if (nbyte == 0)
+        return 0;
+    int64_t end = offset+nbyte;
+    write_buffer_t::iterator next = wbuf_.lower_bound(offset);
+    write_buffer_t::iterator prev = next;
+    bool prevadjacent = false;
+    if (prev != wbuf_.begin()) {
+        prev--;
+        int64_t prevend = prev->first+prev->second.length();
+        if (prevend > offset)
+            next = prev; // overlaps
+        prevadjacent = (prevend == offset);
+    }
+    if (next != wbuf_.end() && next->first < end) {
+        // Rewrite of buffered data, rare. Keep the order of writes.
+        if (Flush() < 0)
             return -1;
+        return WriteNow(buf,nbyte,offset);
+    }
+
+    if (wbuf_.empty())
+        wbuf_time_ = NOW;
+    write_buffer_t::iterator iter;
+    if (prevadjacent) {
+        iter = prev;
+        iter->second.append((const char *)buf,nbyte);
+    } else
+        iter = wbuf_.insert(next,std::make_pair(offset,std::string((const char *)buf,nbyte)));
+    if (next != wbuf_.end() && next->first == end) {
+        iter->second.append(next->second);
+        wbuf_.erase(next);
+    }
+    wbuf_bytes_ += nbyte;
+    global_buffered_bytes_ += nbyte;
+
+    if (WriteBlocks(iter) < 0)
+        return -1;
+    if (global_buffered_bytes_ > SWIFT_STORAGE_WRITE_BUFFER_MAX && Flush() < 0)
+        return -1;
+    return nbyte;
+}
+
+
+/** Write the whole aligned blocks in the extent at iter, keep head and tail buffered */
+int Storage::WriteBlocks(write_buffer_t::iterator iter)
+{
+    int64_t start = iter->first;
+    int64_t end = start+iter->second.length();
+    int64_t blockstart = (start+SWIFT_STORAGE_WRITE_BLOCK-1)/SWIFT_STORAGE_WRITE_BLOCK*SWIFT_STORAGE_WRITE_BLOCK;
+    int64_t blockend = end/SWIFT_STORAGE_WRITE_BLOCK*SWIFT_STORAGE_WRITE_BLOCK;
+    if (blockend-blockstart < SWIFT_STORAGE_WRITE_BLOCK)
+        return 0;
+
+    std::string data;
+    data.swap(iter->second);
+    wbuf_.erase(iter);
+    if (blockstart > start)
+        wbuf_[start] = data.substr(0,blockstart-start);
+    if (end > blockend)
+        wbuf_[blockend] = data.substr(blockend-start);
+    wbuf_bytes_ -= blockend-blockstart;
+    global_buffered_bytes_ -= blockend-blockstart;
+
+    return WriteExtent(data.data()+(blockstart-start),blockend-blockstart,blockstart);
+}
+
+
+int Storage::WriteExtent(const char *buf, size_t nbyte, int64_t offset)
+{
+    if (DEBUGSTORAGE)
+        dprintf("%s %s storage: WriteExtent: nbyte " PRISIZET " off %" PRIi64 " direct %d\n", tintstr(),
+                roothashhex().c_str(), nbyte, offset, (int)(direct_fd_ != -1));
+
+    size_t done = 0;
+    if (direct_fd_ != -1 && offset % SWIFT_STORAGE_WRITE_BLOCK == 0 && nbyte % SWIFT_STORAGE_WRITE_BLOCK == 0) {
+        for (; done<nbyte; done+=SWIFT_STORAGE_WRITE_BLOCK) {
+            // O_DIRECT wants aligned memory as well
+            memcpy(direct_buf_,buf+done,SWIFT_STORAGE_WRITE_BLOCK);
+            global_disk_writes++;
+            if (pwrite(direct_fd_,direct_buf_,SWIFT_STORAGE_WRITE_BLOCK,offset+done) != SWIFT_STORAGE_WRITE_BLOCK) {
+                // E.g. EINVAL if the filesystem needs other alignment
+                print_error("storage: O_DIRECT write failed, using normal writes");
+                close(direct_fd_);
+                direct_fd_ = -1;
+                break;
+            }
+            global_disk_write_bytes += SWIFT_STORAGE_WRITE_BLOCK;
         }
+        if (done == nbyte)
+            return 0;
+    }
 
-        //dprintf("%s %s storage: Write: complete: first %" PRIi64 " second %" PRIi64 "\n", tintstr(), roothashhex().c_str(), ht.first, ht.second);
+    global_disk_writes++;
+    ssize_t ret = WriteNow(buf+done,nbyte-done,offset+done);
+    if (ret < 0)
+        return -1;
+    global_disk_write_bytes += ret;
+    return 0;
+}
 
-        if (ht.second > 0) {
-            // Write tail to next StorageFile(s) using recursion
-            const char *bufstr = (const char *)buf;
-            int ret = Write(&bufstr[ht.first], ht.second, offset+ht.first);
-            if (ret < 0)
-                return ret;
-            else
-                return ht.first+ret;
-        } else
-            return ht.first;
+
+int Storage::Flush()
+{
+    int ret = 0;
+    write_buffer_t::iterator iter;
+    for (iter=wbuf_.begin(); iter!=wbuf_.end(); iter++) {
+        if (WriteExtent(iter->second.data(),iter->second.length(),iter->first) < 0)
+            ret = -1;
+    }
+    if (ret < 0)
+        print_error("storage: flushing buffered writes failed");
+    wbuf_.clear();
+    global_buffered_bytes_ -= wbuf_bytes_;
+    wbuf_bytes_ = 0;
+    return ret;
+}
+
+
+int Storage::FlushIfDue()
+{
+    if (wbuf_.empty() || NOW < wbuf_time_+SWIFT_STORAGE_WRITE_FLUSH_TIME)
+        return 0;
+    return Flush();
+}
+
+
+/** Copy buffered data over what was read from disk, extending ret if the
+ * data lies beyond the end of the file */
+void Storage::ReadBuffered(char *buf, size_t nbyte, int64_t offset, ssize_t &ret)
+{
+    if (ret < 0)
+        return;
+    int64_t end = offset+nbyte;
+    write_buffer_t::iterator iter = wbuf_.upper_bound(offset);
+    if (iter != wbuf_.begin())
+        iter--;
+    for (; iter != wbuf_.end() && iter->first < end; iter++) {
+        int64_t from = std::max(offset,iter->first);
+        int64_t to = std::min(end,iter->first+(int64_t)iter->second.length());
+        if (from >= to)
+            continue;
+        if (from-offset > ret)
+            memset(buf+ret,0,from-offset-ret);
+        memcpy(buf+(from-offset),iter->second.data()+(from-iter->first),to-from);
+        if (to-offset > ret)
+            ret = to-offset;
     }
 }
 
 
+bool Storage::IsBuffered(size_t nbyte, int64_t offset)
+{
+    write_buffer_t::iterator iter = wbuf_.lower_bound(offset+nbyte);
+    if (iter == wbuf_.begin())
+        return false;
+    iter--;
+    return iter->first+(int64_t)iter->second.length() > offset;
+}
+
+
+void Storage::OpenDirect()
+{
+#ifdef O_DIRECT
+    direct_fd_ = open_utf8(os_pathname_.c_str(),O_WRONLY|O_DIRECT,0);
+    if (direct_fd_ < 0) {
+        dprintf("%s %s storage: Cannot open %s with O_DIRECT\n", tintstr(), roothashhex().c_str(), os_pathname_.c_str());
+        direct_fd_ = -1;
+        return;
+    }
+    if (direct_buf_ == NULL && posix_memalign((void **)&direct_buf_,SWIFT_STORAGE_WRITE_BLOCK,SWIFT_STORAGE_WRITE_BLOCK) != 0) {
+        direct_buf_ = NULL;
+        close(direct_fd_);
+        direct_fd_ = -1;
+    }
+#endif
+}
+
+
 int Storage::WriteSpecPart(StorageFile *sf, const void *buf, size_t nbyte, int64_t offset)
 {
     //dprintf("%s %s storage: WriteSpecPart: %s %d %" PRIi64 "\n", tintstr(), roothashhex().c_str(), sf->GetSpecPathName().c_str(), nbyte, offset );
@@ -311,8 +499,12 @@ std::pair<int64_t,int64_t> Storage::WriteBuffer(StorageFile *sf, const void *buf
 
 
 
-StorageFile * Storage::FindStorageFile(int64_t offset)
+int Storage::FindStorageFile(int64_t offset)
 {
+    if (last_sfi_ >= 0 && last_sfi_ < sfs_.size() && offset >= sfs_[last_sfi_]->GetStart()
+            && offset <= sfs_[last_sfi_]->GetEnd())
+        return last_sfi_;
+
     // Binary search for StorageFile that manages the given offset
     int imin = 0, imax=sfs_.size()-1;
     while (imax >= imin) {
@@ -321,11 +513,39 @@ StorageFile * Storage::FindStorageFile(int64_t offset)
             imin = imid + 1;
         else if (offset < sfs_[imid]->GetStart())
             imax = imid - 1;
-        else
-            return sfs_[imid];
+        else {
+            last_sfi_ = imid;
+            return imid;
+        }
     }
     // Should find it.
-    return NULL;
+    return -1;
+}
+
+
+/** FILEPOOL: Fill iol_ with the parts of [offset,offset+nbyte) per file,
+ * walking the (sorted) files from the one holding offset. Returns the
+ * number of bytes covered, less than nbyte past the end of the content,
+ * or -1 if no file holds offset. */
+int Storage::MapFileIO(size_t nbyte, int64_t offset)
+{
+    iol_.clear();
+    int i = FindStorageFile(offset);
+    if (i < 0)
+        return -1;
+
+    size_t done = 0;
+    for (; i<sfs_.size() && done<nbyte; i++) {
+        StorageFile *sf = sfs_[i];
+        if (sf->GetSize() == 0)
+            continue;
+        int64_t pos = offset+done;
+        size_t n = std::min((int64_t)(nbyte-done),sf->GetEnd()+1-pos);
+        file_io_t io = { sf, pos-sf->GetStart(), done, n };
+        iol_.push_back(io);
+        done += n;
+    }
+    return done;
 }
 
 
@@ -420,6 +640,8 @@ int Storage::OpenSingleFile()
         SetBroken();
         return -1;
     }
+    if (direct_io_)
+        OpenDirect();
 
     // Perform postponed resize.
     if (reserved_size_ != -1) {
@@ -437,17 +659,80 @@ int Storage::OpenSingleFile()
 
 
 
+ssize_t Storage::WriteLiveWrap(const void *buf, size_t nbyte, int64_t offset)
+{
+    int64_t newoff = offset % live_disc_wnd_bytes_;
+
+    if (DEBUGSTORAGE)
+        dprintf("%s %d ?data writing %s %" PRIi64 " window %" PRIu64 "\n",tintstr(), 0,
+                (live_ram_ != NULL ? "ram" : "disk"), newoff, live_disc_wnd_bytes_);
+
+    // Writing more than window: split at wrap point
+    size_t firstbyte = nbyte;
+    if (newoff+nbyte > live_disc_wnd_bytes_)
+        firstbyte = live_disc_wnd_bytes_ - newoff;
+
+    if (live_ram_ != NULL) {
+        memcpy(live_ram_+newoff,buf,firstbyte);
+        if (ENABLE_LIVE_RAM_WRITEBEHIND && single_fd_ != -1) {
+            // Disk copy is best effort, RAM is authoritative
+            if (pwrite(single_fd_, buf, firstbyte, newoff) < 0)
+                print_error("storage: live write-behind failed");
+        }
+    } else {
+        int ret = pwrite(single_fd_, buf, firstbyte, newoff);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (firstbyte < nbyte) {
+        ssize_t ret = WriteLiveWrap(((char *)buf)+firstbyte,nbyte-firstbyte,offset+firstbyte);
+        if (ret < 0)
+            return ret;
+    }
+    return nbyte;
+}
+
+
+ssize_t Storage::ReadLiveWrap(void *buf, size_t nbyte, int64_t offset)
+{
+    int64_t newoff = offset % live_disc_wnd_bytes_;
+
+    if (DEBUGSTORAGE)
+        dprintf("%s %d ?data reading %s %" PRIi64 " window %" PRIu64 "\n",tintstr(), 0,
+                (live_ram_ != NULL ? "ram" : "disk"), newoff, live_disc_wnd_bytes_);
+
+    if (live_ram_ == NULL)
+        return pread(single_fd_, buf, nbyte, newoff);
+
+    size_t firstbyte = nbyte;
+    if (newoff+nbyte > live_disc_wnd_bytes_)
+        firstbyte = live_disc_wnd_bytes_ - newoff;
+    memcpy(buf,live_ram_+newoff,firstbyte);
+    if (firstbyte < nbyte)
+        memcpy(((char *)buf)+firstbyte,live_ram_,nbyte-firstbyte);
+    return nbyte;
+}
+
+
 ssize_t Storage::Read(void *buf, size_t nbyte, int64_t offset)
+{
+    ssize_t ret = ReadNow(buf,nbyte,offset);
+    // WRITEBUF
+    if (!wbuf_.empty())
+        ReadBuffered((char *)buf,nbyte,offset,ret);
+    return ret;
+}
+
+
+ssize_t Storage::ReadNow(void *buf, size_t nbyte, int64_t offset)
 {
     //dprintf("%s %s storage: Read: nbyte " PRISIZET " off %" PRIi64 "\n", tintstr(), roothashhex().c_str(), nbyte, offset );
 
     if (state_ == STOR_STATE_SINGLE_FILE) {
         return pread(single_fd_, buf, nbyte, offset);
     } else if (state_ == STOR_STATE_SINGLE_LIVE_WRAP) {
-        int64_t newoff = offset % live_disc_wnd_bytes_;
-        dprintf("%s %d ?data reading disk %" PRIi64 " window %" PRIu64 "\n",tintstr(), 0, newoff, live_disc_wnd_bytes_);
-
-        return pread(single_fd_, buf, nbyte, newoff);
+        return ReadLiveWrap(buf,nbyte,offset);
     }
 
 
@@ -456,38 +741,58 @@ ssize_t Storage::Read(void *buf, size_t nbyte, int64_t offset)
         errno = EINVAL;
         return -1;
     } else {
-        StorageFile *sf = NULL;
-        if (last_sf_ != NULL && offset >= last_sf_->GetStart() && offset <= last_sf_->GetEnd())
-            sf = last_sf_;
-        else {
-            sf = FindStorageFile(offset);
-            if (sf == NULL) {
-                errno = EINVAL;
-                return -1;
-            }
-            last_sf_ = sf;
-            //dprintf("%s %s storage: Read: Found file %s for off %" PRIi64 "\n", tintstr(), roothashhex().c_str(), sf->GetSpecPathName().c_str(), offset );
+        if (MapFileIO(nbyte,offset) < 0) {
+            errno = EINVAL;
+            return -1;
         }
 
-        ssize_t ret = sf->Read(buf,nbyte,offset - sf->GetStart());
-        if (ret < 0)
-            return ret;
+        // FILEPOOL: one pread per file the data spans, short at the end of the content
+        char *bufstr = (char *)buf;
+        ssize_t total = 0;
+        file_iolist_t::iterator iter;
+        for (iter=iol_.begin(); iter!=iol_.end(); iter++) {
+            ssize_t ret = iter->sf->Read(bufstr+iter->bufoff,iter->nbyte,iter->offset);
+            if (ret < 0)
+                return ret;
+            total += ret;
+            if (ret < iter->nbyte)
+                break; // file shorter than in spec
+        }
+        return total;
+    }
+}
 
-        //dprintf("%s %s storage: Read: read %d\n", tintstr(), roothashhex().c_str(), ret );
 
-        if (ret < nbyte && offset+ret != ht_->size()) {
-            //dprintf("%s %s storage: Read: want %d more\n", tintstr(), roothashhex().c_str(), nbyte-ret );
+ssize_t Storage::Read(struct evbuffer *evb, size_t nbyte, int64_t offset, bool filerefok)
+{
+#ifndef _WIN32
+    if (filerefok && state_ == STOR_STATE_SINGLE_FILE && !IsBuffered(nbyte,offset)) {
+        // Let libevent send straight from the file. It closes the fd when
+        // done, hence dup.
+        int fd = dup(single_fd_);
+        if (fd >= 0) {
+            if (evbuffer_add_file(evb, fd, offset, nbyte) == 0)
+                return nbyte;
+            close(fd);
+        }
+        // else fall back to copy
+    }
+#endif
 
-            // Not at end, and can fit more in buffer. Do recursion
-            char *bufstr = (char *)buf;
-            ssize_t newret = Read((void *)(bufstr+ret),nbyte-ret,offset+ret);
-            if (newret < 0)
-                return newret;
-            else
-                return ret + newret;
-        } else
-            return ret;
+    struct evbuffer_iovec vec;
+    if (evbuffer_reserve_space(evb, nbyte, &vec, 1) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ssize_t ret = Read(vec.iov_base, nbyte, offset);
+    if (ret < 0)
+        return ret; // reserved space is simply not committed
+    vec.iov_len = ret;
+    if (evbuffer_commit_space(evb, &vec, 1) < 0) {
+        errno = ENOMEM;
+        return -1;
     }
+    return ret;
 }
 
 
@@ -551,10 +856,13 @@ int Storage::ResizeReserved(int64_t size)
         alloc_cb_(td_,bin_t::NONE);
         alloc_cb_ = NULL; // One time callback
     }
+    // WRITEBUF: a shrink must not lose buffered data past the new end
+    if (Flush() < 0)
+        return -1;
 
     if (state_ == STOR_STATE_SINGLE_FILE) {
         dprintf("%s %s storage: Resizing single file %d to %" PRIi64 "\n", tintstr(), roothashhex().c_str(), single_fd_, size);
-        return file_resize(single_fd_,size);
+        return file_preallocate(single_fd_,size);
     } else if (state_ == STOR_STATE_INIT) {
         dprintf("%s %s storage: Postpone resize to %" PRIi64 "\n", tintstr(), roothashhex().c_str(), size);
         reserved_size_ = size;
@@ -664,9 +972,8 @@ StorageFile::StorageFile(std::string specpath, int64_t start, int64_t size, std:
     }
 
 
-    // Open
-    fd_ = open_utf8(os_pathname_.c_str(),OPENFLAGS,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-    if (fd_<0) {
+    // Open, also to create it. FILEPOOL: may be closed again later to make room.
+    if (GetFD() < 0) {
         //print_error("storage: file: Could not open");
         dprintf("%s %s storage: file: Could not open %s\n", tintstr(), "0000000000000000000000000000000000000000",
                 os_pathname_.c_str());
@@ -677,8 +984,50 @@ StorageFile::StorageFile(std::string specpath, int64_t start, int64_t size, std:
 
 StorageFile::~StorageFile()
 {
-    if (fd_>=0) {
-        close(fd_);
+    Close();
+}
+
+
+int StorageFile::GetFD()
+{
+    if (fd_ >= 0) {
+        open_files_.splice(open_files_.begin(),open_files_,lru_iter_);
+        return fd_;
     }
+
+    while (open_files_.size() >= max_open_files_ && !open_files_.empty())
+        open_files_.back()->Close();
+    fd_ = open_utf8(os_pathname_.c_str(),OPENFLAGS,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (fd_ < 0 && (errno == EMFILE || errno == ENFILE) && !open_files_.empty()) {
+        // Other parts of the process use more fds than budgeted for
+        open_files_.back()->Close();
+        fd_ = open_utf8(os_pathname_.c_str(),OPENFLAGS,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    }
+    if (fd_ < 0) {
+        fd_ = -1;
+        return -1;
+    }
+    global_file_opens++;
+    open_files_.push_front(this);
+    lru_iter_ = open_files_.begin();
+    return fd_;
+}
+
+
+void StorageFile::Close()
+{
+    if (fd_ < 0)
+        return;
+    close(fd_);
+    fd_ = -1;
+    open_files_.erase(lru_iter_);
+}
+
+
+void StorageFile::SetMaxOpenFiles(size_t n)
+{
+    max_open_files_ = n > 0 ? n : 1;
+    while (open_files_.size() > max_open_files_)
+        open_files_.back()->Close();
 }
 
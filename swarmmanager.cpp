@@ -54,11 +54,12 @@ namespace swift
     SwarmManager SwarmManager::instance_;
 
     SwarmData::SwarmData(const std::string filename, const Sha1Hash& rootHash, const std::string trackerurl,
-                         bool force_check_diskvshash, popt_cont_int_prot_t cipm, bool zerostate, uint32_t chunk_size, std::string metadir) :
+                         bool force_check_diskvshash, popt_cont_int_prot_t cipm, bool zerostate, uint32_t chunk_size, std::string metadir,
+                         popt_merkle_func_t merkle_func) :
         id_(-1), rootHash_(rootHash), active_(false), latestUse_(0), stateToBeRemoved_(false), contentToBeRemoved_(false),
         ft_(NULL),
         filename_(filename), trackerurl_(trackerurl), forceCheckDiskVSHash_(force_check_diskvshash), contIntProtMethod_(cipm),
-        chunkSize_(chunk_size), zerostate_(zerostate), cached_(false), metadir_(metadir)
+        chunkSize_(chunk_size), zerostate_(zerostate), merkleFunc_(merkle_func), cached_(false), metadir_(metadir)
     {
     }
 
@@ -66,7 +67,8 @@ namespace swift
         id_(-1), rootHash_(sd.rootHash_), active_(false), latestUse_(0), stateToBeRemoved_(false), contentToBeRemoved_(false),
         ft_(NULL),
         filename_(sd.filename_), trackerurl_(sd.trackerurl_), forceCheckDiskVSHash_(sd.forceCheckDiskVSHash_),
-        contIntProtMethod_(sd.contIntProtMethod_), chunkSize_(sd.chunkSize_), zerostate_(sd.zerostate_), cached_(false),
+        contIntProtMethod_(sd.contIntProtMethod_), chunkSize_(sd.chunkSize_), zerostate_(sd.zerostate_),
+        merkleFunc_(sd.merkleFunc_), cached_(false),
         metadir_(sd.metadir_)
     {
     }
@@ -248,7 +250,8 @@ namespace swift
     SwarmManager::SwarmManager() :
         knownSwarms_(64, std::vector<SwarmData*>()), swarmList_(), unusedIndices_(),
         eventCheckToBeRemoved_(NULL),
-        maxActiveSwarms_(DEFAULT_MAX_ACTIVE_SWARMS), activeSwarmCount_(0), activeSwarms_()
+        maxActiveSwarms_(DEFAULT_MAX_ACTIVE_SWARMS), activeSwarmCount_(0), activeSwarms_(),
+        activationCount_(0), deactivationCount_(0)
     {
         enter("cons");
         // Do not call the invariant here, directly or indirectly: screws up event creation
@@ -272,12 +275,12 @@ namespace swift
 
     SwarmData* SwarmManager::AddSwarm(const std::string filename, const Sha1Hash& hash, const std::string trackerurl,
                                       bool force_check_diskvshash, popt_cont_int_prot_t cipm, bool zerostate, bool activate, uint32_t chunk_size,
-                                      std::string metadir)
+                                      std::string metadir, popt_merkle_func_t merkle_func)
     {
         //fprintf(stderr,"sm: AddSwarm %s hash %s track %s cdisk %d cipm %" PRIu32 " zs %d act %d cs %" PRIu32 "\n", filename.c_str(), hash.hex().c_str(), trackerurl.c_str(), force_check_diskvshash, cipm, zerostate, activate, chunk_size );
         enter("addswarm( many )");
         invariant();
-        SwarmData sd(filename, hash, trackerurl, force_check_diskvshash, cipm, zerostate, chunk_size, metadir);
+        SwarmData sd(filename, hash, trackerurl, force_check_diskvshash, cipm, zerostate, chunk_size, metadir, merkle_func);
 #if SWARMMANAGER_ASSERT_INVARIANTS
         SwarmData* res = AddSwarm(sd, activate);
         assert(hash == Sha1Hash::ZERO || res == FindSwarm(hash));
@@ -323,6 +326,7 @@ namespace swift
                 // Swarm is good on disk, create SwarmData without activation
                 newSwarm->cached_ = true;
                 newSwarm->rootHash_ = ht->root_hash();
+                newSwarm->merkleFunc_ = ht->hash_func();
                 newSwarm->cachedComplete_ = ht->complete();
                 newSwarm->cachedSize_ = content_size;
                 newSwarm->cachedIsComplete_ = true;
@@ -412,7 +416,8 @@ namespace swift
             return;
 
         swarm->ft_ = new FileTransfer(swarm->id_, swarm->filename_, swarm->rootHash_, swarm->forceCheckDiskVSHash_,
-                                      swarm->contIntProtMethod_, swarm->chunkSize_, swarm->zerostate_, swarm->metadir_);
+                                      swarm->contIntProtMethod_, swarm->chunkSize_, swarm->zerostate_, swarm->metadir_,
+                                      swarm->merkleFunc_);
         if (!swarm->ft_ || !swarm->ft_->IsOperational()) { // Arno, 2012-10-01: Check if operational
             exit("buildswarm (1)");
             return;
@@ -669,6 +674,7 @@ namespace swift
         }
 
         activeSwarmCount_++;
+        activationCount_++;
 
         sd->active_ = true;
         sd->latestUse_ = 0;
@@ -695,6 +701,7 @@ namespace swift
         activeSwarms_[activeLoc] = activeSwarms_[activeSwarms_.size()-1];
         activeSwarms_.pop_back();
         activeSwarmCount_--;
+        deactivationCount_++;
 
         if (swarm->ft_) {
             swarm->cachedMaxSpeeds_[DDIR_DOWNLOAD] = swarm->ft_->GetMaxSpeed(DDIR_DOWNLOAD);
@@ -788,6 +795,21 @@ namespace swift
         return maxActiveSwarms_;
     }
 
+    int SwarmManager::GetActiveSwarmCount()
+    {
+        return activeSwarmCount_;
+    }
+
+    uint64_t SwarmManager::GetActivationCount()
+    {
+        return activationCount_;
+    }
+
+    uint64_t SwarmManager::GetDeactivationCount()
+    {
+        return deactivationCount_;
+    }
+
     void SwarmManager::SetMaximumActiveSwarms(int newMaxSwarms)
     {
         enter("setmaximumactiveswarms");
@@ -832,7 +854,7 @@ namespace swift
         while (low < high) {
             mid = (low + high) / 2;
             bits = list[mid]->rootHash_.bits;
-            res = memcmp(bits, bitsTarget, Sha1Hash::SIZE);
+            res = memcmp(bits, bitsTarget, HASHSZ_MAX);
             if (res < 0)
                 low = mid + 1;
             else if (res > 0)
@@ -950,7 +972,7 @@ namespace swift
                 c1++;
             }
             for (j = 1; j < l.size(); j++)
-                assert(memcmp(l[j-1]->RootHash().bits, l[j]->RootHash().bits, Sha1Hash::SIZE) < 0);
+                assert(memcmp(l[j-1]->RootHash().bits, l[j]->RootHash().bits, HASHSZ_MAX) < 0);
             for (j = 0; j < l.size(); j++)
                 assert(GetSwarmLocation(l, l[j]->RootHash()) == j);
         }
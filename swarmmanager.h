@@ -61,6 +61,7 @@ namespace swift
         popt_cont_int_prot_t contIntProtMethod_;
         uint32_t chunkSize_;
         bool zerostate_;
+        popt_merkle_func_t merkleFunc_;
         double cachedMaxSpeeds_[2];
         bool cachedStorageReady_;
         std::list<std::string> cachedStorageFilenames_;
@@ -75,7 +76,7 @@ namespace swift
     public:
         SwarmData(const std::string filename, const Sha1Hash& rootHash, const std::string trackerurl,
                   bool force_check_diskvshash, popt_cont_int_prot_t cipm, bool zerostate, uint32_t chunk_size,
-                  const std::string metadata="");
+                  const std::string metadata="", popt_merkle_func_t merkle_func=POPT_MERKLE_HASH_FUNC_SHA1);
         SwarmData(const SwarmData& sd);
 
         ~SwarmData();
@@ -150,6 +151,9 @@ namespace swift
         int maxActiveSwarms_;
         int activeSwarmCount_;
         std::vector<SwarmData*> activeSwarms_;
+        // Number of (de)activations since start, for statsgw /metrics
+        uint64_t activationCount_;
+        uint64_t deactivationCount_;
 
 #if SWARMMANAGER_ASSERT_INVARIANTS
         void invariant();
@@ -161,7 +165,7 @@ namespace swift
         // Add and remove swarms
         SwarmData* AddSwarm(const std::string filename, const Sha1Hash& rootHash, const std::string trackerurl,
                             bool force_check_diskvshash, popt_cont_int_prot_t cipm, bool zerostate, bool activate, uint32_t chunk_size,
-                            std::string metadir);
+                            std::string metadir, popt_merkle_func_t merkle_func=POPT_MERKLE_HASH_FUNC_SHA1);
         SwarmData* AddSwarm(const SwarmData& swarm, bool activate=true);
         void RemoveSwarm(const Sha1Hash& rootHash, bool removeState = false, bool removeContent = false);
 
@@ -176,6 +180,9 @@ namespace swift
         // Manage maximum of active swarms
         int GetMaximumActiveSwarms();
         void SetMaximumActiveSwarms(int newMaxActiveSwarms);
+        int GetActiveSwarmCount();
+        uint64_t GetActivationCount();
+        uint64_t GetDeactivationCount();
 
         // Arno
         tdlist_t GetTransferDescriptors();
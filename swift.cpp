@@ -60,7 +60,10 @@ void usage(void)
     fprintf(stderr,"  -y, --downrate\tdownload rate limit in KiB/s (default: unlimited)\n");
     fprintf(stderr,"  -w, --wait\t\tlimit running time, e.g. 1[DHMs] (default: infinite with -l, -g)\n");
     fprintf(stderr,"  -H, --checkpoint\tcreate checkpoint of file when complete for fast restart\n");
-    fprintf(stderr,"  -z, --chunksize\tchunk size in bytes (default: %d)\n", SWIFT_DEFAULT_CHUNK_SIZE);
+    fprintf(stderr,"  -z, --chunksize\tchunk size in bytes, up to %d (default: %d)\n", SWIFT_MAX_CHUNK_SIZE,
+            SWIFT_DEFAULT_CHUNK_SIZE);
+    fprintf(stderr,"  -U, --pmtu\t\tlargest UDP payload to probe for, %d disables (default: %d)\n",
+            SWIFT_MAX_UDP_OVER_ETH_PAYLOAD, SWIFT_PMTU_JUMBO);
     fprintf(stderr,"  -m, --printurl\tcompose URL from tracker, file and chunksize\n");
     fprintf(stderr,"  -q, --quiet\t\tquiet mode: don't print general status information on stderr\n");
     fprintf(stderr,"  -r, --urlfile\t\tfile to write URL to for --printurl\n");
@@ -81,6 +84,13 @@ void usage(void)
     fprintf(stderr,"  -a live signature algorithm\n");
     fprintf(stderr,"  -W live discard window in chunks\n");
     fprintf(stderr,"  -I live source address (used with ext tracker)\n");
+    fprintf(stderr,"  -x live push: number of peers to push new chunks to (default: 0, pull only)\n");
+    fprintf(stderr,"  -R live source: number of first-tier relays to serve, others are steered to them (default: 0, serve all)\n");
+    fprintf(stderr,"  -F live: FEC repair chunks per data chunk sent by the source, or \"auto\" to adapt to loss. Clients: any value accepts repairs (default: 0, off)\n");
+    fprintf(stderr,"  -A, --hashfunc\tMerkle hash function for new swarms: sha1, sha256 or sha512_256 (default: sha1)\n");
+    fprintf(stderr,"  -Y, --dedup\t\ttake chunks another local swarm has from disk instead of the network\n");
+    fprintf(stderr,"  -O, --directio\twrite received content in whole blocks with O_DIRECT, bypassing the page cache\n");
+    fprintf(stderr,"  -Q, --dedupstore\tfile listing swarms to take chunks from, also when not open (if checkpointed, -H); implies -Y\n");
 }
 #define quit(...) {fprintf(stderr,__VA_ARGS__); exit(1); }
 int HandleSwiftSwarm(std::string filename, SwarmID &swarmid, std::string trackerurl, Address srcaddr, bool printurl,
@@ -146,7 +156,11 @@ uint64_t livesource_disc_wnd=POPT_LIVE_DISC_WND_ALL;
 std::string livesource_checkpoint_filename = "";
 bool livesource_isfile=false;
 popt_cont_int_prot_t swarm_cipm=POPT_CONT_INT_PROT_MERKLE;
+popt_merkle_func_t swarm_merkle_func=POPT_MERKLE_HASH_FUNC_SHA1;
 popt_live_sig_alg_t livesource_sigalg=DEFAULT_LIVE_SIG_ALG;
+uint32_t livepush_children=SWIFT_LIVE_DEFAULT_PUSH_CHILDREN;
+uint32_t livesource_tier1_relays=SWIFT_LIVE_DEFAULT_TIER1_RELAYS;
+double livefec_ratio=SWIFT_LIVE_DEFAULT_FEC_RATIO;
 
 int64_t cmdgw_report_counter=0;
 int64_t cmdgw_report_interval=REPORT_INTERVAL; // seconds
@@ -191,6 +205,14 @@ int utf8main(int argc, char** argv)
         {"lsa",required_argument, 0, 'a'}, // PPSP
         {"ldw",required_argument, 0, 'W'}, // PPSP
         {"ia",required_argument, 0, 'I'}, // EXTTRACK
+        {"livepush",required_argument, 0, 'x'}, // LIVEPUSH
+        {"liverelays",required_argument, 0, 'R'}, // RELAYTREE
+        {"livefec",required_argument, 0, 'F'}, // LIVEFEC
+        {"pmtu",required_argument, 0, 'U'}, // MULTIDATA
+        {"hashfunc",required_argument, 0, 'A'}, // PPSP
+        {"dedup",no_argument, 0, 'Y'}, // DEDUP
+        {"dedupstore",required_argument, 0, 'Q'}, // DEDUP
+        {"directio",no_argument, 0, 'O'}, // WRITEBUF
         {"quiet", no_argument, 0, 'q'}, // be quiet!
         {0, 0, 0, 0}
     };
@@ -207,6 +229,8 @@ int utf8main(int argc, char** argv)
     tint wait_time = 0;
     double maxspeed[2] = {DBL_MAX,DBL_MAX};
     tint zerostimeout = TINT_NEVER;
+    bool dedup=false;
+    std::string dedupstore="";
 
 
     LibraryInit();
@@ -214,7 +238,7 @@ int utf8main(int argc, char** argv)
 
     std::string optargstr;
     int c,n;
-    while (-1 != (c = getopt_long(argc, argv, ":h:f:d:l:t:D:L:pg:s:c:o:u:y:z:w:BNHmqM:e:r:ji:kC:1:2:3:4:T:GW:P:K:S:a:I:n:",
+    while (-1 != (c = getopt_long(argc, argv, ":h:f:d:l:t:D:L:pg:s:c:o:u:y:z:w:BNHmqM:e:r:ji:kC:1:2:3:4:T:GW:P:K:S:a:I:n:x:R:F:U:A:YQ:O",
                                   long_options, 0))) {
         switch (c) {
         case 'h':
@@ -329,6 +353,8 @@ int utf8main(int argc, char** argv)
             n = sscanf(optarg,"%i",&chunk_size);
             if (n != 1)
                 quit("chunk size must be bytes as int\n");
+            if (chunk_size == 0 || chunk_size > SWIFT_MAX_CHUNK_SIZE)
+                quit("chunk size must be between 1 and %d bytes\n",SWIFT_MAX_CHUNK_SIZE);
             break;
         case 'm': // printurl
             printurl = true;
@@ -429,6 +455,44 @@ int utf8main(int argc, char** argv)
             if (srcaddr==Address())
                 quit("address must be hostname:port, ip:port or just port\n");
             break;
+        case 'x': // LIVEPUSH
+            if (sscanf(optarg,"%" SCNu32,&livepush_children)!=1)
+                quit("live push children must be int\n");
+            break;
+        case 'R': // RELAYTREE
+            if (sscanf(optarg,"%" SCNu32,&livesource_tier1_relays)!=1)
+                quit("live relays must be int\n");
+            break;
+        case 'F': // LIVEFEC
+            if (!strcmp(optarg,"auto"))
+                livefec_ratio = SWIFT_LIVE_FEC_ADAPTIVE;
+            else if (sscanf(optarg,"%lf",&livefec_ratio)!=1 || livefec_ratio < 0.0)
+                quit("live FEC ratio must be a non-negative number or auto\n");
+            break;
+        case 'U': // MULTIDATA
+            if (sscanf(optarg,"%d",&Channel::MAX_PMTU)!=1 || Channel::MAX_PMTU < SWIFT_MAX_UDP_OVER_ETH_PAYLOAD
+                    || Channel::MAX_PMTU > SWIFT_MAX_RECV_DGRAM_SIZE)
+                quit("pmtu must be between %d and %d bytes\n",SWIFT_MAX_UDP_OVER_ETH_PAYLOAD,SWIFT_MAX_RECV_DGRAM_SIZE);
+            break;
+        case 'A': // PPSP
+            if (!strcmp(optarg,"sha1"))
+                swarm_merkle_func = POPT_MERKLE_HASH_FUNC_SHA1;
+            else if (!strcmp(optarg,"sha256"))
+                swarm_merkle_func = POPT_MERKLE_HASH_FUNC_SHA256;
+            else if (!strcmp(optarg,"sha512_256"))
+                swarm_merkle_func = POPT_MERKLE_HASH_FUNC_SHA512_256;
+            else
+                quit("Merkle hash function must be sha1, sha256 or sha512_256\n");
+            break;
+        case 'Y': // DEDUP
+            dedup = true;
+            break;
+        case 'Q': // DEDUP
+            dedupstore = strdup(optarg); // UNICODE
+            break;
+        case 'O': // WRITEBUF
+            Storage::SetDirectIO(true);
+            break;
         case 'T': // ZEROSTATE
             double t=0.0;
             n = sscanf(optarg,"%lf",&t);
@@ -525,6 +589,13 @@ int utf8main(int argc, char** argv)
     zs->SetMetaDir(metadir);
     zs->SetConnectTimeout(zerostimeout);
 
+    // DEDUP
+    if (dedupstore != "") {
+        if (ChunkIndex::GetInstance()->SetStore(dedupstore) < 0)
+            quit("cannot open dedup store %s\n",dedupstore.c_str());
+    } else if (dedup)
+        ChunkIndex::GetInstance()->SetEnabled(true);
+
     if ((!cmdgw_enabled || gtesting) && livesource_input == "" && zerostatedir == "") {
         // Seed file or dir, or create multi-spec
         int ret = -1;
@@ -669,9 +740,13 @@ int OpenSwiftSwarm(std::string filename, SwarmID &swarmid, std::string trackerur
     // Client mode: regular or live download
     int td = -1;
     if (!livestream)
-        td = swift::Open(filename,swarmid,trackerurl,force_check_diskvshash,swarm_cipm,false,activate,chunk_size,metadir);
-    else
+        td = swift::Open(filename,swarmid,trackerurl,force_check_diskvshash,swarm_cipm,false,activate,chunk_size,metadir,
+                         swarm_merkle_func);
+    else {
         td = swift::LiveOpen(filename,swarmid,trackerurl,srcaddr,swarm_cipm,livesource_disc_wnd,chunk_size);
+        swift::SetLivePushChildren(td,livepush_children);
+        swift::SetLiveFECRatio(td,livefec_ratio);
+    }
     return td;
 }
 
@@ -845,6 +920,11 @@ void HandleLiveSource(std::string livesource_input, std::string filename, std::s
         // Create swarm
         livesource_lt = swift::LiveCreate(filename,*keypairptr,livesource_checkpoint_filename,swarm_cipm,livesource_disc_wnd,
                                           SWIFT_DEFAULT_LIVE_NCHUNKS_PER_SIGN,chunk_size); // SIGNPEAKTODO
+        if (livesource_lt != NULL) {
+            livesource_lt->SetPushChildren(livepush_children);
+            livesource_lt->SetTier1Relays(livesource_tier1_relays);
+            livesource_lt->SetFECRatio(livefec_ratio);
+        }
 
         // Periodically create chunks by reading from source
         evtimer_assign(&evlivesource, Channel::evbase, LiveSourceFileTimerCallback, NULL);
@@ -875,6 +955,11 @@ void HandleLiveSource(std::string livesource_input, std::string filename, std::s
         // Create swarm
         livesource_lt = swift::LiveCreate(filename,*keypairptr,livesource_checkpoint_filename,swarm_cipm,livesource_disc_wnd,
                                           SWIFT_DEFAULT_LIVE_NCHUNKS_PER_SIGN,chunk_size); // SIGNPEAKTODO
+        if (livesource_lt != NULL) {
+            livesource_lt->SetPushChildren(livepush_children);
+            livesource_lt->SetTier1Relays(livesource_tier1_relays);
+            livesource_lt->SetFECRatio(livefec_ratio);
+        }
 
         // Create HTTP client
         struct evhttp_connection *cn = evhttp_connection_base_new(Channel::evbase, NULL, httpservname.c_str(), httpport);
@@ -82,6 +82,8 @@
 #include "hashtree.h"
 #include "livehashtree.h"
 #include "avgspeed.h"
+#include "histogram.h"
+#include "telemetry.h"
 #include "avail.h"
 #include "exttrack.h"
 
@@ -98,6 +100,10 @@ namespace swift
 // Arno, 2011-12-22: Enable Riccardo's VodPiecePicker
 #define ENABLE_VOD_PIECEPICKER        0
 
+// DEADLINE: Pick VOD chunks by playback deadline once a player reports its
+// position. Only used when ENABLE_VOD_PIECEPICKER is 0.
+#define ENABLE_DEADLINE_PIECEPICKER   1
+
 // Arno, 2013-10-02: Configure which live piecepicker: default or with small-swarms optimization
 #define ENABLE_LIVE_SMALLSWARMOPT_PIECEPICKER      1
 
@@ -105,6 +111,33 @@ namespace swift
 // Arno, 2013-10-02: Default for mobile devices. Set to 0 to disable.
 #define DEFAULT_MOBILE_LIVE_DISC_WND_BYTES         (1*1024*1024*1024) // 1 GB
 
+// Keep a bounded live discard window in a RAM ring instead of a wrapping
+// file, if it is not larger than this. Set to 0 to always use the file.
+#define SWIFT_LIVE_RAM_STORAGE_MAX_BYTES           (64*1024*1024) // 64 MB
+
+// Also write live chunks kept in RAM to the wrapping file on disk. Only
+// needed when an external program reads that file.
+#define ENABLE_LIVE_RAM_WRITEBEHIND                0
+
+// WRITEBUF: Storage buffers verified chunks in memory and writes adjacent
+// ones together, in whole aligned blocks of SWIFT_STORAGE_WRITE_BLOCK bytes
+// where possible. Whatever is left is written after at most
+// SWIFT_STORAGE_WRITE_FLUSH_TIME, or when the buffers of all Storages
+// together exceed SWIFT_STORAGE_WRITE_BUFFER_MAX. Set the latter to 0 to
+// write every chunk as it comes in.
+#define SWIFT_STORAGE_WRITE_BLOCK                  (64*1024)
+#define SWIFT_STORAGE_WRITE_BUFFER_MAX             (16*1024*1024) // 16 MB
+#define SWIFT_STORAGE_WRITE_FLUSH_TIME             (1*TINT_SEC)
+
+// FILEPOOL: Files of multi-file swarms are opened on demand. At most this
+// many are open at a time, over all swarms; the least recently used one is
+// closed to make room. Single-file swarms keep their one file open.
+#ifdef __APPLE__
+#define SWIFT_STORAGE_MAX_OPEN_FILES               64 // of 256 fds by default
+#else
+#define SWIFT_STORAGE_MAX_OPEN_FILES               256
+#endif
+
 // Value for protocol option: Live Discard Window
 #define POPT_LIVE_DISC_WND_ALL               0xFFFFFFFF // automatically truncated for 32-bit
 
@@ -132,17 +165,107 @@ namespace swift
 // timeout for the piece picker
 #define PICKER_TIMEOUT                     2  // seconds
 
+// DEADLINE: chunks due within this much playback time are picked in order
+// from peers that can deliver them in time, later chunks rarest first.
+#define SWIFT_VOD_DEADLINE_WINDOW_TIME     10 // seconds
+
+// DEADLINE: chunks due within this time that are late at the peer asked
+// are requested again from another peer.
+#define SWIFT_VOD_DEADLINE_ENDGAME_TIME    2  // seconds
+
+// DEADLINE: playback rate assumed until known from content duration or
+// player progress.
+#define SWIFT_VOD_DEFAULT_BITRATE          (256*1024) // bytes/s
+
+// ACKAGG: Received chunks are acknowledged together once this many are
+// pending, or SWIFT_DELAYED_ACK_TIME (at most a quarter RTT) after the first.
+#define SWIFT_DELAYED_ACK_CHUNKS           4
+#define SWIFT_DELAYED_ACK_TIME             (20*TINT_MSEC)
+
+// CHUNK64: Channels are reopened with 64-bit chunk addressing when the
+// transfer gets within this many chunks of the 32-bit limit, leaving room
+// for chunks addressed while the new channel is set up.
+#define SWIFT_CHUNKADDR_UPGRADE_MARGIN     (1024*1024) // chunks
+// Highest chunk ID accepted in 64-bit chunk addresses (bin tree limit)
+#define SWIFT_CHUNK64_MAX_CHUNK            ((1ULL<<62)-1)
+
 // How much time a SIGNED_INTEGRITY timestamp may diverge from current time
 #define SWIFT_LIVE_MAX_SOURCE_DIVERGENCE_TIME   30 // seconds
 
+// Live source: spread the HAVEs for a new epoch over this part of the epoch
+// interval, in batches at least SWIFT_LIVE_FANOUT_MIN_TICK apart.
+#define SWIFT_LIVE_FANOUT_SPREAD_PERCENT        50
+#define SWIFT_LIVE_FANOUT_MIN_TICK              (2*TINT_MSEC)
+
+// Live: default number of channels to push new chunks to without waiting
+// for a REQUEST. 0 means pull only.
+#define SWIFT_LIVE_DEFAULT_PUSH_CHILDREN        0
+// Live client: max chunks pushed ahead of their munro to keep until it
+// arrives and they can be checked (UMT).
+#define SWIFT_LIVE_PUSH_MAX_PENDING             1024
+// Live: a peer is taken to push to us after this many unrequested chunks,
+// each at most SWIFT_LIVE_PUSH_EVIDENCE_TIME after the previous one.
+#define SWIFT_LIVE_PUSH_EVIDENCE                4
+#define SWIFT_LIVE_PUSH_EVIDENCE_TIME           (2*TINT_SEC)
+
+// Live client: hook in such that the chunks between the hook-in point and
+// the live edge give this much playout buffer, unless downloading them would
+// take longer than SWIFT_LIVE_HOOKIN_FILL_TIME at the measured throughput.
+#define SWIFT_LIVE_HOOKIN_PREBUFFER_TIME        (2*TINT_SEC)
+#define SWIFT_LIVE_HOOKIN_FILL_TIME             (1*TINT_SEC)
+// Live client: how long to collect munros before hooking in without a
+// bitrate estimate.
+#define SWIFT_LIVE_HOOKIN_MAX_WAIT              (1*TINT_SEC)
+
+// Live source: default number of first-tier relays to serve in the relay
+// overlay. 0 means serve all peers.
+#define SWIFT_LIVE_DEFAULT_TIER1_RELAYS         0
+// Live source: how often to revise the first tier, how often to tell other
+// peers about the relays, and how much more capacity a peer must have to
+// replace a relay.
+#define SWIFT_LIVE_RELAY_REBALANCE_INTERVAL     (5*TINT_SEC)
+#define SWIFT_LIVE_RELAY_STEER_INTERVAL         (10*TINT_SEC)
+#define SWIFT_LIVE_RELAY_SWAP_FACTOR            2.0
+
+// Live FEC: default ratio of repair to data chunks. 0 means off.
+#define SWIFT_LIVE_DEFAULT_FEC_RATIO            0.0
+// Live FEC: ratio that makes the source adapt the ratio to the loss rate
+#define SWIFT_LIVE_FEC_ADAPTIVE                 -1.0
+// Live FEC: in adaptive mode, repair ratio is this times the loss rate,
+// capped by SWIFT_LIVE_FEC_MAX_RATIO
+#define SWIFT_LIVE_FEC_LOSS_FACTOR              2.0
+#define SWIFT_LIVE_FEC_MAX_RATIO                0.5
+// Live FEC: max data chunks per repair block. Epochs are split into blocks.
+#define SWIFT_LIVE_FEC_MAX_BLOCK                64
+// Live FEC: client: number of incomplete blocks to keep repairs for
+#define SWIFT_LIVE_FEC_MAX_PENDING_BLOCKS       16
+// Live FEC: source: max repairs queued per channel, oldest dropped first
+#define SWIFT_LIVE_FEC_MAX_QUEUED               64
+
 
 #define SWIFT_MAX_UDP_OVER_ETH_PAYLOAD        (1500-20-8)
+#define SWIFT_MAX_UDP_PAYLOAD                 (65535-20-8)
 // Arno: Maximum size of non-DATA messages in a UDP packet we send.
 #define SWIFT_MAX_NONDATA_DGRAM_SIZE         (SWIFT_MAX_UDP_OVER_ETH_PAYLOAD-SWIFT_DEFAULT_CHUNK_SIZE-1-4)
-// Arno: Maximum size of a UDP packet we send. Note: depends on CHUNKSIZE 8192
-#define SWIFT_MAX_SEND_DGRAM_SIZE            (SWIFT_MAX_NONDATA_DGRAM_SIZE+1+4+8192)
-// Arno: Maximum size of a UDP packet we are willing to accept. Note: depends on CHUNKSIZE 8192
-#define SWIFT_MAX_RECV_DGRAM_SIZE            (SWIFT_MAX_SEND_DGRAM_SIZE*2)
+// Maximum size of a UDP packet we send: a DATA message for the largest
+// chunk (BYTE64 address and timestamp) plus non-DATA messages.
+#define SWIFT_MAX_SEND_DGRAM_SIZE            (SWIFT_MAX_NONDATA_DGRAM_SIZE+1+16+8+SWIFT_MAX_CHUNK_SIZE)
+// Maximum size of a UDP packet we are willing to accept. Uncle hashes for
+// big chunks may exceed SWIFT_MAX_NONDATA_DGRAM_SIZE, so take anything UDP
+// can carry.
+#define SWIFT_MAX_RECV_DGRAM_SIZE            SWIFT_MAX_UDP_PAYLOAD
+
+// MULTIDATA: A datagram carries as many chunks as fit in the path MTU (as
+// UDP payload). Channels start at SWIFT_MAX_UDP_OVER_ETH_PAYLOAD and probe
+// for up to Channel::MAX_PMTU, by default the size of a jumbo frame.
+#define SWIFT_PMTU_JUMBO                     (9000-20-8)
+// Time after a failed probe before probing for the maximum again
+#define SWIFT_PMTU_RAISE_TIME                600 // seconds
+
+// HASHDEDUP: Every so many chunks a channel sends the full uncle path, so
+// that later chunks no longer depend on the hashes in earlier datagrams.
+// This bounds the chunks a single lost datagram makes unverifiable.
+#define SWIFT_HASH_ANCHOR_INTERVAL           8 // chunks
 
 #define layer2bytes(ln,cs)    (uint64_t)( ((double)cs)*pow(2.0,(double)ln))
 #define bytes2layer(bn,cs)  (int)log2(  ((double)bn)/((double)cs) )
@@ -332,7 +455,8 @@ namespace swift
         SWIFT_UNCHOKE = 11,
         SWIFT_PEX_RESv6 = 12,
         SWIFT_PEX_REScert = 13,
-        SWIFT_MESSAGE_COUNT = 14
+        SWIFT_LIVE_REPAIR = 14, // LIVEFEC, not in PPSPP
+        SWIFT_MESSAGE_COUNT = 15
     } messageid_t;
 
     typedef enum {
@@ -377,13 +501,7 @@ namespace swift
         POPT_CONT_INT_PROT_UNIFIED_MERKLE = 3
     } popt_cont_int_prot_t;
 
-    typedef enum {
-        POPT_MERKLE_HASH_FUNC_SHA1 = 0,
-        POPT_MERKLE_HASH_FUNC_SHA224 = 1,
-        POPT_MERKLE_HASH_FUNC_SHA256 = 2,
-        POPT_MERKLE_HASH_FUNC_SHA384 = 3,
-        POPT_MERKLE_HASH_FUNC_SHA512 = 4
-    } popt_merkle_func_t;
+    // popt_merkle_func_t is in hashtree.h
 
     typedef enum {
         POPT_CHUNK_ADDR_BIN32 = 0,
@@ -396,17 +514,107 @@ namespace swift
     // popt_live_sig_alg_t: See livesig.h
 
 
+    /** DECODE: Fixed-size list of the bins a chunk spec describes. A range of
+     * 64-bit chunk IDs never takes more than 2 bins per layer, so decoding
+     * into this does not allocate. */
+#define SWIFT_BINARRAY_MAX_BINS     128
+
+    struct binarray_t {
+        bin_t   bins[SWIFT_BINARRAY_MAX_BINS];
+        int     size;
+        binarray_t() : size(0) {}
+        void push_back(bin_t b) {
+            if (size < SWIFT_BINARRAY_MAX_BINS)
+                bins[size++] = b;
+        }
+    };
+
+
+    /** DECODE: Reads the fields of a received datagram in place. The cursor
+     * walks a linear buffer, reading past its end yields 0 like the
+     * evbuffer_remove_* helpers and marks the cursor as not ok. */
+    class DgramCursor
+    {
+    public:
+        DgramCursor(const uint8_t *buf, size_t len) : start_(buf), ptr_(buf), end_(buf+len), ok_(true) {}
+
+        size_t          remaining() const {
+            return end_-ptr_;
+        }
+        size_t          consumed() const {
+            return ptr_-start_;
+        }
+        bool            ok() const {
+            return ok_;
+        }
+        /** Pointer to the unread bytes, e.g. a DATA payload */
+        const uint8_t  *data() const {
+            return ptr_;
+        }
+        void            skip(size_t n) {
+            if (n > remaining()) {
+                n = remaining();
+                ok_ = false;
+            }
+            ptr_ += n;
+        }
+        uint8_t         get8() {
+            if (!Need(1))
+                return 0;
+            return *ptr_++;
+        }
+        uint16_t        get16be() {
+            if (!Need(2))
+                return 0;
+            uint16_t w = ((uint16_t)ptr_[0]<<8) | ptr_[1];
+            ptr_ += 2;
+            return w;
+        }
+        uint32_t        get32be() {
+            if (!Need(4))
+                return 0;
+            uint32_t i = ((uint32_t)ptr_[0]<<24) | ((uint32_t)ptr_[1]<<16) | ((uint32_t)ptr_[2]<<8) | ptr_[3];
+            ptr_ += 4;
+            return i;
+        }
+        uint64_t        get64be() {
+            uint64_t l = get32be();
+            l <<= 32;
+            return l | get32be();
+        }
+        Sha1Hash        gethash(popt_merkle_func_t func=POPT_MERKLE_HASH_FUNC_SHA1);
+        /** Decodes a chunk spec into bins. Returns the number of bins, 0 on
+         * bad input. */
+        int             getchunkaddr(popt_chunk_addr_t chunk_addr, uint32_t chunk_size, binarray_t *ba);
+
+    protected:
+        const uint8_t  *start_;
+        const uint8_t  *ptr_;
+        const uint8_t  *end_;
+        bool            ok_;
+
+        bool            Need(size_t n) {
+            if (remaining() >= n)
+                return true;
+            ptr_ = end_;
+            ok_ = false;
+            return false;
+        }
+    };
+
+
+
     class Handshake
     {
     public:
 #if ENABLE_IETF_PPSP_VERSION == 1
         Handshake() : version_(VER_PPSPP_v1), min_version_(VER_PPSPP_v1), merkle_func_(POPT_MERKLE_HASH_FUNC_SHA1),
             live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_CHUNK32), live_disc_wnd_(POPT_LIVE_DISC_WND_ALL),
-            swarm_id_ptr_(NULL) {}
+            supp_msgs_(0), swarm_id_ptr_(NULL) {}
 #else
         Handshake() : version_(VER_SWIFT_LEGACY), min_version_(VER_SWIFT_LEGACY), merkle_func_(POPT_MERKLE_HASH_FUNC_SHA1),
             live_sig_alg_(DEFAULT_LIVE_SIG_ALG), chunk_addr_(POPT_CHUNK_ADDR_BIN32), live_disc_wnd_(POPT_LIVE_DISC_WND_ALL),
-            swarm_id_ptr_(NULL) {}
+            supp_msgs_(0), swarm_id_ptr_(NULL) {}
 #endif
         Handshake(Handshake &c) {
             version_ = c.version_;
@@ -416,6 +624,7 @@ namespace swift
             live_sig_alg_ = c.live_sig_alg_;
             chunk_addr_ = c.chunk_addr_;
             live_disc_wnd_ = c.live_disc_wnd_;
+            supp_msgs_ = c.supp_msgs_;
             if (c.swarm_id_ptr_ == NULL)
                 swarm_id_ptr_ = NULL;
             else
@@ -438,11 +647,11 @@ namespace swift
         bool IsSupported() {
             if (cont_int_prot_ == POPT_CONT_INT_PROT_SIGNALL)
                 return false; // PPSPTODO
-            else if (merkle_func_ >= POPT_MERKLE_HASH_FUNC_SHA224)
-                return false; // PPSPTODO
-            else if (chunk_addr_ == POPT_CHUNK_ADDR_BYTE64 || chunk_addr_ == POPT_CHUNK_ADDR_BIN64
-                     || chunk_addr_ == POPT_CHUNK_ADDR_CHUNK64)
-                return false; // PPSPTODO
+            else if (!(merkle_func_ == POPT_MERKLE_HASH_FUNC_SHA1 || merkle_func_ == POPT_MERKLE_HASH_FUNC_SHA256
+                       || merkle_func_ == POPT_MERKLE_HASH_FUNC_SHA512_256))
+                return false; // PPSPTODO: SHA224, SHA384, SHA512
+            else if (chunk_addr_ > POPT_CHUNK_ADDR_CHUNK64)
+                return false;
             else if (!(live_sig_alg_ == POPT_LIVE_SIG_ALG_RSASHA1 || live_sig_alg_ == POPT_LIVE_SIG_ALG_ECDSAP256SHA256
                        || live_sig_alg_ == POPT_LIVE_SIG_ALG_ECDSAP384SHA384))
                 return false; // PPSPTODO
@@ -458,6 +667,22 @@ namespace swift
             chunk_addr_ =    POPT_CHUNK_ADDR_BIN32;
             live_disc_wnd_ = (uint32_t)POPT_LIVE_DISC_WND_ALL;
             live_sig_alg_ =  DEFAULT_LIVE_SIG_ALG;
+            supp_msgs_ =     0;
+        }
+        /** Whether chunk addresses take 32 bits, see SWIFT_CHUNKADDR_UPGRADE_MARGIN */
+        bool Is32BitChunkAddr() {
+            return chunk_addr_ == POPT_CHUNK_ADDR_BIN32 || chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32;
+        }
+        /** CHUNK64: Switch to the 64-bit variant of the chunk addressing */
+        void WidenChunkAddr() {
+            if (chunk_addr_ == POPT_CHUNK_ADDR_BIN32)
+                chunk_addr_ = POPT_CHUNK_ADDR_BIN64;
+            else if (chunk_addr_ == POPT_CHUNK_ADDR_CHUNK32)
+                chunk_addr_ = POPT_CHUNK_ADDR_CHUNK64;
+        }
+        /** Whether the peer listed msgid in POPT_SUPP_MSGS */
+        bool SupportsMessage(messageid_t msgid) {
+            return (supp_msgs_ >> msgid) & 1;
         }
 
         /**    Peer channel id; zero if we are trying to open a channel. */
@@ -469,6 +694,9 @@ namespace swift
         popt_live_sig_alg_t  live_sig_alg_;
         popt_chunk_addr_t    chunk_addr_;
         uint64_t             live_disc_wnd_;
+        /** POPT_SUPP_MSGS, bit i set if message type i is supported. 0 if
+         * not sent. */
+        uint64_t             supp_msgs_;
     protected:
         /** Dynamically allocated such that we can deallocate it and
          * save some bytes per channel */
@@ -563,6 +791,10 @@ namespace swift
         Channel *       FindChannel(const Address &addr, Channel *notc);
         void            CloseChannels(channels_t delset, bool isall); // do not pass by reference
         void            GarbageCollectChannels();
+        /** CHUNK64: Open a new channel to addr later, from the clean
+         * callback, as the caller may be iterating the channels. */
+        void            ReopenChannel(evutil_socket_t sock, const Address &addr);
+        void            ReopenChannels();
 
         // RATELIMIT
         /** Arno: Call when n bytes are received. */
@@ -584,6 +816,42 @@ namespace swift
         /** Arno: Return the number of seeders current channeled with. */
         uint32_t        GetNumSeeders();
 
+        // METRICS
+        /** Call when a datagram of n bytes is sent or received for this transfer. */
+        void            OnDatagram(data_direction_t ddir, int n) {
+            dgrams_[ddir]++;
+            raw_bytes_[ddir] += n;
+        }
+        void            OnRetransmit() {
+            retransmits_++;
+        }
+        void            OnHashCheckFail() {
+            hash_check_fails_++;
+        }
+        /** Return the number of datagrams sent/received for this transfer,
+         * summed over all channels, also ones that have been closed. */
+        uint64_t        GetDgrams(data_direction_t ddir) {
+            return dgrams_[ddir];
+        }
+        /** Return the number of bytes sent/received in datagrams for this transfer */
+        uint64_t        GetRawBytes(data_direction_t ddir) {
+            return raw_bytes_[ddir];
+        }
+        uint64_t        GetRetransmits() {
+            return retransmits_;
+        }
+        uint64_t        GetHashCheckFails() {
+            return hash_check_fails_;
+        }
+
+        // TELEMETRY
+        /** Turn recording of trace events on/off for all current and future
+         * channels of this transfer. */
+        void            SetTracing(bool enable);
+        bool            IsTracing() {
+            return tracing_;
+        }
+
         /** Arno: Return (pointer to) the list of Channels for this transfer. MORESTATS */
         channels_t *    GetChannels() {
             return &mychannels_;
@@ -648,6 +916,8 @@ namespace swift
 
         /** Channels working for this transfer. */
         channels_t      mychannels_;
+        /** CHUNK64: Channels to open on the next clean callback */
+        std::vector<std::pair<evutil_socket_t,Address> > reopen_;
 
         /** Progress callback management **/
         progcallbackregs_t callbacks_;
@@ -660,6 +930,13 @@ namespace swift
         double          max_speed_[2];
         uint32_t        speedupcount_;
         uint32_t        speeddwcount_;
+        // METRICS
+        uint64_t        dgrams_[2];
+        uint64_t        raw_bytes_[2];
+        uint64_t        retransmits_;
+        uint64_t        hash_check_fails_;
+        // TELEMETRY
+        bool            tracing_;
         // MULTIFILE
         Storage         *storage_;
 
@@ -692,7 +969,7 @@ namespace swift
          */
         FileTransfer(int td, std::string file_name, const Sha1Hash& root_hash=Sha1Hash::ZERO, bool force_check_diskvshash=true,
                      popt_cont_int_prot_t cipm=POPT_CONT_INT_PROT_MERKLE, uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE, bool zerostate=false,
-                     std::string metadir="");
+                     std::string metadir="", popt_merkle_func_t merkle_func=POPT_MERKLE_HASH_FUNC_SHA1);
         /**    Close everything. */
         ~FileTransfer();
 
@@ -727,6 +1004,9 @@ namespace swift
         bool        IsZeroState() {
             return zerostate_;
         }
+        /** DEDUP: Called when chunk pos has been received and verified. Takes
+         * its sibling from another local swarm if one has it. */
+        void        OnDataVerified(bin_t pos);
 
     protected:
         // Ric: PPPLUG
@@ -785,6 +1065,14 @@ namespace swift
         /** Source: announce only chunks under signed munros */
         void            UpdateSignedAckOut();
 
+        // FANOUT
+        /** Source: append the HAVEs for the last epoch, encoded once for all
+         * channels, if have_out covers everything in ack before that epoch
+         * and none of it. Returns whether it did so. */
+        bool            AddFanoutHave(struct evbuffer *evb, binmap_t &have_out, binmap_t &ack,
+                                      popt_chunk_addr_t chunk_addr);
+        static void     LibeventFanoutCallback(int fd, short event, void *arg);
+
 
         /** Returns the byte offset at which we hooked into the live stream */
         uint64_t        GetHookinOffset();
@@ -798,13 +1086,79 @@ namespace swift
         /** Source: Return all chunks in ack_out_ covered by peaks */
         binmap_t *      ack_out_signed();
 
-        /** Received a correctly signed munro hash with timestamp sourcet */
-        void        OnVerifiedMunroHash(bin_t munro, tint sourcet);
+        /** Received a correctly signed munro hash with timestamp sourcet
+         * via channel channelid */
+        void        OnVerifiedMunroHash(bin_t munro, tint sourcet, uint32_t channelid);
 
         /** If live discard window is used, purge unused parts of tree.
          * pos is last received chunk. */
         void            OnDataPruneTree(Handshake &hs_out, bin_t pos, uint32_t nchunks2forget);
 
+        // LIVEPUSH
+        /** Set the number of channels new chunks are pushed to */
+        void            SetPushChildren(uint32_t nchildren) {
+            push_children_ = nchildren;
+        }
+        uint32_t        GetPushChildren() {
+            return push_children_;
+        }
+        /** Push bins to up to push_children_ channels, except from */
+        void            PushChunks(binvector &bins, Channel *from);
+        /** Client: chunk pos failed the integrity check, it may have been
+         * pushed before its munro was signed. Keep it till the munro
+         * arrives, returns false if it can't be checked that way. */
+        bool            OnPushedData(bin_t pos, const uint8_t *data, uint32_t length);
+        /** Client: check the kept chunks under munro whose uncle hashes are
+         * now known, from the tree or from the other kept chunks */
+        void            VerifyPushed(bin_t munro);
+        uint64_t        GetPushPending() {
+            return push_pending_.size();
+        }
+
+        // RELAYTREE
+        /** Source: serve only this many first-tier relays and steer other
+         * peers to them via PEX. 0 means serve all peers. */
+        void            SetTier1Relays(uint32_t nrelays);
+        uint32_t        GetTier1Relays() {
+            return tier1_relays_;
+        }
+        /** Source: whether to announce and serve chunks to the peer on c */
+        bool            IsServed(Channel *c);
+        /** Source: promote c to first-tier relay if there is a free slot,
+         * else steer it to the relays now and then. */
+        void            UpdateRelay(Channel *c);
+        /** Source: a random first-tier relay other than c, or NULL */
+        Channel *       RandomRelay(Channel *c);
+        static void     LibeventRebalanceCallback(int fd, short event, void *arg);
+
+        // LIVEFEC
+        /** Source: ratio of repair to data chunks sent per epoch, or
+         * SWIFT_LIVE_FEC_ADAPTIVE. Client: any non-zero value accepts repairs.
+         * 0 turns FEC off. */
+        void            SetFECRatio(double ratio) {
+            fec_ratio_ = ratio;
+        }
+        double          GetFECRatio() {
+            return fec_ratio_;
+        }
+        bool            FECEnabled() {
+            return fec_ratio_ != 0.0;
+        }
+        /** Client: received repair chunk repairidx of the block of k chunks
+         * starting at first */
+        void            OnRepair(bin_t first, uint32_t k, uint32_t repairidx, const uint8_t *data, uint32_t length);
+        /** Client: received chunk pos, see if its block can be repaired */
+        void            OnRepairData(bin_t pos);
+        uint64_t        GetFECRepairsSent() {
+            return fec_repairs_sent_;
+        }
+        void            OnRepairSent() {
+            fec_repairs_sent_++;
+        }
+        uint64_t        GetFECRecovered() {
+            return fec_recovered_;
+        }
+
         // Arno: FileTransfers are managed by the SwarmManager which
         // activates/deactivates them as required. LiveTransfers are unmanaged.
         /** Find transfer by the transfer descriptor. */
@@ -824,6 +1178,9 @@ namespace swift
 
         /** Source: returns current last_chunkid_ as bin */
         bin_t       GetSourceCurrentPos();
+        /** CHUNK64: Source: ID of last generated chunk. Client: ID of
+         * chunk currently wanted. */
+        uint64_t    GetLastChunkID();
 
         /** Client: return source address */
         Address     GetSourceAddress() {
@@ -835,6 +1192,8 @@ namespace swift
         binmap_t        ack_out_;
         /**    Binmap of own chunk availability restricted to current signed peaks SIGNPEAK */
         binmap_t    signed_ack_out_;
+        /**    Signed peaks already in signed_ack_out_ */
+        binvector   signed_peaks_;
         /**    Bin of right-most received chunk LIVE */
         bin_t       ack_out_right_basebin_; // FUTURE: make part of binmap_t?
         // CHUNKSIZE
@@ -863,11 +1222,100 @@ namespace swift
         /** Client: Source address for chunk picker and protocol optimization */
         Address     srcaddr_;
 
+        // FANOUT
+        /** Source: timer for sending the next batch of channels */
+        struct event    *evfanout_ptr_;
+        /** Source: HAVEs of the last epoch, encoded for def_hs_out_ */
+        struct evbuffer *fanout_have_evb_;
+        /** Source: bins announced in fanout_have_evb_ */
+        binvector       fanout_bins_;
+        /** Source: chunk addressing fanout_have_evb_ was encoded with */
+        popt_chunk_addr_t fanout_chunk_addr_;
+        /** Source: first chunk of the next epoch */
+        uint64_t        fanout_epoch_start_;
+        /** Source: channel index to send to next */
+        uint32_t        fanout_next_;
+        /** Source: channels still to send to this epoch */
+        uint32_t        fanout_left_;
+        /** Source: channels per batch, and time between batches */
+        uint32_t        fanout_batch_;
+        tint            fanout_tick_;
+        /** Source: time of last epoch and average time between epochs */
+        tint            last_epoch_time_;
+        tint            epoch_interval_;
+
+        // LIVEPUSH
+        /** Number of channels to push new chunks to */
+        uint32_t        push_children_;
+        /** Client: chunks pushed ahead of their munro, by chunk ID */
+        std::map<uint64_t,std::string> push_pending_;
+
+        // RELAYTREE
+        /** Source: max number of first-tier relays, 0 = serve all */
+        uint32_t        tier1_relays_;
+        /** Source: channel IDs of the first-tier relays */
+        std::vector<uint32_t> relays_;
+        struct event    *evrebalance_ptr_;
+
+        // LIVEFEC
+        /** Repair ratio, see SetFECRatio() */
+        double          fec_ratio_;
+        /** Source: loss estimate for adaptive mode, and the counters it
+         * was last computed from */
+        double          fec_loss_;
+        uint64_t        fec_retransmits0_;
+        uint64_t        fec_raw_up0_;
+        /** Source: REPAIR messages of the last epoch, encoded for def_hs_out_ */
+        std::vector<struct evbuffer *> fec_repair_evbs_;
+        /** Source: chunk addressing fec_repair_evbs_ were encoded with */
+        popt_chunk_addr_t fec_chunk_addr_;
+        uint64_t        fec_repairs_sent_;
+        /** Client: repair chunks received for incomplete blocks, by first chunk */
+        struct fec_block_t {
+            uint32_t                k;
+            std::vector<uint32_t>   repairidx;
+            std::vector<uint8_t>    repairs;
+        };
+        std::map<uint64_t,fec_block_t> fec_blocks_;
+        uint64_t        fec_recovered_;
+
         /** Arno: global list of LiveTransfers, which are not managed via SwarmManager */
         static std::vector<LiveTransfer*> liveswarms;
 
         /** Joint constructor code between source and client */
         void Initialize(KeyPair &keypair, popt_cont_int_prot_t cipm, uint64_t disc_wnd,uint32_t nchunks_per_sign);
+
+        // FANOUT
+        /** Source: encode HAVEs for the new epoch and start sending them */
+        void ScheduleFanout();
+        /** Source: send to the next batch of channels */
+        void FanoutSend();
+
+        // RELAYTREE
+        bool IsRelay(Channel *c);
+        /** Source: forget relays whose channel has gone */
+        void PruneRelays();
+        /** Source: fill free relay slots and replace the weakest relay */
+        void Rebalance();
+        /** Source: estimated capacity of the path to the peer, in bytes/s */
+        double RelayCapacity(Channel *c);
+
+        // LIVEFEC
+        /** Source: current repair ratio, updates the loss estimate */
+        double CurrentFECRatio();
+        /** Source: encode the REPAIR messages for chunks [start,end) */
+        void EncodeRepairs(uint64_t start, uint64_t end);
+        /** Source: queue the REPAIR messages of the last epoch on c */
+        void SendRepairs(Channel *c);
+        /** Client: reconstruct the block at first if enough chunks are in */
+        void TryRepair(uint64_t first);
+        /** Client: store a chunk that was repaired or kept as if received */
+        bool OfferChunk(bin_t pos, const uint8_t *data, uint32_t length);
+
+        // LIVEPUSH
+        /** Client: hash of pos from the verified tree or kept chunks, ZERO
+         * if unknown */
+        Sha1Hash PushedHash(bin_t pos, std::map<bin_t,Sha1Hash> &hashes);
     };
 
 
@@ -890,19 +1338,44 @@ namespace swift
          *  @param  offbin        bin number of new playback pos
          *  @param  whence      only SEEK_CUR supported */
         virtual int     Seek(bin_t offbin, int whence) = 0;
+        /** DEADLINE: sets the playback rate of the content for pickers
+         * that schedule by playback deadline.
+         *  @param  bytespersec   content bitrate in bytes/s, 0 = unknown */
+        virtual void    SetBitrate(double bytespersec) {}
+        /** PREFETCH: sets the ranges expected to be read next, most
+         * likely first, for pickers that support it. Replaces earlier ones. */
+        virtual void    SetPrefetch(binvector &ranges) {}
         virtual         ~PiecePicker() {}
     };
 
+    /** Hook-in and playout statistics of a live client, as if a player
+     * started when the prebuffer was filled and consumed chunks at the
+     * estimated stream rate. */
+    struct livepp_stats_t {
+        tint        open_time;       // when the picker was created
+        tint        hookin_time;     // when the last hook-in pos was chosen, 0 = not yet
+        tint        play_time;       // when the prebuffer was filled, 0 = not yet
+        bin_t       hookin_bin;
+        uint64_t    prebuf_chunks;   // chunks between hook-in pos and live edge
+        double      rate;            // estimated stream rate in chunks/s, 0 = unknown
+        uint32_t    npeers;          // peers whose munro was used for hook-in
+        uint32_t    nhookins;        // incl. re-hook-ins after lagging
+        uint32_t    nstalls;
+        tint        stall_time;      // total time stalled, incl. current stall
+    };
+
     class LivePiecePicker : public PiecePicker
     {
     public:
         /** Arno: Register the last munro sent by a peer, to be able to choose
          * a hook-in point. */
-        virtual void    AddPeerMunro(bin_t munro, tint sourcet) = 0;
+        virtual void    AddPeerMunro(bin_t munro, tint sourcet, uint32_t channelid) = 0;
         /** Returns the bin at which we hooked into the live stream. */
         virtual bin_t   GetHookinPos() = 0;
         /** Returns the bin in the live stream we currently want to download. */
         virtual bin_t   GetCurrentPos() = 0;
+        /** Returns startup delay and stall statistics. */
+        virtual void    GetStats(livepp_stats_t &stats) = 0;
     };
 
 
@@ -947,6 +1420,14 @@ namespace swift
         static tint     epoch, start;
         static uint64_t global_dgrams_up, global_dgrams_down, global_raw_bytes_up, global_raw_bytes_down, global_bytes_up,
                global_bytes_down;
+        /** Bytes of INTEGRITY hashes sent and received, to measure hash overhead per chunk */
+        static uint64_t global_hash_bytes_up, global_hash_bytes_down;
+        /** Uncle hashes not sent because the peer could already derive them */
+        static uint64_t global_hashes_deduped;
+        /** Chunks sent again after a timeout, and chunks received that failed the hash check */
+        static uint64_t global_retransmits, global_hash_check_fails;
+        /** RTT samples and lateness of send events w.r.t. NextSendTime(), for statsgw /metrics */
+        static LatencyHistogram global_rtt_hist, global_send_lag_hist;
         static void     CloseChannelByAddress(const Address &addr);
 
         // SOCKMGMT
@@ -956,7 +1437,8 @@ namespace swift
         static void     LibeventReceiveCallback(int fd, short event, void *arg);
         static void     RecvDatagram(evutil_socket_t socket);  // Called by LibeventReceiveCallback
         static int      RecvFrom(evutil_socket_t sock, Address& addr, struct evbuffer *evb); // Called by RecvDatagram
-        static int      SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb); // Called by Channel::Send()
+        static int      SendTo(evutil_socket_t sock, const Address& addr, struct evbuffer *evb,
+                               bool dontfrag=false); // Called by Channel::Send()
         static evutil_socket_t Bind(Address address, sckrwecb_t callbacks=sckrwecb_t());
         static Address  BoundAddress(evutil_socket_t sock);
         static evutil_socket_t default_socket() {
@@ -990,31 +1472,58 @@ namespace swift
             transfer_ = NULL;    // for swarm cleanup
         }
 
-        void        OnAck(struct evbuffer *evb);
-        void        OnHave(struct evbuffer *evb);
+        void        OnAck(DgramCursor &dc);
+        void        OnHave(DgramCursor &dc);
         void        OnHaveLive(bin_t ackd_pos);
-        bin_t       OnData(struct evbuffer *evb);
-        void        OnHint(struct evbuffer *evb);
-        void        OnHash(struct evbuffer *evb);
+        bin_t       OnData(DgramCursor &dc);
+        void        OnHint(DgramCursor &dc);
+        void        OnHash(DgramCursor &dc);
         void        OnPexAdd(struct evbuffer *evb, int family);
         void        OnPexAddCert(struct evbuffer *evb);
         static Handshake *StaticOnHandshake(Address &addr, uint32_t cid, bool ver_known, popt_version_t ver,
                                             struct evbuffer *evb);
         void        OnHandshake(Handshake *hishs);
-        void        OnCancel(struct evbuffer *evb); // PPSP
+        void        OnCancel(DgramCursor &dc); // PPSP
         void        OnChoke(struct evbuffer *evb);
         void        OnUnchoke(struct evbuffer *evb);
         void        OnSignedHash(struct evbuffer *evb);
+        void        OnRepair(struct evbuffer *evb); // LIVEFEC
         void        AddHandshake(struct evbuffer *evb);
+        /** LIVEFEC: Bitmap of the message types this peer handles, for
+         * POPT_SUPP_MSGS */
+        uint64_t    SupportedMessages();
+        /** CHUNK64: Whether the transfer is near the limit of the 32-bit
+         * chunk addressing of hs_out_ */
+        bool        NearChunkAddrLimit();
+        /** CHUNK64: Pick the chunk addressing for the opening handshake */
+        void        ChooseChunkAddr();
         bin_t       AddData(struct evbuffer *evb);
+        /** MULTIDATA: Add DATA message for tosend, returns bytes of content
+         * added or -1 on error */
+        ssize_t     AddDataChunk(struct evbuffer *evb, bin_t tosend, bool isretransmit);
+        /** MULTIDATA: Add more chunks and their hashes up to the path MTU */
+        void        AddMoreData(struct evbuffer *evb);
+        /** LIVEFEC: Add the next queued REPAIR message, last in datagram */
+        void        AddRepair(struct evbuffer *evb);
+        /** MULTIDATA: Undo DequeueHint() for a chunk that didn't fit */
+        void        RequeueHint(bin_t pos, bool isretransmit);
+        void        OnPMTUProbeFailed(bool sendfailed);
         void        SendIfTooBig(struct evbuffer *evb);
         void        AddAck(struct evbuffer *evb);
         void        AddHave(struct evbuffer *evb);
+        /** ACKAGG: Add ACK or HAVE messages for chunks schunk to echunk
+         * (inclusive), one range if the chunk addressing allows. */
+        void        AddChunkRange(struct evbuffer *evb, uint8_t msgtype, bin_t::uint_t schunk, bin_t::uint_t echunk,
+                                  tint owd);
+        /** ACKAGG: First bin at or right of chunk in src not yet in have_out_ */
+        bin_t       FindHaveFrom(binmap_t &src, bin_t::uint_t chunk);
+        /** ACKAGG: When the pending ACKs must be sent, TINT_NEVER if none */
+        tint        AckDueTime();
         void        AddHint(struct evbuffer *evb);
         void        AddCancel(struct evbuffer *evb);
         void        AddRequiredHashes(struct evbuffer *evb, bin_t pos, bool isretransmit);
         void        AddUnsignedPeakHashes(struct evbuffer *evb);
-        void        AddFileUncleHashes(struct evbuffer *evb, bin_t pos);
+        void        AddFileUncleHashes(struct evbuffer *evb, bin_t pos, bool isretransmit);
         void        AddLiveSignedMunroHash(struct evbuffer *evb,bin_t munro); // SIGNMUNRO
         void        AddLiveUncleHashes(struct evbuffer *evb, bin_t pos, bin_t munro, bool isretransmit);  // SIGNMUNRO
         void        AddPex(struct evbuffer *evb);
@@ -1047,6 +1556,7 @@ namespace swift
         static bool SELF_CONN_OK;
         static tint MAX_POSSIBLE_RTT;
         static tint MIN_PEX_REQUEST_INTERVAL;
+        static int  MAX_PMTU; // MULTIDATA
         static FILE* debug_file;
         // Only in devel: file used to debug LEDBAT
         static FILE* debug_ledbat;
@@ -1069,6 +1579,9 @@ namespace swift
             tint tmo = rtt_avg_ + dev * 4;
             return tmo < 30*TINT_SEC ? tmo : 30*TINT_SEC;
         }
+        tint        rtt_avg() {
+            return rtt_avg_;
+        }
         uint32_t    id() const {
             return id_;
         }
@@ -1089,6 +1602,16 @@ namespace swift
         uint64_t    bytes_down() {
             return bytes_down_;
         }
+        send_control_t GetSendControl() {
+            return send_control_;
+        }
+
+        // TELEMETRY
+        /** Allocate or free the trace event ring of this channel */
+        void        SetTracing(bool enable);
+        const TraceRing *GetTraceRing() {
+            return trace_;
+        }
 
         static int  DecodeID(int scrambled);
         static int  EncodeID(int unscrambled);
@@ -1118,8 +1641,32 @@ namespace swift
         }
 
         // LIVE
-        /** Arno: Called when source generates chunk. */
+        /** Called by the source's fan-out scheduler to announce a new epoch now. */
         void        LiveSend();
+        /** LIVEPUSH: Send bins to peer without waiting for its REQUEST. */
+        void        LivePush(binvector &bins);
+        /** LIVEPUSH: Peer recently sent us a run of chunks we did not
+         * request, i.e., it pushes to us, so don't push to it. */
+        bool        PeerPushes() {
+            return push_in_count_ >= SWIFT_LIVE_PUSH_EVIDENCE && push_in_time_ >= NOW-SWIFT_LIVE_PUSH_EVIDENCE_TIME;
+        }
+        /** LIVEPUSH: Count a chunk the peer sent without our REQUEST */
+        void        OnUnrequestedData();
+        /** LIVEFEC: Queue a REPAIR message encoded with chunk_addr. It goes
+         * out in a send slot that no chunk takes, see AddData(). Returns
+         * false if the channel uses another chunk addressing. */
+        bool        LiveQueueRepair(struct evbuffer *repair, popt_chunk_addr_t chunk_addr);
+        uint32_t    GetRepairsQueued() {
+            return repair_out_.size();
+        }
+        bool        PeerSupportsRepair() {
+            return hs_in_ != NULL && hs_in_->SupportsMessage(SWIFT_LIVE_REPAIR);
+        }
+        /** RELAYTREE: Send the addresses of the given relays via PEX. */
+        void        AddRelayPex(std::vector<uint32_t> &relayids);
+        tint        GetRelayPexTime() {
+            return relay_pex_time_;
+        }
         bool        PeerIsSource();
         tint        GetLastRecvTime() {
             return last_recv_time_;
@@ -1133,8 +1680,6 @@ namespace swift
 
     protected:
         struct event    *evsend_ptr_; // Arno: timer per channel // SAFECLOSE
-        //LIVE
-        struct event    *evsendlive_ptr_; // Arno: timer per channel
 
         /** Channel id: index in the channel array. */
         uint32_t    id_;
@@ -1153,17 +1698,44 @@ namespace swift
         /**    Last data received; needs to be acked immediately. */
         tintbin     data_in_;
         bin_t       data_in_dbl_;
+        /** ACKAGG: Chunks received since the last ACK, when the first came
+         * in and the one-way delay of the last. */
+        binvector   ack_pending_;
+        tint        ack_pending_time_;
+        tint        ack_pending_owd_;
+        /** ACKAGG: Chunk from which to look for chunks to announce in HAVEs */
+        bin_t::uint_t have_cursor_;
+        /** MULTIDATA: Largest datagram known to reach the peer and the limit
+         * up to which to probe. A probe is a datagram larger than pmtu_,
+         * confirmed when its last chunk is acked. */
+        int         pmtu_;
+        int         pmtu_max_;
+        int         pmtu_probe_size_;
+        int         pmtu_probe_nchunks_;
+        bin_t       pmtu_probe_bin_;
+        bool        pmtu_probe_sending_;
+        /** MULTIDATA: Time from which probing is allowed again */
+        tint        pmtu_probe_time_;
         /** The history of data sent and still unacknowledged. */
         tbqueue     data_out_;
         uint32_t    data_out_size_; // pkts not acknowledged
         /** Timeouted data (potentially to be retransmitted). */
         tbqueue     data_out_tmo_; // it contains only leaf bins
         bin_t       data_out_cap_; // Ric: maybe we should remove it.. creates problems if lost
+        /** HASHDEDUP: Chunks sent with their uncle hashes since the last
+         * full uncle path and not lost. The peer has the uncles of their
+         * parents, so those need not be sent again. */
+        binmap_t    hashes_out_;
+        uint32_t    hashes_out_count_; // chunks sent since the last full path
         /** Index in the history array. */
         binmap_t    have_out_;
         /**    Transmit schedule: in most cases filled with the peer's hints */
         tbqueue     hint_in_;
         uint64_t    hint_in_size_;
+        /** LIVEPUSH: bins to send unrequested (counted in hint_in_size_), and
+         * those sent so that later REQUESTs for them are not served twice */
+        tbqueue     push_in_;
+        binmap_t    push_out_;
         /** Hints sent (to detect and reschedule ignored hints). */
         tbqueue     hint_out_;
         uint64_t    hint_out_size_;
@@ -1209,6 +1781,20 @@ namespace swift
             outstanding. In that case we should not wait till next_send_time_
             but request directly. See send_control.cpp */
         bool        live_have_no_hint_;
+        /** LIVE source: new chunks to announce, don't let keep-alive
+            postpone the HAVE. Cleared on the next send. */
+        bool        live_have_due_;
+        /** LIVEPUSH: unrequested chunks in the current run, and when the
+            last one came in */
+        uint32_t    push_in_count_;
+        tint        push_in_time_;
+        /** RELAYTREE: when the source last sent us relay addresses */
+        tint        relay_pex_time_;
+        /** LIVEFEC: REPAIR messages waiting for a send slot */
+        std::deque<struct evbuffer *> repair_out_;
+        /** LIVEFEC: when the repairs in data_out_size_ were sent. They are
+            not acked, so each leaves the window after an RTT. */
+        std::deque<tint> repair_sent_;
 
         /** Recent acknowlegements for data previously sent. */
         int         ack_rcvd_recent_; // Arno, 2013-07-01: appears broken at the moment
@@ -1249,10 +1835,16 @@ namespace swift
         // SIGNMUNRO
         bin_t       last_sent_munro_;
         bool        munro_ack_rcvd_;
+        /** LIVEPUSH: Last munro sent for chunks pushed before it was signed */
+        bin_t       push_munro_out_;
 
         // RTTCS
         tintbin     rtt_hint_tintbin_;
 
+        // TELEMETRY
+        /** Ring of recent trace events, NULL when tracing is off */
+        TraceRing   *trace_;
+
         int         PeerBPS() const {
             return TINT_SEC / dip_avg_ * 1024;
         }
@@ -1261,7 +1853,7 @@ namespace swift
         bin_t       ImposeHint();
         void        TimeoutDataOut();
         void        CleanStaleHintOut();
-        void        CleanHintOut(bin_t pos);
+        bool        CleanHintOut(bin_t pos);
         void        Reschedule();
         void        UpdateDIP(bin_t pos); // RETRANSMIT
         void        UpdateRTT(tint owd);
@@ -1278,7 +1870,9 @@ namespace swift
 
     // MULTIFILE
     /*
-     * Class representing a single file in a multi-file swarm.
+     * Class representing a single file in a multi-file swarm. FILEPOOL: the
+     * file is only open while it is among the SWIFT_STORAGE_MAX_OPEN_FILES
+     * (see SetMaxOpenFiles) most recently used StorageFiles of all swarms.
      */
     class StorageFile : public Operational
     {
@@ -1301,22 +1895,47 @@ namespace swift
             return os_pathname_;
         }
         ssize_t  Write(const void *buf, size_t nbyte, int64_t offset) {
-            return pwrite(fd_,buf,nbyte,offset);
+            int fd = GetFD();
+            return fd < 0 ? -1 : pwrite(fd,buf,nbyte,offset);
         }
         ssize_t  Read(void *buf, size_t nbyte, int64_t offset) {
-            return pread(fd_,buf,nbyte,offset);
+            int fd = GetFD();
+            return fd < 0 ? -1 : pread(fd,buf,nbyte,offset);
         }
         int ResizeReserved() {
-            return file_resize(fd_,GetSize());
+            int fd = GetFD();
+            return fd < 0 ? -1 : file_preallocate(fd,GetSize());
         }
 
+        /** FILEPOOL: Open file descriptor, opening the file if needed */
+        int         GetFD();
+        /** FILEPOOL: Close the file until it is used again */
+        void        Close();
+
+        /** FILEPOOL: Change the number of files open at a time, closing
+         * the least recently used ones if there are too many now */
+        static void SetMaxOpenFiles(size_t n);
+        static size_t GetOpenFiles() {
+            return open_files_.size();
+        }
+        /** FILEPOOL: Number of times a file was (re)opened */
+        static uint64_t global_file_opens;
+
     protected:
+        typedef std::list<StorageFile *>    open_files_t;
+
         std::string spec_pathname_;
         std::string os_pathname_;
         int64_t     start_;
         int64_t     end_;
 
-        int         fd_; // actual fd
+        int         fd_; // actual fd, -1 if not open
+        /** Place in open_files_ if open */
+        open_files_t::iterator lru_iter_;
+
+        /** Open StorageFiles, most recently used first */
+        static open_files_t open_files_;
+        static size_t max_open_files_;
     };
 
     typedef std::vector<StorageFile *>    storage_files_t;
@@ -1372,9 +1991,44 @@ namespace swift
         /** UNIX pread approximation. Does change file pointer. Thread-safe if no concurrent writes */
         ssize_t     Read(void *buf, size_t nbyte, int64_t offset); // off_t not 64-bit dynamically on Win32
 
-        /** UNIX pwrite approximation. Does change file pointer. Is not thread-safe */
+        /** Append nbyte bytes from offset to evb, reading directly into evb's
+         * memory. If filerefok and the content is a single file, the data is
+         * added as a reference to the file instead (sendfile/mmap), so the
+         * caller must not inspect the contents of evb. Only use on verified
+         * (i.e. immutable) content. */
+        ssize_t     Read(struct evbuffer *evb, size_t nbyte, int64_t offset, bool filerefok);
+
+        /** UNIX pwrite approximation. Does change file pointer. Is not thread-safe.
+         * WRITEBUF: Once the content is known to be a single file or a complete
+         * multi-file spec, the data may stay in memory until Flush(). Read()
+         * returns it meanwhile. */
         ssize_t     Write(const void *buf, size_t nbyte, int64_t offset);
 
+        /** WRITEBUF: Write all buffered data to disk */
+        int         Flush();
+
+        /** WRITEBUF: Flush if data has been buffered for SWIFT_STORAGE_WRITE_FLUSH_TIME */
+        int         FlushIfDue();
+
+        /** WRITEBUF: Number of bytes written but not yet on disk */
+        uint64_t    GetBufferedBytes() {
+            return wbuf_bytes_;
+        }
+
+        /** WRITEBUF: Write whole aligned blocks of single files with O_DIRECT,
+         * bypassing the page cache, for bulk ingest. Applies to files opened
+         * after the call. */
+        static void SetDirectIO(bool enable) {
+            direct_io_ = enable;
+        }
+
+        /** WRITEBUF: Number of write calls to disk and bytes they wrote, by all Storages */
+        static uint64_t global_disk_writes, global_disk_write_bytes;
+        /** WRITEBUF: Number of bytes buffered by all Storages */
+        static uint64_t GetGlobalBufferedBytes() {
+            return global_buffered_bytes_;
+        }
+
         /** Link to HashTree */
         void        SetHashTree(HashTree *ht) {
             ht_ = ht;
@@ -1444,19 +2098,61 @@ namespace swift
         int         single_fd_;
         int64_t     reserved_size_;
         int64_t     total_size_from_spec_;
-        StorageFile *last_sf_;
+        /** Index in sfs_ of the file last read or written */
+        int         last_sfi_;
+
+        // FILEPOOL
+        /** Part of a read or write that falls in one StorageFile */
+        typedef struct {
+            StorageFile *sf;
+            int64_t     offset; // in sf
+            size_t      bufoff;
+            size_t      nbyte;
+        } file_io_t;
+        typedef std::vector<file_io_t>  file_iolist_t;
+        /** Reused by MapFileIO */
+        file_iolist_t iol_;
 
         int         td_; // transfer ID of the *Transfer we're part of.
         ProgressCallback alloc_cb_;
         uint64_t    live_disc_wnd_bytes_;
+        /** RAM ring holding the live discard window, NULL if on disk */
+        char        *live_ram_;
 
         std::string meta_mfspec_os_pathname_; // metadata might be located in a different dir
 
+        // WRITEBUF
+        /** Buffered data by start offset. Extents neither overlap nor touch. */
+        typedef std::map<int64_t,std::string>   write_buffer_t;
+        write_buffer_t wbuf_;
+        uint64_t    wbuf_bytes_;
+        /** Time the oldest data in wbuf_ was buffered */
+        tint        wbuf_time_;
+        /** O_DIRECT descriptor for the single file, -1 if not used */
+        int         direct_fd_;
+        /** Aligned buffer for writes through direct_fd_ */
+        char        *direct_buf_;
+
+        static bool direct_io_;
+        static uint64_t global_buffered_bytes_;
+
+        ssize_t     WriteNow(const void *buf, size_t nbyte, int64_t offset);
+        ssize_t     ReadNow(void *buf, size_t nbyte, int64_t offset);
+        ssize_t     WriteBuffered(const void *buf, size_t nbyte, int64_t offset);
+        int         WriteBlocks(write_buffer_t::iterator iter);
+        int         WriteExtent(const char *buf, size_t nbyte, int64_t offset);
+        void        ReadBuffered(char *buf, size_t nbyte, int64_t offset, ssize_t &ret);
+        bool        IsBuffered(size_t nbyte, int64_t offset);
+        void        OpenDirect();
+
         int         WriteSpecPart(StorageFile *sf, const void *buf, size_t nbyte, int64_t offset);
         std::pair<int64_t,int64_t> WriteBuffer(StorageFile *sf, const void *buf, size_t nbyte, int64_t offset);
-        StorageFile * FindStorageFile(int64_t offset);
+        int         FindStorageFile(int64_t offset);
+        int         MapFileIO(size_t nbyte, int64_t offset);
         int         ParseSpec(StorageFile *sf);
         int         OpenSingleFile();
+        ssize_t     WriteLiveWrap(const void *buf, size_t nbyte, int64_t offset);
+        ssize_t     ReadLiveWrap(void *buf, size_t nbyte, int64_t offset);
 
     };
 
@@ -1496,6 +2192,99 @@ namespace swift
     };
 
 
+    /*
+     * DEDUP: Per-process index from Merkle leaf hash to a local copy of that
+     * chunk, over the file swarms open in this process. Once a leecher knows
+     * the hash of a chunk it does not have, it takes the chunk from another
+     * local swarm with the same chunk size and hash function instead of
+     * the network.
+     *
+     * Optionally the swarms are listed in an on-disk store. Their chunks
+     * then stay indexed after they are closed and across restarts, with the
+     * index rebuilt from their .mhash and .mbinmap files.
+     */
+    class ChunkIndex
+    {
+    public:
+        ChunkIndex();
+        ~ChunkIndex();
+        static ChunkIndex *GetInstance();
+
+        /** Turn indexing of the file swarms opened from now on on/off. Costs
+         * memory per chunk, so off by default. */
+        void SetEnabled(bool enable) {
+            enabled_ = enable;
+        }
+        bool IsEnabled() {
+            return enabled_;
+        }
+        /** Enable, use the file as on-disk store and index the swarms listed
+         * in it. Returns -1 if it cannot be opened. */
+        int SetStore(std::string filename);
+
+        /** Index the verified chunks of ft, and add it to the store if any.
+         * The filenames are those ft was opened with. */
+        void AddTransfer(FileTransfer *ft, std::string filename, std::string destdir, std::string hash_filename,
+                         std::string binmap_filename, std::string mfspec_filename);
+        /** Called when ft is closed. Its chunks remain indexed if it is in
+         * the store. */
+        void RemoveTransfer(FileTransfer *ft);
+        /** Index chunk pos of ft, which was just verified */
+        void AddChunk(FileTransfer *ft, bin_t pos);
+
+        /** Read the chunk with the given leaf hash into buf of chunk_size
+         * bytes, from a local swarm other than notft. Returns the length
+         * of the chunk, or -1 if no local swarm has it. */
+        ssize_t Read(const Sha1Hash &leafhash, uint32_t chunk_size, char *buf, FileTransfer *notft);
+
+        /** Number of chunks indexed, and of chunks read for another swarm */
+        uint64_t GetChunkCount() {
+            return index_.size();
+        }
+        uint64_t GetHitCount() {
+            return hits_;
+        }
+
+    protected:
+        static ChunkIndex *__singleton;
+
+        /** A swarm whose chunks are indexed. ft is NULL when closed, storage
+         * is then opened on the first Read() and kept until it reopens. It is
+         * only read from, and only opened when the content is on disk. */
+        struct chunk_source_t {
+            FileTransfer        *ft;
+            Storage             *storage;
+            std::string         filename;
+            std::string         destdir;
+            std::string         hash_filename;
+            std::string         binmap_filename;
+            std::string         mfspec_filename;
+            Sha1Hash            root_hash;
+            uint32_t            chunk_size;
+            popt_merkle_func_t  func;
+            bool                stored;
+        };
+        typedef std::vector<chunk_source_t *> chunk_sources_t;
+        /** First 8 bytes of the leaf hash to (source, chunk). Read() checks
+         * the full hash. */
+        typedef std::multimap<uint64_t,std::pair<uint32_t,uint64_t> > chunk_index_t;
+
+        chunk_sources_t sources_;
+        chunk_index_t   index_;
+        bool            enabled_;
+        std::string     store_filename_;
+        uint64_t        hits_;
+
+        int         FindSource(std::string hash_filename);
+        int         FindSource(FileTransfer *ft);
+        void        AddSourceChunks(uint32_t src, HashTree *ht);
+        void        AddSourceChunk(uint32_t src, uint64_t chunk, const Sha1Hash &leafhash);
+        bool        HasContent(chunk_source_t *cs);
+        int         LoadStoredSource(uint32_t src);
+        int         WriteStoredSource(chunk_source_t *cs);
+    };
+
+
     /*************** The top-level API ****************/
     // See api.cpp for the implementation.
     /** Must be called by any client using the library */
@@ -1520,12 +2309,15 @@ namespace swift
         them on receipt. In this mode, checking disk contents against hashes
         no longer works on restarts, unless checkpoints are used.
         The .mhash and .mbinmap files might be located along with the file, or in
-        a separate directory specified by the metadir parameter.
+        a separate directory specified by the metadir parameter. merkle_func
+        selects the hash function of the Merkle tree; a checkpointed tree keeps
+        the one it was built with.
         */
     // TODO: replace check_netwvshash with full set of protocol options
     int     Open(std::string filename, SwarmID& swarmid, std::string trackerurl="", bool force_check_diskvshash=true,
                  popt_cont_int_prot_t cipm=POPT_CONT_INT_PROT_MERKLE, bool zerostate=false, bool activate=true,
-                 uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE, std::string metadir="");
+                 uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE, std::string metadir="",
+                 popt_merkle_func_t merkle_func=POPT_MERKLE_HASH_FUNC_SHA1);
     /** Get the root hash for the transmission. */
     SwarmID GetSwarmID(int file);
     /** Close a file and a transmission, remove state or content if desired. */
@@ -1537,12 +2329,21 @@ namespace swift
 
     /** UNIX pread approximation. Does change file pointer. Thread-safe if no concurrent writes. Autoactivates */
     ssize_t Read(int td, void *buf, size_t nbyte, int64_t offset);  // off_t not 64-bit dynamically on Win32
+    /** Read content into evb without intermediate buffer, see Storage::Read() */
+    ssize_t Read(int td, struct evbuffer *evb, size_t nbyte, int64_t offset, bool filerefok=false);
 
     /** UNIX pwrite approximation. Does change file pointer. Is not thread-safe. Autoactivates. */
     ssize_t Write(int td, const void *buf, size_t nbyte, int64_t offset);
 
-    /** Seek, i.e., move start of interest window */
+    /** Seek, i.e., move start of interest window. SEEK_CUR reports the
+     * absolute offset a streaming reader has consumed up to. */
     int     Seek(int td, int64_t offset, int whence);
+    /** DEADLINE: Set the playback rate of the content in bytes/s, used to
+     * compute when chunks are needed. */
+    void    SetBitrate(int td, double bytespersec);
+    /** PREFETCH: Set the byte ranges (first,last) expected to be read
+     * next, most likely first. Replaces ranges set before. */
+    void    SetPrefetch(int td, std::vector<std::pair<uint64_t,uint64_t> > &ranges);
     /** Set the default tracker that is used when Open is not passed a tracker
         address. */
     void    SetTracker(std::string trackerurl);
@@ -1559,6 +2360,12 @@ namespace swift
     uint64_t SeqComplete(int td, int64_t offset=0);
     /** Returns the bin at which we hooked into the live stream. */
     uint64_t GetHookinOffset(int td);
+    /** LIVE: Push new chunks to up to nchildren peers without waiting for
+        their REQUEST. 0 means pull only. */
+    void    SetLivePushChildren(int td, uint32_t nchildren);
+    /** LIVE: Ratio of FEC repair chunks to data chunks the source sends, or
+        SWIFT_LIVE_FEC_ADAPTIVE. On clients non-zero accepts repairs. */
+    void    SetLiveFECRatio(int td, double ratio);
 
     /** Arno: See if swarm is known and activate if requested */
     int     Find(SwarmID& swarmid, bool activate=false);
@@ -1621,17 +2428,21 @@ namespace swift
     int evbuffer_add_32be(struct evbuffer *evb, uint32_t i);
     int evbuffer_add_64be(struct evbuffer *evb, uint64_t l);
     int evbuffer_add_hash(struct evbuffer *evb, const Sha1Hash& hash);
-    int evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr); // PPSP
+    int evbuffer_add_chunkaddr(struct evbuffer *evb, bin_t &b, popt_chunk_addr_t chunk_addr, uint32_t chunk_size); // PPSP
+    int evbuffer_add_chunkrange(struct evbuffer *evb, uint64_t schunk, uint64_t echunk, popt_chunk_addr_t chunk_addr,
+                                uint32_t chunk_size); // ACKAGG
     int evbuffer_add_pexaddr(struct evbuffer *evb, Address& a);
 
     uint8_t evbuffer_remove_8(struct evbuffer *evb);
     uint16_t evbuffer_remove_16be(struct evbuffer *evb);
     uint32_t evbuffer_remove_32be(struct evbuffer *evb);
     uint64_t evbuffer_remove_64be(struct evbuffer *evb);
-    Sha1Hash evbuffer_remove_hash(struct evbuffer* evb);
-    binvector evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr_t chunk_addr); // PPSP
+    Sha1Hash evbuffer_remove_hash(struct evbuffer* evb, popt_merkle_func_t func=POPT_MERKLE_HASH_FUNC_SHA1);
+    binvector evbuffer_remove_chunkaddr(struct evbuffer *evb, popt_chunk_addr_t chunk_addr, uint32_t chunk_size); // PPSP
     Address evbuffer_remove_pexaddr(struct evbuffer *evb, int family);
     void chunk32_to_bin32(uint32_t schunk, uint32_t echunk, binvector *bvptr);
+    void chunk64_to_bin64(uint64_t schunk, uint64_t echunk, binvector *bvptr);
+    int chunk64_to_binarray(uint64_t schunk, uint64_t echunk, binarray_t *ba); // DECODE
     binvector bin_fragment(bin_t &origbin, bin_t &cancelbin);
 
     const char* tintstr(tint t=0);
@@ -1655,5 +2466,7 @@ namespace swift
 #define dflush() do {} while(0)
 #endif
 #define eprintf(...) fprintf(stderr,__VA_ARGS__)
+// TELEMETRY: record trace event in current Channel's ring, if enabled
+#define tevent(type,a,b) do { if (trace_ != NULL) trace_->Add(NOW,type,a,b); } while (0)
 
 #endif
@@ -0,0 +1,24 @@
+/*
+ *  telemetry.cpp
+ *  Per-channel ring buffer of binary trace events
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+using namespace swift;
+
+
+void TraceRing::Dump(struct evbuffer *evb, uint32_t chid) const
+{
+    uint64_t start = head_ - size();
+    for (uint64_t i=start; i<head_; i++) {
+        const trace_event_t &e = events_[i & (TRACE_RING_SIZE-1)];
+        evbuffer_add_64be(evb,e.time);
+        evbuffer_add_32be(evb,chid);
+        evbuffer_add_8(evb,e.type);
+        evbuffer_add_32be(evb,e.a);
+        evbuffer_add_64be(evb,e.b);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ *  telemetry.h
+ *  Per-channel ring buffer of binary trace events (send, recv, ack, loss,
+ *  cwnd, owd). Recording is a few stores, so it can stay enabled under
+ *  full load, unlike dprintf/lprintf. Rings are dumped via the cmdgw
+ *  DUMPTRACE command and turned into CSV or Chrome trace JSON by the
+ *  tracedecode tool.
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "compat.h"
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+namespace swift
+{
+
+/** Number of events kept per channel, must be a power of 2 */
+#define TRACE_RING_SIZE     1024
+
+/** Dump format: magic, version, then TRACE_RECORD_SIZE records, big endian */
+#define TRACE_DUMP_MAGIC    "SWTR"
+#define TRACE_DUMP_VERSION  1
+#define TRACE_RECORD_SIZE   (8+4+1+4+8)   // time, channel, type, a, b
+
+    typedef enum {
+        TRACE_SEND = 1,     // a: datagram bytes, b: DATA bin or bin_t::NONE
+        TRACE_RECV,         // a: datagram bytes
+        TRACE_ACK,          // a: RTT sample in usec, b: acked bin
+        TRACE_LOSS,         // b: timed out bin
+        TRACE_CWND,         // a: send control mode, b: cwnd * 1000
+        TRACE_OWD           // b: one-way delay in usec
+    } trace_event_type_t;
+
+    struct trace_event_t {
+        tint        time;
+        uint64_t    b;
+        uint32_t    a;
+        uint8_t     type;
+    };
+
+    /** Single-writer ring: all Adds happen on the libevent thread, as do
+     * dumps, so no locking is needed. Oldest events are overwritten. */
+    class TraceRing
+    {
+    public:
+        TraceRing() : head_(0) {}
+        void Add(tint time, uint8_t type, uint32_t a, uint64_t b) {
+            trace_event_t &e = events_[head_ & (TRACE_RING_SIZE-1)];
+            e.time = time;
+            e.type = type;
+            e.a = a;
+            e.b = b;
+            head_++;
+        }
+        /** Number of events currently stored */
+        uint32_t size() const {
+            return head_ < TRACE_RING_SIZE ? (uint32_t)head_ : TRACE_RING_SIZE;
+        }
+        /** Append stored events oldest first as records to evb. */
+        void Dump(struct evbuffer *evb, uint32_t chid) const;
+    protected:
+        trace_event_t events_[TRACE_RING_SIZE];
+        uint64_t head_;
+    };
+
+}
+
+#endif
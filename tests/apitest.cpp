@@ -143,6 +143,27 @@ TEST(SimpleAPITest,ChunkSizeSuccess8192)
     swift::Close(td,true,true);
 }
 
+TEST(SimpleAPITest,ChunkSizeSuccessMax)
+{
+    ASSERT_EQ(CreateTestFile(1024),1024);
+
+    SwarmID swarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,swarmid,"",false,POPT_CONT_INT_PROT_NONE,false,true,SWIFT_MAX_CHUNK_SIZE);
+    uint32_t cs = swift::ChunkSize(td);
+    ASSERT_EQ(cs,SWIFT_MAX_CHUNK_SIZE);
+
+    swift::Close(td,true,true);
+}
+
+TEST(SimpleAPITest,ChunkSizeFailTooBig)
+{
+    ASSERT_EQ(CreateTestFile(1024),1024);
+
+    SwarmID swarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,swarmid,"",false,POPT_CONT_INT_PROT_NONE,false,true,2*SWIFT_MAX_CHUNK_SIZE);
+    ASSERT_EQ(td,-1);
+}
+
 TEST(SimpleAPITest,ChunkSizeFailUnknownTD)
 {
     uint32_t cs = swift::ChunkSize(567);
@@ -230,6 +251,22 @@ TEST(SimpleAPITest,SeekSuccess)
 }
 
 
+TEST(SimpleAPITest,SeekCurBounds)
+{
+    ASSERT_EQ(CreateTestFile(4100),4100);
+
+    // SEEK_CUR takes the absolute offset a streaming reader is at
+    SwarmID swarmid = SwarmID::NOSWARMID;
+    int td = swift::Open(TESTFILE,swarmid);
+    ASSERT_EQ(0,swift::Seek(td,4099,SEEK_CUR));
+    ASSERT_EQ(-1,swift::Seek(td,4100,SEEK_CUR));
+    ASSERT_EQ(-1,swift::Seek(td,-1,SEEK_CUR));
+    ASSERT_EQ(-1,swift::Seek(td,0,SEEK_END));
+
+    swift::Close(td,true,true);
+}
+
+
 TEST(SimpleAPITest,SeekFailUnknownTD)
 {
     int ret = swift::Seek(567,1032,SEEK_SET);
@@ -133,9 +133,305 @@ TEST(ChunkAddrTest,Bin32)
 }
 
 
+/*
+ * CHUNK64
+ */
+
+/** Encodes b with chunk_addr and decodes it again, checking the size. */
+binvector roundtrip(bin_t b, popt_chunk_addr_t chunk_addr, size_t expsize)
+{
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add_chunkaddr(evb,b,chunk_addr,1024);
+    EXPECT_EQ(expsize,evbuffer_get_length(evb));
+    binvector bv = evbuffer_remove_chunkaddr(evb,chunk_addr,1024);
+    EXPECT_EQ(0,evbuffer_get_length(evb));
+    evbuffer_free(evb);
+    return bv;
+}
+
+
+TEST(ChunkAddrTest,RoundTrip32)
+{
+    // No extra cost for small swarms
+    bin_t b(3,5);
+    binvector bv = roundtrip(b,POPT_CHUNK_ADDR_BIN32,4);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(b,bv[0]);
+    bv = roundtrip(b,POPT_CHUNK_ADDR_CHUNK32,8);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(b,bv[0]);
+}
+
+
+TEST(ChunkAddrTest,RoundTrip64)
+{
+    // Past 2^32 chunks
+    bin_t b(3,(1ULL<<33)+5);
+    ASSERT_GT(b.base_offset(),0xffffffffULL);
+
+    binvector bv = roundtrip(b,POPT_CHUNK_ADDR_BIN64,8);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(b,bv[0]);
+    bv = roundtrip(b,POPT_CHUNK_ADDR_CHUNK64,16);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(b,bv[0]);
+    bv = roundtrip(b,POPT_CHUNK_ADDR_BYTE64,16);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(b,bv[0]);
+
+    bv = roundtrip(bin_t::ALL,POPT_CHUNK_ADDR_BIN64,8);
+    ASSERT_EQ(1,bv.size());
+    EXPECT_EQ(bin_t::ALL,bv[0]);
+}
+
+
+TEST(ChunkAddrTest,Chunk64AcrossLimit)
+{
+    // Range crossing chunk 2^32 is covered exactly
+    uint64_t s = 0xffffffffULL-2;
+    uint64_t e = 0xffffffffULL+6;
+    binvector bv;
+    swift::chunk64_to_bin64(s,e,&bv);
+
+    uint64_t next = s;
+    binvector::iterator iter;
+    for (iter=bv.begin(); iter != bv.end(); iter++) {
+        EXPECT_EQ(next,iter->base_offset());
+        next = iter->base_offset()+iter->base_length();
+    }
+    EXPECT_EQ(e+1,next);
+
+    // Same as 32-bit conversion shifted by a multiple of a large power of 2
+    binvector bv32;
+    swift::chunk32_to_bin32(s-0x80000000ULL,e-0x80000000ULL,&bv32);
+    ASSERT_EQ(bv32.size(),bv.size());
+    for (int i=0; i<bv.size(); i++) {
+        EXPECT_EQ(bv32[i].layer(),bv[i].layer());
+        EXPECT_EQ(bv32[i].base_offset()+0x80000000ULL,bv[i].base_offset());
+    }
+}
+
+
+TEST(ChunkAddrTest,Byte64LastChunkShort)
+{
+    // Byte range ending halfway the last chunk
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add_64be(evb,5*1024);
+    evbuffer_add_64be(evb,7*1024+100);
+    binvector bv = evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_BYTE64,1024);
+    ASSERT_EQ(2,bv.size());
+    EXPECT_EQ(bin_t(0,5),bv[0]);
+    EXPECT_EQ(bin_t(1,3),bv[1]);
+    evbuffer_free(evb);
+}
+
+
+TEST(ChunkAddrTest,BadInput64)
+{
+    struct evbuffer *evb = evbuffer_new();
+    // start after end
+    evbuffer_add_64be(evb,10);
+    evbuffer_add_64be(evb,9);
+    EXPECT_EQ(0,evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_CHUNK64,1024).size());
+    // beyond bin tree
+    evbuffer_add_64be(evb,0);
+    evbuffer_add_64be(evb,0xffffffffffffffffULL);
+    EXPECT_EQ(0,evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_CHUNK64,1024).size());
+    // not chunk aligned
+    evbuffer_add_64be(evb,1000);
+    evbuffer_add_64be(evb,2047);
+    EXPECT_EQ(0,evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_BYTE64,1024).size());
+    // bin beyond bin tree
+    evbuffer_add_64be(evb,0x8000000000000000ULL);
+    EXPECT_EQ(0,evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_BIN64,1024).size());
+    evbuffer_add_64be(evb,bin_t(0,SWIFT_CHUNK64_MAX_CHUNK).toUInt());
+    EXPECT_EQ(1,evbuffer_remove_chunkaddr(evb,POPT_CHUNK_ADDR_BIN64,1024).size());
+    evbuffer_free(evb);
+
+    uint8_t buf[8] = { 0xc0,0,0,0, 0,0,0,1 };
+    DgramCursor dc(buf,8);
+    binarray_t ba;
+    EXPECT_EQ(0,dc.getchunkaddr(POPT_CHUNK_ADDR_BIN64,1024,&ba));
+    EXPECT_TRUE(dc.ok());
+}
+
+
+TEST(ChunkAddrTest,HandshakeSupported)
+{
+    Handshake hs;
+    hs.cont_int_prot_ = POPT_CONT_INT_PROT_MERKLE;
+    for (int ca=POPT_CHUNK_ADDR_BIN32; ca<=POPT_CHUNK_ADDR_CHUNK64; ca++) {
+        hs.chunk_addr_ = (popt_chunk_addr_t)ca;
+        EXPECT_TRUE(hs.IsSupported());
+    }
+    hs.chunk_addr_ = (popt_chunk_addr_t)(POPT_CHUNK_ADDR_CHUNK64+1);
+    EXPECT_FALSE(hs.IsSupported());
+
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_CHUNK32;
+    EXPECT_TRUE(hs.Is32BitChunkAddr());
+    hs.chunk_addr_ = POPT_CHUNK_ADDR_CHUNK64;
+    EXPECT_FALSE(hs.Is32BitChunkAddr());
+}
+
+
+TEST(ChunkAddrTest,ChunkRange)
+{
+    // ACKAGG: unaligned ranges encode as one chunk spec
+    popt_chunk_addr_t methods[] = { POPT_CHUNK_ADDR_CHUNK32, POPT_CHUNK_ADDR_CHUNK64, POPT_CHUNK_ADDR_BYTE64 };
+    for (int m=0; m<3; m++) {
+        struct evbuffer *evb = evbuffer_new();
+        ASSERT_EQ(0,evbuffer_add_chunkrange(evb,5,25,methods[m],1024));
+        binvector bv = evbuffer_remove_chunkaddr(evb,methods[m],1024);
+        binvector expbv;
+        chunk64_to_bin64(5,25,&expbv);
+        EXPECT_EQ(expbv,bv);
+        EXPECT_EQ(0,evbuffer_get_length(evb));
+        evbuffer_free(evb);
+    }
+
+    struct evbuffer *evb = evbuffer_new();
+    EXPECT_EQ(-1,evbuffer_add_chunkrange(evb,5,25,POPT_CHUNK_ADDR_BIN32,1024));
+    EXPECT_EQ(-1,evbuffer_add_chunkrange(evb,5,25,POPT_CHUNK_ADDR_BIN64,1024));
+    EXPECT_EQ(0,evbuffer_get_length(evb));
+    evbuffer_free(evb);
+}
+
+TEST(ChunkAddrTest,CursorMatchesEvbuffer)
+{
+    popt_chunk_addr_t methods[] = { POPT_CHUNK_ADDR_BIN32, POPT_CHUNK_ADDR_CHUNK32, POPT_CHUNK_ADDR_BIN64,
+                                    POPT_CHUNK_ADDR_CHUNK64, POPT_CHUNK_ADDR_BYTE64
+                                  };
+    bin_t b(4,7);
+    for (int m=0; m<5; m++) {
+        struct evbuffer *evb = evbuffer_new();
+        evbuffer_add_chunkaddr(evb,b,methods[m],1024);
+        evbuffer_add_8(evb,0xAB);
+        size_t len = evbuffer_get_length(evb);
+
+        DgramCursor dc(evbuffer_pullup(evb,len),len);
+        binarray_t ba;
+        ASSERT_EQ(1,dc.getchunkaddr(methods[m],1024,&ba));
+        EXPECT_EQ(b,ba.bins[0]);
+        EXPECT_EQ(0xAB,dc.get8());
+        EXPECT_EQ(len,dc.consumed());
+        EXPECT_TRUE(dc.ok());
+        evbuffer_free(evb);
+    }
+}
+
+
+TEST(ChunkAddrTest,CursorWorstCaseRange)
+{
+    // Widest decomposition: one bin per layer on each side
+    uint64_t s = 1;
+    uint64_t e = SWIFT_CHUNK64_MAX_CHUNK-1;
+    binvector bv;
+    chunk64_to_bin64(s,e,&bv);
+    binarray_t ba;
+    ASSERT_EQ(bv.size(),chunk64_to_binarray(s,e,&ba));
+    ASSERT_LE(bv.size(),SWIFT_BINARRAY_MAX_BINS);
+    for (int i=0; i<ba.size; i++)
+        EXPECT_EQ(bv[i],ba.bins[i]);
+}
+
+
+TEST(ChunkAddrTest,CursorTruncated)
+{
+    uint8_t buf[12] = { 0,0,0,1, 0,0,0,9, 0,0,0,0 };
+    binarray_t ba;
+
+    DgramCursor dc(buf,6);
+    EXPECT_EQ(0,dc.getchunkaddr(POPT_CHUNK_ADDR_CHUNK32,1024,&ba));
+    EXPECT_FALSE(dc.ok());
+    EXPECT_EQ(0,dc.remaining());
+
+    DgramCursor dc2(buf,8);
+    EXPECT_EQ(4,dc2.getchunkaddr(POPT_CHUNK_ADDR_CHUNK32,1024,&ba)); // 1, 2-3, 4-7, 8-9
+    EXPECT_EQ(0,dc2.get64be());
+    EXPECT_FALSE(dc2.ok());
+}
+
+
+
+/** CHUNK64: Chunk addressing chosen by channels of a live client that
+ * hooked in past 2^32 chunks */
+TEST(ChunkAddrTest,ChannelPast32Bits)
+{
+    const char *srcfile = "chunkaddr-source.dat";
+    const char *clientfile = "chunkaddr-client.dat";
+    LiveTransfer *src = new LiveTransfer(srcfile,*KeyPair::Generate(DEFAULT_LIVE_SIG_ALG),"",
+                                         POPT_CONT_INT_PROT_UNIFIED_MERKLE,POPT_LIVE_DISC_WND_ALL,4,1024);
+    SwarmID swarmid = src->swarm_id();
+    Address srcaddr;
+    LiveTransfer *client = new LiveTransfer(clientfile,swarmid,srcaddr,POPT_CONT_INT_PROT_UNIFIED_MERKLE,
+                                            POPT_LIVE_DISC_WND_ALL,1024);
+    Address addr("127.0.0.1:1");
+
+    // Before hook-in, 32 bits do
+    Channel *oldch = new Channel(client,INVALID_SOCKET,addr);
+    EXPECT_FALSE(oldch->NearChunkAddrLimit());
+    struct evbuffer *evb = evbuffer_new();
+    oldch->AddHandshake(evb);
+    Handshake *hs = Channel::StaticOnHandshake(addr,0,false,VER_PPSPP_v1,evb);
+    ASSERT_TRUE(hs != NULL);
+    EXPECT_TRUE(hs->Is32BitChunkAddr());
+    delete hs;
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+
+    uint64_t c = (1ULL<<32)+4;
+    ((LivePiecePicker *)client->picker())->AddPeerMunro(bin_t(2,c/4),NOW,oldch->id());
+    ASSERT_EQ(c,client->GetLastChunkID());
+    EXPECT_TRUE(oldch->NearChunkAddrLimit());
+
+    // A new channel starts out wide, and so will later ones
+    Channel *ch = new Channel(client,INVALID_SOCKET,addr);
+    ch->AddHandshake(evb);
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK64,client->GetDefaultHandshake().chunk_addr_);
+    EXPECT_FALSE(ch->NearChunkAddrLimit());
+
+    // The peer answers wide too
+    Channel *srcch = new Channel(src,INVALID_SOCKET,addr);
+    srcch->OnHandshake(Channel::StaticOnHandshake(addr,0,false,VER_PPSPP_v1,evb));
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    srcch->AddHandshake(evb);
+    hs = Channel::StaticOnHandshake(addr,ch->id(),false,VER_PPSPP_v1,evb);
+    ASSERT_TRUE(hs != NULL);
+    EXPECT_EQ(POPT_CHUNK_ADDR_CHUNK64,hs->chunk_addr_);
+    delete hs;
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+
+    // and decodes what the client has
+    client->ack_out()->set(bin_t(0,c));
+    ch->AddHave(evb);
+    size_t len = evbuffer_get_length(evb);
+    DgramCursor dc(evbuffer_pullup(evb,len),len);
+    while (dc.remaining() > 0) {
+        ASSERT_EQ(SWIFT_HAVE,dc.get8());
+        srcch->OnHave(dc);
+    }
+    EXPECT_TRUE(dc.ok());
+    EXPECT_TRUE(srcch->ack_in().is_filled(bin_t(0,c)));
+    evbuffer_free(evb);
+
+    // The narrow channel is replaced on the next clean callback
+    size_t nchannels = client->GetChannels()->size();
+    client->ReopenChannel(INVALID_SOCKET,addr);
+    EXPECT_EQ(nchannels,client->GetChannels()->size());
+    client->ReopenChannels();
+    EXPECT_EQ(nchannels+1,client->GetChannels()->size());
+
+    delete client;
+    delete src;
+    unlink(srcfile);
+    unlink(clientfile);
+}
+
 
 int main(int argc, char** argv)
 {
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
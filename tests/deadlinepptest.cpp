@@ -0,0 +1,181 @@
+/*
+ *  deadlinepptest.cpp
+ *
+ *  Tests for the VoD piece picker that requests chunks by playback
+ *  deadline (DEADLINE).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define DL_NCHUNKS      64
+#define DL_CHUNK_SIZE   1024
+
+const char *DLSEED = "deadline_seed.dat";
+const char *DLLEECH = "deadline_leech.dat";
+
+
+static void remove_swarm(std::string filename)
+{
+    unlink(filename.c_str());
+    unlink((filename+".mhash").c_str());
+    unlink((filename+".mbinmap").c_str());
+}
+
+
+/** Leecher that knows the size of the content, and a channel to pick for */
+class DeadlinePickerTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        remove_swarm(DLSEED);
+        remove_swarm(DLLEECH);
+        FILE *fp = fopen(DLSEED,"wb");
+        char buf[DL_CHUNK_SIZE];
+        for (int i=0; i<DL_NCHUNKS; i++) {
+            memset(buf,'a'+i%26,DL_CHUNK_SIZE);
+            fwrite(buf,1,DL_CHUNK_SIZE,fp);
+        }
+        fclose(fp);
+
+        seed_ = new FileTransfer(581,DLSEED);
+        leech_ = new FileTransfer(582,DLLEECH,seed_->hashtree()->root_hash());
+        for (int i=0; i<seed_->hashtree()->peak_count(); i++)
+            leech_->hashtree()->OfferHash(seed_->hashtree()->peak(i),seed_->hashtree()->peak_hash(i));
+        ASSERT_EQ(DL_NCHUNKS,leech_->hashtree()->size_in_chunks());
+
+        channel_ = new Channel(leech_,INVALID_SOCKET,Address("127.0.0.1:1"));
+        offer_.set(bin_t(6,0));
+        // One chunk per second, so the deadline window is 10 chunks
+        picker()->SetBitrate(DL_CHUNK_SIZE);
+    }
+
+    virtual void TearDown()
+    {
+        delete channel_;
+        delete leech_;
+        delete seed_;
+        remove_swarm(DLSEED);
+        remove_swarm(DLLEECH);
+    }
+
+    PiecePicker *picker()
+    {
+        return leech_->picker();
+    }
+
+    bin_t Pick(uint32_t channelid)
+    {
+        return picker()->Pick(offer_,1,NOW+TINT_SEC,channelid);
+    }
+
+    bin_t Pick()
+    {
+        return Pick(channel_->id());
+    }
+
+    FileTransfer *seed_;
+    FileTransfer *leech_;
+    Channel *channel_;
+    binmap_t offer_;
+};
+
+
+TEST_F(DeadlinePickerTest,DeadlineOrder)
+{
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,5),SEEK_SET));
+    for (uint64_t c=5; c<=5+SWIFT_VOD_DEADLINE_WINDOW_TIME; c++)
+        ASSERT_EQ(bin_t(0,c),Pick());
+}
+
+
+TEST_F(DeadlinePickerTest,OnlyOffered)
+{
+    // Chunks the peer doesn't have are left to others
+    offer_.clear();
+    offer_.set(bin_t(0,7));
+    offer_.set(bin_t(1,5));
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,5),SEEK_SET));
+    EXPECT_EQ(bin_t(0,7),Pick());
+    EXPECT_EQ(bin_t(0,10),Pick());
+    EXPECT_EQ(bin_t(0,11),Pick());
+}
+
+
+TEST_F(DeadlinePickerTest,Seek)
+{
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,0),SEEK_SET));
+    EXPECT_EQ(bin_t(0,0),Pick());
+    EXPECT_EQ(bin_t(0,1),Pick());
+
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,40),SEEK_SET));
+    EXPECT_EQ(bin_t(0,40),Pick());
+    EXPECT_EQ(bin_t(0,41),Pick());
+
+    // Back to what was skipped, requested chunks are not asked again
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,0),SEEK_CUR));
+    EXPECT_EQ(bin_t(0,2),Pick());
+
+    EXPECT_EQ(-1,picker()->Seek(bin_t(0,0),SEEK_END));
+}
+
+
+TEST_F(DeadlinePickerTest,WindowClampedAtEnd)
+{
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,DL_NCHUNKS-2),SEEK_SET));
+    EXPECT_EQ(bin_t(0,DL_NCHUNKS-2),Pick());
+    EXPECT_EQ(bin_t(0,DL_NCHUNKS-1),Pick());
+    bin_t hint = Pick();
+    if (!hint.is_none()) {
+        EXPECT_LT(hint.base_offset(),DL_NCHUNKS-2);
+    }
+}
+
+
+TEST_F(DeadlinePickerTest,FallbackToPrefetch)
+{
+    binvector prefetch;
+    prefetch.push_back(bin_t(2,12));
+    picker()->SetPrefetch(prefetch);
+
+    // No playback position yet
+    EXPECT_EQ(bin_t(0,48),Pick());
+
+    // Deadline window first, prefetch when it is all requested
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,0),SEEK_SET));
+    for (uint64_t c=0; c<=SWIFT_VOD_DEADLINE_WINDOW_TIME; c++)
+        ASSERT_EQ(bin_t(0,c),Pick());
+    EXPECT_EQ(bin_t(0,49),Pick());
+
+    // Without a channel there is no arrival estimate
+    ASSERT_EQ(0,picker()->Seek(bin_t(0,20),SEEK_SET));
+    EXPECT_EQ(bin_t(0,50),Pick(channel_->id()+1000));
+    EXPECT_EQ(bin_t(0,20),Pick());
+}
+
+
+TEST_F(DeadlinePickerTest,FallbackToRarestFirst)
+{
+    // Not playing, nothing to prefetch
+    bin_t hint = Pick();
+    ASSERT_FALSE(hint.is_none());
+    EXPECT_TRUE(offer_.is_filled(hint));
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,186 @@
+/*
+ *  deduptest.cpp
+ *
+ *  Tests for the chunk index that lets swarms with identical chunks take
+ *  them from each other instead of the network (DEDUP).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "compat.h"
+#include <gtest/gtest.h>
+
+using namespace swift;
+
+
+#define DEDUP_NCHUNKS   8
+
+const char *DTA = "dedup_a.dat";
+const char *DTB = "dedup_b.dat";
+const char *DTCOPY = "dedup_copy.dat";
+const char *DTSTORE = "dedup.store";
+
+
+static void remove_swarm(std::string filename)
+{
+    unlink(filename.c_str());
+    unlink((filename+".mhash").c_str());
+    unlink((filename+".mbinmap").c_str());
+}
+
+
+/** Chunk i of A, shared by B from chunk DEDUP_NCHUNKS/2 on */
+static void create_content(const char *filename, bool shared)
+{
+    FILE *fp = fopen(filename,"wb");
+    char buf[1024];
+    for (int i=0; i<DEDUP_NCHUNKS; i++) {
+        memset(buf,(shared || i>=DEDUP_NCHUNKS/2) ? 'a'+i : 'A'+i,1024);
+        fwrite(buf,1,1024,fp);
+    }
+    fclose(fp);
+}
+
+
+/** Index whose stored sources can be inspected */
+class DedupChunkIndex : public ChunkIndex
+{
+public:
+    Storage *GetStorage(uint32_t src)
+    {
+        return sources_[src]->storage;
+    }
+};
+
+
+/** Offer chunk pos of seed to leech, with its uncles, as a seeder would */
+static void offer_chunk(FileTransfer *seed, FileTransfer *leech, bin_t pos)
+{
+    HashTree *ht = seed->hashtree();
+    bin_t peak = ht->peak_for(pos);
+    for (bin_t p=pos; p!=peak; p=p.parent())
+        leech->hashtree()->OfferHash(p.sibling(),ht->hash(p.sibling()));
+
+    char buf[1024];
+    ssize_t r = seed->GetStorage()->Read(buf,1024,pos.base_offset()*1024);
+    ASSERT_TRUE(leech->hashtree()->OfferData(pos,buf,r));
+    leech->OnDataVerified(pos);
+}
+
+
+TEST(DedupTest,SiblingFromOtherSwarm)
+{
+    ChunkIndex *ci = ChunkIndex::GetInstance();
+
+    // B is not indexed, it only provides the hashes a seeder would send
+    FileTransfer *seedb = new FileTransfer(482,DTB);
+    ci->SetEnabled(true);
+    FileTransfer *seeda = new FileTransfer(481,DTA);
+    EXPECT_EQ(DEDUP_NCHUNKS,ci->GetChunkCount());
+
+    FileTransfer *leech = new FileTransfer(483,DTCOPY,seedb->hashtree()->root_hash());
+    for (int i=0; i<seedb->hashtree()->peak_count(); i++)
+        leech->hashtree()->OfferHash(seedb->hashtree()->peak(i),seedb->hashtree()->peak_hash(i));
+
+    // Chunk 1 is B's own
+    offer_chunk(seedb,leech,bin_t(0,0));
+    EXPECT_FALSE(leech->ack_out()->is_filled(bin_t(0,1)));
+    EXPECT_EQ(0,ci->GetHitCount());
+
+    // Chunk 5 is also A's chunk 5
+    offer_chunk(seedb,leech,bin_t(0,4));
+    EXPECT_TRUE(leech->ack_out()->is_filled(bin_t(0,5)));
+    EXPECT_EQ(1,ci->GetHitCount());
+    EXPECT_EQ(3,leech->hashtree()->chunks_complete());
+
+    char buf[1024];
+    ASSERT_EQ(1024,leech->GetStorage()->Read(buf,1024,5*1024));
+    EXPECT_EQ('a'+5,buf[0]);
+
+    // The leecher's chunks are indexed too, until it is closed
+    EXPECT_EQ(DEDUP_NCHUNKS+3,ci->GetChunkCount());
+    delete leech;
+    EXPECT_EQ(DEDUP_NCHUNKS,ci->GetChunkCount());
+
+    delete seeda;
+    EXPECT_EQ(0,ci->GetChunkCount());
+    ci->SetEnabled(false);
+    delete seedb;
+}
+
+
+TEST(DedupTest,Store)
+{
+    unlink(DTSTORE);
+    ChunkIndex *ci = ChunkIndex::GetInstance();
+    ASSERT_EQ(0,ci->SetStore(DTSTORE));
+    FileTransfer *seeda = new FileTransfer(491,DTA);
+    Sha1Hash leafhash = seeda->hashtree()->hash(bin_t(0,1));
+    Sha1Hash leafhash2 = seeda->hashtree()->hash(bin_t(0,2));
+
+    // The store indexes A from its checkpoint
+    FILE *fp = fopen((std::string(DTA)+".mbinmap").c_str(),"wb");
+    ASSERT_EQ(0,((MmapHashTree *)seeda->hashtree())->serialize(fp));
+    fclose(fp);
+    delete seeda;
+    EXPECT_EQ(DEDUP_NCHUNKS,ci->GetChunkCount());
+
+    DedupChunkIndex reloaded;
+    ASSERT_EQ(0,reloaded.SetStore(DTSTORE));
+    EXPECT_EQ(DEDUP_NCHUNKS,reloaded.GetChunkCount());
+    EXPECT_TRUE(reloaded.GetStorage(0) == NULL);
+    char buf[1024];
+    ASSERT_EQ(1024,reloaded.Read(leafhash,1024,buf,NULL));
+    EXPECT_EQ('a'+1,buf[0]);
+
+    // A is opened once for all reads
+    Storage *storage = reloaded.GetStorage(0);
+    ASSERT_TRUE(storage != NULL);
+    ASSERT_EQ(1024,reloaded.Read(leafhash2,1024,buf,NULL));
+    EXPECT_EQ('a'+2,buf[0]);
+    EXPECT_EQ(storage,reloaded.GetStorage(0));
+    EXPECT_EQ(-1,reloaded.Read(leafhash,2048,buf,NULL));
+
+    // Content gone: skipped, not created again
+    DedupChunkIndex gone;
+    ASSERT_EQ(0,gone.SetStore(DTSTORE));
+    EXPECT_EQ(DEDUP_NCHUNKS,gone.GetChunkCount());
+    std::string moved = std::string(DTA)+".moved";
+    ASSERT_EQ(0,rename(DTA,moved.c_str()));
+    EXPECT_EQ(-1,gone.Read(leafhash,1024,buf,NULL));
+    EXPECT_TRUE(gone.GetStorage(0) == NULL);
+    EXPECT_NE(1,file_exists_utf8(DTA));
+    DedupChunkIndex goneload;
+    ASSERT_EQ(0,goneload.SetStore(DTSTORE));
+    EXPECT_EQ(0,goneload.GetChunkCount());
+    EXPECT_NE(1,file_exists_utf8(DTA));
+    ASSERT_EQ(0,rename(moved.c_str(),DTA));
+
+    // Content changed since
+    create_content(DTA,false);
+    EXPECT_EQ(-1,reloaded.Read(leafhash,1024,buf,NULL));
+    create_content(DTA,true);
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    remove_swarm(DTA);
+    remove_swarm(DTB);
+    remove_swarm(DTCOPY);
+    create_content(DTA,true);
+    create_content(DTB,false);
+
+    testing::InitGoogleTest(&argc, argv);
+    int ret = RUN_ALL_TESTS();
+
+    remove_swarm(DTA);
+    remove_swarm(DTB);
+    remove_swarm(DTCOPY);
+    unlink(DTSTORE);
+    return ret;
+}
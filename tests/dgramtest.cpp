@@ -108,10 +108,364 @@ TEST(Datagram,TwoPortTest)
     Channel::CloseSocket(sock2);
 }
 
+TEST(Datagram,DontFragTest)
+{
+    // MULTIDATA: PMTU probes go out unfragmented, loopback takes jumbo
+    int sock1 = Channel::Bind("0.0.0.0:10003");
+    int sock2 = Channel::Bind("0.0.0.0:10004");
+    ASSERT_TRUE(sock1>0);
+    ASSERT_TRUE(sock2>0);
+    struct evbuffer *snd = evbuffer_new();
+    for (int i=0; i<SWIFT_PMTU_JUMBO; i++)
+        evbuffer_add_8(snd, i & 0xff);
+    ASSERT_EQ(SWIFT_PMTU_JUMBO,Channel::SendTo(sock1,Address("127.0.0.1:10004"),snd,true));
+    evbuffer_free(snd);
+    event_assign(&evrecv, evbase, sock2, EV_READ, ReceiveCallback, NULL);
+    event_add(&evrecv, NULL);
+    event_base_dispatch(evbase);
+    struct evbuffer *rcv = evbuffer_new();
+    Address address;
+    ASSERT_EQ(SWIFT_PMTU_JUMBO,Channel::RecvFrom(sock2, address, rcv));
+    uint8_t *data = evbuffer_pullup(rcv, SWIFT_PMTU_JUMBO);
+    EXPECT_EQ(0,data[0]);
+    EXPECT_EQ((SWIFT_PMTU_JUMBO-1) & 0xff,data[SWIFT_PMTU_JUMBO-1]);
+    evbuffer_free(rcv);
+    Channel::CloseSocket(sock1);
+    Channel::CloseSocket(sock2);
+}
+
+TEST(Datagram,LargeChunkTest)
+{
+    // A DATA message for the largest chunk goes in one datagram
+    int sock1 = Channel::Bind("0.0.0.0:10005");
+    int sock2 = Channel::Bind("0.0.0.0:10006");
+    ASSERT_TRUE(sock1>0);
+    ASSERT_TRUE(sock2>0);
+    struct evbuffer *snd = evbuffer_new();
+    for (int i=0; i<SWIFT_MAX_SEND_DGRAM_SIZE; i++)
+        evbuffer_add_8(snd, i & 0xff);
+    ASSERT_EQ(SWIFT_MAX_SEND_DGRAM_SIZE,Channel::SendTo(sock1,Address("127.0.0.1:10006"),snd));
+    evbuffer_free(snd);
+    event_assign(&evrecv, evbase, sock2, EV_READ, ReceiveCallback, NULL);
+    event_add(&evrecv, NULL);
+    event_base_dispatch(evbase);
+    struct evbuffer *rcv = evbuffer_new();
+    Address address;
+    ASSERT_EQ(SWIFT_MAX_SEND_DGRAM_SIZE,Channel::RecvFrom(sock2, address, rcv));
+    uint8_t *data = evbuffer_pullup(rcv, SWIFT_MAX_SEND_DGRAM_SIZE);
+    EXPECT_EQ((SWIFT_MAX_SEND_DGRAM_SIZE-1) & 0xff,data[SWIFT_MAX_SEND_DGRAM_SIZE-1]);
+    evbuffer_free(rcv);
+    Channel::CloseSocket(sock1);
+    Channel::CloseSocket(sock2);
+}
+
+#ifdef IP_MTU_DISCOVER
+TEST(Datagram,DontFragPerDatagram)
+{
+    // MULTIDATA: Only a probe has DF set, the socket is shared by all peers
+    int sock1 = Channel::Bind("0.0.0.0:10007");
+    int sock2 = Channel::Bind("0.0.0.0:10008");
+    ASSERT_TRUE(sock1>0);
+    ASSERT_TRUE(sock2>0);
+    int pmtudisc0 = -1, pmtudisc = -1;
+    socklen_t optlen = sizeof(int);
+    ASSERT_EQ(0,getsockopt(sock1,IPPROTO_IP,IP_MTU_DISCOVER,(setsockoptptr_t)&pmtudisc0,&optlen));
+    ASSERT_NE(IP_PMTUDISC_DO,pmtudisc0);
+    struct evbuffer *snd = evbuffer_new();
+    evbuffer_add_32be(snd, 1234);
+    ASSERT_EQ(4,Channel::SendTo(sock1,Address("127.0.0.1:10008"),snd,true));
+    ASSERT_EQ(0,getsockopt(sock1,IPPROTO_IP,IP_MTU_DISCOVER,(setsockoptptr_t)&pmtudisc,&optlen));
+    EXPECT_EQ(pmtudisc0,pmtudisc);
+    evbuffer_add_32be(snd, 5678);
+    ASSERT_EQ(4,Channel::SendTo(sock1,Address("127.0.0.1:10008"),snd));
+    ASSERT_EQ(0,getsockopt(sock1,IPPROTO_IP,IP_MTU_DISCOVER,(setsockoptptr_t)&pmtudisc,&optlen));
+    EXPECT_EQ(pmtudisc0,pmtudisc);
+    evbuffer_free(snd);
+    Channel::CloseSocket(sock1);
+    Channel::CloseSocket(sock2);
+}
+#endif
+
+
+#define MD_CHUNK_SIZE   256
+#define MD_NCHUNKS      40      // full chunks, then a short one
+#define MD_LAST_SIZE    100
+
+const char *MDSEED = "multidata_seed.dat";
+const char *MDLEECH = "multidata_leech.dat";
+
+
+static void remove_swarm(std::string filename)
+{
+    unlink(filename.c_str());
+    unlink((filename+".mhash").c_str());
+    unlink((filename+".mbinmap").c_str());
+}
+
+
+/** Seeder channel whose congestion window can be opened at once */
+class MultiDataChannel : public Channel
+{
+public:
+    MultiDataChannel(ContentTransfer *transfer) :
+        Channel(transfer,INVALID_SOCKET,Address("127.0.0.1:1")) {}
+
+    void OpenWindow(float cwnd)
+    {
+        cwnd_ = cwnd;
+    }
+    void NextSendSlot()
+    {
+        last_data_out_time_ = 0;
+    }
+    int pmtu() const
+    {
+        return pmtu_;
+    }
+    bool probing() const
+    {
+        return !pmtu_probe_bin_.is_none();
+    }
+};
+
+
+/** MULTIDATA: Seeder packing chunks in datagrams, leecher taking them */
+class MultiDataTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        remove_swarm(MDSEED);
+        remove_swarm(MDLEECH);
+        FILE *fp = fopen(MDSEED,"wb");
+        char buf[MD_CHUNK_SIZE];
+        for (int i=0; i<MD_NCHUNKS; i++) {
+            memset(buf,'a'+i%26,MD_CHUNK_SIZE);
+            fwrite(buf,1,MD_CHUNK_SIZE,fp);
+        }
+        memset(buf,'Z',MD_LAST_SIZE);
+        fwrite(buf,1,MD_LAST_SIZE,fp);
+        fclose(fp);
+
+        seed_ = new FileTransfer(591,MDSEED,Sha1Hash::ZERO,true,POPT_CONT_INT_PROT_MERKLE,MD_CHUNK_SIZE);
+        leech_ = new FileTransfer(592,MDLEECH,seed_->hashtree()->root_hash(),true,
+                                  POPT_CONT_INT_PROT_MERKLE,MD_CHUNK_SIZE);
+        for (int i=0; i<seed_->hashtree()->peak_count(); i++)
+            leech_->hashtree()->OfferHash(seed_->hashtree()->peak(i),seed_->hashtree()->peak_hash(i));
+        ASSERT_EQ(MD_NCHUNKS+1,leech_->hashtree()->size_in_chunks());
+
+        Address addr("127.0.0.1:1");
+        seedch_ = new MultiDataChannel(seed_);
+        leechch_ = new Channel(leech_,INVALID_SOCKET,addr);
+        struct evbuffer *evb = evbuffer_new();
+        leechch_->AddHandshake(evb);
+        seedch_->Recv(evb);
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+        seedch_->AddHandshake(evb);
+        leechch_->Recv(evb);
+        evbuffer_free(evb);
+    }
+
+    virtual void TearDown()
+    {
+        delete leechch_;
+        delete seedch_;
+        delete leech_;
+        delete seed_;
+        remove_swarm(MDSEED);
+        remove_swarm(MDLEECH);
+    }
+
+    /** Peer asks for chunks first to last */
+    void Request(uint64_t first, uint64_t last)
+    {
+        for (uint64_t c=last+1; c>first; c--)
+            seedch_->RequeueHint(bin_t(0,c-1),false);
+    }
+
+    /** The first chunk goes alone, with the peak hashes. Window opens. */
+    void Start(float cwnd)
+    {
+        Request(0,0);
+        struct evbuffer *evb = evbuffer_new();
+        SeedDatagram(evb);
+        Deliver(evb);
+        evbuffer_free(evb);
+        ASSERT_TRUE(leech_->ack_out()->is_filled(bin_t(0,0)));
+        seedch_->OpenWindow(cwnd);
+    }
+
+    int SeedDatagram(struct evbuffer *evb)
+    {
+        seedch_->NextSendSlot();
+        seedch_->AddData(evb);
+        return evbuffer_get_length(evb);
+    }
+
+    /** Leecher takes the datagram, the seeder gets ACKs for what was in it.
+     *  The leecher's own reply goes nowhere, the channels have no socket. */
+    void Deliver(struct evbuffer *evb)
+    {
+        leechch_->Recv(evb);
+        popt_chunk_addr_t chunkaddr = leech_->GetDefaultHandshake().chunk_addr_;
+        for (uint64_t c=0; c<=MD_NCHUNKS; c++) {
+            bin_t pos(0,c);
+            if (!leech_->ack_out()->is_filled(pos) || seedch_->ack_in().is_filled(pos))
+                continue;
+            struct evbuffer *ack = evbuffer_new();
+            evbuffer_add_chunkaddr(ack,pos,chunkaddr,MD_CHUNK_SIZE);
+            evbuffer_add_64be(ack,0);
+            size_t len = evbuffer_get_length(ack);
+            DgramCursor dc(evbuffer_pullup(ack,len),len);
+            seedch_->OnAck(dc);
+            evbuffer_free(ack);
+        }
+    }
+
+    int LeechHas(uint64_t first, uint64_t last)
+    {
+        int n = 0;
+        for (uint64_t c=first; c<=last; c++)
+            if (leech_->ack_out()->is_filled(bin_t(0,c)))
+                n++;
+        return n;
+    }
+
+    FileTransfer *seed_;
+    FileTransfer *leech_;
+    MultiDataChannel *seedch_;
+    Channel *leechch_;
+};
+
+
+/** As with --pmtu 1472, datagrams up to the Ethernet payload */
+class MultiDataNoProbeTest : public MultiDataTest
+{
+protected:
+    virtual void SetUp()
+    {
+        maxpmtu_ = Channel::MAX_PMTU;
+        Channel::MAX_PMTU = SWIFT_MAX_UDP_OVER_ETH_PAYLOAD;
+        MultiDataTest::SetUp();
+    }
+
+    virtual void TearDown()
+    {
+        MultiDataTest::TearDown();
+        Channel::MAX_PMTU = maxpmtu_;
+    }
+
+    int maxpmtu_;
+};
+
+
+TEST_F(MultiDataNoProbeTest,PackAndParse)
+{
+    Start(8);
+    Request(1,8);
+    struct evbuffer *evb = evbuffer_new();
+    int len = SeedDatagram(evb);
+    EXPECT_LE(len,SWIFT_MAX_UDP_OVER_ETH_PAYLOAD);
+    EXPECT_FALSE(seedch_->probing());
+    Deliver(evb);
+    evbuffer_free(evb);
+
+    int n = LeechHas(1,8);
+    EXPECT_GE(n,2);
+    EXPECT_EQ(n,LeechHas(1,n));
+    char buf[MD_CHUNK_SIZE];
+    ASSERT_EQ(MD_CHUNK_SIZE,leech_->GetStorage()->Read(buf,MD_CHUNK_SIZE,n*MD_CHUNK_SIZE));
+    EXPECT_EQ('a'+n,buf[0]);
+    EXPECT_EQ('a'+n,buf[MD_CHUNK_SIZE-1]);
+}
+
+
+TEST_F(MultiDataTest,ShortLastChunk)
+{
+    // The short chunk ends the datagram, the receiver takes the rest
+    Start(8);
+    Request(5,5);
+    Request(MD_NCHUNKS-2,MD_NCHUNKS);
+    struct evbuffer *evb = evbuffer_new();
+    SeedDatagram(evb);
+    Deliver(evb);
+    evbuffer_free(evb);
+
+    EXPECT_EQ(3,LeechHas(MD_NCHUNKS-2,MD_NCHUNKS));
+    EXPECT_FALSE(leech_->ack_out()->is_filled(bin_t(0,5)));
+    char buf[MD_CHUNK_SIZE];
+    ASSERT_EQ(MD_LAST_SIZE,leech_->GetStorage()->Read(buf,MD_CHUNK_SIZE,MD_NCHUNKS*MD_CHUNK_SIZE));
+    EXPECT_EQ('Z',buf[MD_LAST_SIZE-1]);
+    ASSERT_EQ(MD_CHUNK_SIZE,leech_->GetStorage()->Read(buf,MD_CHUNK_SIZE,(MD_NCHUNKS-1)*MD_CHUNK_SIZE));
+    EXPECT_EQ('a'+(MD_NCHUNKS-1)%26,buf[0]);
+}
+
+
+TEST_F(MultiDataTest,ProbeAcked)
+{
+    Start(8);
+    Request(1,8);
+    EXPECT_EQ(SWIFT_MAX_UDP_OVER_ETH_PAYLOAD,seedch_->pmtu());
+    struct evbuffer *evb = evbuffer_new();
+    int len = SeedDatagram(evb);
+    EXPECT_GT(len,SWIFT_MAX_UDP_OVER_ETH_PAYLOAD);
+    EXPECT_TRUE(seedch_->probing());
+    Deliver(evb);
+    evbuffer_free(evb);
+
+    EXPECT_EQ(8,LeechHas(1,8));
+    EXPECT_FALSE(seedch_->probing());
+    EXPECT_EQ(len,seedch_->pmtu());
+}
+
+
+TEST_F(MultiDataTest,ProbeLost)
+{
+    Start(16);
+    Request(1,32);
+    struct evbuffer *evb = evbuffer_new();
+    int probe = SeedDatagram(evb);
+    ASSERT_TRUE(seedch_->probing());
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+
+    // Next probe is halfway between what is known and what was lost
+    seedch_->OnPMTUProbeFailed(false);
+    EXPECT_FALSE(seedch_->probing());
+    EXPECT_EQ(SWIFT_MAX_UDP_OVER_ETH_PAYLOAD,seedch_->pmtu());
+    int len = SeedDatagram(evb);
+    EXPECT_LE(len,(SWIFT_MAX_UDP_OVER_ETH_PAYLOAD+probe)/2);
+    EXPECT_GT(len,SWIFT_MAX_UDP_OVER_ETH_PAYLOAD);
+    evbuffer_free(evb);
+}
+
+
+TEST_F(MultiDataTest,ProbeNotSent)
+{
+    // Too big for the link, the chunks go again, smaller
+    Start(8);
+    Request(1,8);
+    struct evbuffer *evb = evbuffer_new();
+    int probe = SeedDatagram(evb);
+    ASSERT_TRUE(seedch_->probing());
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    seedch_->OnPMTUProbeFailed(true);
+    EXPECT_EQ(SWIFT_MAX_UDP_OVER_ETH_PAYLOAD,seedch_->pmtu());
+
+    for (int i=0; i<8 && LeechHas(1,7) < 7; i++) {
+        EXPECT_LT(SeedDatagram(evb),probe);
+        Deliver(evb);
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+    }
+    evbuffer_free(evb);
+    EXPECT_EQ(7,LeechHas(1,7));
+}
+
+
 int main(int argc, char** argv)
 {
     swift::LibraryInit();
     evbase = event_base_new();
+    Channel::evbase = evbase;
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
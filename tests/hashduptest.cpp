@@ -0,0 +1,241 @@
+/*
+ *  hashduptest.cpp
+ *
+ *  Tests for sending each uncle hash once per channel, and the full path
+ *  again after a loss (HASHDEDUP).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define HD_NCHUNKS      64
+#define HD_CHUNK_SIZE   1024
+
+const char *HDSEED = "hashdup_seed.dat";
+const char *HDLEECH = "hashdup_leech.dat";
+
+
+static void remove_swarm(std::string filename)
+{
+    unlink(filename.c_str());
+    unlink((filename+".mhash").c_str());
+    unlink((filename+".mbinmap").c_str());
+}
+
+
+/** Seeder channel whose chunks in flight can be made to time out */
+class HashDupChannel : public Channel
+{
+public:
+    HashDupChannel(ContentTransfer *transfer) :
+        Channel(transfer,INVALID_SOCKET,Address("127.0.0.1:1")) {}
+
+    void NextSendSlot()
+    {
+        last_data_out_time_ = 0;
+    }
+    void LoseInFlight()
+    {
+        // Timed out, yet recent enough to retransmit
+        for (int i=0; i<data_out_.size(); i++)
+            if (data_out_[i] != tintbin())
+                data_out_[i].time = NOW-3*ack_timeout()-TINT_MSEC;
+        TimeoutDataOut();
+    }
+};
+
+
+/** Seeder sending one chunk per datagram, leecher that knows the peaks */
+class HashDupTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        remove_swarm(HDSEED);
+        remove_swarm(HDLEECH);
+        FILE *fp = fopen(HDSEED,"wb");
+        char buf[HD_CHUNK_SIZE];
+        for (int i=0; i<HD_NCHUNKS; i++) {
+            memset(buf,'a'+i%26,HD_CHUNK_SIZE);
+            fwrite(buf,1,HD_CHUNK_SIZE,fp);
+        }
+        fclose(fp);
+
+        seed_ = new FileTransfer(601,HDSEED);
+        leech_ = new FileTransfer(602,HDLEECH,seed_->hashtree()->root_hash());
+        for (int i=0; i<seed_->hashtree()->peak_count(); i++)
+            leech_->hashtree()->OfferHash(seed_->hashtree()->peak(i),seed_->hashtree()->peak_hash(i));
+        ASSERT_EQ(HD_NCHUNKS,leech_->hashtree()->size_in_chunks());
+
+        seedch_ = new HashDupChannel(seed_);
+        leechch_ = new Channel(leech_,INVALID_SOCKET,Address("127.0.0.1:1"));
+        struct evbuffer *evb = evbuffer_new();
+        leechch_->AddHandshake(evb);
+        seedch_->Recv(evb);
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+        seedch_->AddHandshake(evb);
+        leechch_->Recv(evb);
+        evbuffer_free(evb);
+    }
+
+    virtual void TearDown()
+    {
+        delete leechch_;
+        delete seedch_;
+        delete leech_;
+        delete seed_;
+        remove_swarm(HDSEED);
+        remove_swarm(HDLEECH);
+    }
+
+    /** Peer asks for chunks first to last */
+    void Request(uint64_t first, uint64_t last)
+    {
+        for (uint64_t c=last+1; c>first; c--)
+            seedch_->RequeueHint(bin_t(0,c-1),false);
+    }
+
+    /** Next datagram from the seeder, returns the number of uncle hashes
+     *  in it and the chunk it carries. Peak hashes are not counted. */
+    int SeedDatagram(struct evbuffer *evb, bin_t *chunk)
+    {
+        seedch_->NextSendSlot();
+        *chunk = seedch_->AddData(evb);
+        popt_chunk_addr_t chunkaddr = seed_->GetDefaultHandshake().chunk_addr_;
+        size_t len = evbuffer_get_length(evb);
+        DgramCursor dc(evbuffer_pullup(evb,len),len);
+        binarray_t ba;
+        int nhashes = 0;
+        while (dc.remaining() > 0 && dc.get8() == SWIFT_INTEGRITY) {
+            dc.getchunkaddr(chunkaddr,HD_CHUNK_SIZE,&ba);
+            dc.skip(Sha1Hash::SIZE);
+            if (ba.bins[0] != seed_->hashtree()->peak_for(ba.bins[0]))
+                nhashes++;
+        }
+        EXPECT_TRUE(dc.ok());
+        return nhashes;
+    }
+
+    /** Leecher takes the datagram, the seeder gets an ACK if it checked out.
+     *  The leecher's own reply goes nowhere, the channels have no socket. */
+    void Deliver(struct evbuffer *evb, bin_t chunk)
+    {
+        leechch_->Recv(evb);
+        if (!leech_->ack_out()->is_filled(chunk))
+            return;
+        struct evbuffer *ack = evbuffer_new();
+        evbuffer_add_chunkaddr(ack,chunk,leech_->GetDefaultHandshake().chunk_addr_,HD_CHUNK_SIZE);
+        evbuffer_add_64be(ack,0);
+        size_t len = evbuffer_get_length(ack);
+        DgramCursor dc(evbuffer_pullup(ack,len),len);
+        seedch_->OnAck(dc);
+        evbuffer_free(ack);
+    }
+
+    FileTransfer *seed_;
+    FileTransfer *leech_;
+    HashDupChannel *seedch_;
+    Channel *leechch_;
+};
+
+
+TEST_F(HashDupTest,UnclesOnce)
+{
+    // Nothing acked yet: 0 takes its full path, 1 has it all, 2 needs 3,
+    // and 3 has it all
+    uint64_t deduped = Channel::global_hashes_deduped;
+    Request(0,3);
+    int want[] = { 6, 0, 1, 0 };
+    struct evbuffer *evb = evbuffer_new();
+    for (int c=0; c<4; c++) {
+        bin_t chunk;
+        EXPECT_EQ(want[c],SeedDatagram(evb,&chunk)) << "chunk " << c;
+        ASSERT_EQ(bin_t(0,c),chunk);
+        leechch_->Recv(evb);
+        evbuffer_drain(evb,evbuffer_get_length(evb));
+        EXPECT_TRUE(leech_->ack_out()->is_filled(chunk)) << "chunk " << c;
+    }
+    evbuffer_free(evb);
+    EXPECT_EQ(deduped+6+5+6,Channel::global_hashes_deduped);
+}
+
+
+TEST_F(HashDupTest,ResendAfterLoss)
+{
+    Request(0,3);
+    struct evbuffer *evb = evbuffer_new();
+    bin_t chunk;
+
+    // The datagram with the full path is lost, the next chunks can't be
+    // checked without it
+    EXPECT_EQ(6,SeedDatagram(evb,&chunk));
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_EQ(0,SeedDatagram(evb,&chunk));
+    Deliver(evb,chunk);
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_FALSE(leech_->ack_out()->is_filled(bin_t(0,1)));
+
+    // Detected: retransmits carry their full path
+    seedch_->LoseInFlight();
+    EXPECT_EQ(6,SeedDatagram(evb,&chunk));
+    EXPECT_EQ(bin_t(0,0),chunk);
+    Deliver(evb,chunk);
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_TRUE(leech_->ack_out()->is_filled(bin_t(0,0)));
+
+    // Up to what the peer acknowledged
+    EXPECT_EQ(0,SeedDatagram(evb,&chunk));
+    EXPECT_EQ(bin_t(0,1),chunk);
+    Deliver(evb,chunk);
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_TRUE(leech_->ack_out()->is_filled(bin_t(0,1)));
+
+    // A new chunk after a loss sends its uncles again
+    EXPECT_EQ(1,SeedDatagram(evb,&chunk));
+    EXPECT_EQ(bin_t(0,2),chunk);
+    Deliver(evb,chunk);
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_TRUE(leech_->ack_out()->is_filled(bin_t(0,2)));
+    evbuffer_free(evb);
+}
+
+
+TEST_F(HashDupTest,ResendWithoutAcks)
+{
+    // Lost in flight before any ACK, the full paths go again
+    Request(0,1);
+    struct evbuffer *evb = evbuffer_new();
+    bin_t chunk;
+    EXPECT_EQ(6,SeedDatagram(evb,&chunk));
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    EXPECT_EQ(0,SeedDatagram(evb,&chunk));
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+
+    seedch_->LoseInFlight();
+    EXPECT_EQ(6,SeedDatagram(evb,&chunk));
+    EXPECT_EQ(bin_t(0,0),chunk);
+    evbuffer_drain(evb,evbuffer_get_length(evb));
+    // The retransmit of 0 may be lost as well, so 1 can't rely on it
+    EXPECT_EQ(6,SeedDatagram(evb,&chunk));
+    EXPECT_EQ(bin_t(0,1),chunk);
+    leechch_->Recv(evb);
+    EXPECT_TRUE(leech_->ack_out()->is_filled(bin_t(0,1)));
+    evbuffer_free(evb);
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -21,6 +21,17 @@ char hash456a[] = "4d38c7459a659d769bb956c2d758d266008199a4";
 char hash456b[] = "a923e4b60d2a2a2a5ede87479e0314b028e3ae60";
 char rooth456[] = "5b53677d3a695f29f1b4e18ab6d705312ef7f8c3";
 
+char sha256abc[] = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+char sha512_256abc[] = "53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f13107e7af23";
+char sha256hash123[] = "181210f8f9c779c26da1d9b2075bde0127302ee0e3fca38c9a83f5b1dd8e5d3b";
+
+char sha256hash456a[] = "54b5a03e26b99259570c6f302ac6268119d441583798f6d219f60417eef8f9fe";
+char sha256hash456b[] = "0d1a6f01c06f2ac5c7267a5f40c746a09196a2dd3a56687b49ce42f2c0d70fac";
+char sha256rooth456[] = "062c7130ba18b20f6d3b7aa76a4c63530255fe2bac6304aec9d71d029e128acd";
+char sha512_256hash456a[] = "de885b004b5927df2fc234d306e6e119267e86d54bc63e5bdf659afb8ecd7838";
+char sha512_256hash456b[] = "df97b81c82715e8ee5d25543ee573fb24fc7c4a74a20222b0d5044a15cf3d605";
+char sha512_256rooth456[] = "3baa3bdafa15c11d40d79c2d72f63c948f02188895f7ff30b6eeb99e2d765dbd";
+
 
 TEST(Sha1HashTest,Trivial)
 {
@@ -105,9 +116,169 @@ TEST(Sha1HashTest,OfferDataTest2)
 
 
 
+static Sha1Hash hexhash(popt_merkle_func_t func, const char *hex)
+{
+    Sha1Hash h(true,hex);
+    h.func_ = func;
+    return h;
+}
+
+
+TEST(Sha2HashTest,Vectors)
+{
+    Sha1Hash h256(POPT_MERKLE_HASH_FUNC_SHA256,"abc",3);
+    EXPECT_EQ(32,h256.size());
+    EXPECT_STREQ(sha256abc,h256.hex().c_str());
+    Sha1Hash h512(POPT_MERKLE_HASH_FUNC_SHA512_256,"abc",3);
+    EXPECT_EQ(32,h512.size());
+    EXPECT_STREQ(sha512_256abc,h512.hex().c_str());
+
+    // 64 hex digits parse as SHA-256
+    Sha1Hash parsed(true,sha256abc);
+    EXPECT_EQ(POPT_MERKLE_HASH_FUNC_SHA256,parsed.func());
+    EXPECT_TRUE(parsed == h256);
+    EXPECT_TRUE(SwarmID(std::string(sha256abc)).ttype() == FILE_TRANSFER);
+}
+
+
+TEST(Sha2HashTest,SubmitTest)
+{
+    FILE* f123 = fopen("123","wb+");
+    fprintf(f123, "123\n");
+    fclose(f123);
+    unlink("123.mhash");
+    unlink("123.mbinmap");
+    SwarmID noswarmid = SwarmID::NOSWARMID;
+    int td = swift::Open("123",noswarmid);
+    Storage storage("123", ".", td, POPT_LIVE_DISC_WND_ALL);
+    MmapHashTree ht123(&storage,Sha1Hash::ZERO,1024,"123.mhash",false,"123.mbinmap",POPT_MERKLE_HASH_FUNC_SHA256);
+    EXPECT_STREQ(sha256hash123,ht123.hash(bin_t(0,0)).hex().c_str());
+    EXPECT_STREQ(sha256hash123,ht123.root_hash().hex().c_str());
+    EXPECT_EQ(4,ht123.size());
+
+    // Checkpoint records the hash function
+    FILE *fp = fopen("123.mbinmap","wb");
+    ASSERT_EQ(0,ht123.serialize(fp));
+    fclose(fp);
+    MmapHashTree cp(true,"123.mbinmap");
+    EXPECT_EQ(POPT_MERKLE_HASH_FUNC_SHA256,cp.hash_func());
+    EXPECT_STREQ(sha256hash123,cp.root_hash().hex().c_str());
+    unlink("123.mhash");
+    unlink("123.mbinmap");
+}
+
+
+static void offer_data_456(popt_merkle_func_t func, const char *hexa, const char *hexb, const char *hexroot)
+{
+    char data456a[1024];
+    memset(data456a,'$',1024);
+    char data456b[4];
+    memset(data456b,'$',4);
+
+    Sha1Hash roothash456(hexhash(func,hexa),hexhash(func,hexb));
+    EXPECT_STREQ(hexroot,roothash456.hex().c_str());
+    unlink("456");
+    unlink("456.mhash");
+    Storage storage("456", ".", -1, POPT_LIVE_DISC_WND_ALL);
+    MmapHashTree tree(&storage,roothash456,1024,"456.mhash",false,"456.mbinmap",func);
+    tree.OfferHash(bin_t(1,0),roothash456);
+    tree.OfferHash(bin_t(0,0),hexhash(func,hexa));
+    tree.OfferHash(bin_t(0,1),hexhash(func,hexb));
+    ASSERT_EQ(2,tree.size_in_chunks());
+    ASSERT_TRUE(tree.OfferData(bin_t(0,0), data456a, 1024));
+    ASSERT_FALSE(tree.OfferData(bin_t(0,1), "$$$#", 4));
+    ASSERT_TRUE(tree.OfferData(bin_t(0,1), data456b, 4));
+    unlink("456");
+    unlink("456.mhash");
+    ASSERT_EQ(1028,tree.size());
+}
+
+
+TEST(Sha2HashTest,OfferDataTest)
+{
+    offer_data_456(POPT_MERKLE_HASH_FUNC_SHA256,sha256hash456a,sha256hash456b,sha256rooth456);
+    offer_data_456(POPT_MERKLE_HASH_FUNC_SHA512_256,sha512_256hash456a,sha512_256hash456b,sha512_256rooth456);
+}
+
+
+
+/** Initiating PPSPP handshake for the given root hash */
+static struct evbuffer *handshake(const Sha1Hash &root, bool withfunc, popt_merkle_func_t func)
+{
+    struct evbuffer *evb = evbuffer_new();
+    evbuffer_add_8(evb, SWIFT_HANDSHAKE);
+    evbuffer_add_32be(evb, 0x1234);
+    evbuffer_add_8(evb, POPT_VERSION);
+    evbuffer_add_8(evb, VER_PPSPP_v1);
+    evbuffer_add_8(evb, POPT_SWARMID);
+    evbuffer_add_16be(evb, root.size());
+    evbuffer_add_hash(evb, root);
+    evbuffer_add_8(evb, POPT_CONT_INT_PROT);
+    evbuffer_add_8(evb, POPT_CONT_INT_PROT_MERKLE);
+    if (withfunc) {
+        evbuffer_add_8(evb, POPT_MERKLE_HASH_FUNC);
+        evbuffer_add_8(evb, func);
+    }
+    evbuffer_add_8(evb, POPT_END);
+    return evb;
+}
+
+
+static bool handshake_ok(const Sha1Hash &root, bool withfunc, popt_merkle_func_t func)
+{
+    Address addr("127.0.0.1:1");
+    struct evbuffer *evb = handshake(root,withfunc,func);
+    Handshake *hs = Channel::StaticOnHandshake(addr,0,false,VER_PPSPP_v1,evb);
+    evbuffer_free(evb);
+    if (hs == NULL)
+        return false;
+    delete hs;
+    return true;
+}
+
+
+TEST(Sha2HashTest,HandshakeNeedsMerkleFunc)
+{
+    Sha1Hash root256 = hexhash(POPT_MERKLE_HASH_FUNC_SHA256,sha256rooth456);
+    EXPECT_FALSE(handshake_ok(root256,false,POPT_MERKLE_HASH_FUNC_SHA1));
+    EXPECT_FALSE(handshake_ok(root256,true,POPT_MERKLE_HASH_FUNC_SHA1));
+    EXPECT_TRUE(handshake_ok(root256,true,POPT_MERKLE_HASH_FUNC_SHA256));
+    EXPECT_TRUE(handshake_ok(root256,true,POPT_MERKLE_HASH_FUNC_SHA512_256));
+
+    // SHA-1 is the default
+    Sha1Hash root1(true,rooth456);
+    EXPECT_TRUE(handshake_ok(root1,false,POPT_MERKLE_HASH_FUNC_SHA1));
+
+    // Sent also without integrity checking, the root says nothing itself
+    FILE *fp = fopen("456","wb");
+    fprintf(fp,"456\n");
+    fclose(fp);
+    unlink("456.mhash");
+    unlink("456.mbinmap");
+    FileTransfer *ft = new FileTransfer(456,"456",Sha1Hash::ZERO,true,POPT_CONT_INT_PROT_NONE,1024,false,"",
+                                        POPT_MERKLE_HASH_FUNC_SHA256);
+    Address addr("127.0.0.1:1");
+    Channel *ch = new Channel(ft,INVALID_SOCKET,addr);
+    struct evbuffer *evb = evbuffer_new();
+    ch->AddHandshake(evb);
+    Handshake *hs = Channel::StaticOnHandshake(addr,0,false,VER_PPSPP_v1,evb);
+    ASSERT_TRUE(hs != NULL);
+    EXPECT_EQ(POPT_MERKLE_HASH_FUNC_SHA256,hs->merkle_func_);
+    delete hs;
+    evbuffer_free(evb);
+    delete ft;
+    unlink("456");
+    unlink("456.mhash");
+    unlink("456.mbinmap");
+}
+
+
+
 int main(int argc, char** argv)
 {
     //bin::init();
+    LibraryInit();
+    Channel::evbase = event_base_new();
 
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
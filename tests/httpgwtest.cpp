@@ -0,0 +1,245 @@
+/*
+ *  httpgwtest.cpp
+ *
+ *  Tests for the HTTP gateway's pool of request state, its indices and
+ *  memory accounting, serving a local swarm over loopback.
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <event2/http.h>
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define GW_SIZE     (4*1024*1024+100)
+#define GW_PORT     18561
+
+const char *GWFILE = "httpgw_test.dat";
+
+// Not in a header, swift.cpp and statsgw.cpp declare these themselves
+struct http_gw_t;
+bool InstallHTTPGateway(struct event_base *evbase, Address bindaddr, popt_cont_int_prot_t cipm, uint64_t disc_wnd,
+                        uint32_t chunk_size, double *maxspeed, std::string storage_dir, int32_t vod_step,
+                        int32_t min_prebuf);
+void HttpGwGetRequestStats(int *open, uint64_t *membytes, uint64_t *poolbytes);
+http_gw_t *HttpGwAllocRequest();
+void HttpGwFreeRequest(http_gw_t *req);
+http_gw_t *HttpGwFindRequestByTD(int td);
+extern std::map<struct evhttp_request *,http_gw_t *> httpgw_reqs_by_ev;
+extern std::map<int,std::deque<struct evhttp_request *> > httpgw_tdevreqqueues;
+
+int gwtd = -1;
+std::string gwroothex;
+
+
+/** Reply to one GET */
+struct gw_reply_t {
+    int         code;
+    size_t      length;
+    char        first;
+    int         order;
+};
+
+int gw_pending = 0;
+int gw_done = 0;
+int gw_maxopen = 0;
+size_t gw_maxqueued = 0;
+struct event *gw_pollev = NULL;
+
+
+static void gw_reply_callback(struct evhttp_request *evreq, void *arg)
+{
+    gw_reply_t *reply = (gw_reply_t *)arg;
+    if (evreq != NULL) {
+        reply->code = evhttp_request_get_response_code(evreq);
+        struct evbuffer *evb = evhttp_request_get_input_buffer(evreq);
+        reply->length = evbuffer_get_length(evb);
+        if (reply->length > 0)
+            evbuffer_copyout(evb,&reply->first,1);
+    }
+    reply->order = gw_done++;
+    if (--gw_pending == 0)
+        event_base_loopexit(Channel::evbase,NULL);
+}
+
+
+/** Samples the gateway state every loop iteration */
+static void gw_poll_callback(evutil_socket_t fd, short events, void *arg)
+{
+    int open;
+    uint64_t membytes, poolbytes;
+    HttpGwGetRequestStats(&open,&membytes,&poolbytes);
+    gw_maxopen = std::max(gw_maxopen,open);
+    std::map<int,std::deque<struct evhttp_request *> >::iterator iter = httpgw_tdevreqqueues.find(gwtd);
+    if (iter != httpgw_tdevreqqueues.end())
+        gw_maxqueued = std::max(gw_maxqueued,iter->second.size());
+    struct timeval tv = { 0, 0 };
+    evtimer_add(gw_pollev,&tv);
+}
+
+
+class HttpGwTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        gw_pending = 0;
+        gw_done = 0;
+        gw_maxopen = 0;
+        gw_maxqueued = 0;
+    }
+
+    virtual void TearDown()
+    {
+        for (int i=0; i<conns_.size(); i++)
+            evhttp_connection_free(conns_[i]);
+    }
+
+    /** GET the swarm on a connection of its own, range "" for all of it */
+    void Get(gw_reply_t *reply, std::string range)
+    {
+        reply->code = 0;
+        reply->length = 0;
+        reply->first = 0;
+        reply->order = -1;
+        struct evhttp_connection *evconn = evhttp_connection_base_new(Channel::evbase,NULL,"127.0.0.1",GW_PORT);
+        conns_.push_back(evconn);
+        struct evhttp_request *evreq = evhttp_request_new(gw_reply_callback,reply);
+        evhttp_add_header(evhttp_request_get_output_headers(evreq),"Host","127.0.0.1");
+        if (range != "")
+            evhttp_add_header(evhttp_request_get_output_headers(evreq),"Range",range.c_str());
+        std::string uri = "/"+gwroothex;
+        ASSERT_EQ(0,evhttp_make_request(evconn,evreq,EVHTTP_REQ_GET,uri.c_str()));
+        gw_pending++;
+    }
+
+    /** Run until all replies are in, or 30 s */
+    void Run()
+    {
+        gw_pollev = evtimer_new(Channel::evbase,gw_poll_callback,NULL);
+        struct timeval tv = { 0, 0 };
+        evtimer_add(gw_pollev,&tv);
+        struct event *evtimeout = evtimer_new(Channel::evbase,gw_timeout_callback,NULL);
+        struct timeval tmo = { 30, 0 };
+        evtimer_add(evtimeout,&tmo);
+
+        event_base_dispatch(Channel::evbase);
+
+        event_free(evtimeout);
+        event_free(gw_pollev);
+        gw_pollev = NULL;
+    }
+
+    static void gw_timeout_callback(evutil_socket_t fd, short events, void *arg)
+    {
+        event_base_loopexit(Channel::evbase,NULL);
+    }
+
+    void ExpectIdle()
+    {
+        int open;
+        uint64_t membytes, poolbytes;
+        HttpGwGetRequestStats(&open,&membytes,&poolbytes);
+        EXPECT_EQ(0,open);
+        EXPECT_EQ(0,membytes);
+        EXPECT_TRUE(HttpGwFindRequestByTD(gwtd) == NULL);
+        EXPECT_TRUE(httpgw_reqs_by_ev.empty());
+        EXPECT_TRUE(httpgw_tdevreqqueues.empty());
+    }
+
+    std::vector<struct evhttp_connection *> conns_;
+};
+
+
+TEST_F(HttpGwTest,SlotReused)
+{
+    http_gw_t *req = HttpGwAllocRequest();
+    HttpGwFreeRequest(req);
+    http_gw_t *again = HttpGwAllocRequest();
+    EXPECT_EQ(req,again);
+    HttpGwFreeRequest(again);
+}
+
+
+TEST_F(HttpGwTest,SequentialRequests)
+{
+    int open;
+    uint64_t membytes, poolbytes0, poolbytes;
+    HttpGwGetRequestStats(&open,&membytes,&poolbytes0);
+
+    // A range request, then one for everything in the same slot, which
+    // must not inherit the range
+    gw_reply_t ranged;
+    Get(&ranged,"bytes=1024-2047");
+    Run();
+    EXPECT_EQ(206,ranged.code);
+    EXPECT_EQ(1024,ranged.length);
+    EXPECT_EQ('b',ranged.first);
+    ExpectIdle();
+
+    gw_reply_t full;
+    Get(&full,"");
+    Run();
+    EXPECT_EQ(200,full.code);
+    EXPECT_EQ(GW_SIZE,full.length);
+    EXPECT_EQ('a',full.first);
+    ExpectIdle();
+
+    HttpGwGetRequestStats(&open,&membytes,&poolbytes);
+    EXPECT_EQ(poolbytes0,poolbytes);
+}
+
+
+TEST_F(HttpGwTest,QueuedPerTransfer)
+{
+    // Requests for the same swarm are served one after the other
+    gw_reply_t first, second;
+    Get(&first,"");
+    Get(&second,"");
+    Run();
+    EXPECT_EQ(200,first.code);
+    EXPECT_EQ(GW_SIZE,first.length);
+    EXPECT_EQ(200,second.code);
+    EXPECT_EQ(GW_SIZE,second.length);
+    EXPECT_EQ(1,gw_maxopen);
+    EXPECT_EQ(1,gw_maxqueued);
+    ExpectIdle();
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    // Chunk c starts with 'a'+c%26
+    FILE *fp = fopen(GWFILE,"wb");
+    char buf[1024];
+    for (int c=0; c*1024<GW_SIZE; c++) {
+        memset(buf,'a'+c%26,1024);
+        fwrite(buf,1,std::min(1024,GW_SIZE-c*1024),fp);
+    }
+    fclose(fp);
+    SwarmID swarmid = SwarmID::NOSWARMID;
+    gwtd = swift::Open(GWFILE,swarmid);
+    if (gwtd < 0)
+        return 1;
+    gwroothex = swift::GetSwarmID(gwtd).hex();
+
+    double maxspeed[2] = { DBL_MAX, DBL_MAX };
+    if (!InstallHTTPGateway(Channel::evbase,Address("127.0.0.1",GW_PORT),POPT_CONT_INT_PROT_MERKLE,
+                            POPT_LIVE_DISC_WND_ALL,SWIFT_DEFAULT_CHUNK_SIZE,maxspeed,"",-1,-1))
+        return 1;
+
+    testing::InitGoogleTest(&argc, argv);
+    int ret = RUN_ALL_TESTS();
+
+    swift::Close(gwtd,true,true);
+    unlink(GWFILE);
+    return ret;
+}
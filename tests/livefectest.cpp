@@ -0,0 +1,112 @@
+/*
+ *  livefectest.cpp
+ *
+ *  Test for the Reed-Solomon erasure code used by live FEC
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "fec.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define TEST_LEN    1024
+
+
+/** Encodes k random chunks with m repairs, erases the chunks in lost and
+ * checks that decoding with the given repairs restores them. */
+bool erase_and_decode(uint32_t k, uint32_t m, std::vector<uint32_t> lost, std::vector<uint32_t> userepairs)
+{
+    std::vector<std::vector<uint8_t> > orig(k,std::vector<uint8_t>(TEST_LEN));
+    std::vector<const uint8_t *> cdata;
+    for (uint32_t i=0; i<k; i++) {
+        for (int b=0; b<TEST_LEN; b++)
+            orig[i][b] = (uint8_t)rand();
+        cdata.push_back(&orig[i][0]);
+    }
+    std::vector<std::vector<uint8_t> > repairs(m,std::vector<uint8_t>(TEST_LEN));
+    for (uint32_t j=0; j<m; j++)
+        FECCodec::Encode(k,j,cdata,&repairs[j][0],TEST_LEN);
+
+    std::vector<std::vector<uint8_t> > recv(orig);
+    std::vector<bool> present(k,true);
+    for (uint32_t l=0; l<lost.size(); l++) {
+        memset(&recv[lost[l]][0],0xAA,TEST_LEN);
+        present[lost[l]] = false;
+    }
+    std::vector<uint8_t *> data;
+    for (uint32_t i=0; i<k; i++)
+        data.push_back(&recv[i][0]);
+    std::vector<uint32_t> repairidx;
+    std::vector<const uint8_t *> rdata;
+    for (uint32_t r=0; r<userepairs.size(); r++) {
+        repairidx.push_back(userepairs[r]);
+        rdata.push_back(&repairs[userepairs[r]][0]);
+    }
+
+    if (!FECCodec::Decode(k,data,present,repairidx,rdata,TEST_LEN))
+        return false;
+    return recv == orig;
+}
+
+
+TEST(TLiveFEC,NoLoss)
+{
+    std::vector<uint32_t> lost, use;
+    ASSERT_TRUE(erase_and_decode(8,2,lost,use));
+}
+
+
+TEST(TLiveFEC,SingleLoss)
+{
+    for (uint32_t l=0; l<8; l++) {
+        std::vector<uint32_t> lost(1,l), use(1,1);
+        ASSERT_TRUE(erase_and_decode(8,2,lost,use));
+    }
+}
+
+
+TEST(TLiveFEC,MaxLoss)
+{
+    // Lose as many data chunks as there are repairs, use them out of order
+    std::vector<uint32_t> lost, use;
+    for (uint32_t i=0; i<16; i++) {
+        lost.push_back(i*4+1);
+        use.push_back(15-i);
+    }
+    ASSERT_TRUE(erase_and_decode(64,16,lost,use));
+}
+
+
+TEST(TLiveFEC,TooFewRepairs)
+{
+    std::vector<uint32_t> lost, use;
+    lost.push_back(0);
+    lost.push_back(5);
+    use.push_back(3);
+    ASSERT_FALSE(erase_and_decode(32,4,lost,use));
+}
+
+
+TEST(TLiveFEC,AllDataLost)
+{
+    std::vector<uint32_t> lost, use;
+    for (uint32_t i=0; i<4; i++) {
+        lost.push_back(i);
+        use.push_back(i+2);
+    }
+    ASSERT_TRUE(erase_and_decode(4,6,lost,use));
+}
+
+
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,432 @@
+/*
+ *  livelatencybench.cpp
+ *
+ *  Live glass-to-glass latency benchmark: one live source and K clients on
+ *  127.0.0.1, each a separate process using the real swift::LiveCreate/
+ *  LiveOpen API. The source injects a chunk every 1/rate seconds carrying
+ *  its injection time. Each client plays out the stream in order from its
+ *  hook-in point and records for every chunk the time from injection until
+ *  it became playable. The benchmark is run twice, once with pull-only
+ *  dissemination and once with the source pushing to -x children (see
+ *  LiveTransfer::PushChunks), and the following is reported as JSON on
+ *  stdout for both runs:
+ *
+ *  - hook-in-to-playout delay, i.e. LiveOpen until the first playable chunk
+ *  - per-chunk playout latency avg/p50/p95/max
+ *  - raw bytes received per chunk played (duplicate overhead of pushing)
+ *
+ *  Usage: livelatencybench [-n clients] [-r chunks-per-s] [-d duration-in-s]
+ *                          [-c chunksize] [-x pushchildren] [-p baseport] [-R] [-N]
+ *  -R also makes clients forward pushed chunks (tree-shaped overlays only),
+ *  -N uses POPT_CONT_INT_PROT_NONE instead of UNIFIED_MERKLE. With the
+ *  latter, pushed chunks arrive before their epoch is signed.
+ *
+ *  POSIX only (uses fork).
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+
+using namespace swift;
+
+
+#define LIVELAT_SOURCE_FILENAME     "livelat-source.dat"
+#define LIVELAT_CLIENT_FILENAME     "livelat-client"
+#define LIVELAT_DISC_WND            4096
+#define LIVELAT_HEADER_SIZE         (sizeof(tint)+sizeof(uint64_t))
+
+
+/** What a client process reports back to the parent */
+struct client_result_t {
+    uint64_t nplayed;        // chunks played out after client start
+    tint     hookin;         // usec from LiveOpen till first playable chunk
+    tint     lat_avg, lat_p50, lat_p95, lat_max;
+    uint64_t raw_bytes_down;
+};
+
+
+/*
+ * Peer process state
+ */
+static int peer_td = -1;
+static uint32_t peer_chunk_size = 0;
+static tint peer_start = 0;
+static client_result_t peer_result;
+
+static LiveTransfer *source_lt = NULL;
+static tint source_interval = 0;
+static uint64_t source_seq = 0;
+static char *source_buf = NULL;
+static struct event evsource;
+
+static std::set<uint64_t> client_got;
+static int64_t client_playpos = -1;
+static std::vector<tint> client_lats;
+
+
+static void peer_init(uint16_t port)
+{
+    LibraryInit();
+    // Channel IDs are scrambled with Channel::start, which forked peers
+    // inherit. Make it differ, else peers look like self-connections.
+    Channel::start = usec_time();
+    Channel::evbase = event_base_new();
+    Address bindaddr("127.0.0.1",port);
+    if (swift::Listen(bindaddr) <= 0) {
+        eprintf("livelatencybench: cannot listen on %s\n", bindaddr.str().c_str());
+        exit(1);
+    }
+}
+
+
+static void StopCallback(int fd, short event, void *arg)
+{
+    event_base_loopexit(Channel::evbase, NULL);
+}
+
+
+static void SourceTimerCallback(int fd, short event, void *arg)
+{
+    tint now = usec_time();
+    memcpy(source_buf,&now,sizeof(tint));
+    memcpy(source_buf+sizeof(tint),&source_seq,sizeof(uint64_t));
+    source_seq++;
+    if (swift::LiveWrite(source_lt,source_buf,peer_chunk_size) < 0) {
+        eprintf("livelatencybench: LiveWrite failed\n");
+        exit(1);
+    }
+    evtimer_add(&evsource, tint2tv(source_interval));
+}
+
+
+/** Source process: creates the live swarm, sends the swarm ID to the parent,
+ * then injects timestamped chunks until SIGTERM. */
+static void run_source(int fd, uint16_t port, uint32_t chunk_size, tint interval,
+                       popt_cont_int_prot_t cipm, uint32_t pushchildren)
+{
+    peer_init(port);
+
+    KeyPair *keypair = KeyPair::Generate(DEFAULT_LIVE_SIG_ALG);
+    if (keypair == NULL)
+        exit(1);
+    source_lt = swift::LiveCreate(LIVELAT_SOURCE_FILENAME,*keypair,"",cipm,LIVELAT_DISC_WND,
+                                  SWIFT_DEFAULT_LIVE_NCHUNKS_PER_SIGN,chunk_size);
+    if (source_lt == NULL)
+        exit(1);
+    source_lt->SetPushChildren(pushchildren);
+
+    std::string hex = source_lt->swarm_id().hex();
+    uint32_t len = hex.length();
+    if (write(fd,&len,sizeof(len)) != sizeof(len) || write(fd,hex.c_str(),len) != len)
+        exit(1);
+
+    peer_chunk_size = chunk_size;
+    source_interval = interval;
+    source_buf = new char[chunk_size];
+    memset(source_buf,'L',chunk_size);
+    evtimer_assign(&evsource, Channel::evbase, SourceTimerCallback, NULL);
+    evtimer_add(&evsource, tint2tv(source_interval));
+
+    struct event *evstop = evsignal_new(Channel::evbase,SIGTERM,StopCallback,NULL);
+    evsignal_add(evstop,NULL);
+    event_base_dispatch(Channel::evbase);
+    exit(0);
+}
+
+
+/** Plays out as far as the received chunks allow, recording the latency
+ * of every chunk injected after this client started. */
+static void ClientProgressCallback(int td, bin_t bin)
+{
+    for (uint64_t c=bin.base_offset(); c<=bin.base_right().base_offset(); c++)
+        client_got.insert(c);
+
+    if (client_playpos < 0) {
+        uint64_t hookin = swift::GetHookinOffset(td)/peer_chunk_size;
+        if (client_got.find(hookin) == client_got.end())
+            return;
+        client_playpos = hookin;
+    }
+
+    std::set<uint64_t>::iterator iter = client_got.find(client_playpos);
+    while (iter != client_got.end() && *iter == (uint64_t)client_playpos) {
+        tint now = usec_time();
+        char hdr[LIVELAT_HEADER_SIZE];
+        if (swift::Read(td,hdr,LIVELAT_HEADER_SIZE,client_playpos*peer_chunk_size) == LIVELAT_HEADER_SIZE) {
+            tint injected;
+            memcpy(&injected,hdr,sizeof(tint));
+            if (peer_result.hookin == 0)
+                peer_result.hookin = now - peer_start;
+            if (injected >= peer_start)
+                client_lats.push_back(now - injected);
+        }
+        client_got.erase(iter++);
+        client_playpos++;
+    }
+}
+
+
+/** Client process: hooks in via the source (which acts as tracker, so
+ * clients learn about each other via PEX) and reports its latencies. */
+static void run_client(int fd, int idx, uint16_t port, uint16_t srcport, std::string swarmidhex,
+                       uint32_t chunk_size, popt_cont_int_prot_t cipm, uint32_t pushchildren,
+                       tint duration)
+{
+    peer_init(port);
+    memset(&peer_result,0,sizeof(peer_result));
+
+    std::ostringstream fn;
+    fn << LIVELAT_CLIENT_FILENAME << idx << ".dat";
+    std::ostringstream tracker;
+    tracker << SWIFT_URI_SCHEME << "://127.0.0.1:" << srcport;
+    Address srcaddr("127.0.0.1",srcport);
+
+    SwarmID swarmid(swarmidhex);
+    peer_chunk_size = chunk_size;
+    peer_start = usec_time();
+    peer_td = swift::LiveOpen(fn.str(),swarmid,tracker.str(),srcaddr,cipm,LIVELAT_DISC_WND,chunk_size);
+    if (peer_td < 0)
+        exit(1);
+    swift::SetLivePushChildren(peer_td,pushchildren);
+    swift::AddProgressCallback(peer_td,&ClientProgressCallback,0);
+
+    struct event *evstop = evtimer_new(Channel::evbase,StopCallback,NULL);
+    evtimer_add(evstop,tint2tv(duration));
+    event_base_dispatch(Channel::evbase);
+
+    peer_result.nplayed = client_lats.size();
+    if (!client_lats.empty()) {
+        std::sort(client_lats.begin(),client_lats.end());
+        tint sum = 0;
+        for (size_t i=0; i<client_lats.size(); i++)
+            sum += client_lats[i];
+        peer_result.lat_avg = sum/(tint)client_lats.size();
+        peer_result.lat_p50 = client_lats[client_lats.size()/2];
+        peer_result.lat_p95 = client_lats[client_lats.size()*95/100];
+        peer_result.lat_max = client_lats.back();
+    }
+    peer_result.raw_bytes_down = Channel::global_raw_bytes_down;
+    if (write(fd,&peer_result,sizeof(peer_result)) != sizeof(peer_result))
+        exit(1);
+    exit(0);
+}
+
+
+static pid_t spawn(int *readfdptr)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        print_error("livelatencybench: pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        print_error("livelatencybench: fork");
+        exit(1);
+    } else if (pid == 0) {
+        close(fds[0]);
+        *readfdptr = fds[1]; // child writes
+    } else {
+        close(fds[1]);
+        *readfdptr = fds[0];
+    }
+    return pid;
+}
+
+
+static bool read_full(int fd, void *buf, size_t nbyte)
+{
+    char *p = (char *)buf;
+    size_t got = 0;
+    while (got < nbyte) {
+        ssize_t ret = read(fd,p+got,nbyte-got);
+        if (ret <= 0)
+            return false;
+        got += ret;
+    }
+    return true;
+}
+
+
+static void remove_files(int nclients)
+{
+    for (int i=-1; i<nclients; i++) {
+        std::ostringstream fn;
+        if (i < 0)
+            fn << LIVELAT_SOURCE_FILENAME;
+        else
+            fn << LIVELAT_CLIENT_FILENAME << i << ".dat";
+        unlink(fn.str().c_str());
+        unlink((fn.str()+".mhash").c_str());
+        unlink((fn.str()+".mbinmap").c_str());
+    }
+}
+
+
+/** Runs one source and nclients clients, returns the number of clients
+ * that played out at least one chunk. */
+static int run_once(int nclients, uint16_t baseport, uint32_t chunk_size, tint interval,
+                    tint duration, popt_cont_int_prot_t cipm, uint32_t srcpush, uint32_t clientpush,
+                    std::vector<client_result_t> &results)
+{
+    remove_files(nclients);
+
+    int srcfd;
+    pid_t srcpid = spawn(&srcfd);
+    if (srcpid == 0)
+        run_source(srcfd,baseport,chunk_size,interval,cipm,srcpush);
+
+    uint32_t len = 0;
+    if (!read_full(srcfd,&len,sizeof(len)) || len == 0 || len > 4096) {
+        eprintf("livelatencybench: source failed\n");
+        exit(1);
+    }
+    std::string hex(len,'\0');
+    if (!read_full(srcfd,&hex[0],len)) {
+        eprintf("livelatencybench: source failed\n");
+        exit(1);
+    }
+
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    for (int i=0; i<nclients; i++) {
+        int fd;
+        pid_t pid = spawn(&fd);
+        if (pid == 0)
+            run_client(fd,i,baseport+1+i,baseport,hex,chunk_size,cipm,clientpush,duration);
+        pids.push_back(pid);
+        fds.push_back(fd);
+    }
+
+    results.resize(nclients);
+    int nplaying = 0;
+    for (int i=0; i<nclients; i++) {
+        if (!read_full(fds[i],&results[i],sizeof(client_result_t)))
+            memset(&results[i],0,sizeof(client_result_t));
+        if (results[i].nplayed > 0)
+            nplaying++;
+        close(fds[i]);
+        waitpid(pids[i],NULL,0);
+    }
+
+    kill(srcpid,SIGTERM);
+    close(srcfd);
+    waitpid(srcpid,NULL,0);
+    remove_files(nclients);
+    return nplaying;
+}
+
+
+static void print_run(const char *name, uint32_t srcpush, uint32_t clientpush, int nplaying,
+                      std::vector<client_result_t> &results, uint32_t chunk_size, bool last)
+{
+    double n = nplaying ? nplaying : 1;
+    double hookin=0.0, avg=0.0, p50=0.0, p95=0.0, bytes_per_chunk=0.0, maxhookin=0.0, maxlat=0.0;
+    for (size_t i=0; i<results.size(); i++) {
+        client_result_t &r = results[i];
+        if (r.nplayed == 0)
+            continue;
+        hookin += (double)r.hookin/TINT_MSEC;
+        maxhookin = std::max(maxhookin,(double)r.hookin/TINT_MSEC);
+        avg += (double)r.lat_avg/TINT_MSEC;
+        p50 += (double)r.lat_p50/TINT_MSEC;
+        p95 += (double)r.lat_p95/TINT_MSEC;
+        maxlat = std::max(maxlat,(double)r.lat_max/TINT_MSEC);
+        bytes_per_chunk += (double)r.raw_bytes_down/r.nplayed;
+    }
+
+    printf("  \"%s\": {\n", name);
+    printf("    \"source_push_children\": %" PRIu32 ",\n", srcpush);
+    printf("    \"client_push_children\": %" PRIu32 ",\n", clientpush);
+    printf("    \"playing\": %d,\n", nplaying);
+    printf("    \"hookin_avg_ms\": %.3f,\n", hookin/n);
+    printf("    \"hookin_max_ms\": %.3f,\n", maxhookin);
+    printf("    \"latency_avg_ms\": %.3f,\n", avg/n);
+    printf("    \"latency_p50_ms\": %.3f,\n", p50/n);
+    printf("    \"latency_p95_ms\": %.3f,\n", p95/n);
+    printf("    \"latency_max_ms\": %.3f,\n", maxlat);
+    printf("    \"raw_bytes_per_chunk\": %.1f,\n", bytes_per_chunk/n);
+    printf("    \"chunk_size\": %" PRIu32 "\n", chunk_size);
+    printf("  }%s\n", last ? "" : ",");
+}
+
+
+static void usage()
+{
+    fprintf(stderr,"Usage: livelatencybench [-n clients] [-r chunks-per-s] [-d duration-in-s] [-c chunksize] [-x pushchildren] [-p baseport] [-R] [-N]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    int nclients = 3;
+    int rate = 50;
+    tint duration = 10*TINT_SEC;
+    uint32_t chunk_size = SWIFT_DEFAULT_CHUNK_SIZE;
+    uint32_t pushchildren = 4;
+    uint16_t baseport = 22000;
+    bool relaypush = false;
+    popt_cont_int_prot_t cipm = POPT_CONT_INT_PROT_UNIFIED_MERKLE;
+
+    int c;
+    while ((c = getopt(argc,argv,"n:r:d:c:x:p:RN")) != -1) {
+        switch (c) {
+        case 'n':
+            nclients = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg)*TINT_SEC;
+            break;
+        case 'c':
+            chunk_size = atoi(optarg);
+            break;
+        case 'x':
+            pushchildren = atoi(optarg);
+            break;
+        case 'p':
+            baseport = atoi(optarg);
+            break;
+        case 'R':
+            relaypush = true;
+            break;
+        case 'N':
+            cipm = POPT_CONT_INT_PROT_NONE;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (nclients < 1 || rate < 1 || duration <= 0 || chunk_size < LIVELAT_HEADER_SIZE) {
+        usage();
+        return 1;
+    }
+    tint interval = TINT_SEC/rate;
+
+    std::vector<client_result_t> pullres, pushres;
+    int pullplaying = run_once(nclients,baseport,chunk_size,interval,duration,cipm,0,0,pullres);
+    uint32_t clientpush = relaypush ? pushchildren : 0;
+    int pushplaying = run_once(nclients,baseport+nclients+1,chunk_size,interval,duration,cipm,
+                               pushchildren,clientpush,pushres);
+
+    printf("{\n");
+    printf("  \"clients\": %d,\n", nclients);
+    printf("  \"chunks_per_s\": %d,\n", rate);
+    printf("  \"cont_int_prot\": %d,\n", (int)cipm);
+    print_run("pull",0,0,pullplaying,pullres,chunk_size,false);
+    print_run("push",pushchildren,clientpush,pushplaying,pushres,chunk_size,true);
+    printf("}\n");
+
+    return (pullplaying == nclients && pushplaying == nclients) ? 0 : 2;
+}
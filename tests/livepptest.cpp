@@ -36,7 +36,7 @@ TEST(TLivePiecePicker,HookinFirst)
     bin_t munro_bin(5,481);
     tint  munro_tint(NOW + TINT_SEC);
 
-    lpp->AddPeerMunro(munro_bin,munro_tint);
+    lpp->AddPeerMunro(munro_bin,munro_tint,0);
 
     bin_t hookin_bin = lpp->GetHookinPos();
     ASSERT_EQ(munro_bin.base_left(),hookin_bin);
@@ -53,7 +53,7 @@ TEST(TLivePiecePicker,ReHookinBitRateTooShort)
     bin_t munro_bin(5,481);
     tint  munro_tint(NOW + TINT_SEC);
 
-    lpp->AddPeerMunro(munro_bin,munro_tint);
+    lpp->AddPeerMunro(munro_bin,munro_tint,0);
 
     bin_t hookin_bin = lpp->GetHookinPos();
     ASSERT_EQ(munro_bin.base_left(),hookin_bin);
@@ -61,7 +61,7 @@ TEST(TLivePiecePicker,ReHookinBitRateTooShort)
     munro_bin = bin_t(5,481+1000);
     munro_tint = NOW + 5*TINT_SEC;   // must be smaller than LIVE_PP_MIN_BITRATE_MEASUREMENT_INTERVAL
 
-    lpp->AddPeerMunro(munro_bin,munro_tint);
+    lpp->AddPeerMunro(munro_bin,munro_tint,0);
     tint current_tint = lpp->CalculateCurrentPosInTime(munro_bin);
 
     fprintf(stderr,"test: current time %s\n", tintstr(current_tint));
@@ -80,7 +80,7 @@ TEST(TLivePiecePicker,ReHookinBitRateGood)
     tint  munro_tint(NOW + TINT_SEC);
 
     fprintf(stderr,"test: Add 1st munro\n");
-    lpp->AddPeerMunro(munro_bin,munro_tint);
+    lpp->AddPeerMunro(munro_bin,munro_tint,0);
 
     bin_t hookin_bin = lpp->GetHookinPos();
     ASSERT_EQ(munro_bin.base_left(),hookin_bin);
@@ -91,7 +91,7 @@ TEST(TLivePiecePicker,ReHookinBitRateGood)
     bin_t new_munro_bin = bin_t(5,481+ntrees);
     tint  new_munro_tint = NOW + TINT_SEC + ntrees*TINT_SEC;
     fprintf(stderr,"test: Add 2nd munro\n");
-    lpp->AddPeerMunro(new_munro_bin,new_munro_tint);
+    lpp->AddPeerMunro(new_munro_bin,new_munro_tint,0);
 
     fprintf(stderr,"test: Verify bitrate\n");
     double gotbitrate = lpp->CalculateBitrate();
@@ -118,6 +118,87 @@ TEST(TLivePiecePicker,ReHookinBitRateGood)
 
 
 
+/** Picker with fixed per-peer throughput, as if channels existed */
+class FixedThroughputLivePiecePicker : public SimpleLivePiecePicker
+{
+public:
+    std::map<uint32_t,double> nchunks_;
+
+    FixedThroughputLivePiecePicker(LiveTransfer* lt) : SimpleLivePiecePicker(lt) {}
+
+    double EstimatePeerChunks(uint32_t channelid, peer_munro_t &pm, tint interval) {
+        return nchunks_[channelid];
+    }
+};
+
+
+/** Adds munros such that the estimated rate is 32 chunks/s, peer 1 having
+ * chunks up to 3231 and peer 2 up to 3551 */
+bin_t adaptive_hookin(FixedThroughputLivePiecePicker *lpp)
+{
+    tint munro_tint(NOW + TINT_SEC);
+
+    lpp->AddPeerMunro(bin_t(5,100),munro_tint,1);
+    // Rate unknown, wait for more munros
+    EXPECT_EQ(bin_t::NONE,lpp->GetHookinPos());
+
+    lpp->AddPeerMunro(bin_t(5,110),munro_tint+10*TINT_SEC,2);
+    EXPECT_EQ(32.0,lpp->CalculateChunkRate());
+    return lpp->GetHookinPos();
+}
+
+
+TEST(TLivePiecePicker,AdaptiveHookinPrebuffer)
+{
+    LiveTransfer *lt = create_lt();
+    FixedThroughputLivePiecePicker *lpp = new FixedThroughputLivePiecePicker(lt);
+    lpp->nchunks_[1] = 1000.0;
+    lpp->nchunks_[2] = 1000.0;
+
+    // Full prebuffer behind the highest edge
+    uint64_t prebuf = 32*SWIFT_LIVE_HOOKIN_PREBUFFER_TIME/TINT_SEC;
+    ASSERT_EQ(bin_t(0,3551-prebuf+1),adaptive_hookin(lpp));
+
+    livepp_stats_t stats;
+    lpp->GetStats(stats);
+    ASSERT_EQ(prebuf,stats.prebuf_chunks);
+    ASSERT_EQ(1,stats.nhookins);
+    ASSERT_EQ(1,stats.npeers);
+    ASSERT_EQ(0,stats.play_time);
+    ASSERT_EQ(0,stats.nstalls);
+}
+
+
+TEST(TLivePiecePicker,AdaptiveHookinSlowPeerAtEdge)
+{
+    LiveTransfer *lt = create_lt();
+    FixedThroughputLivePiecePicker *lpp = new FixedThroughputLivePiecePicker(lt);
+    lpp->nchunks_[1] = 1000.0;
+    lpp->nchunks_[2] = 10.0;
+
+    // Peer 2 alone cannot keep up with the stream, use the edge both have
+    uint64_t prebuf = 32*SWIFT_LIVE_HOOKIN_PREBUFFER_TIME/TINT_SEC;
+    ASSERT_EQ(bin_t(0,3231-prebuf+1),adaptive_hookin(lpp));
+}
+
+
+TEST(TLivePiecePicker,AdaptiveHookinLimitedByThroughput)
+{
+    LiveTransfer *lt = create_lt();
+    FixedThroughputLivePiecePicker *lpp = new FixedThroughputLivePiecePicker(lt);
+    lpp->nchunks_[1] = 5.0;
+    lpp->nchunks_[2] = 5.0;
+
+    // Only 10 chunks can be downloaded within the fill time
+    ASSERT_EQ(bin_t(0,3231-10+1),adaptive_hookin(lpp));
+
+    livepp_stats_t stats;
+    lpp->GetStats(stats);
+    ASSERT_EQ(10,stats.prebuf_chunks);
+    ASSERT_EQ(2,stats.npeers);
+}
+
+
 int main(int argc, char** argv)
 {
 
@@ -0,0 +1,142 @@
+/*
+ *  livepushtest.cpp
+ *
+ *  Tests for live clients keeping chunks pushed before their epoch is
+ *  signed, and checking them when the munro arrives (LIVEPUSH).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define LP_NCHUNKS_PER_SIGN 4
+#define LP_CHUNK_SIZE       1024
+
+const char *LPSOURCE = "livepush-source.dat";
+const char *LPCLIENT = "livepush-client.dat";
+
+
+static void remove_files()
+{
+    unlink(LPSOURCE);
+    unlink(LPCLIENT);
+}
+
+
+/** Source with two epochs, client that verified the first munro */
+class LivePushTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        remove_files();
+        src_ = new LiveTransfer(LPSOURCE,*KeyPair::Generate(DEFAULT_LIVE_SIG_ALG),"",
+                                POPT_CONT_INT_PROT_UNIFIED_MERKLE,POPT_LIVE_DISC_WND_ALL,
+                                LP_NCHUNKS_PER_SIGN,LP_CHUNK_SIZE);
+        char buf[LP_CHUNK_SIZE];
+        for (int c=0; c<2*LP_NCHUNKS_PER_SIGN; c++) {
+            memset(buf,'a'+c,LP_CHUNK_SIZE);
+            ASSERT_EQ(0,src_->AddData(buf,LP_CHUNK_SIZE));
+        }
+
+        SwarmID swarmid = src_->swarm_id();
+        Address addr;
+        client_ = new LiveTransfer(LPCLIENT,swarmid,addr,POPT_CONT_INT_PROT_UNIFIED_MERKLE,
+                                   POPT_LIVE_DISC_WND_ALL,LP_CHUNK_SIZE);
+        ASSERT_TRUE(AddMunro(bin_t(2,0)));
+    }
+
+    virtual void TearDown()
+    {
+        delete client_;
+        delete src_;
+        remove_files();
+    }
+
+    /** As if a signed munro of the source came in, signature checked */
+    bool AddMunro(bin_t munro)
+    {
+        LiveHashTree *srcumt = (LiveHashTree *)src_->hashtree();
+        LiveHashTree *umt = (LiveHashTree *)client_->hashtree();
+        umt->OfferHash(munro,srcumt->FindNode(munro)->GetHash());
+        SigTintTuple sigtint(Signature(),NOW);
+        return umt->AddVerifiedMunro(munro,sigtint);
+    }
+
+    bool Push(uint64_t c, char fill=0)
+    {
+        char buf[LP_CHUNK_SIZE];
+        memset(buf,fill ? fill : 'a'+c,LP_CHUNK_SIZE);
+        return client_->OnPushedData(bin_t(0,c),(const uint8_t *)buf,LP_CHUNK_SIZE);
+    }
+
+    LiveTransfer *src_;
+    LiveTransfer *client_;
+};
+
+
+TEST_F(LivePushTest,VerifiedOnMunro)
+{
+    for (uint64_t c=4; c<8; c++)
+        ASSERT_TRUE(Push(c));
+    EXPECT_EQ(4,client_->GetPushPending());
+    EXPECT_TRUE(client_->ack_out()->is_empty(bin_t(2,1)));
+
+    ASSERT_TRUE(AddMunro(bin_t(2,1)));
+    client_->VerifyPushed(bin_t(2,1));
+    EXPECT_EQ(0,client_->GetPushPending());
+    EXPECT_TRUE(client_->ack_out()->is_filled(bin_t(2,1)));
+    EXPECT_EQ(0,client_->GetHashCheckFails());
+
+    char buf[LP_CHUNK_SIZE];
+    ASSERT_EQ(LP_CHUNK_SIZE,client_->GetStorage()->Read(buf,LP_CHUNK_SIZE,6*LP_CHUNK_SIZE));
+    EXPECT_EQ('a'+6,buf[0]);
+}
+
+
+TEST_F(LivePushTest,CorruptChunk)
+{
+    // A bad chunk spoils the uncle hashes of all others
+    uint64_t fails = Channel::global_hash_check_fails;
+    for (uint64_t c=4; c<8; c++)
+        ASSERT_TRUE(Push(c,c == 6 ? 'X' : 0));
+
+    ASSERT_TRUE(AddMunro(bin_t(2,1)));
+    client_->VerifyPushed(bin_t(2,1));
+    EXPECT_EQ(0,client_->GetPushPending());
+    EXPECT_TRUE(client_->ack_out()->is_empty(bin_t(2,1)));
+    EXPECT_EQ(4,client_->GetHashCheckFails());
+    EXPECT_EQ(fails+4,Channel::global_hash_check_fails);
+}
+
+
+TEST_F(LivePushTest,MissingChunk)
+{
+    for (uint64_t c=4; c<7; c++)
+        ASSERT_TRUE(Push(c));
+    ASSERT_TRUE(AddMunro(bin_t(2,1)));
+    client_->VerifyPushed(bin_t(2,1));
+    EXPECT_EQ(3,client_->GetPushPending());
+    EXPECT_TRUE(client_->ack_out()->is_empty(bin_t(2,1)));
+
+    // The last one completes the epoch, the munro is known already
+    ASSERT_TRUE(Push(7));
+    EXPECT_EQ(0,client_->GetPushPending());
+    EXPECT_TRUE(client_->ack_out()->is_filled(bin_t(2,1)));
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,149 @@
+/*
+ *  prefetchtest.cpp
+ *
+ *  Tests for the HTTP gateway predicting the ranges a player asks for next
+ *  from the ones it asked for, and the picker fetching those (PREFETCH).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define PF_NCHUNKS      64
+#define PF_CHUNK_SIZE   1024
+#define PF_SIZE         (PF_NCHUNKS*PF_CHUNK_SIZE)
+
+const char *PFSEED = "prefetch_seed.dat";
+const char *PFLEECH = "prefetch_leech.dat";
+
+// Not in a header, the HTTP gateway calls these itself
+void HttpGwPrefetchRecord(int td, uint64_t first, uint64_t last);
+void HttpGwGetPrefetchStats(uint64_t *requests, uint64_t *predicted, uint64_t *hits);
+
+
+/** Leecher that knows the size of the content, and a channel to pick for */
+class PrefetchTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        FILE *fp = fopen(PFSEED,"wb");
+        char buf[PF_CHUNK_SIZE];
+        for (int i=0; i<PF_NCHUNKS; i++) {
+            memset(buf,'a'+i%26,PF_CHUNK_SIZE);
+            fwrite(buf,1,PF_CHUNK_SIZE,fp);
+        }
+        fclose(fp);
+
+        // Only one swarm per root hash can be open, so hash then close
+        SwarmID swarmid = SwarmID::NOSWARMID;
+        int seedtd = swift::Open(PFSEED,swarmid);
+        ASSERT_GE(seedtd,0);
+        swarmid = swift::GetSwarmID(seedtd);
+        HashTree *seedht = swift::GetActivatedTransfer(seedtd)->hashtree();
+        std::vector<std::pair<bin_t,Sha1Hash> > peaks;
+        for (int i=0; i<seedht->peak_count(); i++)
+            peaks.push_back(std::make_pair(seedht->peak(i),seedht->peak_hash(i)));
+        swift::Close(seedtd,true,false);
+        unlink(PFSEED);
+
+        td_ = swift::Open(PFLEECH,swarmid);
+        ASSERT_GE(td_,0);
+        leech_ = (FileTransfer *)swift::GetActivatedTransfer(td_);
+        for (int i=0; i<peaks.size(); i++)
+            leech_->hashtree()->OfferHash(peaks[i].first,peaks[i].second);
+        ASSERT_EQ(PF_SIZE,swift::Size(td_));
+
+        channel_ = new Channel(leech_,INVALID_SOCKET,Address("127.0.0.1:1"));
+        offer_.set(bin_t(6,0));
+    }
+
+    virtual void TearDown()
+    {
+        delete channel_;
+        swift::Close(td_,true,true);
+    }
+
+    bin_t Pick()
+    {
+        return leech_->picker()->Pick(offer_,PF_NCHUNKS,NOW+TINT_SEC,channel_->id());
+    }
+
+    int td_;
+    FileTransfer *leech_;
+    Channel *channel_;
+    binmap_t offer_;
+};
+
+
+TEST_F(PrefetchTest,Sequential)
+{
+    // Range requests that continue where the last one ended
+    HttpGwPrefetchRecord(td_,0,4*PF_CHUNK_SIZE-1);
+    HttpGwPrefetchRecord(td_,4*PF_CHUNK_SIZE,8*PF_CHUNK_SIZE-1);
+    EXPECT_EQ(bin_t(2,2),Pick());
+    EXPECT_EQ(bin_t(2,3),Pick());
+    EXPECT_EQ(bin_t(2,4),Pick());
+
+    // Nothing more predicted, rarest-first takes over
+    bin_t hint = Pick();
+    EXPECT_TRUE(hint.is_none() || hint.base_offset() >= 20 || hint.base_offset()+hint.base_length() <= 8);
+}
+
+
+TEST_F(PrefetchTest,Stride)
+{
+    // DASH segments of 2 chunks every 8 chunks, e.g. one quality level
+    HttpGwPrefetchRecord(td_,0,2*PF_CHUNK_SIZE-1);
+    HttpGwPrefetchRecord(td_,8*PF_CHUNK_SIZE,10*PF_CHUNK_SIZE-1);
+    EXPECT_EQ(bin_t(1,8),Pick());
+    EXPECT_EQ(bin_t(1,12),Pick());
+    EXPECT_EQ(bin_t(1,16),Pick());
+}
+
+
+TEST_F(PrefetchTest,ClampedAtEnd)
+{
+    HttpGwPrefetchRecord(td_,44*PF_CHUNK_SIZE,52*PF_CHUNK_SIZE-1);
+    HttpGwPrefetchRecord(td_,52*PF_CHUNK_SIZE,60*PF_CHUNK_SIZE-1);
+    EXPECT_EQ(bin_t(2,15),Pick());
+    bin_t hint = Pick();
+    EXPECT_TRUE(hint.is_none() || hint.base_offset()+hint.base_length() <= 60);
+}
+
+
+TEST_F(PrefetchTest,NoPattern)
+{
+    uint64_t requests0, predicted0, hits0;
+    HttpGwGetPrefetchStats(&requests0,&predicted0,&hits0);
+
+    HttpGwPrefetchRecord(td_,0,4*PF_CHUNK_SIZE-1);
+    HttpGwPrefetchRecord(td_,4*PF_CHUNK_SIZE,8*PF_CHUNK_SIZE-1);
+    // Asked for what was predicted, not there yet
+    HttpGwPrefetchRecord(td_,8*PF_CHUNK_SIZE,12*PF_CHUNK_SIZE-1);
+    // Jump back, no pattern, so the request after it is not predicted
+    HttpGwPrefetchRecord(td_,2*PF_CHUNK_SIZE,3*PF_CHUNK_SIZE-1);
+    HttpGwPrefetchRecord(td_,16*PF_CHUNK_SIZE,17*PF_CHUNK_SIZE-1);
+
+    uint64_t requests, predicted, hits;
+    HttpGwGetPrefetchStats(&requests,&predicted,&hits);
+    EXPECT_EQ(5,requests-requests0);
+    EXPECT_EQ(1,predicted-predicted0);
+    EXPECT_EQ(0,hits-hits0);
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,229 @@
+/*
+ *  relaytreetest.cpp
+ *
+ *  Tests for the live source serving only a few first-tier relays and
+ *  steering other peers to them (RELAYTREE).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace swift;
+
+
+#define RT_NCHUNKS_PER_SIGN 4
+#define RT_CHUNK_SIZE       1024
+#define RT_NPEERS           4
+#define RT_NRELAYS          2
+
+const char *RTSOURCE = "relaytree-source.dat";
+
+
+/** Source whose relay selection can be run and inspected */
+class RelayTransfer : public LiveTransfer
+{
+public:
+    RelayTransfer() :
+        LiveTransfer(RTSOURCE,*KeyPair::Generate(DEFAULT_LIVE_SIG_ALG),"",POPT_CONT_INT_PROT_UNIFIED_MERKLE,
+                     POPT_LIVE_DISC_WND_ALL,RT_NCHUNKS_PER_SIGN,RT_CHUNK_SIZE) {}
+
+    void Rebalance()
+    {
+        LiveTransfer::Rebalance();
+    }
+    std::vector<uint32_t> &relays()
+    {
+        return relays_;
+    }
+};
+
+
+/** Established channel to a peer with a given path capacity */
+class RelayChannel : public Channel
+{
+public:
+    RelayChannel(ContentTransfer *transfer, Address peer) : Channel(transfer,INVALID_SOCKET,peer)
+    {
+        hs_in_ = new Handshake(*hs_out_);
+        hs_in_->peer_channel_id_ = id()+1000;
+        own_id_mentioned_ = true;
+    }
+
+    /** Window of cwnd chunks per 100 ms RTT */
+    void SetPath(float cwnd)
+    {
+        cwnd_ = cwnd;
+        rtt_avg_ = 100*TINT_MSEC;
+    }
+    /** Channel IDs of the relays queued for PEX to the peer */
+    std::vector<uint32_t> RelayPex()
+    {
+        std::vector<uint32_t> ids;
+        tbqueue::iterator iter;
+        for (iter=reverse_pex_out_.begin(); iter!=reverse_pex_out_.end(); iter++)
+            ids.push_back((*iter).bin.toUInt());
+        return ids;
+    }
+    size_t HaveBytes()
+    {
+        struct evbuffer *evb = evbuffer_new();
+        AddHave(evb);
+        size_t len = evbuffer_get_length(evb);
+        evbuffer_free(evb);
+        return len;
+    }
+};
+
+
+/** Source with two signed epochs and RT_NPEERS peers connected */
+class RelayTreeTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        unlink(RTSOURCE);
+        src_ = new RelayTransfer();
+        char buf[RT_CHUNK_SIZE];
+        for (int c=0; c<2*RT_NCHUNKS_PER_SIGN; c++) {
+            memset(buf,'a'+c,RT_CHUNK_SIZE);
+            ASSERT_EQ(0,src_->AddData(buf,RT_CHUNK_SIZE));
+        }
+        for (int i=0; i<RT_NPEERS; i++) {
+            char addr[32];
+            sprintf(addr,"130.161.0.%d:7758",i+1);
+            RelayChannel *c = new RelayChannel(src_,Address(addr));
+            c->SetPath(10);
+            peers_.push_back(c);
+        }
+        src_->SetTier1Relays(RT_NRELAYS);
+    }
+
+    virtual void TearDown()
+    {
+        for (int i=0; i<peers_.size(); i++)
+            delete peers_[i];
+        delete src_;
+        unlink(RTSOURCE);
+    }
+
+    /** What Channel::Send() does before announcing anything */
+    void Connect()
+    {
+        for (int i=0; i<peers_.size(); i++)
+            src_->UpdateRelay(peers_[i]);
+    }
+
+    std::vector<uint32_t> Ids(int first, int last)
+    {
+        std::vector<uint32_t> ids;
+        for (int i=first; i<=last; i++)
+            ids.push_back(peers_[i]->id());
+        return ids;
+    }
+
+    RelayTransfer *src_;
+    std::vector<RelayChannel *> peers_;
+};
+
+
+TEST_F(RelayTreeTest,PromotedUntilFull)
+{
+    Connect();
+    EXPECT_EQ(Ids(0,RT_NRELAYS-1),src_->relays());
+    for (int i=0; i<RT_NPEERS; i++)
+        EXPECT_EQ(i < RT_NRELAYS,src_->IsServed(peers_[i])) << "peer " << i;
+
+    // A free slot goes to the next peer that comes along
+    delete peers_[0];
+    peers_.erase(peers_.begin());
+    Connect();
+    EXPECT_EQ(Ids(0,RT_NRELAYS-1),src_->relays());
+}
+
+
+TEST_F(RelayTreeTest,SteeredToRelays)
+{
+    Connect();
+    for (int i=0; i<RT_NRELAYS; i++)
+        EXPECT_TRUE(peers_[i]->RelayPex().empty()) << "relay " << i;
+    for (int i=RT_NRELAYS; i<RT_NPEERS; i++) {
+        EXPECT_EQ(Ids(0,RT_NRELAYS-1),peers_[i]->RelayPex()) << "peer " << i;
+        EXPECT_EQ(NOW,peers_[i]->GetRelayPexTime());
+    }
+
+    // Not again until SWIFT_LIVE_RELAY_STEER_INTERVAL has passed
+    tint pextime = peers_[RT_NRELAYS]->GetRelayPexTime();
+    Connect();
+    EXPECT_EQ(RT_NRELAYS,peers_[RT_NRELAYS]->RelayPex().size());
+    EXPECT_EQ(pextime,peers_[RT_NRELAYS]->GetRelayPexTime());
+}
+
+
+TEST_F(RelayTreeTest,WeakestReplaced)
+{
+    Connect();
+
+    // Not enough better to swap
+    peers_[1]->SetPath(5);
+    peers_[2]->SetPath(5*SWIFT_LIVE_RELAY_SWAP_FACTOR);
+    src_->Rebalance();
+    EXPECT_EQ(Ids(0,1),src_->relays());
+
+    peers_[3]->SetPath(11*SWIFT_LIVE_RELAY_SWAP_FACTOR);
+    src_->Rebalance();
+    std::vector<uint32_t> want;
+    want.push_back(peers_[0]->id());
+    want.push_back(peers_[3]->id());
+    EXPECT_EQ(want,src_->relays());
+    EXPECT_FALSE(src_->IsServed(peers_[1]));
+    EXPECT_TRUE(src_->IsServed(peers_[3]));
+
+    // The demoted relay is sent to the new ones
+    EXPECT_EQ(want,peers_[1]->RelayPex());
+}
+
+
+TEST_F(RelayTreeTest,RebalanceFillsFreeSlots)
+{
+    src_->SetTier1Relays(RT_NRELAYS+1);
+    peers_[1]->SetPath(5);
+    peers_[2]->SetPath(20);
+    peers_[3]->SetPath(30);
+    src_->Rebalance();
+    std::vector<uint32_t> want;
+    want.push_back(peers_[3]->id());
+    want.push_back(peers_[2]->id());
+    want.push_back(peers_[0]->id());
+    EXPECT_EQ(want,src_->relays());
+}
+
+
+TEST_F(RelayTreeTest,HavesToRelaysOnly)
+{
+    Connect();
+    for (int i=0; i<RT_NPEERS; i++) {
+        if (i < RT_NRELAYS)
+            EXPECT_GT(peers_[i]->HaveBytes(),0) << "peer " << i;
+        else
+            EXPECT_EQ(0,peers_[i]->HaveBytes()) << "peer " << i;
+    }
+
+    // Without relays the source serves everyone
+    src_->SetTier1Relays(0);
+    EXPECT_TRUE(src_->IsServed(peers_[RT_NPEERS-1]));
+    EXPECT_GT(peers_[RT_NPEERS-1]->HaveBytes(),0);
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
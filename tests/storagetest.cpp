@@ -0,0 +1,242 @@
+/*
+ *  storagetest.cpp
+ *
+ *  Tests for buffered, coalesced writes in Storage (WRITEBUF).
+ *
+ *  Copyright 2009-2016 Vrije Universiteit Amsterdam. All rights reserved.
+ *
+ */
+#include "swift.h"
+#include "compat.h"
+#include <gtest/gtest.h>
+
+using namespace swift;
+
+
+#define ST_CHUNK_SIZE   1024
+#define ST_NCHUNKS      (4*SWIFT_STORAGE_WRITE_BLOCK/ST_CHUNK_SIZE)
+
+const char *STFILE = "storagetest.dat";
+
+
+static void fill_chunk(char *buf, int chunk, int version=0)
+{
+    for (int i=0; i<ST_CHUNK_SIZE; i++)
+        buf[i] = (char)(chunk*7+i+version);
+}
+
+
+static bool check_chunk(const char *buf, int chunk, int version=0)
+{
+    char want[ST_CHUNK_SIZE];
+    fill_chunk(want,chunk,version);
+    return memcmp(buf,want,ST_CHUNK_SIZE) == 0;
+}
+
+
+/** Write all chunks in a scattered order, as rarest-first would */
+static void write_scattered(Storage &storage)
+{
+    char buf[ST_CHUNK_SIZE];
+    for (int i=0; i<ST_NCHUNKS; i++) {
+        int c = (i*37) % ST_NCHUNKS;
+        fill_chunk(buf,c);
+        ASSERT_EQ(ST_CHUNK_SIZE,storage.Write(buf,ST_CHUNK_SIZE,(int64_t)c*ST_CHUNK_SIZE));
+    }
+}
+
+
+static void check_file(const char *filename)
+{
+    FILE *fp = fopen(filename,"rb");
+    ASSERT_TRUE(fp != NULL);
+    char buf[ST_CHUNK_SIZE];
+    for (int c=0; c<ST_NCHUNKS; c++) {
+        ASSERT_EQ(ST_CHUNK_SIZE,fread(buf,1,ST_CHUNK_SIZE,fp));
+        EXPECT_TRUE(check_chunk(buf,c)) << "chunk " << c;
+    }
+    fclose(fp);
+}
+
+
+TEST(StorageTest,CoalescedWrites)
+{
+    unlink(STFILE);
+    Storage storage(STFILE,".",-1,0);
+    char buf[ST_CHUNK_SIZE];
+    fill_chunk(buf,0);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage.Write(buf,ST_CHUNK_SIZE,0));
+    ASSERT_EQ(0,storage.ResizeReserved((int64_t)ST_NCHUNKS*ST_CHUNK_SIZE));
+    EXPECT_EQ((int64_t)ST_NCHUNKS*ST_CHUNK_SIZE,file_size_by_path_utf8(STFILE));
+
+    uint64_t writes = Storage::global_disk_writes;
+    write_scattered(storage);
+    // 37 is coprime with the number of chunks, so blocks fill up late
+    EXPECT_LE(Storage::global_disk_writes-writes,ST_NCHUNKS*ST_CHUNK_SIZE/SWIFT_STORAGE_WRITE_BLOCK);
+
+    for (int c=0; c<ST_NCHUNKS; c++) {
+        ASSERT_EQ(ST_CHUNK_SIZE,storage.Read(buf,ST_CHUNK_SIZE,(int64_t)c*ST_CHUNK_SIZE));
+        EXPECT_TRUE(check_chunk(buf,c)) << "chunk " << c;
+    }
+    EXPECT_EQ(0,storage.Flush());
+    EXPECT_EQ(0,storage.GetBufferedBytes());
+    check_file(STFILE);
+}
+
+
+TEST(StorageTest,ReadBeforeFlush)
+{
+    unlink(STFILE);
+    Storage *storage = new Storage(STFILE,".",-1,0);
+    char buf[ST_CHUNK_SIZE];
+    fill_chunk(buf,0);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage->Write(buf,ST_CHUNK_SIZE,0));
+    fill_chunk(buf,4);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage->Write(buf,ST_CHUNK_SIZE,4*ST_CHUNK_SIZE));
+    EXPECT_EQ(2*ST_CHUNK_SIZE,storage->GetBufferedBytes());
+
+    // Not on disk yet, the gap reads as a hole
+    char all[5*ST_CHUNK_SIZE];
+    ASSERT_EQ(5*ST_CHUNK_SIZE,storage->Read(all,5*ST_CHUNK_SIZE,0));
+    EXPECT_TRUE(check_chunk(all,0));
+    for (int i=ST_CHUNK_SIZE; i<4*ST_CHUNK_SIZE; i++)
+        ASSERT_EQ(0,all[i]);
+    EXPECT_TRUE(check_chunk(all+4*ST_CHUNK_SIZE,4));
+
+    // Rewrite of buffered data
+    fill_chunk(buf,4,1);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage->Write(buf,ST_CHUNK_SIZE,4*ST_CHUNK_SIZE));
+    ASSERT_EQ(ST_CHUNK_SIZE,storage->Read(buf,ST_CHUNK_SIZE,4*ST_CHUNK_SIZE));
+    EXPECT_TRUE(check_chunk(buf,4,1));
+
+    // Closing writes everything out
+    fill_chunk(buf,2);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage->Write(buf,ST_CHUNK_SIZE,2*ST_CHUNK_SIZE));
+    delete storage;
+    EXPECT_EQ(0,Storage::GetGlobalBufferedBytes());
+    FILE *fp = fopen(STFILE,"rb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(5*ST_CHUNK_SIZE,fread(all,1,5*ST_CHUNK_SIZE,fp));
+    fclose(fp);
+    EXPECT_TRUE(check_chunk(all+2*ST_CHUNK_SIZE,2));
+    EXPECT_TRUE(check_chunk(all+4*ST_CHUNK_SIZE,4,1));
+}
+
+
+TEST(StorageTest,DirectIO)
+{
+    // Falls back to normal writes where the filesystem has no O_DIRECT
+    unlink(STFILE);
+    Storage::SetDirectIO(true);
+    Storage storage(STFILE,".",-1,0);
+    char buf[ST_CHUNK_SIZE];
+    fill_chunk(buf,0);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage.Write(buf,ST_CHUNK_SIZE,0));
+    Storage::SetDirectIO(false);
+    ASSERT_EQ(0,storage.ResizeReserved((int64_t)ST_NCHUNKS*ST_CHUNK_SIZE));
+
+    write_scattered(storage);
+    EXPECT_EQ(0,storage.Flush());
+    check_file(STFILE);
+}
+
+
+/** Multi-file swarm of many small files, some empty, so chunks span files */
+#define ST_MF_DIR       "storagetest_mf"
+#define ST_MF_NFILES    300
+
+static std::string create_multifile(std::string &content)
+{
+    std::ostringstream body;
+    std::string files;
+    mkdir_utf8(ST_MF_DIR);
+    for (int i=0; i<ST_MF_NFILES; i++) {
+        char name[64];
+        sprintf(name,"f%03d.dat",i);
+        std::string data;
+        for (int j=0; j<(i*53)%200; j++)
+            data.push_back((char)(i+j));
+        FILE *fp = fopen((std::string(ST_MF_DIR)+FILE_SEP+name).c_str(),"wb");
+        fwrite(data.data(),1,data.length(),fp);
+        fclose(fp);
+        body << name << " " << data.length() << "\n";
+        files += data;
+    }
+
+    // The spec lists its own size
+    std::string head = Storage::MULTIFILE_PATHNAME+" ";
+    size_t fixed = head.length()+1+body.str().length();
+    size_t specsize = fixed;
+    while (fixed+std::to_string((unsigned long long)specsize).length() != specsize)
+        specsize = fixed+std::to_string((unsigned long long)specsize).length();
+    std::string spec = head+std::to_string((unsigned long long)specsize)+"\n"+body.str();
+
+    std::string specpath = std::string(ST_MF_DIR)+FILE_SEP+"spec.txt";
+    FILE *fp = fopen(specpath.c_str(),"wb");
+    fwrite(spec.data(),1,spec.length(),fp);
+    fclose(fp);
+    content = spec+files;
+    return specpath;
+}
+
+
+TEST(StorageTest,MultiFilePool)
+{
+    std::string content;
+    std::string specpath = create_multifile(content);
+    StorageFile::SetMaxOpenFiles(16);
+    uint64_t opens = StorageFile::global_file_opens;
+
+    Storage storage(specpath,ST_MF_DIR,-1,0);
+    ASSERT_TRUE(storage.IsOperational());
+    EXPECT_EQ((int64_t)content.length(),storage.GetSizeFromSpec());
+    EXPECT_LE(StorageFile::GetOpenFiles(),16);
+
+    // Read in chunks that span several files each
+    char buf[ST_CHUNK_SIZE];
+    for (size_t off=0; off<content.length(); off+=ST_CHUNK_SIZE) {
+        size_t want = std::min((size_t)ST_CHUNK_SIZE,content.length()-off);
+        ASSERT_EQ(want,storage.Read(buf,ST_CHUNK_SIZE,off)) << "offset " << off;
+        ASSERT_EQ(0,memcmp(buf,content.data()+off,want)) << "offset " << off;
+    }
+    EXPECT_LE(StorageFile::GetOpenFiles(),16);
+    EXPECT_GT(StorageFile::global_file_opens-opens,ST_MF_NFILES);
+
+    // Write a chunk in the middle, over several files
+    size_t off = content.length()/2;
+    for (int i=0; i<ST_CHUNK_SIZE; i++)
+        buf[i] = (char)(255-i);
+    ASSERT_EQ(ST_CHUNK_SIZE,storage.Write(buf,ST_CHUNK_SIZE,off));
+    ASSERT_EQ(0,storage.Flush());
+    memcpy(&content[off],buf,ST_CHUNK_SIZE);
+
+    // Fewer files open than the test uses
+    StorageFile::SetMaxOpenFiles(2);
+    EXPECT_EQ(2,StorageFile::GetOpenFiles());
+    for (size_t off=0; off<content.length(); off+=ST_CHUNK_SIZE) {
+        size_t want = std::min((size_t)ST_CHUNK_SIZE,content.length()-off);
+        ASSERT_EQ(want,storage.Read(buf,ST_CHUNK_SIZE,off)) << "offset " << off;
+        ASSERT_EQ(0,memcmp(buf,content.data()+off,want)) << "offset " << off;
+    }
+    StorageFile::SetMaxOpenFiles(SWIFT_STORAGE_MAX_OPEN_FILES);
+}
+
+
+int main(int argc, char** argv)
+{
+    LibraryInit();
+    Channel::evbase = event_base_new();
+
+    testing::InitGoogleTest(&argc, argv);
+    int ret = RUN_ALL_TESTS();
+
+    unlink(STFILE);
+    for (int i=0; i<ST_MF_NFILES; i++) {
+        char name[64];
+        sprintf(name,"%s%sf%03d.dat",ST_MF_DIR,FILE_SEP,i);
+        unlink(name);
+    }
+    unlink((std::string(ST_MF_DIR)+FILE_SEP+"spec.txt").c_str());
+    rmdir(ST_MF_DIR);
+    return ret;
+}
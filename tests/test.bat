@@ -7,13 +7,22 @@ binstest3.exe
 binstest4.exe
 bttracktest.exe
 chunkaddrtest.exe
+deadlinepptest.exe
 REM connecttest.exe
+deduptest.exe
 dgramtest.exe
 freemap.exe
+hashduptest.exe
 hashtest.exe
+httpgwtest.exe
+livefectest.exe
+livepushtest.exe
 livepptest.exe
 livesigtest.exe
 livetreetest.exe
+prefetchtest.exe
+relaytreetest.exe
+storagetest.exe
 transfertest.exe
 
 activatetest.py
@@ -7,9 +7,18 @@ binstest2
 binstest3
 binstest4
 chunkaddrtest
+deadlinepptest
+deduptest
 dgramtest
 freemap
+hashduptest
 hashtest
+httpgwtest
+livefectest
+livepushtest
+prefetchtest
+relaytreetest
+storagetest
 transfertest
 python activatetest.py
 python cmdgwtest.py
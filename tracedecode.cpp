@@ -0,0 +1,162 @@
+/*
+ *  tracedecode.cpp
+ *  Decodes channel trace dumps obtained via the cmdgw DUMPTRACE command
+ *  (see telemetry.h) into CSV or Chrome trace JSON (chrome://tracing).
+ *
+ *  Usage: tracedecode [-j] [dumpfile]
+ *
+ *  Copyright 2009-2016 TECHNISCHE UNIVERSITEIT DELFT. All rights reserved.
+ *
+ */
+#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace swift;
+
+// Same order as Channel::send_control_t
+static const char *trace_modes[] = { "keepalive", "pingpong", "slowstart", "standard_aimd", "ledbat", "closing" };
+static const char *trace_names[] = { "?", "send", "recv", "ack", "loss", "cwnd", "owd" };
+
+struct trace_record_t {
+    int64_t     time;
+    uint32_t    chid;
+    uint8_t     type;
+    uint32_t    a;
+    uint64_t    b;
+};
+
+
+static uint64_t get_be(const unsigned char *p, int n)
+{
+    uint64_t v = 0;
+    for (int i=0; i<n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+
+static const char *trace_name(uint8_t type)
+{
+    return type <= TRACE_OWD ? trace_names[type] : trace_names[0];
+}
+
+
+static const char *trace_mode(uint32_t mode)
+{
+    return mode < sizeof(trace_modes)/sizeof(trace_modes[0]) ? trace_modes[mode] : "?";
+}
+
+
+static void print_csv(std::vector<trace_record_t> &recs)
+{
+    printf("time_us,channel,event,a,b\n");
+    for (int i=0; i<recs.size(); i++) {
+        trace_record_t &r = recs[i];
+        printf("%lld,%u,%s,", (long long)r.time, r.chid, trace_name(r.type));
+        if (r.type == TRACE_CWND)
+            printf("%s,%.3f\n", trace_mode(r.a), (double)r.b/1000.0);
+        else if (r.type == TRACE_OWD)
+            printf("%u,%lld\n", r.a, (long long)(int64_t)r.b);
+        else
+            printf("%u,%llu\n", r.a, (unsigned long long)r.b);
+    }
+}
+
+
+static void print_chrome(std::vector<trace_record_t> &recs)
+{
+    // Counters for continuous values, instant events for the rest. One
+    // thread per channel.
+    printf("{\"traceEvents\":[\n");
+    for (int i=0; i<recs.size(); i++) {
+        trace_record_t &r = recs[i];
+        printf("%s{\"pid\":1,\"tid\":%u,\"ts\":%lld,\"name\":\"%s\",", i ? ",\n" : "",
+               r.chid, (long long)r.time, trace_name(r.type));
+        switch (r.type) {
+        case TRACE_CWND:
+            printf("\"ph\":\"C\",\"args\":{\"cwnd\":%.3f}}", (double)r.b/1000.0);
+            break;
+        case TRACE_OWD:
+            printf("\"ph\":\"C\",\"args\":{\"owd_us\":%lld}}", (long long)(int64_t)r.b);
+            break;
+        case TRACE_ACK:
+            printf("\"ph\":\"C\",\"args\":{\"rtt_us\":%u}}", r.a);
+            break;
+        default:
+            printf("\"ph\":\"i\",\"s\":\"t\",\"args\":{\"a\":%u,\"b\":%llu}}", r.a, (unsigned long long)r.b);
+            break;
+        }
+    }
+    printf("\n]}\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool chrome = false;
+    const char *filename = NULL;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i],"-j"))
+            chrome = true;
+        else if (argv[i][0] == '-') {
+            fprintf(stderr,"Usage: %s [-j] [dumpfile]\n", argv[0]);
+            return 1;
+        } else
+            filename = argv[i];
+    }
+
+    FILE *fp = filename == NULL ? stdin : fopen(filename,"rb");
+    if (fp == NULL) {
+        fprintf(stderr,"tracedecode: cannot open %s\n", filename);
+        return 1;
+    }
+    std::string data;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf,1,sizeof(buf),fp)) > 0)
+        data.append(buf,n);
+    if (fp != stdin)
+        fclose(fp);
+
+    // Skip cmdgw "TRACE roothash nbytes\r\n" line, if saved along
+    size_t off = 0;
+    if (!data.compare(0,6,"TRACE ")) {
+        off = data.find("\r\n");
+        if (off == std::string::npos) {
+            fprintf(stderr,"tracedecode: bad TRACE line\n");
+            return 1;
+        }
+        off += 2;
+    }
+    size_t hdrlen = strlen(TRACE_DUMP_MAGIC)+1;
+    if (data.size() < off+hdrlen || data.compare(off,strlen(TRACE_DUMP_MAGIC),TRACE_DUMP_MAGIC)) {
+        fprintf(stderr,"tracedecode: not a trace dump\n");
+        return 1;
+    }
+    if ((uint8_t)data[off+hdrlen-1] != TRACE_DUMP_VERSION) {
+        fprintf(stderr,"tracedecode: unsupported version %d\n", (int)(uint8_t)data[off+hdrlen-1]);
+        return 1;
+    }
+    off += hdrlen;
+
+    std::vector<trace_record_t> recs;
+    const unsigned char *p = (const unsigned char *)data.data();
+    for (; off+TRACE_RECORD_SIZE <= data.size(); off += TRACE_RECORD_SIZE) {
+        trace_record_t r;
+        r.time = (int64_t)get_be(p+off,8);
+        r.chid = (uint32_t)get_be(p+off+8,4);
+        r.type = p[off+12];
+        r.a = (uint32_t)get_be(p+off+13,4);
+        r.b = get_be(p+off+17,8);
+        recs.push_back(r);
+    }
+
+    if (chrome)
+        print_chrome(recs);
+    else
+        print_csv(recs);
+    return 0;
+}
@@ -14,6 +14,7 @@
 #include "ext/seq_picker.cpp" // FIXME FIXME FIXME FIXME
 #include "ext/vod_picker.cpp"
 #include "ext/rf_picker.cpp"
+#include "ext/deadline_picker.cpp"
 
 using namespace swift;
 
@@ -22,7 +23,8 @@ using namespace swift;
 // FIXME: separate Bootstrap() and Download(), then Size(), Progress(), SeqProgress()
 
 FileTransfer::FileTransfer(int td, std::string filename, const Sha1Hash& root_hash, bool force_check_diskvshash,
-                           popt_cont_int_prot_t cipm, uint32_t chunk_size, bool zerostate, std::string metadir) :
+                           popt_cont_int_prot_t cipm, uint32_t chunk_size, bool zerostate, std::string metadir,
+                           popt_merkle_func_t merkle_func) :
     ContentTransfer(FILE_TRANSFER), availability_(NULL), zerostate_(zerostate)
 {
     td_ = td;
@@ -88,21 +90,30 @@ FileTransfer::FileTransfer(int td, std::string filename, const Sha1Hash& root_ha
     // automatic size determination via peak hashes.
     if (!zerostate_) {
         hashtree_ = (HashTree *)new MmapHashTree(storage_,root_hash,chunk_size,hash_filename,force_check_diskvshash,
-                    binmap_filename);
+                    binmap_filename,merkle_func);
         availability_ = new Availability(SWIFT_MAX_OUTGOING_CONNECTIONS);
 
         if (ENABLE_VOD_PIECEPICKER)
             picker_ = new VodPiecePicker(this);
+        else if (ENABLE_DEADLINE_PIECEPICKER)
+            picker_ = new DeadlinePiecePicker(this);
         else
             //picker_ = new SeqPiecePicker(this);
             picker_ = new RFPiecePicker(this);
         picker_->Randomize(rand()&63);
     } else {
         // ZEROHASH
-        hashtree_ = (HashTree *)new ZeroHashTree(storage_,root_hash,chunk_size,hash_filename,binmap_filename);
+        hashtree_ = (HashTree *)new ZeroHashTree(storage_,root_hash,chunk_size,hash_filename,binmap_filename,merkle_func);
     }
+    // A checkpoint may override the hash function asked for
+    GetDefaultHandshake().merkle_func_ = hashtree_->hash_func();
 
     UpdateOperational();
+
+    // DEDUP
+    if (!zerostate_ && IsOperational())
+        ChunkIndex::GetInstance()->AddTransfer(this,filename,destdir,hash_filename,binmap_filename,
+                                               meta_mfspec_filename);
 }
 
 
@@ -118,6 +129,12 @@ void FileTransfer::UpdateOperational()
 
 FileTransfer::~FileTransfer()
 {
+    ChunkIndex::GetInstance()->RemoveTransfer(this);
+
+    // WRITEBUF: Storage refers to the hashtree
+    if (storage_ != NULL)
+        (void)storage_->Flush();
+
     if (hashtree_ != NULL) {
         delete hashtree_;
         hashtree_ = NULL;
@@ -137,3 +154,29 @@ FileTransfer::~FileTransfer()
     }
 }
 
+
+void FileTransfer::OnDataVerified(bin_t pos)
+{
+    ChunkIndex *ci = ChunkIndex::GetInstance();
+    if (!ci->IsEnabled())
+        return;
+    ci->AddChunk(this,pos);
+
+    // Verifying pos proved the hash of its sibling, see if that chunk is
+    // already here under another swarm
+    bin_t sibling = pos.sibling();
+    if (ack_out()->is_filled(sibling) || sibling.base_offset() >= hashtree_->size_in_chunks())
+        return;
+    Sha1Hash leafhash = hashtree_->hash(sibling);
+    if (leafhash == Sha1Hash::ZERO)
+        return;
+
+    char *buf = new char[chunk_size()];
+    ssize_t r = ci->Read(leafhash,chunk_size(),buf,this);
+    if (r > 0 && hashtree_->OfferData(sibling,buf,r)) {
+        dprintf("%s %s dedup %s\n",tintstr(),hashtree_->root_hash().hex().c_str(),sibling.str().c_str());
+        ci->AddChunk(this,sibling);
+        Progress(ack_out()->cover(sibling));
+    }
+    delete[] buf;
+}
@@ -28,11 +28,13 @@ using namespace swift;
 
 
 ZeroHashTree::ZeroHashTree(Storage *storage, const Sha1Hash& root_hash, uint32_t chunk_size, std::string hash_filename,
-                           std::string binmap_filename) :
-    HashTree(), root_hash_(root_hash), peak_count_(0), hash_fd_(0),
+                           std::string binmap_filename, popt_merkle_func_t hash_func) :
+    HashTree(), root_hash_(root_hash), peak_count_(0), hash_fd_(0), hash_func_(hash_func),
     size_(0), sizec_(0), complete_(0), completec_(0),
     chunk_size_(chunk_size), storage_(storage)
 {
+    root_hash_.func_ = hash_func_;
+
     // MULTIFILE
     storage_->SetHashTree(this);
 
@@ -138,29 +140,32 @@ Sha1Hash ZeroHashTree::DeriveRoot()
     return hash;
 }
 
-const Sha1Hash& ZeroHashTree::peak_hash(int i) const
+Sha1Hash ZeroHashTree::peak_hash(int i) const
 {
     // switch to peak_hashes_ when caching enabled
     return hash(peak(i));
 }
 
 
-const Sha1Hash& ZeroHashTree::hash(bin_t pos) const
+Sha1Hash ZeroHashTree::hash(bin_t pos) const
 {
-    // RISKY BUSINESS
-    static Sha1Hash hash;
+    // Zero hash of the right size on error, callers put it on the wire
+    uint8_t raw[HASHSZ_MAX];
+    size_t hash_size = Sha1Hash::Size(hash_func_);
+    memset(raw,0,HASHSZ_MAX);
 
-    int ret = file_seek(hash_fd_,pos.toUInt()*sizeof(Sha1Hash));
+    int ret = file_seek(hash_fd_,pos.toUInt()*hash_size);
     if (ret < 0) {
         print_error("reading zero hashtree");
-        return Sha1Hash::ZERO;
+        return Sha1Hash(hash_func_,raw);
     }
-    ret = read(hash_fd_,&hash,sizeof(Sha1Hash));
-    if (ret < 0 || ret !=sizeof(Sha1Hash))
-        return Sha1Hash::ZERO;
-    else {
+    ret = read(hash_fd_,raw,hash_size);
+    if (ret < 0 || ret !=hash_size) {
+        memset(raw,0,HASHSZ_MAX);
+        return Sha1Hash(hash_func_,raw);
+    } else {
         //fprintf(stderr,"read hash %" PRIu64 " %s\n", pos.toUInt(), hash.hex().c_str() );
-        return hash;
+        return Sha1Hash(hash_func_,raw);
     }
 }
 
@@ -185,7 +185,7 @@ void Channel::OnDataZeroState(struct evbuffer *evb)
 
 void Channel::OnHaveZeroState(struct evbuffer *evb)
 {
-    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_);
+    binvector bv = evbuffer_remove_chunkaddr(evb,hs_in_->chunk_addr_,transfer()->chunk_size());
     // Forget about it, i.e.. don't build peer binmap.
 }
 